@@ -0,0 +1,16 @@
+#ifndef _AVR_STUB_PGMSPACE_H_
+#define _AVR_STUB_PGMSPACE_H_
+
+/*
+ * Stand-in for avr-libc's avr/pgmspace.h, so the __AVR__ paths of the library
+ * can be compiled on the host (scons footprint) without an AVR toolchain.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define memcpy_P(destination, source, size) memcpy(destination, source, size)
+
+#endif
@@ -0,0 +1,236 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 16;
+
+static int16_t s_holding_registers[NUMBER_OF_HOLDING_REGISTERS];
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+
+static MODBUS_HANDLER s_modbus_handler;
+
+static int s_calls;
+static int16_t s_read_values[NUMBER_OF_HOLDING_REGISTERS];
+
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	s_calls++;
+	memcpy(s_read_values, &s_holding_registers[reg], n_registers * sizeof(int16_t));
+}
+
+static void write_holding_register(uint16_t reg, int16_t value)
+{
+	s_calls++;
+	s_holding_registers[reg] = value;
+}
+
+static void exception_handler(uint8_t, MODBUS_EXCEPTION_CODES) {}
+
+struct test_frame
+{
+	uint8_t bytes[8];
+	MODBUS_FRAME frame;
+};
+
+static void make_frame(test_frame& f, uint8_t address, MODBUS_FUNCTION_CODE function_code, uint16_t a, uint16_t b)
+{
+	f.bytes[0] = address;
+	f.bytes[1] = function_code;
+	f.bytes[2] = a >> 8;
+	f.bytes[3] = a & 0xFF;
+	f.bytes[4] = b >> 8;
+	f.bytes[5] = b & 0xFF;
+	modbus_write_crc(f.bytes, 6);
+	f.frame.message = f.bytes;
+	f.frame.length = 8;
+}
+
+class ModbusBatchTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusBatchTest);
+
+	CPPUNIT_TEST(test_validate_message_crcs);
+	CPPUNIT_TEST(test_validate_message_crcs_with_mixed_lengths);
+	CPPUNIT_TEST(test_validate_message_crcs_of_long_frames);
+	CPPUNIT_TEST(test_service_messages_reports_status_per_frame);
+	CPPUNIT_TEST(test_service_messages_keeps_arrival_order);
+	CPPUNIT_TEST(test_service_messages_longer_than_one_pass);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_validate_message_crcs()
+	{
+		test_frame frames[6];
+		MODBUS_FRAME list[6];
+		bool valid[6];
+
+		for (int i = 0; i < 6; i++)
+		{
+			make_frame(frames[i], TEST_ADDRESS, READ_HOLDING_REGISTERS, i, 1);
+			list[i] = frames[i].frame;
+		}
+		frames[1].bytes[7] ^= 0x01;
+		frames[5].bytes[3] ^= 0x80;
+		list[4].length = 3;
+
+		modbus_validate_message_crcs(list, 6, valid);
+
+		CPPUNIT_ASSERT(valid[0]);
+		CPPUNIT_ASSERT(!valid[1]);
+		CPPUNIT_ASSERT(valid[2]);
+		CPPUNIT_ASSERT(valid[3]);
+		CPPUNIT_ASSERT(!valid[4]);
+		CPPUNIT_ASSERT(!valid[5]);
+	}
+
+	void test_validate_message_crcs_with_mixed_lengths()
+	{
+		uint8_t long_frame[32];
+		uint8_t short_frame[] = {0x11, 0x03, 0x00, 0x6B, 0x00, 0x03, 0x76, 0x87};
+		MODBUS_FRAME list[5];
+		bool valid[5];
+
+		for (int i = 0; i < 30; i++) { long_frame[i] = (uint8_t)(i * 7); }
+		modbus_write_crc(long_frame, 30);
+
+		for (int i = 0; i < 5; i++)
+		{
+			list[i].message = (i & 1) ? short_frame : long_frame;
+			list[i].length = (i & 1) ? sizeof(short_frame) : sizeof(long_frame);
+		}
+
+		modbus_validate_message_crcs(list, 5, valid);
+
+		for (int i = 0; i < 5; i++)
+		{
+			CPPUNIT_ASSERT(valid[i]);
+		}
+	}
+
+	void test_validate_message_crcs_of_long_frames()
+	{
+		uint8_t long_frames[5][64];
+		MODBUS_FRAME list[5];
+		bool valid[5];
+
+		for (int i = 0; i < 5; i++)
+		{
+			for (int b = 0; b < 62; b++) { long_frames[i][b] = (uint8_t)((b * 7) + i); }
+			modbus_write_crc(long_frames[i], 62 - i);
+			list[i].message = long_frames[i];
+			list[i].length = 64 - i;
+		}
+		long_frames[2][40] ^= 0x10;
+
+		modbus_validate_message_crcs(list, 5, valid);
+
+		CPPUNIT_ASSERT(valid[0]);
+		CPPUNIT_ASSERT(valid[1]);
+		CPPUNIT_ASSERT(!valid[2]);
+		CPPUNIT_ASSERT(valid[3]);
+		CPPUNIT_ASSERT(valid[4]);
+	}
+
+	void test_service_messages_reports_status_per_frame()
+	{
+		test_frame frames[4];
+		MODBUS_FRAME list[4];
+		MODBUS_FRAME_STATUS statuses[4];
+
+		make_frame(frames[0], TEST_ADDRESS, READ_HOLDING_REGISTERS, 0, 2);
+		make_frame(frames[1], 0x01, READ_HOLDING_REGISTERS, 0, 2);
+		make_frame(frames[2], TEST_ADDRESS, READ_HOLDING_REGISTERS, 0, 2);
+		frames[2].bytes[6] ^= 0xFF;
+		make_frame(frames[3], TEST_ADDRESS, READ_HOLDING_REGISTERS, NUMBER_OF_HOLDING_REGISTERS, 1);
+		for (int i = 0; i < 4; i++) { list[i] = frames[i].frame; }
+
+		modbus_service_messages(list, 4, s_modbus_handler, statuses, true);
+
+		CPPUNIT_ASSERT_EQUAL(1, s_calls);
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_ACCEPTED, statuses[0].state);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, statuses[0].exception);
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_IGNORED, statuses[1].state);
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_CRC_FAILED, statuses[2].state);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_INVALID_CRC, statuses[2].exception);
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_ACCEPTED, statuses[3].state);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, statuses[3].exception);
+	}
+
+	void test_service_messages_keeps_arrival_order()
+	{
+		test_frame frames[3];
+		MODBUS_FRAME list[3];
+		MODBUS_FRAME_STATUS statuses[3];
+
+		make_frame(frames[0], TEST_ADDRESS, WRITE_HOLDING_REGISTER, 3, 0x1111);
+		make_frame(frames[1], TEST_ADDRESS, READ_HOLDING_REGISTERS, 3, 1);
+		make_frame(frames[2], TEST_ADDRESS, WRITE_HOLDING_REGISTER, 3, 0x2222);
+		for (int i = 0; i < 3; i++) { list[i] = frames[i].frame; }
+
+		modbus_service_messages(list, 3, s_modbus_handler, statuses, true);
+
+		CPPUNIT_ASSERT_EQUAL(3, s_calls);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x1111, s_read_values[0]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x2222, s_holding_registers[3]);
+	}
+
+	void test_service_messages_longer_than_one_pass()
+	{
+		const int count = MODBUS_MAX_BATCH_FRAMES + 5;
+		test_frame frames[count];
+		MODBUS_FRAME list[count];
+		MODBUS_FRAME_STATUS statuses[count];
+
+		for (int i = 0; i < count; i++)
+		{
+			make_frame(frames[i], TEST_ADDRESS, WRITE_HOLDING_REGISTER, i % NUMBER_OF_HOLDING_REGISTERS, i);
+			list[i] = frames[i].frame;
+		}
+		frames[count - 1].bytes[7] ^= 0x10;
+
+		modbus_service_messages(list, count, s_modbus_handler, statuses, true);
+
+		CPPUNIT_ASSERT_EQUAL(count - 1, s_calls);
+		for (int i = 0; i < count - 1; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(MESSAGE_ACCEPTED, statuses[i].state);
+		}
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_CRC_FAILED, statuses[count - 1].state);
+	}
+
+public:
+	void setUp()
+	{
+		memset(&s_modbus_handler, 0, sizeof(s_modbus_handler));
+		s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+		s_modbus_handler.functions.write_holding_register = write_holding_register;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+		s_modbus_handler.data.device_address = TEST_ADDRESS;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+		s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+
+		memset(s_holding_registers, 0, sizeof(s_holding_registers));
+		memset(s_read_values, 0, sizeof(s_read_values));
+		s_calls = 0;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusBatchTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
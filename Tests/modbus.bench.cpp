@@ -0,0 +1,454 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "modbus.h"
+#include "modbus_server.h"
+#include "modbus_map.h"
+
+/*
+ * Micro-benchmarks for the CRC, the service path and the response builders.
+ * The dispatch/ entries compare the same requests through the MODBUS_HANDLER
+ * function pointers, a modbus::Server with an inline handler and a RegisterMap.
+ *
+ * Each benchmark is calibrated to run for roughly BENCH_SAMPLE_NS per sample,
+ * then sampled BENCH_SAMPLES times. The median and minimum ns/op are reported
+ * on stdout and appended as one JSON object per line to the output file
+ * (first argument, default ../bench_output.txt) so runs can be diffed.
+ */
+
+static const int BENCH_SAMPLES = 9;
+static const int64_t BENCH_SAMPLE_NS = 20000000;
+
+static const uint8_t BENCH_ADDRESS = 0x11;
+
+static const int NUMBER_OF_COILS = 2000;
+static const int NUMBER_OF_INPUTS = 2000;
+static const int NUMBER_OF_INPUT_REGISTERS = 125;
+static const int NUMBER_OF_HOLDING_REGISTERS = 125;
+
+static volatile uint32_t s_sink;
+
+static bool s_write_multiple_coils_data_buffer[NUMBER_OF_COILS];
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+
+static MODBUS_HANDLER s_modbus_handler;
+
+static FILE * s_output;
+
+static void read_coils(uint16_t first_coil, uint16_t n_coils) { s_sink += first_coil + n_coils; }
+static void read_discrete_inputs(uint16_t first_input, uint16_t n_inputs) { s_sink += first_input + n_inputs; }
+static void write_single_coil(uint16_t coil, bool on) { s_sink += coil + on; }
+static void write_multiple_coils(uint16_t first_coil, uint16_t n_coils, bool * values) { s_sink += first_coil + n_coils + values[0]; }
+static void read_input_registers(uint16_t reg, uint16_t n_registers) { s_sink += reg + n_registers; }
+static void read_holding_registers(uint16_t reg, uint16_t n_registers) { s_sink += reg + n_registers; }
+static void write_holding_register(uint16_t reg, int16_t value) { s_sink += reg + value; }
+static void write_holding_registers(uint16_t first_reg, uint16_t n_registers, int16_t * values) { s_sink += first_reg + n_registers + values[0]; }
+static void read_write_registers(uint16_t read_start_reg, uint16_t n_registers, uint16_t write_start_reg, uint16_t n_values, int16_t * values)
+{
+	s_sink += read_start_reg + n_registers + write_start_reg + n_values + values[0];
+}
+static void mask_write_register(uint16_t reg, uint16_t and_mask, uint16_t or_mask) { s_sink += reg + and_mask + or_mask; }
+static void diagnostics(uint16_t sub_function, uint16_t data) { s_sink += sub_function + data; }
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code) { s_sink += function_code + exception_code; }
+
+static int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename F> static int64_t time_iterations(F& f, int64_t iterations)
+{
+	int64_t start = now_ns();
+	for (int64_t i = 0; i < iterations; i++) { f(); }
+	return now_ns() - start;
+}
+
+template <typename F> static void run_benchmark(const char * name, int bytes, F f)
+{
+	int64_t iterations = 1;
+	int64_t elapsed = 0;
+
+	/* Warm up and calibrate so that a single sample lasts about BENCH_SAMPLE_NS */
+	while ((elapsed = time_iterations(f, iterations)) < (BENCH_SAMPLE_NS / 8))
+	{
+		iterations *= 2;
+	}
+	iterations = std::max<int64_t>(1, (iterations * BENCH_SAMPLE_NS) / std::max<int64_t>(1, elapsed));
+
+	double samples[BENCH_SAMPLES];
+	for (int s = 0; s < BENCH_SAMPLES; s++)
+	{
+		samples[s] = (double)time_iterations(f, iterations) / (double)iterations;
+	}
+	std::sort(samples, samples + BENCH_SAMPLES);
+
+	double median = samples[BENCH_SAMPLES / 2];
+	double minimum = samples[0];
+	double mb_per_s = (bytes > 0) ? ((double)bytes * 1000.0) / median : 0.0;
+
+	printf("%-48s %10.1f ns/op %10.1f ns/op(min) %8.1f MB/s\n", name, median, minimum, mb_per_s);
+
+	if (s_output)
+	{
+		fprintf(s_output,
+			"{\"name\": \"%s\", \"bytes\": %d, \"iterations\": %lld, \"samples\": %d, \"median_ns\": %.2f, \"min_ns\": %.2f, \"max_ns\": %.2f, \"mb_per_s\": %.2f}\n",
+			name, bytes, (long long)iterations, BENCH_SAMPLES, median, minimum, samples[BENCH_SAMPLES - 1], mb_per_s);
+	}
+}
+
+static void setup_handler()
+{
+	s_modbus_handler.functions.read_coils = read_coils;
+	s_modbus_handler.functions.read_discrete_inputs = read_discrete_inputs;
+	s_modbus_handler.functions.write_single_coil = write_single_coil;
+	s_modbus_handler.functions.write_multiple_coils = write_multiple_coils;
+	s_modbus_handler.functions.read_input_registers = read_input_registers;
+	s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+	s_modbus_handler.functions.write_holding_register = write_holding_register;
+	s_modbus_handler.functions.write_holding_registers = write_holding_registers;
+	s_modbus_handler.functions.read_write_registers = read_write_registers;
+	s_modbus_handler.functions.mask_write_register = mask_write_register;
+	s_modbus_handler.functions.exception_handler = exception_handler;
+	s_modbus_handler.functions.diagnostics = diagnostics;
+	s_modbus_handler.data.device_address = BENCH_ADDRESS;
+	s_modbus_handler.data.write_multiple_coils = s_write_multiple_coils_data_buffer;
+	s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+	s_modbus_handler.data.num_coils = NUMBER_OF_COILS;
+	s_modbus_handler.data.num_inputs = NUMBER_OF_INPUTS;
+	s_modbus_handler.data.num_input_registers = NUMBER_OF_INPUT_REGISTERS;
+	s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+}
+
+struct bench_frame
+{
+	uint8_t bytes[256];
+	int length;
+};
+
+static int put16(uint8_t * buffer, uint16_t value)
+{
+	buffer[0] = (uint8_t)(value >> 8);
+	buffer[1] = (uint8_t)(value & 0xFF);
+	return 2;
+}
+
+static void finish_frame(bench_frame& frame)
+{
+	frame.length += modbus_write_crc(frame.bytes, frame.length);
+}
+
+static bench_frame make_address_count_frame(MODBUS_FUNCTION_CODE function_code, uint16_t address, uint16_t count)
+{
+	bench_frame frame;
+	frame.length = modbus_start_response(frame.bytes, function_code, BENCH_ADDRESS);
+	frame.length += put16(&frame.bytes[frame.length], address);
+	frame.length += put16(&frame.bytes[frame.length], count);
+	finish_frame(frame);
+	return frame;
+}
+
+static bench_frame make_write_multiple_coils_frame(uint16_t n_coils)
+{
+	bench_frame frame;
+	uint8_t n_bytes = (uint8_t)((n_coils + 7) / 8);
+	frame.length = modbus_start_response(frame.bytes, WRITE_MULTIPLE_COILS, BENCH_ADDRESS);
+	frame.length += put16(&frame.bytes[frame.length], 0);
+	frame.length += put16(&frame.bytes[frame.length], n_coils);
+	frame.bytes[frame.length++] = n_bytes;
+	for (int i = 0; i < n_bytes; i++) { frame.bytes[frame.length++] = (uint8_t)(0xA5 ^ i); }
+	finish_frame(frame);
+	return frame;
+}
+
+static bench_frame make_write_holding_registers_frame(uint16_t n_registers)
+{
+	bench_frame frame;
+	frame.length = modbus_start_response(frame.bytes, WRITE_HOLDING_REGISTERS, BENCH_ADDRESS);
+	frame.length += put16(&frame.bytes[frame.length], 0);
+	frame.length += put16(&frame.bytes[frame.length], n_registers);
+	frame.bytes[frame.length++] = (uint8_t)(n_registers * 2);
+	for (int i = 0; i < n_registers; i++) { frame.length += put16(&frame.bytes[frame.length], (uint16_t)(0x1234 + i)); }
+	finish_frame(frame);
+	return frame;
+}
+
+static bench_frame make_read_write_registers_frame(uint16_t n_read, uint16_t n_write)
+{
+	bench_frame frame;
+	frame.length = modbus_start_response(frame.bytes, READ_WRITE_REGISTERS, BENCH_ADDRESS);
+	frame.length += put16(&frame.bytes[frame.length], 0);
+	frame.length += put16(&frame.bytes[frame.length], n_read);
+	frame.length += put16(&frame.bytes[frame.length], 0);
+	frame.length += put16(&frame.bytes[frame.length], n_write);
+	frame.bytes[frame.length++] = (uint8_t)(n_write * 2);
+	for (int i = 0; i < n_write; i++) { frame.length += put16(&frame.bytes[frame.length], (uint16_t)(0x4321 + i)); }
+	finish_frame(frame);
+	return frame;
+}
+
+static bench_frame make_mask_write_register_frame()
+{
+	bench_frame frame;
+	frame.length = modbus_start_response(frame.bytes, MASK_WRITE_REGISTER, BENCH_ADDRESS);
+	frame.length += put16(&frame.bytes[frame.length], 1);
+	frame.length += put16(&frame.bytes[frame.length], 0x00F2);
+	frame.length += put16(&frame.bytes[frame.length], 0x0025);
+	finish_frame(frame);
+	return frame;
+}
+
+static void bench_service(const char * name, const bench_frame& frame)
+{
+	run_benchmark(name, frame.length, [&frame]() {
+		modbus_service_message(frame.bytes, s_modbus_handler, frame.length, true);
+	});
+}
+
+/* The bench callbacks as inline members, for the statically dispatched server */
+class BenchHandler
+{
+public:
+	uint8_t device_address() { return BENCH_ADDRESS; }
+	bool supports(MODBUS_FUNCTION_CODE function_code)
+	{
+		return (function_code == READ_HOLDING_REGISTERS) || (function_code == WRITE_HOLDING_REGISTER) || (function_code == WRITE_HOLDING_REGISTERS);
+	}
+	bool valid_addresses(modbus::Table, modbus::Access, uint16_t first, uint16_t n) { return ((uint32_t)first + n) <= NUMBER_OF_HOLDING_REGISTERS; }
+	MODBUS_FILE const * files() { return NULL; }
+	uint8_t num_files() { return 0; }
+
+	void read_coils(uint16_t, uint16_t) {}
+	void read_discrete_inputs(uint16_t, uint16_t) {}
+	void write_single_coil(uint16_t, bool) {}
+	void write_multiple_coils_view(uint16_t, MODBUS_COIL_VIEW const *) {}
+	void read_input_registers(uint16_t, uint16_t) {}
+	void read_holding_registers(uint16_t reg, uint16_t n_registers) { s_sink += reg + n_registers; }
+	void write_holding_register(uint16_t reg, int16_t value) { s_sink += reg + value; }
+	void write_holding_registers_view(uint16_t first_reg, MODBUS_REGISTER_VIEW const * values)
+	{
+		modbus_register_view_copy(values, s_write_holding_register_data_buffer);
+		s_sink += first_reg + values->n_registers + s_write_holding_register_data_buffer[0];
+	}
+	void read_write_registers_view(uint16_t, uint16_t, uint16_t, MODBUS_REGISTER_VIEW const *) {}
+	void mask_write_register(uint16_t, uint16_t, uint16_t) {}
+	void diagnostics(uint16_t, uint16_t) {}
+	void read_fifo_queue(uint16_t) {}
+	void read_file_record(uint8_t const *, uint8_t) {}
+	void write_file_record(uint8_t const *, uint8_t) {}
+	void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code) { s_sink += function_code + exception_code; }
+};
+
+struct BenchDevice
+{
+	static void read_holding_registers(uint16_t reg, uint16_t n_registers) { s_sink += reg + n_registers; }
+	static void write_holding_register(uint16_t reg, int16_t value) { s_sink += reg + value; }
+	static void write_holding_registers(uint16_t first_reg, uint16_t n_registers, int16_t * values) { s_sink += first_reg + n_registers + values[0]; }
+	static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code) { s_sink += function_code + exception_code; }
+};
+
+typedef modbus::RegisterMap<BenchDevice, modbus::HoldingRegisters<0, NUMBER_OF_HOLDING_REGISTERS> > BENCH_MAP;
+
+static void bench_dispatch(const char * name, const bench_frame& frame)
+{
+	static BenchHandler handler;
+	static modbus::Server<BenchHandler> server(handler);
+	char full_name[64];
+
+	/* CRC checks are off so that only decoding, validation and the callback are timed */
+	snprintf(full_name, sizeof(full_name), "dispatch/handler/%s", name);
+	run_benchmark(full_name, frame.length, [&frame]() {
+		modbus_service_message(frame.bytes, s_modbus_handler, frame.length, false);
+	});
+
+	snprintf(full_name, sizeof(full_name), "dispatch/server/%s", name);
+	run_benchmark(full_name, frame.length, [&frame]() {
+		server.service_message(frame.bytes, frame.length, false);
+	});
+
+	snprintf(full_name, sizeof(full_name), "dispatch/map/%s", name);
+	run_benchmark(full_name, frame.length, [&frame]() {
+		modbus::service_message<BENCH_MAP>(frame.bytes, BENCH_ADDRESS, frame.length, false);
+	});
+}
+
+static void bench_dispatchers()
+{
+	bench_dispatch("read_holding_registers/min", make_address_count_frame(READ_HOLDING_REGISTERS, 0, 1));
+	bench_dispatch("write_holding_register", make_address_count_frame(WRITE_HOLDING_REGISTER, 0, 0x1234));
+	bench_dispatch("write_holding_registers/max", make_write_holding_registers_frame(123));
+	bench_dispatch("illegal_address", make_address_count_frame(READ_HOLDING_REGISTERS, NUMBER_OF_HOLDING_REGISTERS, 1));
+}
+
+static void bench_batch(const char * name, const bench_frame& frame)
+{
+	static MODBUS_FRAME frames[MODBUS_MAX_BATCH_FRAMES];
+	static MODBUS_FRAME_STATUS statuses[MODBUS_MAX_BATCH_FRAMES];
+	char full_name[64];
+
+	for (int i = 0; i < MODBUS_MAX_BATCH_FRAMES; i++)
+	{
+		frames[i].message = frame.bytes;
+		frames[i].length = frame.length;
+	}
+
+	snprintf(full_name, sizeof(full_name), "batch/single/%s", name);
+	run_benchmark(full_name, frame.length * MODBUS_MAX_BATCH_FRAMES, []() {
+		for (int i = 0; i < MODBUS_MAX_BATCH_FRAMES; i++)
+		{
+			modbus_service_message(frames[i].message, s_modbus_handler, frames[i].length, true);
+		}
+	});
+
+	snprintf(full_name, sizeof(full_name), "batch/batch/%s", name);
+	run_benchmark(full_name, frame.length * MODBUS_MAX_BATCH_FRAMES, []() {
+		modbus_service_messages(frames, MODBUS_MAX_BATCH_FRAMES, s_modbus_handler, statuses, true);
+	});
+}
+
+static void bench_batches()
+{
+	bench_batch("read_holding_registers/min", make_address_count_frame(READ_HOLDING_REGISTERS, 0, 1));
+	bench_batch("write_holding_registers/max", make_write_holding_registers_frame(123));
+}
+
+static void bench_crc()
+{
+	static uint8_t data[256];
+	for (int i = 0; i < 256; i++) { data[i] = (uint8_t)(i * 37 + 11); }
+
+	run_benchmark("crc16/8", 8, []() { s_sink += modbus_get_crc16(data, 8); });
+	run_benchmark("crc16/64", 64, []() { s_sink += modbus_get_crc16(data, 64); });
+	run_benchmark("crc16/256", 256, []() { s_sink += modbus_get_crc16(data, 256); });
+}
+
+static void bench_service_message()
+{
+	/* Minimum and maximum legal payloads for each supported function code */
+	bench_service("service/read_coils/min", make_address_count_frame(READ_COILS, 0, 1));
+	bench_service("service/read_coils/max", make_address_count_frame(READ_COILS, 0, 2000));
+	bench_service("service/read_discrete_inputs/min", make_address_count_frame(READ_DISCRETE_INPUTS, 0, 1));
+	bench_service("service/read_discrete_inputs/max", make_address_count_frame(READ_DISCRETE_INPUTS, 0, 2000));
+	bench_service("service/write_single_coil/min", make_address_count_frame(WRITE_SINGLE_COIL, 0, 0x0000));
+	bench_service("service/write_single_coil/max", make_address_count_frame(WRITE_SINGLE_COIL, NUMBER_OF_COILS - 1, 0xFF00));
+	bench_service("service/write_multiple_coils/min", make_write_multiple_coils_frame(1));
+	bench_service("service/write_multiple_coils/max", make_write_multiple_coils_frame(1968));
+	bench_service("service/read_input_registers/min", make_address_count_frame(READ_INPUT_REGISTERS, 0, 1));
+	bench_service("service/read_input_registers/max", make_address_count_frame(READ_INPUT_REGISTERS, 0, 125));
+	bench_service("service/read_holding_registers/min", make_address_count_frame(READ_HOLDING_REGISTERS, 0, 1));
+	bench_service("service/read_holding_registers/max", make_address_count_frame(READ_HOLDING_REGISTERS, 0, 125));
+	bench_service("service/write_holding_register/min", make_address_count_frame(WRITE_HOLDING_REGISTER, 0, 0x0000));
+	bench_service("service/write_holding_register/max", make_address_count_frame(WRITE_HOLDING_REGISTER, NUMBER_OF_HOLDING_REGISTERS - 1, 0xFFFF));
+	bench_service("service/write_holding_registers/min", make_write_holding_registers_frame(1));
+	bench_service("service/write_holding_registers/max", make_write_holding_registers_frame(123));
+	bench_service("service/read_write_registers/min", make_read_write_registers_frame(1, 1));
+	bench_service("service/read_write_registers/max", make_read_write_registers_frame(125, 121));
+	/* Mask write has a fixed size request, so min and max are the same frame */
+	bench_service("service/mask_write_register/min", make_mask_write_register_frame());
+	bench_service("service/mask_write_register/max", make_mask_write_register_frame());
+
+	bench_service("service/diagnostics/return_query_data", make_address_count_frame(DIAGNOSTICS, DIAGNOSTICS_RETURN_QUERY_DATA, 0x0000));
+	bench_service("service/diagnostics/bus_message_count", make_address_count_frame(DIAGNOSTICS, DIAGNOSTICS_RETURN_BUS_MESSAGE_COUNT, 0x0000));
+
+	bench_service("service/exception/illegal_data_address", make_address_count_frame(READ_HOLDING_REGISTERS, 0, 126));
+}
+
+static void bench_response_builders()
+{
+	static uint8_t buffer[256];
+	static bool bools[256];
+	static int16_t registers[125];
+
+	for (int i = 0; i < 256; i++) { bools[i] = (i % 3) == 0; }
+	for (int i = 0; i < 125; i++) { registers[i] = (int16_t)(i * 263); }
+
+	run_benchmark("response/start_response", 2, []() {
+		s_sink += modbus_start_response(buffer, READ_HOLDING_REGISTERS, BENCH_ADDRESS);
+	});
+	run_benchmark("response/write_crc/253", 255, []() {
+		s_sink += modbus_write_crc(buffer, 253);
+	});
+	run_benchmark("response/read_discrete_inputs/1", 6, []() {
+		s_sink += modbus_write_read_discrete_inputs_response(BENCH_ADDRESS, buffer, bools, 1);
+	});
+	run_benchmark("response/read_discrete_inputs/255", 37, []() {
+		s_sink += modbus_write_read_discrete_inputs_response(BENCH_ADDRESS, buffer, bools, 255);
+	});
+	run_benchmark("response/read_input_registers/1", 7, []() {
+		s_sink += modbus_write_read_input_registers_response(BENCH_ADDRESS, buffer, registers, 1);
+	});
+	run_benchmark("response/read_input_registers/125", 255, []() {
+		s_sink += modbus_write_read_input_registers_response(BENCH_ADDRESS, buffer, registers, 125);
+	});
+	run_benchmark("response/read_holding_registers/1", 7, []() {
+		s_sink += modbus_write_read_holding_registers_response(BENCH_ADDRESS, buffer, registers, 1);
+	});
+	run_benchmark("response/read_holding_registers/125", 255, []() {
+		s_sink += modbus_write_read_holding_registers_response(BENCH_ADDRESS, buffer, registers, 125);
+	});
+	static float floats[62];
+	for (int i = 0; i < 62; i++) { floats[i] = (float)i * 1.5f; }
+	run_benchmark("response/read_holding_registers/float32x62_abcd", 253, []() {
+		s_sink += modbus_write_read_holding_registers_response(BENCH_ADDRESS, buffer, floats, 62, WORD_ORDER_ABCD);
+	});
+	run_benchmark("response/read_holding_registers/float32x62_cdab", 253, []() {
+		s_sink += modbus_write_read_holding_registers_response(BENCH_ADDRESS, buffer, floats, 62, WORD_ORDER_CDAB);
+	});
+	run_benchmark("values/read/float32x62_dcba", 248, []() {
+		s_sink += modbus_read_values(&buffer[3], floats, 62, WORD_ORDER_DCBA);
+	});
+	static uint8_t wire_registers[250];
+	static MODBUS_RESPONSE_SEGMENTS segments;
+	run_benchmark("response/read_holding_registers_segments/125", 255, []() {
+		s_sink += modbus_get_read_holding_registers_response_segments(BENCH_ADDRESS, &segments, wire_registers, 125);
+	});
+	run_benchmark("response/write_single_coil", 8, []() {
+		s_sink += modbus_get_write_single_coil_response(BENCH_ADDRESS, buffer, 17, true);
+	});
+	run_benchmark("response/write_holding_register", 8, []() {
+		s_sink += modbus_get_write_holding_register_response(BENCH_ADDRESS, buffer, 17, 0x1234);
+	});
+	run_benchmark("response/write_holding_registers", 8, []() {
+		s_sink += modbus_get_write_holding_registers_response(BENCH_ADDRESS, buffer, 17, 100);
+	});
+	run_benchmark("response/diagnostics", 8, []() {
+		s_sink += modbus_get_diagnostics_response(BENCH_ADDRESS, buffer, DIAGNOSTICS_RETURN_BUS_MESSAGE_COUNT, 100);
+	});
+	static MODBUS_FIFO fifo;
+	modbus_fifo_init(&fifo);
+	run_benchmark("response/read_fifo_queue/31_with_push", 72, []() {
+		for (int i = 0; i < MODBUS_MAX_FIFO_COUNT; i++) { modbus_fifo_push(&fifo, (int16_t)i); }
+		s_sink += modbus_write_read_fifo_queue_response(BENCH_ADDRESS, buffer, &fifo);
+	});
+	run_benchmark("response/exception", 5, []() {
+		s_sink += modbus_write_exception(BENCH_ADDRESS, buffer, EXCEPTION_ILLEGAL_DATA_ADDRESS, READ_HOLDING_REGISTERS + 128);
+	});
+}
+
+int main(int argc, char * argv[])
+{
+	const char * output_path = (argc > 1) ? argv[1] : "../bench_output.txt";
+
+	s_output = fopen(output_path, "w");
+	if (!s_output)
+	{
+		fprintf(stderr, "Could not open %s for writing\n", output_path);
+		return 1;
+	}
+
+	setup_handler();
+
+	bench_crc();
+	bench_service_message();
+	bench_dispatchers();
+	bench_batches();
+	bench_response_builders();
+
+	fclose(s_output);
+
+	return 0;
+}
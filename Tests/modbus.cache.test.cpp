@@ -0,0 +1,252 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 16;
+static const uint32_t WINDOW = 100;
+
+static int16_t s_holding_registers[NUMBER_OF_HOLDING_REGISTERS];
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+
+static MODBUS_HANDLER s_modbus_handler;
+static MODBUS_RESPONSE_CACHE s_cache;
+
+static int s_handler_calls;
+static uint8_t s_response[64];
+static int s_response_length;
+
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	s_handler_calls++;
+	s_response_length = modbus_write_read_holding_registers_response(TEST_ADDRESS, s_response, &s_holding_registers[reg], n_registers);
+}
+
+static void write_holding_registers(uint16_t first_reg, uint16_t n_registers, int16_t * values)
+{
+	s_handler_calls++;
+	for (uint16_t i = 0; i < n_registers; i++) { s_holding_registers[first_reg + i] += values[i]; }
+	s_response_length = modbus_get_write_holding_registers_response(TEST_ADDRESS, s_response, first_reg, n_registers);
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_handler_calls++;
+	s_response_length = modbus_write_exception(TEST_ADDRESS, s_response, exception_code, function_code);
+}
+
+/* The receive path of a slave using the cache: replay a retry, otherwise service and remember the response */
+static int receive(uint8_t const * request, int request_length, uint32_t now, uint8_t const ** response)
+{
+	int length = modbus_response_cache_find(&s_cache, request, request_length, now, response);
+	if (length) { return length; }
+
+	s_response_length = 0;
+	modbus_service_message(request, s_modbus_handler, request_length, true);
+	modbus_response_cache_store(&s_cache, request, request_length, s_response, s_response_length, now);
+
+	*response = s_response;
+	return s_response_length;
+}
+
+class ModbusCacheTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusCacheTest);
+
+	CPPUNIT_TEST(test_retry_is_replayed_without_rerunning_write);
+	CPPUNIT_TEST(test_retry_after_window_is_serviced);
+	CPPUNIT_TEST(test_different_request_is_serviced);
+	CPPUNIT_TEST(test_hash_collision_is_serviced);
+	CPPUNIT_TEST(test_crc_collision_is_serviced);
+	CPPUNIT_TEST(test_reads_are_not_cached);
+	CPPUNIT_TEST(test_broadcast_is_not_cached);
+	CPPUNIT_TEST(test_exception_response_is_replayed);
+	CPPUNIT_TEST(test_window_across_tick_wrap);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	uint8_t m_request[32];
+	int m_request_length;
+
+	void make_write_request(uint8_t address, uint16_t first_reg, int16_t value)
+	{
+		int16_t values[] = {value, value};
+		m_request_length = modbus_write_write_holding_registers_request(address, m_request, first_reg, 2, values);
+	}
+
+	void test_retry_is_replayed_without_rerunning_write()
+	{
+		uint8_t const * response;
+		make_write_request(TEST_ADDRESS, 4, 5);
+
+		int length = receive(m_request, m_request_length, 1000, &response);
+		uint8_t first_response[16];
+		memcpy(first_response, response, length);
+
+		int retry_length = receive(m_request, m_request_length, 1000 + WINDOW - 1, &response);
+
+		CPPUNIT_ASSERT_EQUAL(1, s_handler_calls);
+		CPPUNIT_ASSERT_EQUAL((int16_t)5, s_holding_registers[4]);
+		CPPUNIT_ASSERT_EQUAL(length, retry_length);
+		CPPUNIT_ASSERT(response == s_cache.response);
+		CPPUNIT_ASSERT(memcmp(first_response, response, length) == 0);
+	}
+
+	void test_retry_after_window_is_serviced()
+	{
+		uint8_t const * response;
+		make_write_request(TEST_ADDRESS, 4, 5);
+
+		receive(m_request, m_request_length, 1000, &response);
+		receive(m_request, m_request_length, 1000 + WINDOW, &response);
+
+		CPPUNIT_ASSERT_EQUAL(2, s_handler_calls);
+		CPPUNIT_ASSERT_EQUAL((int16_t)10, s_holding_registers[4]);
+	}
+
+	void test_different_request_is_serviced()
+	{
+		uint8_t const * response;
+
+		make_write_request(TEST_ADDRESS, 4, 5);
+		receive(m_request, m_request_length, 0, &response);
+		make_write_request(TEST_ADDRESS, 4, 6);
+		receive(m_request, m_request_length, 1, &response);
+
+		CPPUNIT_ASSERT_EQUAL(2, s_handler_calls);
+		CPPUNIT_ASSERT_EQUAL((int16_t)11, s_holding_registers[4]);
+	}
+
+	void test_hash_collision_is_serviced()
+	{
+		uint8_t const * response;
+
+		make_write_request(TEST_ADDRESS, 4, 6);
+		receive(m_request, m_request_length, 0, &response);
+		uint32_t colliding_hash = s_cache.request_hash;
+
+		uint8_t other_request[32];
+		memcpy(other_request, m_request, m_request_length);
+
+		/* A different write of the same length, with the cached hash forced to collide */
+		make_write_request(TEST_ADDRESS, 4, 5);
+		receive(m_request, m_request_length, 1, &response);
+		s_cache.request_hash = colliding_hash;
+
+		receive(other_request, m_request_length, 2, &response);
+
+		CPPUNIT_ASSERT_EQUAL(3, s_handler_calls);
+		CPPUNIT_ASSERT_EQUAL((int16_t)17, s_holding_registers[4]);
+	}
+
+	void test_crc_collision_is_serviced()
+	{
+		uint8_t const * response;
+
+		make_write_request(TEST_ADDRESS, 4, 6);
+		receive(m_request, m_request_length, 0, &response);
+		uint16_t colliding_crc = s_cache.request_crc;
+
+		uint8_t other_request[32];
+		memcpy(other_request, m_request, m_request_length);
+
+		/* A different write of the same length, with the cached CRC forced to collide */
+		make_write_request(TEST_ADDRESS, 4, 5);
+		receive(m_request, m_request_length, 1, &response);
+		s_cache.request_crc = colliding_crc;
+
+		receive(other_request, m_request_length, 2, &response);
+
+		CPPUNIT_ASSERT_EQUAL(3, s_handler_calls);
+		CPPUNIT_ASSERT_EQUAL((int16_t)17, s_holding_registers[4]);
+	}
+
+	void test_reads_are_not_cached()
+	{
+		uint8_t const * response;
+		m_request_length = modbus_get_read_holding_registers_request(TEST_ADDRESS, m_request, 0, 2);
+
+		receive(m_request, m_request_length, 0, &response);
+		s_holding_registers[0] = 0x1234;
+		receive(m_request, m_request_length, 1, &response);
+
+		CPPUNIT_ASSERT_EQUAL(2, s_handler_calls);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x12, response[3]);
+		CPPUNIT_ASSERT(!s_cache.valid);
+	}
+
+	void test_broadcast_is_not_cached()
+	{
+		uint8_t const * response;
+		make_write_request(MODBUS_BROADCAST_ADDRESS, 4, 5);
+
+		receive(m_request, m_request_length, 0, &response);
+		receive(m_request, m_request_length, 1, &response);
+
+		CPPUNIT_ASSERT_EQUAL(2, s_handler_calls);
+	}
+
+	void test_exception_response_is_replayed()
+	{
+		uint8_t const * response;
+		make_write_request(TEST_ADDRESS, NUMBER_OF_HOLDING_REGISTERS - 1, 5);
+
+		receive(m_request, m_request_length, 0, &response);
+		int length = receive(m_request, m_request_length, 1, &response);
+
+		CPPUNIT_ASSERT_EQUAL(1, s_handler_calls);
+		CPPUNIT_ASSERT_EQUAL(5, length);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(WRITE_HOLDING_REGISTERS + 128), response[1]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)EXCEPTION_ILLEGAL_DATA_ADDRESS, response[2]);
+	}
+
+	void test_window_across_tick_wrap()
+	{
+		uint8_t const * response;
+		make_write_request(TEST_ADDRESS, 4, 5);
+
+		receive(m_request, m_request_length, 0xFFFFFFF0, &response);
+		receive(m_request, m_request_length, 0x00000010, &response);
+
+		CPPUNIT_ASSERT_EQUAL(1, s_handler_calls);
+	}
+
+public:
+	void setUp()
+	{
+		memset(&s_modbus_handler, 0, sizeof(s_modbus_handler));
+		memset(s_holding_registers, 0, sizeof(s_holding_registers));
+
+		s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+		s_modbus_handler.functions.write_holding_registers = write_holding_registers;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+
+		s_modbus_handler.data.device_address = TEST_ADDRESS;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+		s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+
+		modbus_response_cache_init(&s_cache, WINDOW);
+
+		s_handler_calls = 0;
+		s_response_length = 0;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusCacheTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
@@ -0,0 +1,263 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 16;
+static const uint16_t NUMBER_OF_COILS = 16;
+
+static int16_t s_holding_registers[NUMBER_OF_HOLDING_REGISTERS];
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+static bool s_coils[NUMBER_OF_COILS];
+static bool s_write_coil_data_buffer[NUMBER_OF_COILS];
+
+static MODBUS_HANDLER s_modbus_handler;
+static MODBUS_REQUEST_QUEUE s_queue;
+
+/* One receive buffer per queue slot, so queued frames stay valid until serviced */
+static uint8_t s_frames[MODBUS_REQUEST_QUEUE_SIZE][32];
+
+static uint8_t const * s_current_message;
+static int s_current_message_length;
+static int16_t s_write_order[MODBUS_REQUEST_QUEUE_SIZE];
+static int s_n_writes;
+static uint16_t s_read_first;
+static uint16_t s_read_count;
+static uint8_t s_last_exception_function;
+static MODBUS_EXCEPTION_CODES s_last_exception_code;
+
+static void write_holding_register(uint16_t reg, int16_t value)
+{
+	s_current_message = modbus_get_current_message();
+	s_current_message_length = modbus_get_current_message_length();
+	s_holding_registers[reg] = value;
+	if (s_n_writes < MODBUS_REQUEST_QUEUE_SIZE) { s_write_order[s_n_writes++] = value; }
+}
+
+static void write_holding_registers(uint16_t first_reg, uint16_t n_registers, int16_t * values)
+{
+	memcpy(&s_holding_registers[first_reg], values, n_registers * sizeof(int16_t));
+}
+
+static void write_multiple_coils(uint16_t first_coil, uint16_t n_coils, bool * values)
+{
+	memcpy(&s_coils[first_coil], values, n_coils * sizeof(bool));
+}
+
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	s_read_first = reg;
+	s_read_count = n_registers;
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_last_exception_function = function_code;
+	s_last_exception_code = exception_code;
+}
+
+class ModbusDeferredTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusDeferredTest);
+
+	CPPUNIT_TEST(test_deferred_write_runs_when_serviced);
+	CPPUNIT_TEST(test_requests_are_serviced_in_order);
+	CPPUNIT_TEST(test_full_queue_rejects_request);
+	CPPUNIT_TEST(test_crc_failure_reported_when_serviced);
+	CPPUNIT_TEST(test_message_for_another_device_is_not_queued);
+	CPPUNIT_TEST(test_truncated_message_is_not_queued);
+	CPPUNIT_TEST(test_decode_request_fields);
+	CPPUNIT_TEST(test_deferred_multiple_writes);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_deferred_write_runs_when_serviced()
+	{
+		int length = modbus_get_write_holding_register_request(TEST_ADDRESS, s_frames[0], 3, 0x1234);
+
+		CPPUNIT_ASSERT(modbus_defer_message(&s_queue, s_frames[0], TEST_ADDRESS, length, true));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)1, modbus_request_queue_count(&s_queue));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0, s_holding_registers[3]);
+
+		MODBUS_FRAME_STATUS status;
+		CPPUNIT_ASSERT(modbus_service_deferred_message(&s_queue, s_modbus_handler, &status));
+
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_ACCEPTED, status.state);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, status.exception);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x1234, s_holding_registers[3]);
+		CPPUNIT_ASSERT(s_current_message == s_frames[0]);
+		CPPUNIT_ASSERT_EQUAL(length, s_current_message_length);
+		CPPUNIT_ASSERT(modbus_get_current_message() == NULL);
+
+		CPPUNIT_ASSERT(!modbus_service_deferred_message(&s_queue, s_modbus_handler, &status));
+	}
+
+	void test_requests_are_serviced_in_order()
+	{
+		for (int i = 0; i < MODBUS_REQUEST_QUEUE_SIZE - 1; i++)
+		{
+			int length = modbus_get_write_holding_register_request(TEST_ADDRESS, s_frames[i], 1, 0x0100 + i);
+			CPPUNIT_ASSERT(modbus_defer_message(&s_queue, s_frames[i], TEST_ADDRESS, length, true));
+		}
+
+		while (modbus_service_deferred_message(&s_queue, s_modbus_handler, NULL)) {}
+
+		CPPUNIT_ASSERT_EQUAL(MODBUS_REQUEST_QUEUE_SIZE - 1, s_n_writes);
+		for (int i = 0; i < s_n_writes; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL((int16_t)(0x0100 + i), s_write_order[i]);
+		}
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, modbus_request_queue_count(&s_queue));
+	}
+
+	void test_full_queue_rejects_request()
+	{
+		int length = 0;
+		for (int i = 0; i < MODBUS_REQUEST_QUEUE_SIZE - 1; i++)
+		{
+			length = modbus_get_write_holding_register_request(TEST_ADDRESS, s_frames[i], 1, i);
+			CPPUNIT_ASSERT(modbus_defer_message(&s_queue, s_frames[i], TEST_ADDRESS, length, true));
+		}
+
+		uint8_t message[8];
+		length = modbus_get_write_holding_register_request(TEST_ADDRESS, message, 1, 0x7FFF);
+		CPPUNIT_ASSERT(!modbus_defer_message(&s_queue, message, TEST_ADDRESS, length, true));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(MODBUS_REQUEST_QUEUE_SIZE - 1), modbus_request_queue_count(&s_queue));
+
+		/* A full queue only rejects frames it would have queued */
+		length = modbus_get_write_holding_register_request(TEST_ADDRESS + 1, message, 1, 0x7FFF);
+		CPPUNIT_ASSERT(modbus_defer_message(&s_queue, message, TEST_ADDRESS, length, true));
+	}
+
+	void test_crc_failure_reported_when_serviced()
+	{
+		int length = modbus_get_write_holding_register_request(TEST_ADDRESS, s_frames[0], 1, 0x0101);
+		s_frames[0][length - 1] ^= 0x01;
+
+		CPPUNIT_ASSERT(modbus_defer_message(&s_queue, s_frames[0], TEST_ADDRESS, length, true));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, s_last_exception_function);
+
+		MODBUS_FRAME_STATUS status;
+		CPPUNIT_ASSERT(modbus_service_deferred_message(&s_queue, s_modbus_handler, &status));
+
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_CRC_FAILED, status.state);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(WRITE_HOLDING_REGISTER + 128), s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_INVALID_CRC, s_last_exception_code);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0, s_holding_registers[1]);
+	}
+
+	void test_message_for_another_device_is_not_queued()
+	{
+		int length = modbus_get_write_holding_register_request(TEST_ADDRESS + 1, s_frames[0], 1, 0x0101);
+
+		CPPUNIT_ASSERT(modbus_defer_message(&s_queue, s_frames[0], TEST_ADDRESS, length, true));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, modbus_request_queue_count(&s_queue));
+	}
+
+	void test_truncated_message_is_not_queued()
+	{
+		int16_t values[] = {1, 2, 3};
+		int length = modbus_write_write_holding_registers_request(TEST_ADDRESS, s_frames[0], 0, 3, values);
+
+		MODBUS_DIAGNOSTIC_COUNTERS before;
+		MODBUS_DIAGNOSTIC_COUNTERS after;
+		modbus_get_diagnostic_counters(&before);
+
+		CPPUNIT_ASSERT(modbus_defer_message(&s_queue, s_frames[0], TEST_ADDRESS, length - 4, false));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, modbus_request_queue_count(&s_queue));
+		modbus_get_diagnostic_counters(&after);
+		CPPUNIT_ASSERT_EQUAL(before.bus_communication_error + 1, (int)after.bus_communication_error);
+
+		/* Without the CRC the frame is two bytes short of its full length, which is fine */
+		CPPUNIT_ASSERT(modbus_defer_message(&s_queue, s_frames[0], TEST_ADDRESS, length - 2, false));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)1, modbus_request_queue_count(&s_queue));
+	}
+
+	void test_decode_request_fields()
+	{
+		MODBUS_REQUEST request;
+		int length = modbus_get_read_holding_registers_request(TEST_ADDRESS, s_frames[0], 0x000B, 3);
+
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_ACCEPTED, modbus_decode_request(s_frames[0], TEST_ADDRESS, length, true, &request));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)READ_HOLDING_REGISTERS, request.function_code);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x000B, request.fields[0]);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)3, request.fields[1]);
+		CPPUNIT_ASSERT(request.payload == NULL);
+		CPPUNIT_ASSERT(!request.broadcast);
+
+		CPPUNIT_ASSERT(modbus_defer_message(&s_queue, s_frames[0], TEST_ADDRESS, length, true));
+		CPPUNIT_ASSERT(modbus_service_deferred_message(&s_queue, s_modbus_handler, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x000B, s_read_first);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)3, s_read_count);
+	}
+
+	void test_deferred_multiple_writes()
+	{
+		int16_t values[] = {0x0A0B, 0x0C0D};
+		bool coils[] = {true, false, true, true, false, false, true, true, true, false};
+
+		int length = modbus_write_write_holding_registers_request(MODBUS_BROADCAST_ADDRESS, s_frames[0], 4, 2, values);
+		CPPUNIT_ASSERT(modbus_defer_message(&s_queue, s_frames[0], TEST_ADDRESS, length, true));
+		length = modbus_write_write_multiple_coils_request(TEST_ADDRESS, s_frames[1], 2, 10, coils);
+		CPPUNIT_ASSERT(modbus_defer_message(&s_queue, s_frames[1], TEST_ADDRESS, length, true));
+
+		while (modbus_service_deferred_message(&s_queue, s_modbus_handler, NULL)) {}
+
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0A0B, s_holding_registers[4]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0C0D, s_holding_registers[5]);
+		for (int i = 0; i < 10; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(coils[i], s_coils[2 + i]);
+		}
+	}
+
+public:
+	void setUp()
+	{
+		memset(&s_modbus_handler, 0, sizeof(s_modbus_handler));
+		memset(s_holding_registers, 0, sizeof(s_holding_registers));
+		memset(s_coils, 0, sizeof(s_coils));
+		memset(s_frames, 0, sizeof(s_frames));
+
+		s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+		s_modbus_handler.functions.write_holding_register = write_holding_register;
+		s_modbus_handler.functions.write_holding_registers = write_holding_registers;
+		s_modbus_handler.functions.write_multiple_coils = write_multiple_coils;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+
+		s_modbus_handler.data.device_address = TEST_ADDRESS;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+		s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+		s_modbus_handler.data.num_coils = NUMBER_OF_COILS;
+		s_modbus_handler.data.write_multiple_coils = s_write_coil_data_buffer;
+
+		modbus_request_queue_init(&s_queue);
+
+		s_current_message = NULL;
+		s_current_message_length = 0;
+		s_n_writes = 0;
+		s_read_first = 0;
+		s_read_count = 0;
+		s_last_exception_function = 0;
+		s_last_exception_code = EXCEPTION_NONE;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusDeferredTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
@@ -0,0 +1,211 @@
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const int NUMBER_OF_HOLDING_REGISTERS = 6;
+
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+
+static MODBUS_HANDLER s_modbus_handler;
+
+static uint8_t s_last_exception_function;
+static MODBUS_EXCEPTION_CODES s_last_exception_code;
+
+static struct _diagnostics_data { bool called; uint16_t sub_function; uint16_t data; } s_diagnostics_data;
+static void diagnostics(uint16_t sub_function, uint16_t data)
+{
+	s_diagnostics_data.called = true;
+	s_diagnostics_data.sub_function = sub_function;
+	s_diagnostics_data.data = data;
+}
+
+static void read_holding_registers(uint16_t, uint16_t) {}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_last_exception_function = function_code;
+	s_last_exception_code = exception_code;
+}
+
+static void service_diagnostics(uint8_t address, uint16_t sub_function, uint16_t data)
+{
+	uint8_t message[] = {address, DIAGNOSTICS, (uint8_t)(sub_function >> 8), (uint8_t)(sub_function & 0xFF), (uint8_t)(data >> 8), (uint8_t)(data & 0xFF)};
+	modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+}
+
+static uint16_t query_counter(uint16_t sub_function)
+{
+	service_diagnostics(0xAA, sub_function, 0x0000);
+	return s_diagnostics_data.data;
+}
+
+class ModbusDiagnosticsTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusDiagnosticsTest);
+
+	CPPUNIT_TEST(test_diagnostics_return_query_data_echoes_data);
+	CPPUNIT_TEST(test_diagnostics_bus_message_count_includes_other_addresses);
+	CPPUNIT_TEST(test_diagnostics_bus_communication_error_count_counts_crc_failures);
+	CPPUNIT_TEST(test_diagnostics_bus_communication_error_count_includes_other_addresses);
+	CPPUNIT_TEST(test_diagnostics_slave_exception_error_count_counts_exceptions);
+	CPPUNIT_TEST(test_diagnostics_slave_message_count_includes_broadcasts);
+	CPPUNIT_TEST(test_diagnostics_slave_no_response_count_counts_broadcasts);
+	CPPUNIT_TEST(test_diagnostics_clear_counters);
+	CPPUNIT_TEST(test_diagnostics_without_handler_is_illegal_function);
+	CPPUNIT_TEST(test_diagnostics_unsupported_sub_function_is_illegal_function);
+	CPPUNIT_TEST(test_diagnostics_counter_query_with_non_zero_data_is_illegal_value);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_diagnostics_return_query_data_echoes_data()
+	{
+		service_diagnostics(0xAA, DIAGNOSTICS_RETURN_QUERY_DATA, 0xA537);
+
+		CPPUNIT_ASSERT(s_diagnostics_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)DIAGNOSTICS_RETURN_QUERY_DATA, s_diagnostics_data.sub_function);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0xA537, s_diagnostics_data.data);
+	}
+
+	void test_diagnostics_bus_message_count_includes_other_addresses()
+	{
+		uint8_t other[] = {0xAB, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x01};
+		modbus_service_message(other, s_modbus_handler, sizeof(other), false);
+		modbus_service_message(other, s_modbus_handler, sizeof(other), false);
+
+		/* The query itself is also a message on the bus */
+		CPPUNIT_ASSERT_EQUAL((uint16_t)3, query_counter(DIAGNOSTICS_RETURN_BUS_MESSAGE_COUNT));
+	}
+
+	void test_diagnostics_bus_communication_error_count_counts_crc_failures()
+	{
+		uint8_t bad[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x01, 0x12, 0x34};
+		modbus_service_message(bad, s_modbus_handler, sizeof(bad), true);
+
+		CPPUNIT_ASSERT_EQUAL((uint16_t)1, query_counter(DIAGNOSTICS_RETURN_BUS_COMMUNICATION_ERROR_COUNT));
+	}
+
+	void test_diagnostics_bus_communication_error_count_includes_other_addresses()
+	{
+		uint8_t other[] = {0xAB, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x01, 0x12, 0x34};
+		modbus_service_message(other, s_modbus_handler, sizeof(other), true);
+
+		/* A frame for this unit whose address byte was corrupted */
+		uint8_t corrupted[8];
+		modbus_get_read_holding_registers_request(0xAA, corrupted, 0, 1);
+		corrupted[0] ^= 0x01;
+		modbus_service_message(corrupted, s_modbus_handler, sizeof(corrupted), true);
+
+		CPPUNIT_ASSERT_EQUAL((uint16_t)2, query_counter(DIAGNOSTICS_RETURN_BUS_COMMUNICATION_ERROR_COUNT));
+	}
+
+	void test_diagnostics_slave_exception_error_count_counts_exceptions()
+	{
+		uint8_t bad_address[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, NUMBER_OF_HOLDING_REGISTERS, 0x00, 0x01};
+		modbus_service_message(bad_address, s_modbus_handler, sizeof(bad_address), false);
+		bad_address[0] = MODBUS_BROADCAST_ADDRESS;
+		modbus_service_message(bad_address, s_modbus_handler, sizeof(bad_address), false);
+
+		CPPUNIT_ASSERT_EQUAL((uint16_t)1, query_counter(DIAGNOSTICS_RETURN_SLAVE_EXCEPTION_ERROR_COUNT));
+	}
+
+	void test_diagnostics_slave_message_count_includes_broadcasts()
+	{
+		uint8_t message[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x01};
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+		message[0] = MODBUS_BROADCAST_ADDRESS;
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+		message[0] = 0xAB;
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT_EQUAL((uint16_t)3, query_counter(DIAGNOSTICS_RETURN_SLAVE_MESSAGE_COUNT));
+	}
+
+	void test_diagnostics_slave_no_response_count_counts_broadcasts()
+	{
+		uint8_t message[] = {MODBUS_BROADCAST_ADDRESS, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x01};
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT_EQUAL((uint16_t)2, query_counter(DIAGNOSTICS_RETURN_SLAVE_NO_RESPONSE_COUNT));
+	}
+
+	void test_diagnostics_clear_counters()
+	{
+		uint8_t message[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x01};
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		service_diagnostics(0xAA, DIAGNOSTICS_CLEAR_COUNTERS, 0x0000);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)DIAGNOSTICS_CLEAR_COUNTERS, s_diagnostics_data.sub_function);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x0000, s_diagnostics_data.data);
+
+		MODBUS_DIAGNOSTIC_COUNTERS counters;
+		modbus_get_diagnostic_counters(&counters);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0, counters.bus_message);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0, counters.slave_message);
+	}
+
+	void test_diagnostics_without_handler_is_illegal_function()
+	{
+		s_modbus_handler.functions.diagnostics = NULL;
+		service_diagnostics(0xAA, DIAGNOSTICS_RETURN_QUERY_DATA, 0x1234);
+
+		CPPUNIT_ASSERT_EQUAL((int)(128 + DIAGNOSTICS), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
+	}
+
+	void test_diagnostics_unsupported_sub_function_is_illegal_function()
+	{
+		service_diagnostics(0xAA, 0x0004, 0x0000);
+
+		CPPUNIT_ASSERT(!s_diagnostics_data.called);
+		CPPUNIT_ASSERT_EQUAL((int)(128 + DIAGNOSTICS), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
+	}
+
+	void test_diagnostics_counter_query_with_non_zero_data_is_illegal_value()
+	{
+		service_diagnostics(0xAA, DIAGNOSTICS_RETURN_BUS_MESSAGE_COUNT, 0x0001);
+
+		CPPUNIT_ASSERT(!s_diagnostics_data.called);
+		CPPUNIT_ASSERT_EQUAL((int)(128 + DIAGNOSTICS), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, s_last_exception_code);
+	}
+
+public:
+	void setUp()
+	{
+		s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+		s_modbus_handler.functions.diagnostics = diagnostics;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+		s_modbus_handler.data.device_address = 0xAA;
+		s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+
+		s_diagnostics_data.called = false;
+		s_diagnostics_data.sub_function = UINT16_MAX;
+		s_diagnostics_data.data = UINT16_MAX;
+
+		s_last_exception_function = 0;
+		s_last_exception_code = (MODBUS_EXCEPTION_CODES)0xFF;
+
+		modbus_clear_diagnostic_counters();
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusDiagnosticsTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
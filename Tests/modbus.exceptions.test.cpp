@@ -92,12 +92,14 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	
 	CPPUNIT_TEST(test_service_calls_exception_callback_with_illegal_mask_write_register_data_address_too_high);
 
+	CPPUNIT_TEST(test_service_calls_exception_callback_with_truncated_write_holding_registers);
+
 	CPPUNIT_TEST_SUITE_END();
 
 	void test_service_calls_exception_callback_with_read_coils_illegal_function_exception()
 	{
 		uint8_t message[] = {0xAA, READ_COILS};
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_COILS), (int)s_last_exception_function);	
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
 	}
@@ -105,7 +107,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	void test_service_calls_exception_callback_with_read_discrete_inputs_illegal_function_exception()
 	{
 		uint8_t message[] = {0xAA, READ_DISCRETE_INPUTS};
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_DISCRETE_INPUTS), (int)s_last_exception_function);	
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
 	}
@@ -113,7 +115,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	void test_service_calls_exception_callback_with_write_single_coil_illegal_function_exception()
 	{
 		uint8_t message[] = {0xAA, WRITE_SINGLE_COIL};
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_SINGLE_COIL), (int)s_last_exception_function);	
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
 	}
@@ -121,7 +123,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	void test_service_calls_exception_callback_with_write_multiple_coils_illegal_function_exception()
 	{
 		uint8_t message[] = {0xAA, WRITE_MULTIPLE_COILS};
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_MULTIPLE_COILS), (int)s_last_exception_function);	
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
 	}
@@ -129,7 +131,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	void test_service_calls_exception_callback_with_read_input_registers_illegal_function_exception()
 	{
 		uint8_t message[] = {0xAA, READ_INPUT_REGISTERS};
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_INPUT_REGISTERS), (int)s_last_exception_function);	
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
 	}
@@ -138,7 +140,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 
 		uint8_t message[] = {0xAA, READ_HOLDING_REGISTERS};
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_HOLDING_REGISTERS), (int)s_last_exception_function);	
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
 	}
@@ -147,7 +149,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 
 		uint8_t message[] = {0xAA, WRITE_HOLDING_REGISTER};
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_HOLDING_REGISTER), (int)s_last_exception_function);	
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
 	}
@@ -155,7 +157,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	void test_service_calls_exception_callback_with_write_holding_registers_illegal_function_exception()
 	{
 		uint8_t message[] = {0xAA, WRITE_HOLDING_REGISTERS};
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_HOLDING_REGISTERS), (int)s_last_exception_function);	
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
 	}
@@ -164,7 +166,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 
 		uint8_t message[] = {0xAA, READ_WRITE_REGISTERS};
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_WRITE_REGISTERS), (int)s_last_exception_function);	
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
 	}
@@ -173,7 +175,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 
 		uint8_t message[] = {0xAA, MASK_WRITE_REGISTER};
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + MASK_WRITE_REGISTER), (int)s_last_exception_function);	
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
 	}
@@ -182,7 +184,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, READ_COILS, 0x00, 0x00, 0x00, NUMBER_OF_COILS+1};
 		s_modbus_handler.functions.read_coils = read_coils_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_COILS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -192,7 +194,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, READ_COILS, 0x00, NUMBER_OF_COILS, 0x00, 0x01};
 		s_modbus_handler.functions.read_coils = read_coils_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_COILS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -202,7 +204,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, READ_DISCRETE_INPUTS, 0x00, 0x00, 0x00, NUMBER_OF_INPUTS+1};
 		s_modbus_handler.functions.read_discrete_inputs = read_discrete_inputs_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_DISCRETE_INPUTS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -212,7 +214,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, READ_DISCRETE_INPUTS, 0x00, NUMBER_OF_INPUTS, 0x00, 0x01};
 		s_modbus_handler.functions.read_discrete_inputs = read_discrete_inputs_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_DISCRETE_INPUTS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -222,7 +224,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, WRITE_SINGLE_COIL, 0x00, NUMBER_OF_COILS, 0x00, 0x00};
 		s_modbus_handler.functions.write_single_coil = write_single_coil_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);			
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);			
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_SINGLE_COIL), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -232,7 +234,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, WRITE_SINGLE_COIL, 0x00, NUMBER_OF_COILS-1, 0x00, 0x01};
 		s_modbus_handler.functions.write_single_coil = write_single_coil_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_SINGLE_COIL), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -240,9 +242,9 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 
 	void test_service_calls_exception_callback_with_illegal_write_multiple_coils_data_length()
 	{
-		uint8_t message[] = {0xAA, WRITE_MULTIPLE_COILS, 0x00, 0x00, 0x00, NUMBER_OF_COILS+1};
+		uint8_t message[] = {0xAA, WRITE_MULTIPLE_COILS, 0x00, 0x00, 0x00, NUMBER_OF_COILS+1, 0x01, 0x00};
 		s_modbus_handler.functions.write_multiple_coils = write_multiple_coils_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_MULTIPLE_COILS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -250,9 +252,9 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 
 	void test_service_calls_exception_callback_with_illegal_write_multiple_coils_data_address_too_high()
 	{
-		uint8_t message[] = {0xAA, WRITE_MULTIPLE_COILS, 0x00, NUMBER_OF_COILS, 0x00, 0x01};
+		uint8_t message[] = {0xAA, WRITE_MULTIPLE_COILS, 0x00, NUMBER_OF_COILS, 0x00, 0x01, 0x01, 0x00};
 		s_modbus_handler.functions.write_multiple_coils = write_multiple_coils_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_MULTIPLE_COILS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -262,7 +264,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, READ_INPUT_REGISTERS, 0x00, 0x00, 0x00, NUMBER_OF_INPUT_REGISTERS+1};
 		s_modbus_handler.functions.read_input_registers = read_input_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_INPUT_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -272,7 +274,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, READ_INPUT_REGISTERS, 0x00, NUMBER_OF_INPUT_REGISTERS, 0x00, 0x01};
 		s_modbus_handler.functions.read_input_registers = read_input_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_INPUT_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -282,7 +284,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, NUMBER_OF_HOLDING_REGISTERS+1};
 		s_modbus_handler.functions.read_holding_registers = read_holding_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_HOLDING_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -292,7 +294,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, NUMBER_OF_HOLDING_REGISTERS, 0x00, 0x01};
 		s_modbus_handler.functions.read_holding_registers = read_holding_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_HOLDING_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -302,7 +304,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 	{
 		uint8_t message[] = {0xAA, WRITE_HOLDING_REGISTER, 0x00, NUMBER_OF_HOLDING_REGISTERS, 0x00, 0x00};
 		s_modbus_handler.functions.write_holding_register = write_holding_register_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_HOLDING_REGISTER), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());	
@@ -313,11 +315,12 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 		uint8_t message[] = {0xAA, WRITE_HOLDING_REGISTERS, 
 			0x00, 0x00,
 			0x00, NUMBER_OF_HOLDING_REGISTERS+1,
-			((NUMBER_OF_HOLDING_REGISTERS+1)*2)
+			((NUMBER_OF_HOLDING_REGISTERS+1)*2),
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 		};
 
 		s_modbus_handler.functions.write_holding_registers = write_holding_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_HOLDING_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -328,10 +331,11 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 		uint8_t message[] = {0xAA, WRITE_HOLDING_REGISTERS, 
 			0x00, NUMBER_OF_HOLDING_REGISTERS,
 			0x00, 0x01,
-			0x02
+			0x02,
+			0x00, 0x00
 		};
 		s_modbus_handler.functions.write_holding_registers = write_holding_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_HOLDING_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -346,7 +350,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 		};
 
 		s_modbus_handler.functions.write_holding_registers = write_holding_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_HOLDING_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());
@@ -365,7 +369,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 		};
 
 		s_modbus_handler.functions.read_write_registers = read_write_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_WRITE_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());	
@@ -384,7 +388,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 		};
 
 		s_modbus_handler.functions.read_write_registers = read_write_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_WRITE_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());	
@@ -403,7 +407,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 		};
 
 		s_modbus_handler.functions.read_write_registers = read_write_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_WRITE_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());	
@@ -422,7 +426,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 		};
 
 		s_modbus_handler.functions.read_write_registers = read_write_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_WRITE_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());	
@@ -441,7 +445,7 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 		};
 
 		s_modbus_handler.functions.read_write_registers = read_write_registers_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_WRITE_REGISTERS), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());	
@@ -458,12 +462,34 @@ class ModbusExceptionTest : public CppUnit::TestFixture  {
 		};
 
 		s_modbus_handler.functions.mask_write_register = mask_write_register_function;
-		modbus_service_message(message, s_modbus_handler, 0, false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
 		CPPUNIT_ASSERT_EQUAL((int)(128 + MASK_WRITE_REGISTER), (int)s_last_exception_function);
 		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
 		CPPUNIT_ASSERT(test_buffer_is_empty());	
 	}
 
+	void test_service_calls_exception_callback_with_truncated_write_holding_registers()
+	{
+		/* Claims three registers but carries one, with a valid CRC over what was received */
+		uint8_t message[] = {
+			0xAA, WRITE_HOLDING_REGISTERS,
+			0x00, 0x00,
+			0x00, 0x03,
+			0x06,
+			0x12, 0x34,
+			0x00, 0x00
+		};
+		uint16_t crc = modbus_get_crc16(message, sizeof(message) - 2);
+		message[sizeof(message) - 2] = (uint8_t)(crc & 0xFF);
+		message[sizeof(message) - 1] = (uint8_t)(crc >> 8);
+
+		s_modbus_handler.functions.write_holding_registers = write_holding_registers_function;
+		modbus_service_message(message, s_modbus_handler, sizeof(message), true);
+		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_HOLDING_REGISTERS), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, s_last_exception_code);
+		CPPUNIT_ASSERT(test_buffer_is_empty());
+	}
+
 public:
 	void setUp()
 	{
@@ -0,0 +1,201 @@
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+static const int NUMBER_OF_HOLDING_REGISTERS = 6;
+
+static MODBUS_HANDLER s_modbus_handler;
+static MODBUS_FIFO s_fifo;
+
+static uint8_t s_response[256];
+static int s_response_length;
+
+static uint8_t s_last_exception_function;
+static MODBUS_EXCEPTION_CODES s_last_exception_code;
+
+static struct _read_fifo_queue_data { bool called; uint16_t fifo_pointer_address; } s_read_fifo_queue_data;
+static void read_fifo_queue(uint16_t fifo_pointer_address)
+{
+	s_read_fifo_queue_data.called = true;
+	s_read_fifo_queue_data.fifo_pointer_address = fifo_pointer_address;
+	s_response_length = modbus_write_read_fifo_queue_response(TEST_ADDRESS, s_response, &s_fifo);
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_last_exception_function = function_code;
+	s_last_exception_code = exception_code;
+}
+
+static int16_t two_bytes_to_int16_t(uint8_t c1, uint8_t c2)
+{
+	return (int16_t)((c1 << 8) + c2);
+}
+
+class ModbusFifoTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusFifoTest);
+
+	CPPUNIT_TEST(test_fifo_starts_empty);
+	CPPUNIT_TEST(test_fifo_push_increases_count);
+	CPPUNIT_TEST(test_fifo_holds_at_most_max_fifo_count_values);
+	CPPUNIT_TEST(test_fifo_push_to_null_fifo_fails);
+	CPPUNIT_TEST(test_fifo_response_for_empty_fifo);
+	CPPUNIT_TEST(test_fifo_response_drains_values_in_order);
+	CPPUNIT_TEST(test_fifo_response_drains_full_fifo_across_wrap);
+	CPPUNIT_TEST(test_service_with_read_fifo_queue_message);
+	CPPUNIT_TEST(test_service_read_fifo_queue_without_handler_is_illegal_function);
+	CPPUNIT_TEST(test_service_read_fifo_queue_with_bad_address_is_illegal_address);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_fifo_starts_empty()
+	{
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, modbus_fifo_count(&s_fifo));
+	}
+
+	void test_fifo_push_increases_count()
+	{
+		CPPUNIT_ASSERT(modbus_fifo_push(&s_fifo, 1));
+		CPPUNIT_ASSERT(modbus_fifo_push(&s_fifo, 2));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)2, modbus_fifo_count(&s_fifo));
+	}
+
+	void test_fifo_holds_at_most_max_fifo_count_values()
+	{
+		for (int i = 0; i < MODBUS_MAX_FIFO_COUNT; i++)
+		{
+			CPPUNIT_ASSERT(modbus_fifo_push(&s_fifo, (int16_t)i));
+		}
+		CPPUNIT_ASSERT(!modbus_fifo_push(&s_fifo, 0x7FFF));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)MODBUS_MAX_FIFO_COUNT, modbus_fifo_count(&s_fifo));
+	}
+
+	void test_fifo_push_to_null_fifo_fails()
+	{
+		CPPUNIT_ASSERT(!modbus_fifo_push(NULL, 1));
+	}
+
+	void test_fifo_response_for_empty_fifo()
+	{
+		uint8_t buffer[256];
+		int bytes_written = modbus_write_read_fifo_queue_response(TEST_ADDRESS, buffer, &s_fifo);
+
+		CPPUNIT_ASSERT_EQUAL(8, bytes_written);
+		CPPUNIT_ASSERT_EQUAL(TEST_ADDRESS, buffer[0]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)READ_FIFO_QUEUE, buffer[1]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)2, two_bytes_to_int16_t(buffer[2], buffer[3]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0, two_bytes_to_int16_t(buffer[4], buffer[5]));
+		CPPUNIT_ASSERT(modbus_validate_message_crc(buffer, bytes_written));
+	}
+
+	void test_fifo_response_drains_values_in_order()
+	{
+		modbus_fifo_push(&s_fifo, 0x01B8);
+		modbus_fifo_push(&s_fifo, 0x1284);
+
+		uint8_t buffer[256];
+		int bytes_written = modbus_write_read_fifo_queue_response(TEST_ADDRESS, buffer, &s_fifo);
+
+		CPPUNIT_ASSERT_EQUAL(12, bytes_written);
+		CPPUNIT_ASSERT_EQUAL((int16_t)6, two_bytes_to_int16_t(buffer[2], buffer[3]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)2, two_bytes_to_int16_t(buffer[4], buffer[5]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x01B8, two_bytes_to_int16_t(buffer[6], buffer[7]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x1284, two_bytes_to_int16_t(buffer[8], buffer[9]));
+		CPPUNIT_ASSERT(modbus_validate_message_crc(buffer, bytes_written));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, modbus_fifo_count(&s_fifo));
+	}
+
+	void test_fifo_response_drains_full_fifo_across_wrap()
+	{
+		uint8_t buffer[256];
+
+		/* Move the indices part way round the ring first */
+		for (int i = 0; i < 20; i++) { modbus_fifo_push(&s_fifo, 0); }
+		modbus_write_read_fifo_queue_response(TEST_ADDRESS, buffer, &s_fifo);
+
+		for (int i = 0; i < MODBUS_MAX_FIFO_COUNT; i++) { modbus_fifo_push(&s_fifo, (int16_t)(1000 + i)); }
+
+		int bytes_written = modbus_write_read_fifo_queue_response(TEST_ADDRESS, buffer, &s_fifo);
+
+		CPPUNIT_ASSERT_EQUAL(6 + (MODBUS_MAX_FIFO_COUNT * 2) + 2, bytes_written);
+		CPPUNIT_ASSERT_EQUAL((int16_t)MODBUS_MAX_FIFO_COUNT, two_bytes_to_int16_t(buffer[4], buffer[5]));
+		for (int i = 0; i < MODBUS_MAX_FIFO_COUNT; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL((int16_t)(1000 + i), two_bytes_to_int16_t(buffer[6 + (i * 2)], buffer[7 + (i * 2)]));
+		}
+		CPPUNIT_ASSERT(modbus_validate_message_crc(buffer, bytes_written));
+	}
+
+	void test_service_with_read_fifo_queue_message()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_FIFO_QUEUE, 0x00, 0x04};
+		modbus_fifo_push(&s_fifo, 0x0042);
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT(s_read_fifo_queue_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x0004, s_read_fifo_queue_data.fifo_pointer_address);
+		CPPUNIT_ASSERT_EQUAL(10, s_response_length);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0042, two_bytes_to_int16_t(s_response[6], s_response[7]));
+	}
+
+	void test_service_read_fifo_queue_without_handler_is_illegal_function()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_FIFO_QUEUE, 0x00, 0x04};
+		s_modbus_handler.functions.read_fifo_queue = NULL;
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_FIFO_QUEUE), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
+	}
+
+	void test_service_read_fifo_queue_with_bad_address_is_illegal_address()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_FIFO_QUEUE, 0x00, NUMBER_OF_HOLDING_REGISTERS};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT(!s_read_fifo_queue_data.called);
+		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_FIFO_QUEUE), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+public:
+	void setUp()
+	{
+		s_modbus_handler.functions.read_fifo_queue = read_fifo_queue;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+		s_modbus_handler.data.device_address = TEST_ADDRESS;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+
+		modbus_fifo_init(&s_fifo);
+
+		s_read_fifo_queue_data.called = false;
+		s_read_fifo_queue_data.fifo_pointer_address = UINT16_MAX;
+		s_response_length = 0;
+
+		s_last_exception_function = 0;
+		s_last_exception_code = (MODBUS_EXCEPTION_CODES)0xFF;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusFifoTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
@@ -0,0 +1,319 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_posix_file.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+static const int NUMBER_OF_RECORDS = 16;
+
+static uint8_t s_file_4_records[NUMBER_OF_RECORDS * 2];
+static uint8_t s_file_3_records[NUMBER_OF_RECORDS * 2];
+
+static MODBUS_FILE s_files[2];
+static MODBUS_HANDLER s_modbus_handler;
+
+static uint8_t s_response[256];
+static int s_response_length;
+static bool s_write_called;
+
+static uint8_t s_last_exception_function;
+static MODBUS_EXCEPTION_CODES s_last_exception_code;
+
+static void read_file_record(uint8_t const * request, uint8_t request_length)
+{
+	s_response_length = modbus_write_read_file_record_response(TEST_ADDRESS, s_response, s_modbus_handler.data.files, s_modbus_handler.data.num_files, request, request_length);
+}
+
+static void write_file_record(uint8_t const * request, uint8_t request_length)
+{
+	s_write_called = true;
+	s_response_length = modbus_get_write_file_record_response(TEST_ADDRESS, s_response, request, request_length);
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_last_exception_function = function_code;
+	s_last_exception_code = exception_code;
+}
+
+static int16_t two_bytes_to_int16_t(uint8_t c1, uint8_t c2)
+{
+	return (int16_t)((c1 << 8) + c2);
+}
+
+class ModbusFileRecordTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusFileRecordTest);
+
+	CPPUNIT_TEST(test_service_with_read_file_record_single_sub_request);
+	CPPUNIT_TEST(test_service_with_read_file_record_multiple_sub_requests);
+	CPPUNIT_TEST(test_service_read_file_record_unknown_file_is_illegal_address);
+	CPPUNIT_TEST(test_service_read_file_record_past_end_of_file_is_illegal_address);
+	CPPUNIT_TEST(test_service_read_file_record_bad_reference_type_is_illegal_value);
+	CPPUNIT_TEST(test_service_read_file_record_bad_byte_count_is_illegal_value);
+	CPPUNIT_TEST(test_service_with_write_file_record_multiple_sub_requests);
+	CPPUNIT_TEST(test_service_write_file_record_to_read_only_file_is_illegal_address);
+	CPPUNIT_TEST(test_service_write_file_record_with_bad_sub_request_writes_nothing);
+	CPPUNIT_TEST(test_service_truncated_write_file_record_writes_nothing);
+	CPPUNIT_TEST(test_service_file_record_longer_than_byte_count_is_illegal_value);
+	CPPUNIT_TEST(test_service_file_record_with_memory_mapped_file);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_service_with_read_file_record_single_sub_request()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_FILE_RECORD, 0x07, 0x06, 0x00, 0x04, 0x00, 0x01, 0x00, 0x02};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT_EQUAL(11, s_response_length);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)READ_FILE_RECORD, s_response[1]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)6, s_response[2]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)5, s_response[3]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)MODBUS_FILE_RECORD_REFERENCE_TYPE, s_response[4]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0401, two_bytes_to_int16_t(s_response[5], s_response[6]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0402, two_bytes_to_int16_t(s_response[7], s_response[8]));
+		CPPUNIT_ASSERT(modbus_validate_message_crc(s_response, s_response_length));
+	}
+
+	void test_service_with_read_file_record_multiple_sub_requests()
+	{
+		/* Example request from the Modbus application protocol specification */
+		uint8_t message[] = {
+			TEST_ADDRESS, READ_FILE_RECORD, 0x0E,
+			0x06, 0x00, 0x04, 0x00, 0x01, 0x00, 0x02,
+			0x06, 0x00, 0x03, 0x00, 0x09, 0x00, 0x02
+		};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT_EQUAL(17, s_response_length);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x0C, s_response[2]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x05, s_response[3]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0401, two_bytes_to_int16_t(s_response[5], s_response[6]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0402, two_bytes_to_int16_t(s_response[7], s_response[8]));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x05, s_response[9]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0309, two_bytes_to_int16_t(s_response[11], s_response[12]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x030A, two_bytes_to_int16_t(s_response[13], s_response[14]));
+		CPPUNIT_ASSERT(modbus_validate_message_crc(s_response, s_response_length));
+	}
+
+	void test_service_read_file_record_unknown_file_is_illegal_address()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_FILE_RECORD, 0x07, 0x06, 0x00, 0x05, 0x00, 0x01, 0x00, 0x02};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT_EQUAL(0, s_response_length);
+		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_FILE_RECORD), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+	void test_service_read_file_record_past_end_of_file_is_illegal_address()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_FILE_RECORD, 0x07, 0x06, 0x00, 0x04, 0x00, NUMBER_OF_RECORDS - 1, 0x00, 0x02};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT_EQUAL(0, s_response_length);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+	void test_service_read_file_record_bad_reference_type_is_illegal_value()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_FILE_RECORD, 0x07, 0x05, 0x00, 0x04, 0x00, 0x01, 0x00, 0x02};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT_EQUAL(0, s_response_length);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, s_last_exception_code);
+	}
+
+	void test_service_read_file_record_bad_byte_count_is_illegal_value()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_FILE_RECORD, 0x08, 0x06, 0x00, 0x04, 0x00, 0x01, 0x00, 0x02, 0x00};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT_EQUAL(0, s_response_length);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, s_last_exception_code);
+	}
+
+	void test_service_with_write_file_record_multiple_sub_requests()
+	{
+		uint8_t message[] = {
+			TEST_ADDRESS, WRITE_FILE_RECORD, 0x16,
+			0x06, 0x00, 0x04, 0x00, 0x07, 0x00, 0x03, 0x06, 0xAF, 0x04, 0xBE, 0x10, 0x0D,
+			0x06, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01, 0x12, 0x34
+		};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT(s_write_called);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x06AF, two_bytes_to_int16_t(s_file_4_records[14], s_file_4_records[15]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x04BE, two_bytes_to_int16_t(s_file_4_records[16], s_file_4_records[17]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x100D, two_bytes_to_int16_t(s_file_4_records[18], s_file_4_records[19]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x1234, two_bytes_to_int16_t(s_file_3_records[0], s_file_3_records[1]));
+
+		/* The response echoes the request */
+		CPPUNIT_ASSERT_EQUAL((int)sizeof(message) + 2, s_response_length);
+		CPPUNIT_ASSERT(memcmp(message + 1, s_response + 1, sizeof(message) - 1) == 0);
+		CPPUNIT_ASSERT(modbus_validate_message_crc(s_response, s_response_length));
+	}
+
+	void test_service_write_file_record_to_read_only_file_is_illegal_address()
+	{
+		uint8_t message[] = {TEST_ADDRESS, WRITE_FILE_RECORD, 0x09, 0x06, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01, 0x12, 0x34};
+		s_files[1].writable = false;
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT(!s_write_called);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0300, two_bytes_to_int16_t(s_file_3_records[0], s_file_3_records[1]));
+		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_FILE_RECORD), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+	void test_service_write_file_record_with_bad_sub_request_writes_nothing()
+	{
+		uint8_t message[] = {
+			TEST_ADDRESS, WRITE_FILE_RECORD, 0x12,
+			0x06, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01, 0x12, 0x34,
+			0x06, 0x00, 0x04, 0x00, NUMBER_OF_RECORDS, 0x00, 0x01, 0x56, 0x78
+		};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT(!s_write_called);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0300, two_bytes_to_int16_t(s_file_3_records[0], s_file_3_records[1]));
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+	/* Appends the CRC, so only the frame length gives the truncation away */
+	static int add_crc(uint8_t * message, int length)
+	{
+		uint16_t crc = modbus_get_crc16(message, length);
+		message[length] = (uint8_t)(crc & 0xFF);
+		message[length + 1] = (uint8_t)(crc >> 8);
+		return length + 2;
+	}
+
+	void test_service_truncated_write_file_record_writes_nothing()
+	{
+		/* The byte count claims two sub-requests; only the first was received */
+		uint8_t message[32] = {
+			TEST_ADDRESS, WRITE_FILE_RECORD, 0x12,
+			0x06, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01, 0x12, 0x34
+		};
+		int length = add_crc(message, 12);
+
+		modbus_service_message(message, s_modbus_handler, length, true);
+
+		CPPUNIT_ASSERT(!s_write_called);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0300, two_bytes_to_int16_t(s_file_3_records[0], s_file_3_records[1]));
+		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_FILE_RECORD), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, s_last_exception_code);
+	}
+
+	void test_service_file_record_longer_than_byte_count_is_illegal_value()
+	{
+		uint8_t message[32] = {TEST_ADDRESS, READ_FILE_RECORD, 0x07, 0x06, 0x00, 0x04, 0x00, 0x01, 0x00, 0x02, 0x00};
+		int length = add_crc(message, 11);
+
+		modbus_service_message(message, s_modbus_handler, length, true);
+
+		CPPUNIT_ASSERT_EQUAL(0, s_response_length);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, s_last_exception_code);
+	}
+
+	void test_service_file_record_with_memory_mapped_file()
+	{
+		char path[] = "/tmp/modbus_file_record_test_XXXXXX";
+		int fd = mkstemp(path);
+		CPPUNIT_ASSERT(fd >= 0);
+		uint8_t contents[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77};
+		CPPUNIT_ASSERT_EQUAL((ssize_t)sizeof(contents), write(fd, contents, sizeof(contents)));
+		close(fd);
+
+		MODBUS_FILE mapped_file;
+		CPPUNIT_ASSERT(modbus_posix_map_file(path, 9, true, &mapped_file));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)4, mapped_file.n_records);
+		s_modbus_handler.data.files = &mapped_file;
+		s_modbus_handler.data.num_files = 1;
+
+		uint8_t write_message[] = {TEST_ADDRESS, WRITE_FILE_RECORD, 0x09, 0x06, 0x00, 0x09, 0x00, 0x03, 0x00, 0x01, 0xBE, 0xEF};
+		modbus_service_message(write_message, s_modbus_handler, sizeof(write_message), false);
+		CPPUNIT_ASSERT(modbus_posix_sync_file(&mapped_file));
+
+		uint8_t read_message[] = {TEST_ADDRESS, READ_FILE_RECORD, 0x07, 0x06, 0x00, 0x09, 0x00, 0x02, 0x00, 0x02};
+		modbus_service_message(read_message, s_modbus_handler, sizeof(read_message), false);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x4455, two_bytes_to_int16_t(s_response[5], s_response[6]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0xBEEF, two_bytes_to_int16_t(s_response[7], s_response[8]));
+
+		modbus_posix_unmap_file(&mapped_file);
+
+		FILE * file = fopen(path, "rb");
+		uint8_t written[8];
+		CPPUNIT_ASSERT_EQUAL((size_t)8, fread(written, 1, sizeof(written), file));
+		fclose(file);
+		unlink(path);
+
+		CPPUNIT_ASSERT_EQUAL((int)0xBE, (int)written[6]);
+		CPPUNIT_ASSERT_EQUAL((int)0xEF, (int)written[7]);
+	}
+
+public:
+	void setUp()
+	{
+		for (int i = 0; i < NUMBER_OF_RECORDS; i++)
+		{
+			s_file_4_records[i * 2] = 0x04;
+			s_file_4_records[(i * 2) + 1] = (uint8_t)i;
+			s_file_3_records[i * 2] = 0x03;
+			s_file_3_records[(i * 2) + 1] = (uint8_t)i;
+		}
+
+		s_files[0].file_number = 4;
+		s_files[0].n_records = NUMBER_OF_RECORDS;
+		s_files[0].records = s_file_4_records;
+		s_files[0].writable = true;
+		s_files[1].file_number = 3;
+		s_files[1].n_records = NUMBER_OF_RECORDS;
+		s_files[1].records = s_file_3_records;
+		s_files[1].writable = true;
+
+		s_modbus_handler.functions.read_file_record = read_file_record;
+		s_modbus_handler.functions.write_file_record = write_file_record;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+		s_modbus_handler.data.device_address = TEST_ADDRESS;
+		s_modbus_handler.data.files = s_files;
+		s_modbus_handler.data.num_files = 2;
+
+		s_response_length = 0;
+		s_write_called = false;
+
+		s_last_exception_function = 0;
+		s_last_exception_code = (MODBUS_EXCEPTION_CODES)0xFF;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusFileRecordTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
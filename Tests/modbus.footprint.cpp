@@ -0,0 +1,155 @@
+/*
+ * Minimal slave for the footprint report (scons footprint).
+ *
+ * Every build serves holding registers through a MODBUS_HANDLER; each FOOTPRINT_x
+ * define adds one feature, or swaps the handler for another way of dispatching.
+ * The programs are linked with unused code discarded, so the difference from the
+ * base build is what that feature costs an application that uses it.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "modbus.h"
+
+#ifdef FOOTPRINT_STATIC_DISPATCH
+#include "modbus_server.h"
+#include "modbus_map.h"
+#endif
+
+static const uint8_t DEVICE_ADDRESS = 1;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 16;
+
+static int16_t s_holding_registers[NUMBER_OF_HOLDING_REGISTERS];
+#ifndef FOOTPRINT_STATIC_DISPATCH
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+#endif
+static uint8_t s_response[64];
+static int s_response_length;
+
+/* Stands in for the receive buffer, so the compiler cannot see the frame */
+volatile uint8_t g_frame[64];
+volatile int g_frame_length;
+
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	s_response_length = modbus_write_read_holding_registers_response(DEVICE_ADDRESS, s_response, &s_holding_registers[reg], n_registers);
+}
+
+static void write_holding_register(uint16_t reg, int16_t value)
+{
+	s_holding_registers[reg] = value;
+	s_response_length = modbus_get_write_holding_register_response(DEVICE_ADDRESS, s_response, reg, value);
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_response_length = modbus_write_exception(DEVICE_ADDRESS, s_response, exception_code, function_code);
+}
+
+#if defined(FOOTPRINT_STATIC_DISPATCH)
+
+struct Device
+{
+	static void read_holding_registers(uint16_t reg, uint16_t n_registers) { ::read_holding_registers(reg, n_registers); }
+	static void write_holding_register(uint16_t reg, int16_t value) { ::write_holding_register(reg, value); }
+	static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code) { ::exception_handler(function_code, exception_code); }
+};
+
+typedef modbus::RegisterMap<Device, modbus::HoldingRegisters<0, NUMBER_OF_HOLDING_REGISTERS, modbus::READ_WRITE> > DEVICE_MAP;
+
+#elif defined(FOOTPRINT_ROM_HANDLER)
+
+static const MODBUS_HANDLER s_modbus_handler MODBUS_ROM = {
+	{
+		NULL, NULL, NULL, NULL, NULL,
+		read_holding_registers,
+		write_holding_register,
+		NULL, NULL, NULL,
+		exception_handler,
+		NULL, NULL, NULL, NULL,
+		NULL, NULL, NULL
+	},
+	{
+		DEVICE_ADDRESS,
+		0, 0, 0, NUMBER_OF_HOLDING_REGISTERS,
+		NULL, s_write_holding_register_data_buffer,
+		NULL, 0,
+		NULL, NULL, NULL, NULL,
+		0, 0, 0, 0
+	},
+	true
+};
+
+#else
+
+static MODBUS_HANDLER s_modbus_handler;
+
+#endif
+
+#ifdef FOOTPRINT_TX_QUEUE
+static MODBUS_TX_QUEUE s_tx_queue;
+static void start_transmit(void *, uint8_t const *, uint16_t) {}
+#endif
+
+#ifdef FOOTPRINT_RESPONSE_CACHE
+static MODBUS_RESPONSE_CACHE s_response_cache;
+#endif
+
+#ifdef FOOTPRINT_DEFERRED
+static MODBUS_REQUEST_QUEUE s_request_queue;
+#endif
+
+int main()
+{
+	uint8_t frame[64];
+	int length = g_frame_length;
+
+	for (int i = 0; (i < length) && (i < (int)sizeof(frame)); i++) { frame[i] = g_frame[i]; }
+
+#if defined(FOOTPRINT_STATIC_DISPATCH)
+	modbus::service_message<DEVICE_MAP>(frame, DEVICE_ADDRESS, length, true);
+#elif defined(FOOTPRINT_ROM_HANDLER)
+	modbus_service_rom_message(frame, &s_modbus_handler, length, true);
+#else
+	s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+	s_modbus_handler.functions.write_holding_register = write_holding_register;
+	s_modbus_handler.functions.exception_handler = exception_handler;
+	s_modbus_handler.data.device_address = DEVICE_ADDRESS;
+	s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+	s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+
+#if defined(FOOTPRINT_DEFERRED)
+	modbus_request_queue_init(&s_request_queue);
+	modbus_defer_message(&s_request_queue, frame, DEVICE_ADDRESS, length, true);
+	while (modbus_service_deferred_message(&s_request_queue, s_modbus_handler, NULL)) {}
+#elif defined(FOOTPRINT_SPLIT)
+	MODBUS_SPLIT_FRAME split_frame;
+	modbus_get_ring_frame(frame, sizeof(frame), (uint16_t)g_frame[0], length, &split_frame);
+	modbus_service_split_message(&split_frame, s_modbus_handler, true);
+#else
+	modbus_service_message(frame, s_modbus_handler, length, true);
+#endif
+#endif
+
+#ifdef FOOTPRINT_STATISTICS
+	MODBUS_STATISTICS statistics;
+	modbus_get_statistics(&statistics);
+	g_frame[0] = (uint8_t)statistics.frames_seen;
+#endif
+
+#ifdef FOOTPRINT_RESPONSE_CACHE
+	modbus_response_cache_init(&s_response_cache, 1000);
+	modbus_response_cache_store(&s_response_cache, frame, length, s_response, s_response_length, 0);
+#endif
+
+#ifdef FOOTPRINT_TX_QUEUE
+	modbus_tx_queue_init(&s_tx_queue, start_transmit, NULL, NULL);
+	modbus_tx_queue_send(&s_tx_queue, s_response, s_response_length, NULL, NULL);
+#else
+	for (int i = 0; i < s_response_length; i++) { g_frame[i] = s_response[i]; }
+#endif
+
+	return 0;
+}
@@ -0,0 +1,317 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_posix_master.h"
+#include "modbus_posix_gateway.h"
+#include "modbus_simulator.h"
+
+static const MODBUS_ADDRESS_RANGE s_holding_register_ranges[] = {{0, 10}};
+
+static const uint16_t RESPONSE_TIMEOUT_MS = 50;
+
+/* A Modbus TCP client, collecting the ADUs the gateway sends back */
+struct client
+{
+	int fd;
+	uint8_t rx[2048];
+	int received;
+	uint8_t adus[32][MODBUS_TCP_MAX_ADU];
+	int n_adus;
+};
+
+static uint16_t get_uint16(uint8_t const * bytes)
+{
+	return (uint16_t)((bytes[0] << 8) | bytes[1]);
+}
+
+class ModbusGatewayTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusGatewayTest);
+
+	CPPUNIT_TEST(test_routes_units_to_their_lines);
+	CPPUNIT_TEST(test_unrouted_unit_is_path_unavailable);
+	CPPUNIT_TEST(test_silent_unit_is_target_no_response);
+	CPPUNIT_TEST(test_transaction_ids_return_to_their_connections);
+	CPPUNIT_TEST(test_full_line_queue_is_path_unavailable);
+	CPPUNIT_TEST(test_response_for_closed_connection_is_dropped);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	MODBUS_SIMULATOR m_simulator;
+	MODBUS_POSIX_MASTER m_master;
+	MODBUS_POSIX_GATEWAY m_gateway;
+	int m_line_fds[2];
+	client m_clients[2];
+
+	void connect_client(client& c)
+	{
+		c.fd = socket(AF_INET, SOCK_STREAM, 0);
+		CPPUNIT_ASSERT(c.fd >= 0);
+
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(modbus_posix_gateway_get_port(&m_gateway));
+		CPPUNIT_ASSERT_EQUAL(0, connect(c.fd, (struct sockaddr *)&address, sizeof(address)));
+
+		c.received = 0;
+		c.n_adus = 0;
+	}
+
+	/* Appends a read holding registers ADU to frames and returns its length */
+	static int put_read_request(uint8_t * frames, uint16_t transaction_id, uint8_t unit, uint16_t reg, uint16_t n)
+	{
+		int length = modbus_get_read_holding_registers_request(unit, &frames[MODBUS_MBAP_HEADER_SIZE - 1], reg, n, false);
+		modbus_write_mbap_header(frames, transaction_id, length - 1, unit);
+		return length + MODBUS_MBAP_HEADER_SIZE - 1;
+	}
+
+	void send_frames(client& c, uint8_t const * frames, int length)
+	{
+		CPPUNIT_ASSERT_EQUAL((ssize_t)length, send(c.fd, frames, length, 0));
+	}
+
+	void send_read_request(client& c, uint16_t transaction_id, uint8_t unit, uint16_t reg, uint16_t n)
+	{
+		uint8_t frame[MODBUS_TCP_MAX_ADU];
+		send_frames(c, frame, put_read_request(frame, transaction_id, unit, reg, n));
+	}
+
+	void collect(client& c)
+	{
+		ssize_t n;
+		while ((n = recv(c.fd, &c.rx[c.received], sizeof(c.rx) - c.received, MSG_DONTWAIT)) > 0) { c.received += n; }
+
+		while (c.received >= MODBUS_MBAP_HEADER_SIZE)
+		{
+			int total = get_uint16(&c.rx[4]) + MODBUS_MBAP_HEADER_SIZE - 1;
+			if (c.received < total) { break; }
+
+			memcpy(c.adus[c.n_adus++], c.rx, total);
+			memmove(c.rx, &c.rx[total], c.received - total);
+			c.received -= total;
+		}
+	}
+
+	/* Runs the gateway and simulator until each client has its expected responses */
+	void run_until(int expected_0, int expected_1 = 0)
+	{
+		for (int i = 0; i < 5000; i++)
+		{
+			modbus_posix_gateway_poll(&m_gateway, 1);
+			modbus_simulator_poll(&m_simulator, 0);
+
+			if (m_clients[0].fd >= 0) { collect(m_clients[0]); }
+			if (m_clients[1].fd >= 0) { collect(m_clients[1]); }
+
+			if ((m_clients[0].n_adus >= expected_0) && (m_clients[1].n_adus >= expected_1)) { break; }
+		}
+
+		CPPUNIT_ASSERT_EQUAL(expected_0, m_clients[0].n_adus);
+		CPPUNIT_ASSERT_EQUAL(expected_1, m_clients[1].n_adus);
+	}
+
+	void assert_exception(uint8_t const * adu, uint16_t transaction_id, uint8_t unit, MODBUS_EXCEPTION_CODES exception_code)
+	{
+		CPPUNIT_ASSERT_EQUAL(transaction_id, get_uint16(&adu[0]));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)3, get_uint16(&adu[4]));
+		CPPUNIT_ASSERT_EQUAL(unit, adu[6]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(READ_HOLDING_REGISTERS | 0x80), adu[7]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)exception_code, adu[8]);
+	}
+
+	void test_routes_units_to_their_lines()
+	{
+		*modbus_simulator_get_holding_register(&m_simulator, 0, 1, 2) = 0x0101;
+		*modbus_simulator_get_holding_register(&m_simulator, 1, 1, 2) = 0x7EEF;
+		*modbus_simulator_get_holding_register(&m_simulator, 0, 3, 2) = 0x7EEF;
+		*modbus_simulator_get_holding_register(&m_simulator, 1, 3, 2) = 0x0303;
+
+		connect_client(m_clients[0]);
+		send_read_request(m_clients[0], 0x1001, 1, 2, 1);
+		send_read_request(m_clients[0], 0x1003, 3, 2, 1);
+
+		run_until(2);
+
+		/* The lines run in parallel, so the responses may come back in either order */
+		for (int i = 0; i < 2; i++)
+		{
+			uint8_t const * adu = m_clients[0].adus[i];
+			uint8_t unit = adu[6];
+
+			CPPUNIT_ASSERT_EQUAL((uint16_t)(0x1000 + unit), get_uint16(&adu[0]));
+			CPPUNIT_ASSERT_EQUAL((uint16_t)0, get_uint16(&adu[2]));
+			CPPUNIT_ASSERT_EQUAL((uint16_t)5, get_uint16(&adu[4]));
+			CPPUNIT_ASSERT_EQUAL((uint8_t)READ_HOLDING_REGISTERS, adu[7]);
+			CPPUNIT_ASSERT_EQUAL((uint16_t)(0x0101 * unit), get_uint16(&adu[9]));
+		}
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)2, m_gateway.counters.responses);
+	}
+
+	void test_unrouted_unit_is_path_unavailable()
+	{
+		connect_client(m_clients[0]);
+		send_read_request(m_clients[0], 0x2222, 30, 0, 1);
+
+		run_until(1);
+
+		assert_exception(m_clients[0].adus[0], 0x2222, 30, EXCEPTION_GATEWAY_PATH_UNAVAILABLE);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1, m_gateway.counters.path_unavailable);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, m_simulator.counters.requests);
+	}
+
+	void test_silent_unit_is_target_no_response()
+	{
+		connect_client(m_clients[0]);
+		send_read_request(m_clients[0], 0x3333, 10, 0, 1);
+
+		run_until(1);
+
+		assert_exception(m_clients[0].adus[0], 0x3333, 10, EXCEPTION_GATEWAY_TGT_DEVICE_NO_RSP);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1, m_gateway.counters.target_no_response);
+	}
+
+	void test_transaction_ids_return_to_their_connections()
+	{
+		connect_client(m_clients[0]);
+		connect_client(m_clients[1]);
+
+		for (uint16_t i = 0; i < 3; i++)
+		{
+			send_read_request(m_clients[0], 0x0100 + i, 1, i, 1);
+			send_read_request(m_clients[1], 0x0200 + i, 1, i, 1);
+		}
+
+		run_until(3, 3);
+
+		for (int i = 0; i < 3; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL((uint16_t)(0x0100 + i), get_uint16(&m_clients[0].adus[i][0]));
+			CPPUNIT_ASSERT_EQUAL((uint16_t)(0x0200 + i), get_uint16(&m_clients[1].adus[i][0]));
+		}
+	}
+
+	void test_full_line_queue_is_path_unavailable()
+	{
+		static const int N_REQUESTS = 20;
+		static const int QUEUE_CAPACITY = MODBUS_POSIX_MASTER_QUEUE_SIZE;
+
+		uint8_t frames[N_REQUESTS * 12];
+		int length = 0;
+
+		connect_client(m_clients[0]);
+		for (int i = 0; i < N_REQUESTS; i++)
+		{
+			length += put_read_request(&frames[length], i, 1, 0, 1);
+		}
+		send_frames(m_clients[0], frames, length);
+
+		run_until(N_REQUESTS);
+
+		/* The requests that did not fit are refused straight away, ahead of the rest */
+		for (int i = 0; i < N_REQUESTS - QUEUE_CAPACITY; i++)
+		{
+			assert_exception(m_clients[0].adus[i], QUEUE_CAPACITY + i, 1, EXCEPTION_GATEWAY_PATH_UNAVAILABLE);
+		}
+
+		for (int i = 0; i < QUEUE_CAPACITY; i++)
+		{
+			uint8_t const * adu = m_clients[0].adus[N_REQUESTS - QUEUE_CAPACITY + i];
+			CPPUNIT_ASSERT_EQUAL((uint16_t)i, get_uint16(&adu[0]));
+			CPPUNIT_ASSERT_EQUAL((uint8_t)READ_HOLDING_REGISTERS, adu[7]);
+		}
+	}
+
+	void test_response_for_closed_connection_is_dropped()
+	{
+		connect_client(m_clients[0]);
+		send_read_request(m_clients[0], 0x4444, 10, 0, 1);
+
+		for (int i = 0; (i < 100) && (m_gateway.counters.requests == 0); i++)
+		{
+			modbus_posix_gateway_poll(&m_gateway, 1);
+		}
+
+		close(m_clients[0].fd);
+		m_clients[0].fd = -1;
+
+		for (int i = 0; (i < 5000) && (m_gateway.counters.orphaned == 0); i++)
+		{
+			modbus_posix_gateway_poll(&m_gateway, 1);
+			modbus_simulator_poll(&m_simulator, 0);
+		}
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1, m_gateway.counters.orphaned);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, m_gateway.counters.target_no_response);
+	}
+
+public:
+	void setUp()
+	{
+		MODBUS_SIMULATOR_CONFIG config;
+		memset(&config, 0, sizeof(config));
+		config.first_unit = 1;
+		config.last_unit = 4;
+		config.holding_register_ranges = s_holding_register_ranges;
+		config.num_holding_register_ranges = 1;
+
+		CPPUNIT_ASSERT(modbus_simulator_init(&m_simulator, &config));
+		CPPUNIT_ASSERT(modbus_posix_master_init(&m_master));
+
+		for (int line = 0; line < 2; line++)
+		{
+			CPPUNIT_ASSERT_EQUAL(line, modbus_simulator_add_pty_line(&m_simulator));
+			m_line_fds[line] = modbus_posix_open_serial(modbus_simulator_get_line_path(&m_simulator, line), 115200);
+			CPPUNIT_ASSERT(m_line_fds[line] >= 0);
+			CPPUNIT_ASSERT_EQUAL(line, modbus_posix_master_add_port(&m_master, m_line_fds[line], 115200, RESPONSE_TIMEOUT_MS, 2));
+		}
+
+		CPPUNIT_ASSERT(modbus_posix_gateway_init(&m_gateway, &m_master, 0));
+		CPPUNIT_ASSERT(modbus_posix_gateway_add_route(&m_gateway, 1, 2, 0));
+		CPPUNIT_ASSERT(modbus_posix_gateway_add_route(&m_gateway, 3, 4, 1));
+		CPPUNIT_ASSERT(modbus_posix_gateway_add_route(&m_gateway, 10, 20, 0));
+		CPPUNIT_ASSERT(!modbus_posix_gateway_add_route(&m_gateway, 21, 22, 2));
+
+		memset(m_clients, 0, sizeof(m_clients));
+		m_clients[0].fd = -1;
+		m_clients[1].fd = -1;
+	}
+
+	void tearDown()
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			if (m_clients[i].fd >= 0) { close(m_clients[i].fd); }
+			close(m_line_fds[i]);
+		}
+
+		modbus_posix_gateway_close(&m_gateway);
+		modbus_posix_master_close(&m_master);
+		modbus_simulator_close(&m_simulator);
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusGatewayTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
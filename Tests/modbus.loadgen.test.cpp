@@ -0,0 +1,335 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_posix_master.h"
+#include "modbus_simulator.h"
+#include "modbus_loadgen.h"
+
+static const MODBUS_ADDRESS_RANGE s_register_ranges[] = {{0, 10}};
+
+static const uint16_t RESPONSE_TIMEOUT_MS = 50;
+
+class ModbusLoadgenTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusLoadgenTest);
+
+	CPPUNIT_TEST(test_histogram_is_exact_for_small_values);
+	CPPUNIT_TEST(test_histogram_percentiles_within_precision);
+	CPPUNIT_TEST(test_closed_loop_pipelined_tcp);
+	CPPUNIT_TEST(test_exceptions_are_counted);
+	CPPUNIT_TEST(test_timeouts_are_counted);
+	CPPUNIT_TEST(test_open_loop_keeps_to_rate);
+	CPPUNIT_TEST(test_open_loop_latency_counts_from_schedule);
+	CPPUNIT_TEST(test_rtu_line);
+	CPPUNIT_TEST(test_unsupported_configuration_is_refused);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	MODBUS_SIMULATOR m_simulator;
+	MODBUS_POSIX_MASTER m_master;
+	MODBUS_LOADGEN m_loadgen;
+	MODBUS_LOADGEN_HISTOGRAM m_histogram;
+	int m_line_fd;
+
+	void start_simulator(uint32_t latency_us, uint16_t drop_rate)
+	{
+		MODBUS_SIMULATOR_CONFIG config;
+		memset(&config, 0, sizeof(config));
+		config.first_unit = 1;
+		config.last_unit = 1;
+		config.holding_register_ranges = s_register_ranges;
+		config.num_holding_register_ranges = 1;
+		config.input_register_ranges = s_register_ranges;
+		config.num_input_register_ranges = 1;
+		config.latency_us = latency_us;
+		config.drop_rate = drop_rate;
+		config.seed = 1;
+
+		CPPUNIT_ASSERT(modbus_simulator_init(&m_simulator, &config));
+		CPPUNIT_ASSERT_EQUAL(0, modbus_simulator_add_tcp_port(&m_simulator, 0));
+		CPPUNIT_ASSERT_EQUAL(1, modbus_simulator_add_pty_line(&m_simulator));
+
+		m_line_fd = modbus_posix_open_serial(modbus_simulator_get_line_path(&m_simulator, 1), 115200);
+		CPPUNIT_ASSERT(m_line_fd >= 0);
+		CPPUNIT_ASSERT_EQUAL(0, modbus_posix_master_add_port(&m_master, m_line_fd, 115200, RESPONSE_TIMEOUT_MS, 2));
+	}
+
+	static MODBUS_LOADGEN_CONFIG get_config()
+	{
+		MODBUS_LOADGEN_CONFIG config;
+		memset(&config, 0, sizeof(config));
+		config.unit_id = 1;
+		config.mix[0].function_code = READ_HOLDING_REGISTERS;
+		config.mix[0].weight = 1;
+		config.n_mix = 1;
+		config.first_register = 0;
+		config.n_registers = 10;
+		config.min_block = 1;
+		config.max_block = 1;
+		config.depth = 1;
+		config.timeout_ms = RESPONSE_TIMEOUT_MS;
+		config.seed = 1;
+		return config;
+	}
+
+	void add_tcp_connections(int n)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(i, modbus_loadgen_add_tcp(&m_loadgen, "127.0.0.1", modbus_simulator_get_tcp_port(&m_simulator, 0)));
+		}
+	}
+
+	void run()
+	{
+		for (int i = 0; (i < 1000000) && modbus_loadgen_poll(&m_loadgen, 1); i++)
+		{
+			modbus_simulator_poll(&m_simulator, 0);
+		}
+		CPPUNIT_ASSERT(!modbus_loadgen_poll(&m_loadgen, 0));
+	}
+
+	void test_histogram_is_exact_for_small_values()
+	{
+		for (uint64_t value = 0; value < 2 * MODBUS_LOADGEN_SUB_BUCKETS; value++)
+		{
+			modbus_loadgen_histogram_record(&m_histogram, value);
+		}
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)(MODBUS_LOADGEN_SUB_BUCKETS - 1), modbus_loadgen_histogram_get_percentile(&m_histogram, 50.0));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, modbus_loadgen_histogram_get_percentile(&m_histogram, 0.0));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)(2 * MODBUS_LOADGEN_SUB_BUCKETS - 1), modbus_loadgen_histogram_get_percentile(&m_histogram, 100.0));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, m_histogram.min);
+	}
+
+	void test_histogram_percentiles_within_precision()
+	{
+		for (uint64_t value = 1; value <= 100000; value++)
+		{
+			modbus_loadgen_histogram_record(&m_histogram, value);
+		}
+
+		double expected[] = {50000.0, 99000.0, 99900.0};
+		double percentiles[] = {50.0, 99.0, 99.9};
+
+		for (int i = 0; i < 3; i++)
+		{
+			double value = (double)modbus_loadgen_histogram_get_percentile(&m_histogram, percentiles[i]);
+			CPPUNIT_ASSERT(value >= expected[i]);
+			CPPUNIT_ASSERT(value <= expected[i] * (1.0 + (1.0 / MODBUS_LOADGEN_SUB_BUCKETS)));
+		}
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)100000, modbus_loadgen_histogram_get_percentile(&m_histogram, 100.0));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)100000, m_histogram.total);
+
+		/* Values beyond the range are clamped, not lost */
+		modbus_loadgen_histogram_record(&m_histogram, 0x100000000ULL);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0xFFFFFFFFUL, m_histogram.max);
+	}
+
+	void test_closed_loop_pipelined_tcp()
+	{
+		start_simulator(0, 0);
+
+		MODBUS_LOADGEN_CONFIG config = get_config();
+		config.mix[0].weight = 3;
+		config.mix[1].function_code = WRITE_HOLDING_REGISTERS;
+		config.mix[1].weight = 1;
+		config.n_mix = 2;
+		config.max_block = 5;
+		config.depth = 4;
+		config.max_requests = 200;
+
+		CPPUNIT_ASSERT(modbus_loadgen_init(&m_loadgen, &config, NULL));
+		add_tcp_connections(2);
+
+		run();
+
+		MODBUS_LOADGEN_RESULTS const& results = m_loadgen.results;
+		CPPUNIT_ASSERT_EQUAL((uint64_t)200, results.sent);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)200, results.responses);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, results.exceptions);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, results.timeouts);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, results.errors);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)200, results.latency.total);
+		CPPUNIT_ASSERT(results.elapsed_us > 0);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)200, m_simulator.counters.requests);
+	}
+
+	void test_exceptions_are_counted()
+	{
+		start_simulator(0, 0);
+
+		/* Past the end of the simulated registers */
+		MODBUS_LOADGEN_CONFIG config = get_config();
+		config.first_register = 10;
+		config.max_requests = 20;
+
+		CPPUNIT_ASSERT(modbus_loadgen_init(&m_loadgen, &config, NULL));
+		add_tcp_connections(1);
+
+		run();
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)20, m_loadgen.results.exceptions);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, m_loadgen.results.responses);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)20, m_loadgen.results.latency.total);
+	}
+
+	void test_timeouts_are_counted()
+	{
+		start_simulator(0, 0xFFFF);
+
+		MODBUS_LOADGEN_CONFIG config = get_config();
+		config.max_requests = 3;
+		config.depth = 3;
+
+		CPPUNIT_ASSERT(modbus_loadgen_init(&m_loadgen, &config, NULL));
+		add_tcp_connections(1);
+
+		run();
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)3, m_loadgen.results.timeouts);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, m_loadgen.results.latency.total);
+		CPPUNIT_ASSERT(m_loadgen.results.elapsed_us >= RESPONSE_TIMEOUT_MS * 1000);
+	}
+
+	void test_open_loop_keeps_to_rate()
+	{
+		start_simulator(0, 0);
+
+		MODBUS_LOADGEN_CONFIG config = get_config();
+		config.rate = 1000;
+		config.open_loop = true;
+		config.duration_ms = 100;
+		config.depth = 4;
+
+		CPPUNIT_ASSERT(modbus_loadgen_init(&m_loadgen, &config, NULL));
+		add_tcp_connections(1);
+
+		run();
+
+		CPPUNIT_ASSERT(m_loadgen.results.sent >= 95);
+		CPPUNIT_ASSERT(m_loadgen.results.sent <= 101);
+		CPPUNIT_ASSERT_EQUAL(m_loadgen.results.sent, m_loadgen.results.responses);
+		CPPUNIT_ASSERT(m_loadgen.results.elapsed_us >= 100000);
+	}
+
+	/*
+	 * A target answering every 20ms against a schedule of one request every 5ms falls
+	 * further behind with each request, and open loop latencies show it.
+	 */
+	void test_open_loop_latency_counts_from_schedule()
+	{
+		static const uint32_t LATENCY_US = 20000;
+
+		start_simulator(LATENCY_US, 0);
+
+		MODBUS_LOADGEN_CONFIG config = get_config();
+		config.rate = 200;
+		config.open_loop = true;
+		config.duration_ms = 100;
+		config.timeout_ms = 1000;
+
+		CPPUNIT_ASSERT(modbus_loadgen_init(&m_loadgen, &config, NULL));
+		add_tcp_connections(1);
+
+		run();
+
+		MODBUS_LOADGEN_HISTOGRAM const * latency = &m_loadgen.results.latency;
+		CPPUNIT_ASSERT(m_loadgen.results.responses >= 4);
+		CPPUNIT_ASSERT(latency->min >= LATENCY_US);
+		CPPUNIT_ASSERT(latency->max >= 3 * LATENCY_US);
+		CPPUNIT_ASSERT(modbus_loadgen_histogram_get_percentile(latency, 99.9) >= 3 * LATENCY_US);
+	}
+
+	void test_rtu_line()
+	{
+		start_simulator(0, 0);
+
+		MODBUS_LOADGEN_CONFIG config = get_config();
+		config.mix[1].function_code = WRITE_HOLDING_REGISTER;
+		config.mix[1].weight = 1;
+		config.n_mix = 2;
+		config.depth = 4;
+		config.max_requests = 20;
+
+		CPPUNIT_ASSERT(modbus_loadgen_init(&m_loadgen, &config, &m_master));
+		CPPUNIT_ASSERT_EQUAL(0, modbus_loadgen_add_rtu(&m_loadgen, 0));
+		CPPUNIT_ASSERT_EQUAL(-1, modbus_loadgen_add_rtu(&m_loadgen, 1));
+
+		run();
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)20, m_loadgen.results.responses);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, m_loadgen.results.errors);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)20, m_simulator.counters.requests);
+	}
+
+	void test_unsupported_configuration_is_refused()
+	{
+		start_simulator(0, 0);
+
+		MODBUS_LOADGEN_CONFIG config = get_config();
+		config.mix[0].function_code = READ_FIFO_QUEUE;
+		CPPUNIT_ASSERT(!modbus_loadgen_init(&m_loadgen, &config, NULL));
+
+		config = get_config();
+		config.open_loop = true;
+		CPPUNIT_ASSERT(!modbus_loadgen_init(&m_loadgen, &config, NULL));
+
+		config = get_config();
+		config.timeout_ms = 0;
+		CPPUNIT_ASSERT(!modbus_loadgen_init(&m_loadgen, &config, NULL));
+
+		config = get_config();
+		config.min_block = 4;
+		config.max_block = 2;
+		CPPUNIT_ASSERT(!modbus_loadgen_init(&m_loadgen, &config, NULL));
+
+		config = get_config();
+		CPPUNIT_ASSERT(modbus_loadgen_init(&m_loadgen, &config, NULL));
+		CPPUNIT_ASSERT_EQUAL(-1, modbus_loadgen_add_rtu(&m_loadgen, 0));
+	}
+
+public:
+	void setUp()
+	{
+		memset(&m_simulator, 0, sizeof(m_simulator));
+		memset(&m_loadgen, 0, sizeof(m_loadgen));
+		m_loadgen.epoll_fd = -1;
+		m_line_fd = -1;
+
+		modbus_loadgen_histogram_reset(&m_histogram);
+		CPPUNIT_ASSERT(modbus_posix_master_init(&m_master));
+	}
+
+	void tearDown()
+	{
+		modbus_loadgen_close(&m_loadgen);
+		modbus_posix_master_close(&m_master);
+		if (m_line_fd >= 0)
+		{
+			close(m_line_fd);
+			modbus_simulator_close(&m_simulator);
+		}
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusLoadgenTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
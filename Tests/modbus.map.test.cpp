@@ -0,0 +1,300 @@
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_server.h"
+#include "modbus_map.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+
+static uint8_t s_last_exception_function;
+static MODBUS_EXCEPTION_CODES s_last_exception_code;
+
+static struct _range_call { bool called; uint16_t first; uint16_t n; } s_read_holding_registers_data, s_read_coils_data;
+static struct _write_holding_registers_data { bool called; uint16_t first; uint16_t n; int16_t values[4]; } s_write_holding_registers_data;
+static struct _write_multiple_coils_data { bool called; uint16_t first; uint16_t n; bool values[10]; } s_write_multiple_coils_data;
+static struct _read_write_registers_data { bool called; uint16_t read_start; uint16_t n_read; uint16_t write_start; uint16_t n_write; int16_t value; } s_read_write_registers_data;
+static struct _diagnostics_data { bool called; uint16_t sub_function; uint16_t data; } s_diagnostics_data;
+
+struct TestDevice
+{
+	static void read_coils(uint16_t first_coil, uint16_t n_coils)
+	{
+		s_read_coils_data.called = true;
+		s_read_coils_data.first = first_coil;
+		s_read_coils_data.n = n_coils;
+	}
+
+	static void write_multiple_coils(uint16_t first_coil, uint16_t n_coils, bool * values)
+	{
+		s_write_multiple_coils_data.called = true;
+		s_write_multiple_coils_data.first = first_coil;
+		s_write_multiple_coils_data.n = n_coils;
+		for (uint16_t i = 0; (i < n_coils) && (i < 10); i++) { s_write_multiple_coils_data.values[i] = values[i]; }
+	}
+
+	static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+	{
+		s_read_holding_registers_data.called = true;
+		s_read_holding_registers_data.first = reg;
+		s_read_holding_registers_data.n = n_registers;
+	}
+
+	static void write_holding_registers(uint16_t first_reg, uint16_t n_registers, int16_t * values)
+	{
+		s_write_holding_registers_data.called = true;
+		s_write_holding_registers_data.first = first_reg;
+		s_write_holding_registers_data.n = n_registers;
+		for (uint16_t i = 0; (i < n_registers) && (i < 4); i++) { s_write_holding_registers_data.values[i] = values[i]; }
+	}
+
+	static void read_write_registers(uint16_t read_start_reg, uint16_t n_registers, uint16_t write_start_reg, uint16_t n_values, int16_t * values)
+	{
+		s_read_write_registers_data.called = true;
+		s_read_write_registers_data.read_start = read_start_reg;
+		s_read_write_registers_data.n_read = n_registers;
+		s_read_write_registers_data.write_start = write_start_reg;
+		s_read_write_registers_data.n_write = n_values;
+		s_read_write_registers_data.value = values[0];
+	}
+
+	static void diagnostics(uint16_t sub_function, uint16_t data)
+	{
+		s_diagnostics_data.called = true;
+		s_diagnostics_data.sub_function = sub_function;
+		s_diagnostics_data.data = data;
+	}
+
+	static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+	{
+		s_last_exception_function = function_code;
+		s_last_exception_code = exception_code;
+	}
+};
+
+typedef modbus::RegisterMap<TestDevice,
+	modbus::Coils<0, 16>,
+	modbus::HoldingRegisters<0, 8, modbus::READ_WRITE>,
+	modbus::HoldingRegisters<100, 2, modbus::READ_ONLY>,
+	modbus::HoldingRegisters<200, 4, modbus::WRITE_ONLY>
+> TEST_MAP;
+
+/* The dispatcher buffers are sized from the map, not the protocol maximum */
+static_assert(modbus::MapHandler<TEST_MAP>::register_buffer_size == 8, "Register buffer sized from the largest writable range");
+static_assert(modbus::MapHandler<TEST_MAP>::coil_buffer_size == 16, "Coil buffer sized from the largest writable range");
+static_assert(!TEST_MAP::lookup<modbus::INPUT_REGISTERS, modbus::READ_ONLY>::any, "No input register ranges");
+
+static void service(uint8_t const * message, int length)
+{
+	modbus::service_message<TEST_MAP>(message, TEST_ADDRESS, length, false);
+}
+
+class ModbusMapTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusMapTest);
+
+	CPPUNIT_TEST(test_map_read_holding_registers_in_range);
+	CPPUNIT_TEST(test_map_read_holding_registers_in_read_only_range);
+	CPPUNIT_TEST(test_map_read_spanning_ranges_is_illegal_address);
+	CPPUNIT_TEST(test_map_read_of_write_only_range_is_illegal_address);
+	CPPUNIT_TEST(test_map_write_to_read_only_range_is_illegal_address);
+	CPPUNIT_TEST(test_map_zero_quantity_is_illegal_value);
+	CPPUNIT_TEST(test_map_table_without_ranges_is_illegal_function);
+	CPPUNIT_TEST(test_map_function_missing_from_handler_is_illegal_function);
+	CPPUNIT_TEST(test_map_write_holding_registers_passes_values);
+	CPPUNIT_TEST(test_map_write_multiple_coils_unpacks_values);
+	CPPUNIT_TEST(test_map_read_write_registers_checks_both_ranges);
+	CPPUNIT_TEST(test_map_diagnostics_share_library_counters);
+	CPPUNIT_TEST(test_map_ignores_other_addresses);
+	CPPUNIT_TEST(test_map_reports_crc_failures);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_map_read_holding_registers_in_range()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_HOLDING_REGISTERS, 0x00, 0x02, 0x00, 0x06};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT(s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)2, s_read_holding_registers_data.first);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)6, s_read_holding_registers_data.n);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, s_last_exception_function);
+	}
+
+	void test_map_read_holding_registers_in_read_only_range()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_HOLDING_REGISTERS, 0x00, 100, 0x00, 0x02};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT(s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)100, s_read_holding_registers_data.first);
+	}
+
+	void test_map_read_spanning_ranges_is_illegal_address()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_HOLDING_REGISTERS, 0x00, 0x06, 0x00, 0x03};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT(!s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_HOLDING_REGISTERS), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+	void test_map_read_of_write_only_range_is_illegal_address()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_HOLDING_REGISTERS, 0x00, 200, 0x00, 0x01};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT(!s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+	void test_map_write_to_read_only_range_is_illegal_address()
+	{
+		uint8_t message[] = {TEST_ADDRESS, WRITE_HOLDING_REGISTERS, 0x00, 100, 0x00, 0x01, 0x02, 0x12, 0x34};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT(!s_write_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_HOLDING_REGISTERS), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+	void test_map_zero_quantity_is_illegal_value()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x00};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT(!s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, s_last_exception_code);
+	}
+
+	void test_map_table_without_ranges_is_illegal_function()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_INPUT_REGISTERS, 0x00, 0x00, 0x00, 0x01};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_INPUT_REGISTERS), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
+	}
+
+	void test_map_function_missing_from_handler_is_illegal_function()
+	{
+		/* Holding registers are writable but TestDevice has no write_holding_register */
+		uint8_t message[] = {TEST_ADDRESS, WRITE_HOLDING_REGISTER, 0x00, 0x01, 0x12, 0x34};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT_EQUAL((int)(128 + WRITE_HOLDING_REGISTER), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
+	}
+
+	void test_map_write_holding_registers_passes_values()
+	{
+		uint8_t message[] = {TEST_ADDRESS, WRITE_HOLDING_REGISTERS, 0x00, 200, 0x00, 0x02, 0x04, 0x12, 0x34, 0xFE, 0xDC};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT(s_write_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)200, s_write_holding_registers_data.first);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)2, s_write_holding_registers_data.n);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x1234, s_write_holding_registers_data.values[0]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0xFEDC, s_write_holding_registers_data.values[1]);
+	}
+
+	void test_map_write_multiple_coils_unpacks_values()
+	{
+		uint8_t message[] = {TEST_ADDRESS, WRITE_MULTIPLE_COILS, 0x00, 0x03, 0x00, 0x0A, 0x02, 0xCD, 0x01};
+		service(message, sizeof(message));
+
+		bool expected[10] = {true, false, true, true, false, false, true, true, true, false};
+
+		CPPUNIT_ASSERT(s_write_multiple_coils_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)3, s_write_multiple_coils_data.first);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)10, s_write_multiple_coils_data.n);
+		for (int i = 0; i < 10; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(expected[i], s_write_multiple_coils_data.values[i]);
+		}
+	}
+
+	void test_map_read_write_registers_checks_both_ranges()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_WRITE_REGISTERS, 0x00, 100, 0x00, 0x02, 0x00, 201, 0x00, 0x01, 0x02, 0x00, 0x2A};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT(s_read_write_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)100, s_read_write_registers_data.read_start);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)201, s_read_write_registers_data.write_start);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x2A, s_read_write_registers_data.value);
+
+		s_read_write_registers_data.called = false;
+		message[7] = 100;
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT(!s_read_write_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+	void test_map_diagnostics_share_library_counters()
+	{
+		uint8_t read[] = {TEST_ADDRESS, READ_COILS, 0x00, 0x00, 0x00, 0x10};
+		uint8_t query[] = {TEST_ADDRESS, DIAGNOSTICS, 0x00, DIAGNOSTICS_RETURN_SLAVE_MESSAGE_COUNT, 0x00, 0x00};
+
+		service(read, sizeof(read));
+		service(query, sizeof(query));
+
+		CPPUNIT_ASSERT(s_read_coils_data.called);
+		CPPUNIT_ASSERT(s_diagnostics_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)2, s_diagnostics_data.data);
+	}
+
+	void test_map_ignores_other_addresses()
+	{
+		uint8_t message[] = {0xAB, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x01};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT(!s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, s_last_exception_function);
+	}
+
+	void test_map_reports_crc_failures()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_COILS, 0x00, 0x00, 0x00, 0x01, 0x12, 0x34};
+		modbus::service_message<TEST_MAP>(message, TEST_ADDRESS, sizeof(message), true);
+
+		CPPUNIT_ASSERT(!s_read_coils_data.called);
+		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_COILS), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_INVALID_CRC, s_last_exception_code);
+	}
+
+public:
+	void setUp()
+	{
+		s_read_holding_registers_data.called = false;
+		s_read_coils_data.called = false;
+		s_write_holding_registers_data.called = false;
+		s_write_multiple_coils_data.called = false;
+		s_read_write_registers_data.called = false;
+		s_diagnostics_data.called = false;
+
+		s_last_exception_function = 0;
+		s_last_exception_code = (MODBUS_EXCEPTION_CODES)0xFF;
+
+		modbus_clear_diagnostic_counters();
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusMapTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
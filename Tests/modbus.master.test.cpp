@@ -0,0 +1,313 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_posix_master.h"
+
+static const int NUMBER_OF_LINES = 3;
+static const uint8_t SLAVE_ADDRESS = 0x11;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 32;
+
+/*
+ * Simulated slaves on the far end of pty pairs, serviced in the same loop as the
+ * master so the tests are deterministic.
+ */
+struct sim_line
+{
+	int fd;
+	uint8_t request[MODBUS_RTU_MAX_FRAME];
+	int received;
+	bool corrupt_crc;
+	int16_t registers[NUMBER_OF_HOLDING_REGISTERS];
+};
+
+static sim_line s_lines[NUMBER_OF_LINES];
+static sim_line * s_current_line;
+static uint8_t s_response[MODBUS_RTU_MAX_FRAME];
+static int s_response_length;
+
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+static MODBUS_HANDLER s_modbus_handler;
+
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	s_response_length = modbus_write_read_holding_registers_response(SLAVE_ADDRESS, s_response, &s_current_line->registers[reg], n_registers);
+}
+
+static void write_holding_register(uint16_t reg, int16_t value)
+{
+	s_current_line->registers[reg] = value;
+	s_response_length = modbus_get_write_holding_register_response(SLAVE_ADDRESS, s_response, reg, value);
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_response_length = modbus_write_exception(SLAVE_ADDRESS, s_response, exception_code, function_code);
+}
+
+static void sim_service(sim_line& line)
+{
+	uint8_t bytes[MODBUS_RTU_MAX_FRAME];
+	ssize_t n;
+
+	while ((n = read(line.fd, bytes, sizeof(bytes))) > 0)
+	{
+		memcpy(&line.request[line.received], bytes, n);
+		line.received += n;
+
+		int length = modbus_get_request_length(line.request, line.received);
+		if ((length <= 0) || (line.received < length)) { continue; }
+
+		s_current_line = &line;
+		s_response_length = 0;
+		modbus_service_message(line.request, s_modbus_handler, length, true);
+		line.received = 0;
+
+		if ((s_response_length > 0) && !modbus_last_message_was_broadcast())
+		{
+			if (line.corrupt_crc) { s_response[s_response_length - 1] ^= 0xFF; }
+			CPPUNIT_ASSERT_EQUAL((ssize_t)s_response_length, write(line.fd, s_response, s_response_length));
+		}
+	}
+}
+
+struct completion
+{
+	int port;
+	MODBUS_POSIX_MASTER_RESULT result;
+	uint8_t response[MODBUS_RTU_MAX_FRAME];
+	int response_length;
+	bool has_response;
+};
+
+static completion s_completions[64];
+static int s_n_completions;
+
+static void on_complete(int port, uint8_t const *, int, uint8_t const * response, int response_length, MODBUS_POSIX_MASTER_RESULT result, void *)
+{
+	completion& c = s_completions[s_n_completions++];
+	c.port = port;
+	c.result = result;
+	c.has_response = (response != NULL);
+	c.response_length = response_length;
+	if (response) { memcpy(c.response, response, response_length); }
+}
+
+class ModbusMasterTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusMasterTest);
+
+	CPPUNIT_TEST(test_turnaround_from_baud_rate);
+	CPPUNIT_TEST(test_reads_on_every_port);
+	CPPUNIT_TEST(test_requests_on_one_port_run_in_order);
+	CPPUNIT_TEST(test_unanswered_request_times_out_and_queue_continues);
+	CPPUNIT_TEST(test_corrupted_response_fails_crc);
+	CPPUNIT_TEST(test_exception_response_is_returned);
+	CPPUNIT_TEST(test_broadcast_completes_without_response);
+	CPPUNIT_TEST(test_queue_full);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	MODBUS_POSIX_MASTER m_master;
+	int m_master_fds[NUMBER_OF_LINES];
+
+	void run_until_idle()
+	{
+		for (int i = 0; (i < 2000) && !modbus_posix_master_idle(&m_master); i++)
+		{
+			modbus_posix_master_poll(&m_master, 1);
+			for (int l = 0; l < NUMBER_OF_LINES; l++) { sim_service(s_lines[l]); }
+		}
+		CPPUNIT_ASSERT(modbus_posix_master_idle(&m_master));
+	}
+
+	void queue_read(int port, uint8_t address, uint16_t reg, uint16_t n)
+	{
+		uint8_t request[8];
+		int length = modbus_get_read_holding_registers_request(address, request, reg, n);
+		CPPUNIT_ASSERT(modbus_posix_master_queue(&m_master, port, request, length, on_complete, NULL));
+	}
+
+	void queue_write(int port, uint8_t address, uint16_t reg, int16_t value)
+	{
+		uint8_t request[8];
+		int length = modbus_get_write_holding_register_request(address, request, reg, value);
+		CPPUNIT_ASSERT(modbus_posix_master_queue(&m_master, port, request, length, on_complete, NULL));
+	}
+
+	void test_turnaround_from_baud_rate()
+	{
+		CPPUNIT_ASSERT_EQUAL((uint32_t)4011, modbus_posix_get_turnaround_us(9600));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)2006, modbus_posix_get_turnaround_us(19200));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1750, modbus_posix_get_turnaround_us(115200));
+	}
+
+	void test_reads_on_every_port()
+	{
+		for (int l = 0; l < NUMBER_OF_LINES; l++)
+		{
+			s_lines[l].registers[4] = (int16_t)(0x100 * (l + 1));
+			queue_read(l, SLAVE_ADDRESS, 4, 2);
+		}
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(NUMBER_OF_LINES, s_n_completions);
+		for (int i = 0; i < s_n_completions; i++)
+		{
+			completion& c = s_completions[i];
+			CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_OK, c.result);
+			CPPUNIT_ASSERT_EQUAL(9, c.response_length);
+			CPPUNIT_ASSERT_EQUAL((uint8_t)(c.port + 1), c.response[3]);
+			CPPUNIT_ASSERT_EQUAL((uint8_t)0, c.response[4]);
+		}
+	}
+
+	void test_requests_on_one_port_run_in_order()
+	{
+		queue_write(1, SLAVE_ADDRESS, 7, 0x1234);
+		queue_read(1, SLAVE_ADDRESS, 7, 1);
+		queue_write(1, SLAVE_ADDRESS, 7, 0x5678);
+		queue_read(1, SLAVE_ADDRESS, 7, 1);
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(4, s_n_completions);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x12, s_completions[1].response[3]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x34, s_completions[1].response[4]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x56, s_completions[3].response[3]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x78, s_completions[3].response[4]);
+	}
+
+	void test_unanswered_request_times_out_and_queue_continues()
+	{
+		queue_read(0, SLAVE_ADDRESS + 1, 0, 1);
+		queue_read(0, SLAVE_ADDRESS, 0, 1);
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(2, s_n_completions);
+		CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_TIMEOUT, s_completions[0].result);
+		CPPUNIT_ASSERT(!s_completions[0].has_response);
+		CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_OK, s_completions[1].result);
+	}
+
+	void test_corrupted_response_fails_crc()
+	{
+		s_lines[2].corrupt_crc = true;
+		queue_read(2, SLAVE_ADDRESS, 0, 1);
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(1, s_n_completions);
+		CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_CRC_FAILED, s_completions[0].result);
+	}
+
+	void test_exception_response_is_returned()
+	{
+		queue_read(0, SLAVE_ADDRESS, NUMBER_OF_HOLDING_REGISTERS, 1);
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(1, s_n_completions);
+		CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_OK, s_completions[0].result);
+		CPPUNIT_ASSERT_EQUAL(5, s_completions[0].response_length);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(READ_HOLDING_REGISTERS + 128), s_completions[0].response[1]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)EXCEPTION_ILLEGAL_DATA_ADDRESS, s_completions[0].response[2]);
+	}
+
+	void test_broadcast_completes_without_response()
+	{
+		queue_write(1, MODBUS_BROADCAST_ADDRESS, 3, 0x0BCD);
+		queue_read(1, SLAVE_ADDRESS, 3, 1);
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(2, s_n_completions);
+		CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_OK, s_completions[0].result);
+		CPPUNIT_ASSERT(!s_completions[0].has_response);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0BCD, s_lines[1].registers[3]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x0B, s_completions[1].response[3]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0xCD, s_completions[1].response[4]);
+	}
+
+	void test_queue_full()
+	{
+		uint8_t request[8];
+		int length = modbus_get_read_holding_registers_request(SLAVE_ADDRESS, request, 0, 1);
+
+		for (int i = 0; i < MODBUS_POSIX_MASTER_QUEUE_SIZE; i++)
+		{
+			CPPUNIT_ASSERT(modbus_posix_master_queue(&m_master, 0, request, length, on_complete, NULL));
+		}
+		CPPUNIT_ASSERT(!modbus_posix_master_queue(&m_master, 0, request, length, on_complete, NULL));
+		CPPUNIT_ASSERT(!modbus_posix_master_queue(&m_master, NUMBER_OF_LINES, request, length, on_complete, NULL));
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(MODBUS_POSIX_MASTER_QUEUE_SIZE, s_n_completions);
+	}
+
+public:
+	void setUp()
+	{
+		memset(&s_modbus_handler, 0, sizeof(s_modbus_handler));
+		s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+		s_modbus_handler.functions.write_holding_register = write_holding_register;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+		s_modbus_handler.data.device_address = SLAVE_ADDRESS;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+		s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+
+		CPPUNIT_ASSERT(modbus_posix_master_init(&m_master));
+
+		for (int l = 0; l < NUMBER_OF_LINES; l++)
+		{
+			memset(&s_lines[l], 0, sizeof(s_lines[l]));
+
+			s_lines[l].fd = posix_openpt(O_RDWR | O_NOCTTY);
+			CPPUNIT_ASSERT(s_lines[l].fd >= 0);
+			CPPUNIT_ASSERT_EQUAL(0, grantpt(s_lines[l].fd));
+			CPPUNIT_ASSERT_EQUAL(0, unlockpt(s_lines[l].fd));
+			fcntl(s_lines[l].fd, F_SETFL, fcntl(s_lines[l].fd, F_GETFL) | O_NONBLOCK);
+
+			m_master_fds[l] = modbus_posix_open_serial(ptsname(s_lines[l].fd), 9600);
+			CPPUNIT_ASSERT(m_master_fds[l] >= 0);
+			CPPUNIT_ASSERT_EQUAL(l, modbus_posix_master_add_port(&m_master, m_master_fds[l], 9600, 50, 5));
+		}
+
+		s_n_completions = 0;
+	}
+
+	void tearDown()
+	{
+		modbus_posix_master_close(&m_master);
+
+		for (int l = 0; l < NUMBER_OF_LINES; l++)
+		{
+			close(m_master_fds[l]);
+			close(s_lines[l].fd);
+		}
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusMasterTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+/* Built with only FC3 and FC6 enabled, see target_cppdefines in SConstruct */
+#if MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTERS || MODBUS_ENABLE_FC_DIAGNOSTICS || !MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS
+#error "modbus.minimal expects a build with only read holding registers and write holding register enabled"
+#endif
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 16;
+
+static int16_t s_holding_registers[NUMBER_OF_HOLDING_REGISTERS];
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+static bool s_write_coil_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+
+static MODBUS_HANDLER s_modbus_handler;
+
+static uint8_t s_response[64];
+static int s_response_length;
+static bool s_other_handler_called;
+static uint8_t s_last_exception_function;
+static MODBUS_EXCEPTION_CODES s_last_exception_code;
+
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	s_response_length = modbus_write_read_holding_registers_response(TEST_ADDRESS, s_response, &s_holding_registers[reg], n_registers);
+}
+
+static void write_holding_register(uint16_t reg, int16_t value)
+{
+	s_holding_registers[reg] = value;
+	s_response_length = modbus_get_write_holding_register_response(TEST_ADDRESS, s_response, reg, value);
+}
+
+static void read_coils(uint16_t, uint16_t) { s_other_handler_called = true; }
+static void write_holding_registers(uint16_t, uint16_t, int16_t *) { s_other_handler_called = true; }
+static void diagnostics(uint16_t, uint16_t) { s_other_handler_called = true; }
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_last_exception_function = function_code;
+	s_last_exception_code = exception_code;
+}
+
+class ModbusMinimalTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusMinimalTest);
+
+	CPPUNIT_TEST(test_read_holding_registers);
+	CPPUNIT_TEST(test_write_holding_register);
+	CPPUNIT_TEST(test_disabled_function_codes_are_illegal);
+	CPPUNIT_TEST(test_disabled_function_code_still_validates_crc);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_read_holding_registers()
+	{
+		uint8_t message[8];
+		int length = modbus_get_read_holding_registers_request(TEST_ADDRESS, message, 2, 2);
+		s_holding_registers[2] = 0x1234;
+		s_holding_registers[3] = 0x5678;
+
+		modbus_service_message(message, s_modbus_handler, length, true);
+
+		CPPUNIT_ASSERT_EQUAL(9, s_response_length);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x12, s_response[3]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x78, s_response[6]);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, s_last_exception_code);
+	}
+
+	void test_write_holding_register()
+	{
+		uint8_t message[8];
+		int length = modbus_get_write_holding_register_request(TEST_ADDRESS, message, 5, 0x0102);
+
+		modbus_service_message(message, s_modbus_handler, length, true);
+
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0102, s_holding_registers[5]);
+		CPPUNIT_ASSERT_EQUAL(8, s_response_length);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, s_last_exception_code);
+	}
+
+	void assert_illegal_function(uint8_t const * message, int length)
+	{
+		s_last_exception_code = EXCEPTION_NONE;
+
+		modbus_service_message(message, s_modbus_handler, length, false);
+
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(message[1] + 128), s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
+		CPPUNIT_ASSERT(!s_other_handler_called);
+	}
+
+	void test_disabled_function_codes_are_illegal()
+	{
+		uint8_t message[16];
+		int16_t values[] = {1, 2};
+		uint8_t diagnostics_request[] = {TEST_ADDRESS, DIAGNOSTICS, 0x00, 0x00, 0x12, 0x34};
+
+		assert_illegal_function(message, modbus_get_read_coils_request(TEST_ADDRESS, message, 0, 1, false));
+		assert_illegal_function(message, modbus_write_write_holding_registers_request(TEST_ADDRESS, message, 0, 2, values, false));
+		assert_illegal_function(diagnostics_request, sizeof(diagnostics_request));
+	}
+
+	void test_disabled_function_code_still_validates_crc()
+	{
+		uint8_t message[8];
+		int length = modbus_get_read_coils_request(TEST_ADDRESS, message, 0, 1);
+		message[length - 1] ^= 0x01;
+
+		modbus_service_message(message, s_modbus_handler, length, true);
+
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_INVALID_CRC, s_last_exception_code);
+	}
+
+public:
+	void setUp()
+	{
+		memset(&s_modbus_handler, 0, sizeof(s_modbus_handler));
+		memset(s_holding_registers, 0, sizeof(s_holding_registers));
+
+		s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+		s_modbus_handler.functions.write_holding_register = write_holding_register;
+		s_modbus_handler.functions.read_coils = read_coils;
+		s_modbus_handler.functions.write_holding_registers = write_holding_registers;
+		s_modbus_handler.functions.diagnostics = diagnostics;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+
+		s_modbus_handler.data.device_address = TEST_ADDRESS;
+		s_modbus_handler.data.num_coils = NUMBER_OF_HOLDING_REGISTERS;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+		s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+		s_modbus_handler.data.write_multiple_coils = s_write_coil_data_buffer;
+
+		s_response_length = 0;
+		s_other_handler_called = false;
+		s_last_exception_function = 0;
+		s_last_exception_code = EXCEPTION_NONE;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusMinimalTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
@@ -0,0 +1,305 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_posix_master.h"
+
+static const uint8_t SLAVE_ADDRESS = 0x11;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 16;
+
+/* One simulated slave on the far end of a pty, serviced in the same loop as the master */
+static int s_line_fd;
+static uint8_t s_request[MODBUS_RTU_MAX_FRAME];
+static int s_received;
+static int16_t s_registers[NUMBER_OF_HOLDING_REGISTERS];
+static uint8_t s_response[MODBUS_RTU_MAX_FRAME];
+static int s_response_length;
+
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+static MODBUS_HANDLER s_modbus_handler;
+
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	s_response_length = modbus_write_read_holding_registers_response(SLAVE_ADDRESS, s_response, &s_registers[reg], n_registers);
+}
+
+static void write_holding_register(uint16_t reg, int16_t value)
+{
+	s_registers[reg] = value;
+	s_response_length = modbus_get_write_holding_register_response(SLAVE_ADDRESS, s_response, reg, value);
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_response_length = modbus_write_exception(SLAVE_ADDRESS, s_response, exception_code, function_code);
+}
+
+static void sim_service()
+{
+	uint8_t bytes[MODBUS_RTU_MAX_FRAME];
+	ssize_t n;
+
+	while ((n = read(s_line_fd, bytes, sizeof(bytes))) > 0)
+	{
+		memcpy(&s_request[s_received], bytes, n);
+		s_received += n;
+
+		int length = modbus_get_request_length(s_request, s_received);
+		if ((length <= 0) || (s_received < length)) { continue; }
+
+		s_response_length = 0;
+		modbus_service_message(s_request, s_modbus_handler, length, true);
+		s_received = 0;
+
+		if (s_response_length > 0)
+		{
+			CPPUNIT_ASSERT_EQUAL((ssize_t)s_response_length, write(s_line_fd, s_response, s_response_length));
+		}
+	}
+}
+
+/* The function code and the value read or written, in completion order */
+struct completion
+{
+	uint8_t function_code;
+	int16_t value;
+};
+
+static completion s_completions[32];
+static int s_n_completions;
+
+static void on_complete(int, uint8_t const * request, int, uint8_t const * response, int, MODBUS_POSIX_MASTER_RESULT result, void *)
+{
+	CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_OK, result);
+
+	completion& c = s_completions[s_n_completions++];
+	c.function_code = request[1];
+	c.value = (request[1] == READ_HOLDING_REGISTERS) ? (int16_t)((response[3] << 8) | response[4]) : (int16_t)((request[4] << 8) | request[5]);
+}
+
+class ModbusPriorityTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusPriorityTest);
+
+	CPPUNIT_TEST(test_priority_from_function_code);
+	CPPUNIT_TEST(test_control_write_overtakes_background_polls);
+	CPPUNIT_TEST(test_classes_run_in_order_and_fifo_within_class);
+	CPPUNIT_TEST(test_aged_background_poll_goes_before_later_write);
+	CPPUNIT_TEST(test_no_aging_is_strict);
+	CPPUNIT_TEST(test_queueing_delay_per_class);
+	CPPUNIT_TEST(test_queue_is_shared_by_all_classes);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	MODBUS_POSIX_MASTER m_master;
+	int m_master_fd;
+
+	void run_until_idle()
+	{
+		for (int i = 0; (i < 5000) && !modbus_posix_master_idle(&m_master); i++)
+		{
+			modbus_posix_master_poll(&m_master, 1);
+			sim_service();
+		}
+		CPPUNIT_ASSERT(modbus_posix_master_idle(&m_master));
+	}
+
+	void queue_read(MODBUS_POSIX_MASTER_PRIORITY priority, uint16_t reg)
+	{
+		uint8_t request[8];
+		int length = modbus_get_read_holding_registers_request(SLAVE_ADDRESS, request, reg, 1);
+		CPPUNIT_ASSERT(modbus_posix_master_queue_priority(&m_master, 0, priority, request, length, on_complete, NULL));
+	}
+
+	void queue_write(MODBUS_POSIX_MASTER_PRIORITY priority, uint16_t reg, int16_t value)
+	{
+		uint8_t request[8];
+		int length = modbus_get_write_holding_register_request(SLAVE_ADDRESS, request, reg, value);
+		CPPUNIT_ASSERT(modbus_posix_master_queue_priority(&m_master, 0, priority, request, length, on_complete, NULL));
+	}
+
+	void test_priority_from_function_code()
+	{
+		uint8_t request[8];
+
+		modbus_get_write_holding_register_request(SLAVE_ADDRESS, request, 0, 1);
+		CPPUNIT_ASSERT_EQUAL(MASTER_PRIORITY_CONTROL, modbus_posix_master_get_priority(request));
+
+		modbus_get_read_holding_registers_request(SLAVE_ADDRESS, request, 0, 1);
+		CPPUNIT_ASSERT_EQUAL(MASTER_PRIORITY_INTERACTIVE, modbus_posix_master_get_priority(request));
+
+		request[1] = WRITE_MULTIPLE_COILS;
+		CPPUNIT_ASSERT_EQUAL(MASTER_PRIORITY_CONTROL, modbus_posix_master_get_priority(request));
+		request[1] = MASK_WRITE_REGISTER;
+		CPPUNIT_ASSERT_EQUAL(MASTER_PRIORITY_CONTROL, modbus_posix_master_get_priority(request));
+		request[1] = READ_COILS;
+		CPPUNIT_ASSERT_EQUAL(MASTER_PRIORITY_INTERACTIVE, modbus_posix_master_get_priority(request));
+	}
+
+	void test_control_write_overtakes_background_polls()
+	{
+		for (int i = 0; i < 5; i++)
+		{
+			queue_read(MASTER_PRIORITY_BACKGROUND, 2);
+		}
+		queue_write(MASTER_PRIORITY_CONTROL, 2, 0x55);
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(6, s_n_completions);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)WRITE_HOLDING_REGISTER, s_completions[0].function_code);
+		for (int i = 1; i < 6; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL((int16_t)0x55, s_completions[i].value);
+		}
+	}
+
+	void test_classes_run_in_order_and_fifo_within_class()
+	{
+		s_registers[0] = 10;
+		s_registers[1] = 11;
+		s_registers[2] = 12;
+		s_registers[3] = 13;
+
+		queue_read(MASTER_PRIORITY_BACKGROUND, 0);
+		queue_read(MASTER_PRIORITY_INTERACTIVE, 1);
+		queue_read(MASTER_PRIORITY_BACKGROUND, 2);
+		queue_read(MASTER_PRIORITY_INTERACTIVE, 3);
+
+		run_until_idle();
+
+		int16_t expected[] = {11, 13, 10, 12};
+		CPPUNIT_ASSERT_EQUAL(4, s_n_completions);
+		for (int i = 0; i < 4; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(expected[i], s_completions[i].value);
+		}
+	}
+
+	void test_aged_background_poll_goes_before_later_write()
+	{
+		CPPUNIT_ASSERT(modbus_posix_master_set_aging(&m_master, 0, 5));
+
+		/* Ranked 10ms after it was queued, ahead of a write queued 30ms later */
+		queue_read(MASTER_PRIORITY_BACKGROUND, 4);
+		usleep(30000);
+		queue_write(MASTER_PRIORITY_CONTROL, 4, 0x77);
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(2, s_n_completions);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)READ_HOLDING_REGISTERS, s_completions[0].function_code);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0, s_completions[0].value);
+	}
+
+	void test_no_aging_is_strict()
+	{
+		CPPUNIT_ASSERT(modbus_posix_master_set_aging(&m_master, 0, 0));
+		CPPUNIT_ASSERT(!modbus_posix_master_set_aging(&m_master, 1, 0));
+
+		queue_read(MASTER_PRIORITY_BACKGROUND, 4);
+		usleep(30000);
+		queue_write(MASTER_PRIORITY_CONTROL, 4, 0x77);
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(2, s_n_completions);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)WRITE_HOLDING_REGISTER, s_completions[0].function_code);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x77, s_completions[1].value);
+	}
+
+	void test_queueing_delay_per_class()
+	{
+		MODBUS_POSIX_MASTER_QUEUE_STATS const * stats = m_master.ports[0].stats;
+
+		queue_write(MASTER_PRIORITY_CONTROL, 0, 1);
+		queue_read(MASTER_PRIORITY_BACKGROUND, 0);
+		queue_read(MASTER_PRIORITY_BACKGROUND, 0);
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1, stats[MASTER_PRIORITY_CONTROL].requests);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, stats[MASTER_PRIORITY_INTERACTIVE].requests);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)2, stats[MASTER_PRIORITY_BACKGROUND].requests);
+
+		/* The last poll waited for two exchanges and their turnarounds */
+		uint64_t turnaround_us = modbus_posix_get_turnaround_us(9600);
+		CPPUNIT_ASSERT(stats[MASTER_PRIORITY_BACKGROUND].max_wait_us >= 2 * turnaround_us);
+		CPPUNIT_ASSERT(stats[MASTER_PRIORITY_BACKGROUND].max_wait_us > stats[MASTER_PRIORITY_CONTROL].max_wait_us);
+		CPPUNIT_ASSERT(stats[MASTER_PRIORITY_BACKGROUND].total_wait_us >= stats[MASTER_PRIORITY_BACKGROUND].max_wait_us);
+	}
+
+	void test_queue_is_shared_by_all_classes()
+	{
+		uint8_t request[8];
+		int length = modbus_get_read_holding_registers_request(SLAVE_ADDRESS, request, 0, 1);
+
+		for (int i = 0; i < MODBUS_POSIX_MASTER_QUEUE_SIZE; i++)
+		{
+			MODBUS_POSIX_MASTER_PRIORITY priority = (MODBUS_POSIX_MASTER_PRIORITY)(i % MASTER_PRIORITY_CLASSES);
+			CPPUNIT_ASSERT(modbus_posix_master_queue_priority(&m_master, 0, priority, request, length, on_complete, NULL));
+		}
+		CPPUNIT_ASSERT(!modbus_posix_master_queue_priority(&m_master, 0, MASTER_PRIORITY_CONTROL, request, length, on_complete, NULL));
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(MODBUS_POSIX_MASTER_QUEUE_SIZE, s_n_completions);
+		CPPUNIT_ASSERT(!modbus_posix_master_queue_priority(&m_master, 0, MASTER_PRIORITY_CLASSES, request, length, on_complete, NULL));
+	}
+
+public:
+	void setUp()
+	{
+		memset(&s_modbus_handler, 0, sizeof(s_modbus_handler));
+		s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+		s_modbus_handler.functions.write_holding_register = write_holding_register;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+		s_modbus_handler.data.device_address = SLAVE_ADDRESS;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+		s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+
+		memset(s_registers, 0, sizeof(s_registers));
+		s_received = 0;
+		s_n_completions = 0;
+
+		CPPUNIT_ASSERT(modbus_posix_master_init(&m_master));
+
+		s_line_fd = posix_openpt(O_RDWR | O_NOCTTY);
+		CPPUNIT_ASSERT(s_line_fd >= 0);
+		CPPUNIT_ASSERT_EQUAL(0, grantpt(s_line_fd));
+		CPPUNIT_ASSERT_EQUAL(0, unlockpt(s_line_fd));
+		fcntl(s_line_fd, F_SETFL, fcntl(s_line_fd, F_GETFL) | O_NONBLOCK);
+
+		m_master_fd = modbus_posix_open_serial(ptsname(s_line_fd), 9600);
+		CPPUNIT_ASSERT(m_master_fd >= 0);
+		CPPUNIT_ASSERT_EQUAL(0, modbus_posix_master_add_port(&m_master, m_master_fd, 9600, 50, 5));
+	}
+
+	void tearDown()
+	{
+		modbus_posix_master_close(&m_master);
+		close(m_master_fd);
+		close(s_line_fd);
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusPriorityTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
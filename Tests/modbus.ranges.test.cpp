@@ -0,0 +1,169 @@
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const MODBUS_ADDRESS_RANGE s_holding_register_ranges[] = {
+	{0, 10},
+	{1000, 20},
+	{4000, 4},
+	{40000, 100},
+	{65530, 6}
+};
+static const uint8_t NUMBER_OF_HOLDING_REGISTER_RANGES = sizeof(s_holding_register_ranges) / sizeof(s_holding_register_ranges[0]);
+
+static int16_t s_write_holding_register_data_buffer[125];
+
+static MODBUS_HANDLER s_modbus_handler;
+
+static uint8_t s_last_exception_function;
+static MODBUS_EXCEPTION_CODES s_last_exception_code;
+
+static struct _read_holding_registers_data { bool called; uint16_t reg; uint16_t n_registers; } s_read_holding_registers_data;
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	s_read_holding_registers_data.called = true;
+	s_read_holding_registers_data.reg = reg;
+	s_read_holding_registers_data.n_registers = n_registers;
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_last_exception_function = function_code;
+	s_last_exception_code = exception_code;
+}
+
+static void service_read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	uint8_t message[] = {0xAA, READ_HOLDING_REGISTERS, (uint8_t)(reg >> 8), (uint8_t)(reg & 0xFF), (uint8_t)(n_registers >> 8), (uint8_t)(n_registers & 0xFF)};
+	modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+}
+
+class ModbusRangesTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusRangesTest);
+
+	CPPUNIT_TEST(test_find_address_range_returns_index_of_containing_range);
+	CPPUNIT_TEST(test_find_address_range_returns_minus_one_in_gaps);
+	CPPUNIT_TEST(test_find_address_range_with_no_ranges);
+	CPPUNIT_TEST(test_address_ranges_contain_requests_within_one_range);
+	CPPUNIT_TEST(test_address_ranges_reject_requests_spanning_a_gap);
+	CPPUNIT_TEST(test_address_ranges_reject_requests_wrapping_the_address_space);
+	CPPUNIT_TEST(test_service_with_sparse_holding_registers);
+	CPPUNIT_TEST(test_service_with_sparse_holding_registers_spanning_gap_is_illegal_address);
+	CPPUNIT_TEST(test_service_without_ranges_uses_dense_table);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_find_address_range_returns_index_of_containing_range()
+	{
+		CPPUNIT_ASSERT_EQUAL(0, modbus_find_address_range(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 0));
+		CPPUNIT_ASSERT_EQUAL(0, modbus_find_address_range(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 9));
+		CPPUNIT_ASSERT_EQUAL(1, modbus_find_address_range(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 1019));
+		CPPUNIT_ASSERT_EQUAL(2, modbus_find_address_range(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 4000));
+		CPPUNIT_ASSERT_EQUAL(3, modbus_find_address_range(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 40050));
+		CPPUNIT_ASSERT_EQUAL(4, modbus_find_address_range(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 65535));
+	}
+
+	void test_find_address_range_returns_minus_one_in_gaps()
+	{
+		CPPUNIT_ASSERT_EQUAL(-1, modbus_find_address_range(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 10));
+		CPPUNIT_ASSERT_EQUAL(-1, modbus_find_address_range(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 999));
+		CPPUNIT_ASSERT_EQUAL(-1, modbus_find_address_range(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 4004));
+		CPPUNIT_ASSERT_EQUAL(-1, modbus_find_address_range(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 65529));
+		CPPUNIT_ASSERT_EQUAL(-1, modbus_find_address_range(s_holding_register_ranges + 1, NUMBER_OF_HOLDING_REGISTER_RANGES - 1, 0));
+	}
+
+	void test_find_address_range_with_no_ranges()
+	{
+		CPPUNIT_ASSERT_EQUAL(-1, modbus_find_address_range(NULL, 0, 0));
+		CPPUNIT_ASSERT_EQUAL(-1, modbus_find_address_range(s_holding_register_ranges, 0, 0));
+	}
+
+	void test_address_ranges_contain_requests_within_one_range()
+	{
+		CPPUNIT_ASSERT(modbus_address_ranges_contain(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 1000, 20));
+		CPPUNIT_ASSERT(modbus_address_ranges_contain(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 4001, 3));
+		CPPUNIT_ASSERT(!modbus_address_ranges_contain(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 4001, 4));
+		CPPUNIT_ASSERT(!modbus_address_ranges_contain(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 1000, 0));
+	}
+
+	void test_address_ranges_reject_requests_spanning_a_gap()
+	{
+		CPPUNIT_ASSERT(!modbus_address_ranges_contain(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 5, 1000));
+		CPPUNIT_ASSERT(!modbus_address_ranges_contain(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 1019, 2));
+	}
+
+	void test_address_ranges_reject_requests_wrapping_the_address_space()
+	{
+		CPPUNIT_ASSERT(modbus_address_ranges_contain(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 65534, 2));
+		CPPUNIT_ASSERT(!modbus_address_ranges_contain(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 65534, 3));
+		CPPUNIT_ASSERT(!modbus_address_ranges_contain(s_holding_register_ranges, NUMBER_OF_HOLDING_REGISTER_RANGES, 65535, 0xFFFF));
+	}
+
+	void test_service_with_sparse_holding_registers()
+	{
+		service_read_holding_registers(40000, 100);
+
+		CPPUNIT_ASSERT(s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)40000, s_read_holding_registers_data.reg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)100, s_read_holding_registers_data.n_registers);
+	}
+
+	void test_service_with_sparse_holding_registers_spanning_gap_is_illegal_address()
+	{
+		service_read_holding_registers(8, 4);
+
+		CPPUNIT_ASSERT(!s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_HOLDING_REGISTERS), (int)s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+	void test_service_without_ranges_uses_dense_table()
+	{
+		s_modbus_handler.data.holding_register_ranges = NULL;
+		s_modbus_handler.data.num_holding_registers = 0x40;
+
+		service_read_holding_registers(0x3F, 1);
+		CPPUNIT_ASSERT(s_read_holding_registers_data.called);
+
+		s_read_holding_registers_data.called = false;
+		service_read_holding_registers(0x3F, 2);
+		CPPUNIT_ASSERT(!s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+public:
+	void setUp()
+	{
+		s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+		s_modbus_handler.data.device_address = 0xAA;
+		s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+		s_modbus_handler.data.num_holding_registers = 0;
+		s_modbus_handler.data.holding_register_ranges = s_holding_register_ranges;
+		s_modbus_handler.data.num_holding_register_ranges = NUMBER_OF_HOLDING_REGISTER_RANGES;
+
+		s_read_holding_registers_data.called = false;
+
+		s_last_exception_function = 0;
+		s_last_exception_code = (MODBUS_EXCEPTION_CODES)0xFF;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusRangesTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const uint8_t TEST_ADDRESS = 0x11;
+
+static void assert_bytes(uint8_t const * expected, uint8_t const * actual, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		CPPUNIT_ASSERT_EQUAL((int)expected[i], (int)actual[i]);
+	}
+}
+
+class ModbusRequestTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusRequestTest);
+
+	CPPUNIT_TEST(test_read_holding_registers_request);
+	CPPUNIT_TEST(test_read_requests_use_their_function_codes);
+	CPPUNIT_TEST(test_write_single_coil_request);
+	CPPUNIT_TEST(test_write_multiple_coils_request);
+	CPPUNIT_TEST(test_write_holding_registers_request);
+	CPPUNIT_TEST(test_request_length);
+	CPPUNIT_TEST(test_response_length);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_read_holding_registers_request()
+	{
+		uint8_t buffer[16];
+
+		int length = modbus_get_read_holding_registers_request(TEST_ADDRESS, buffer, 0x006B, 3);
+
+		/* Example from the Modbus serial line specification */
+		uint8_t expected[] = {0x11, 0x03, 0x00, 0x6B, 0x00, 0x03, 0x76, 0x87};
+		CPPUNIT_ASSERT_EQUAL((int)sizeof(expected), length);
+		assert_bytes(expected, buffer, length);
+	}
+
+	void test_read_requests_use_their_function_codes()
+	{
+		uint8_t buffer[16];
+
+		CPPUNIT_ASSERT_EQUAL(6, modbus_get_read_coils_request(TEST_ADDRESS, buffer, 0, 1, false));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)READ_COILS, buffer[1]);
+		modbus_get_read_discrete_inputs_request(TEST_ADDRESS, buffer, 0, 1);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)READ_DISCRETE_INPUTS, buffer[1]);
+		modbus_get_read_input_registers_request(TEST_ADDRESS, buffer, 0, 1);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)READ_INPUT_REGISTERS, buffer[1]);
+	}
+
+	void test_write_single_coil_request()
+	{
+		uint8_t buffer[16];
+
+		int length = modbus_get_write_single_coil_request(TEST_ADDRESS, buffer, 0x00AC, true);
+
+		uint8_t expected[] = {0x11, 0x05, 0x00, 0xAC, 0xFF, 0x00};
+		CPPUNIT_ASSERT_EQUAL(8, length);
+		assert_bytes(expected, buffer, sizeof(expected));
+		CPPUNIT_ASSERT(modbus_validate_message_crc(buffer, length));
+	}
+
+	void test_write_multiple_coils_request()
+	{
+		uint8_t buffer[16];
+		bool coils[] = {true, false, true, true, false, false, true, true, true, false};
+
+		int length = modbus_write_write_multiple_coils_request(TEST_ADDRESS, buffer, 0x0013, 10, coils);
+
+		uint8_t expected[] = {0x11, 0x0F, 0x00, 0x13, 0x00, 0x0A, 0x02, 0xCD, 0x01};
+		CPPUNIT_ASSERT_EQUAL((int)sizeof(expected) + 2, length);
+		assert_bytes(expected, buffer, sizeof(expected));
+		CPPUNIT_ASSERT(modbus_validate_message_crc(buffer, length));
+	}
+
+	void test_write_holding_registers_request()
+	{
+		uint8_t buffer[16];
+		int16_t values[] = {0x000A, 0x0102};
+
+		int length = modbus_write_write_holding_registers_request(TEST_ADDRESS, buffer, 0x0001, 2, values);
+
+		uint8_t expected[] = {0x11, 0x10, 0x00, 0x01, 0x00, 0x02, 0x04, 0x00, 0x0A, 0x01, 0x02};
+		CPPUNIT_ASSERT_EQUAL((int)sizeof(expected) + 2, length);
+		assert_bytes(expected, buffer, sizeof(expected));
+		CPPUNIT_ASSERT_EQUAL(length, modbus_get_request_length(buffer, length));
+	}
+
+	void test_request_length()
+	{
+		uint8_t read[] = {0x11, READ_HOLDING_REGISTERS};
+		uint8_t write_registers[] = {0x11, WRITE_HOLDING_REGISTERS, 0x00, 0x01, 0x00, 0x02, 0x04};
+		uint8_t read_write[] = {0x11, READ_WRITE_REGISTERS, 0, 0, 0, 1, 0, 0, 0, 3, 0x06};
+		uint8_t unknown[] = {0x11, 0x2B};
+
+		CPPUNIT_ASSERT_EQUAL(0, modbus_get_request_length(read, 1));
+		CPPUNIT_ASSERT_EQUAL(8, modbus_get_request_length(read, 2));
+		CPPUNIT_ASSERT_EQUAL(0, modbus_get_request_length(write_registers, 6));
+		CPPUNIT_ASSERT_EQUAL(13, modbus_get_request_length(write_registers, 7));
+		CPPUNIT_ASSERT_EQUAL(19, modbus_get_request_length(read_write, 11));
+		CPPUNIT_ASSERT_EQUAL(-1, modbus_get_request_length(unknown, 2));
+	}
+
+	void test_response_length()
+	{
+		uint8_t read[] = {0x11, READ_HOLDING_REGISTERS, 0x06};
+		uint8_t exception[] = {0x11, READ_HOLDING_REGISTERS + 128};
+		uint8_t write[] = {0x11, WRITE_HOLDING_REGISTERS};
+		uint8_t fifo[] = {0x11, READ_FIFO_QUEUE, 0x00, 0x06};
+
+		CPPUNIT_ASSERT_EQUAL(0, modbus_get_response_length(read, 2));
+		CPPUNIT_ASSERT_EQUAL(11, modbus_get_response_length(read, 3));
+		CPPUNIT_ASSERT_EQUAL(5, modbus_get_response_length(exception, 2));
+		CPPUNIT_ASSERT_EQUAL(8, modbus_get_response_length(write, 2));
+		CPPUNIT_ASSERT_EQUAL(0, modbus_get_response_length(fifo, 3));
+		CPPUNIT_ASSERT_EQUAL(12, modbus_get_response_length(fifo, 4));
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusRequestTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
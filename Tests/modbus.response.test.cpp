@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <string.h>
 
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/ui/text/TestRunner.h>
@@ -25,6 +26,7 @@ class ModbusResponseTest : public CppUnit::TestFixture  {
 	CPPUNIT_TEST(test_modbus_write_read_discrete_input_values_start_not_1_read_many);
 	CPPUNIT_TEST(test_modbus_write_read_discrete_input_values_start_not_1_read_one);
 	CPPUNIT_TEST(test_modbus_write_read_discrete_input_values_start_1_read_one);
+	CPPUNIT_TEST(test_modbus_write_read_discrete_input_values_packs_eight_per_byte);
 
 	CPPUNIT_TEST(test_modbus_write_read_input_registers_start_1_read_many);
 	CPPUNIT_TEST(test_modbus_write_read_input_registers_start_not_1_read_many);
@@ -38,9 +40,12 @@ class ModbusResponseTest : public CppUnit::TestFixture  {
 
 	CPPUNIT_TEST(test_modbus_get_write_holding_register_response);
 	CPPUNIT_TEST(test_modbus_get_write_holding_registers_response);
+	CPPUNIT_TEST(test_modbus_get_diagnostics_response);
 
 	CPPUNIT_TEST(test_modbus_write_crc);
 	CPPUNIT_TEST(test_modbus_write_crc_reversed);
+	CPPUNIT_TEST(test_builders_crc_matches_separate_crc_pass);
+	CPPUNIT_TEST(test_builders_without_crc);
 
 	CPPUNIT_TEST_SUITE_END();
 
@@ -157,6 +162,19 @@ class ModbusResponseTest : public CppUnit::TestFixture  {
 		CPPUNIT_ASSERT_EQUAL(expected_read_start1_read1, buffer[3]);
 	}
 
+	void test_modbus_write_read_discrete_input_values_packs_eight_per_byte()
+	{
+		bool test_values[] = {true, false, false, false, false, false, false, true, false, true};
+
+		uint8_t buffer[64];
+		int bytes_written = modbus_write_read_discrete_inputs_response(TEST_ADDRESS, buffer, test_values, 10);
+		CPPUNIT_ASSERT_EQUAL(7, bytes_written);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)2, buffer[2]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x81, buffer[3]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x02, buffer[4]);
+		CPPUNIT_ASSERT(modbus_validate_message_crc(buffer, bytes_written));
+	}
+
 	void test_modbus_write_read_input_registers_start_1_read_many()
 	{
 		int16_t test_values[] = {0x0000, 0x7FFF, 0x5555, 0x1111};
@@ -311,6 +329,50 @@ class ModbusResponseTest : public CppUnit::TestFixture  {
 		CPPUNIT_ASSERT_EQUAL((int16_t)0x0005, two_bytes_to_int16_t(buffer[4], buffer[5]));
 	}
 
+	void test_modbus_get_diagnostics_response()
+	{
+		uint8_t buffer[64];
+		int bytes_written = modbus_get_diagnostics_response(TEST_ADDRESS, buffer, DIAGNOSTICS_RETURN_BUS_MESSAGE_COUNT, 0x0123);
+
+		CPPUNIT_ASSERT_EQUAL(8, bytes_written);
+		CPPUNIT_ASSERT_EQUAL(TEST_ADDRESS, buffer[0]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)DIAGNOSTICS, buffer[1]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)DIAGNOSTICS_RETURN_BUS_MESSAGE_COUNT, two_bytes_to_int16_t(buffer[2], buffer[3]));
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0123, two_bytes_to_int16_t(buffer[4], buffer[5]));
+		CPPUNIT_ASSERT(modbus_validate_message_crc(buffer, bytes_written));
+	}
+
+	void test_builders_crc_matches_separate_crc_pass()
+	{
+		uint8_t buffer[256];
+		int16_t registers[125];
+		for (int i = 0; i < 125; i++) { registers[i] = (int16_t)(i * 0x0301); }
+
+		int bytes_written = modbus_write_read_holding_registers_response(TEST_ADDRESS, buffer, registers, 125);
+		CPPUNIT_ASSERT_EQUAL(255, bytes_written);
+		uint16_t crc = modbus_get_crc16(buffer, bytes_written - 2);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(crc & 0xFF), buffer[253]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(crc >> 8), buffer[254]);
+
+		float values[] = {1.5f, -2.25f};
+		bytes_written = modbus_write_read_input_registers_response(TEST_ADDRESS, buffer, values, 2, WORD_ORDER_CDAB);
+		CPPUNIT_ASSERT(modbus_validate_message_crc(buffer, bytes_written));
+
+		bytes_written = modbus_write_exception(TEST_ADDRESS, buffer, EXCEPTION_ILLEGAL_DATA_ADDRESS, READ_COILS + 128);
+		CPPUNIT_ASSERT_EQUAL(5, bytes_written);
+		CPPUNIT_ASSERT(modbus_validate_message_crc(buffer, bytes_written));
+	}
+
+	void test_builders_without_crc()
+	{
+		uint8_t buffer[16];
+		memset(buffer, 0xEE, sizeof(buffer));
+
+		int bytes_written = modbus_get_write_holding_register_response(TEST_ADDRESS, buffer, 1, 2, false);
+		CPPUNIT_ASSERT_EQUAL(6, bytes_written);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0xEE, buffer[6]);
+	}
+
 	void test_modbus_write_crc()
 	{
 		uint8_t buffer[] = {0xD4, 0xE3, 0x39, 0x8C, 0x23, 0xA4, 0x00, 0x00};
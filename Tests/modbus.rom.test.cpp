@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+
+static int16_t s_holding_registers[1100];
+static int16_t s_write_holding_register_data_buffer[125];
+
+static uint8_t s_last_exception_function;
+static MODBUS_EXCEPTION_CODES s_last_exception_code;
+
+static struct _read_holding_registers_data { bool called; uint16_t reg; uint16_t n_registers; } s_read_holding_registers_data;
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	s_read_holding_registers_data.called = true;
+	s_read_holding_registers_data.reg = reg;
+	s_read_holding_registers_data.n_registers = n_registers;
+}
+
+static void write_holding_register(uint16_t reg, int16_t value)
+{
+	s_holding_registers[reg] = value;
+}
+
+static void write_holding_registers(uint16_t first_reg, uint16_t n_registers, int16_t * values)
+{
+	memcpy(&s_holding_registers[first_reg], values, n_registers * sizeof(int16_t));
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_last_exception_function = function_code;
+	s_last_exception_code = exception_code;
+}
+
+static const MODBUS_ADDRESS_RANGE s_holding_register_ranges[] MODBUS_ROM = {
+	{0, 10},
+	{1000, 20}
+};
+
+static const MODBUS_HANDLER s_rom_handler MODBUS_ROM = {
+	{
+		NULL, /* read_coils */
+		NULL, /* read_discrete_inputs */
+		NULL, /* write_single_coil */
+		NULL, /* write_multiple_coils */
+		NULL, /* read_input_registers */
+		read_holding_registers,
+		write_holding_register,
+		write_holding_registers,
+		NULL, /* read_write_registers */
+		NULL, /* mask_write_register */
+		exception_handler,
+		NULL, /* diagnostics */
+		NULL, /* read_fifo_queue */
+		NULL, /* read_file_record */
+		NULL, /* write_file_record */
+		NULL, NULL, NULL /* view forms */
+	},
+	{
+		TEST_ADDRESS,
+		0, 0, 0, 0, /* table sizes, unused with ranges */
+		NULL, /* write_multiple_coils buffer */
+		s_write_holding_register_data_buffer,
+		NULL, 0, /* files */
+		NULL, NULL, NULL, s_holding_register_ranges,
+		0, 0, 0, sizeof(s_holding_register_ranges) / sizeof(s_holding_register_ranges[0])
+	},
+	true
+};
+
+class ModbusRomTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusRomTest);
+
+	CPPUNIT_TEST(test_read_holding_registers_through_rom_handler);
+	CPPUNIT_TEST(test_write_holding_register_through_rom_handler);
+	CPPUNIT_TEST(test_write_holding_registers_uses_ram_buffer);
+	CPPUNIT_TEST(test_request_spanning_rom_ranges_is_illegal_address);
+	CPPUNIT_TEST(test_missing_rom_function_is_illegal_function);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_read_holding_registers_through_rom_handler()
+	{
+		uint8_t message[8];
+		int length = modbus_get_read_holding_registers_request(TEST_ADDRESS, message, 1002, 18);
+
+		modbus_service_rom_message(message, &s_rom_handler, length, true);
+
+		CPPUNIT_ASSERT(s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)1002, s_read_holding_registers_data.reg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)18, s_read_holding_registers_data.n_registers);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, s_last_exception_code);
+	}
+
+	void test_write_holding_register_through_rom_handler()
+	{
+		uint8_t message[8];
+		int length = modbus_get_write_holding_register_request(TEST_ADDRESS, message, 9, 0x1234);
+
+		modbus_service_rom_message(message, &s_rom_handler, length, true);
+
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x1234, s_holding_registers[9]);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, s_last_exception_code);
+	}
+
+	void test_write_holding_registers_uses_ram_buffer()
+	{
+		uint8_t message[16];
+		int16_t values[] = {0x0102, 0x0304};
+		int length = modbus_write_write_holding_registers_request(TEST_ADDRESS, message, 1018, 2, values);
+
+		modbus_service_rom_message(message, &s_rom_handler, length, true);
+
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0102, s_holding_registers[1018]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0304, s_holding_registers[1019]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x0102, s_write_holding_register_data_buffer[0]);
+	}
+
+	void test_request_spanning_rom_ranges_is_illegal_address()
+	{
+		uint8_t message[8];
+		int length = modbus_get_read_holding_registers_request(TEST_ADDRESS, message, 8, 3);
+
+		modbus_service_rom_message(message, &s_rom_handler, length, true);
+
+		CPPUNIT_ASSERT(!s_read_holding_registers_data.called);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(READ_HOLDING_REGISTERS + 128), s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, s_last_exception_code);
+	}
+
+	void test_missing_rom_function_is_illegal_function()
+	{
+		uint8_t message[8];
+		int length = modbus_get_read_coils_request(TEST_ADDRESS, message, 0, 1);
+
+		modbus_service_rom_message(message, &s_rom_handler, length, true);
+
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(READ_COILS + 128), s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, s_last_exception_code);
+	}
+
+public:
+	void setUp()
+	{
+		memset(s_holding_registers, 0, sizeof(s_holding_registers));
+		memset(s_write_holding_register_data_buffer, 0, sizeof(s_write_holding_register_data_buffer));
+		memset(&s_read_holding_registers_data, 0, sizeof(s_read_holding_registers_data));
+
+		s_last_exception_function = 0;
+		s_last_exception_code = EXCEPTION_NONE;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusRomTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
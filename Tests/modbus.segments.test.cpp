@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_posix_io.h"
+
+static const uint8_t TEST_ADDRESS = 0x65;
+
+static uint8_t s_wire_registers[] = {0x12, 0x34, 0x80, 0x01, 0x00, 0xFF};
+
+class ModbusSegmentsTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusSegmentsTest);
+
+	CPPUNIT_TEST(test_update_crc16_in_pieces_matches_get_crc16);
+	CPPUNIT_TEST(test_read_holding_registers_segments_point_at_payload);
+	CPPUNIT_TEST(test_read_holding_registers_segments_match_contiguous_response);
+	CPPUNIT_TEST(test_read_input_registers_segments_without_crc);
+	CPPUNIT_TEST(test_set_mbap_header_drops_crc_and_prefixes_header);
+	CPPUNIT_TEST(test_write_mbap_header);
+	CPPUNIT_TEST(test_posix_write_segments);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_update_crc16_in_pieces_matches_get_crc16()
+	{
+		uint8_t message[] = {0x11, 0x03, 0x00, 0x6B, 0x00, 0x03, 0x76, 0x87};
+
+		uint16_t crc = modbus_update_crc16(MODBUS_CRC16_INIT, message, 3);
+		crc = modbus_update_crc16(crc, &message[3], 3);
+
+		CPPUNIT_ASSERT_EQUAL(modbus_get_crc16(message, 6), crc);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x8776, crc);
+	}
+
+	void test_read_holding_registers_segments_point_at_payload()
+	{
+		MODBUS_RESPONSE_SEGMENTS response;
+
+		int length = modbus_get_read_holding_registers_response_segments(TEST_ADDRESS, &response, s_wire_registers, 3);
+
+		CPPUNIT_ASSERT_EQUAL(11, length);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)3, response.n_segments);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)3, response.segments[0].length);
+		CPPUNIT_ASSERT_EQUAL(TEST_ADDRESS, response.segments[0].data[0]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)READ_HOLDING_REGISTERS, response.segments[0].data[1]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)6, response.segments[0].data[2]);
+		CPPUNIT_ASSERT(response.segments[1].data == s_wire_registers);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)6, response.segments[1].length);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)2, response.segments[2].length);
+	}
+
+	void test_read_holding_registers_segments_match_contiguous_response()
+	{
+		MODBUS_RESPONSE_SEGMENTS response;
+		int16_t registers[] = {0x1234, (int16_t)0x8001, 0x00FF};
+		uint8_t expected[64];
+		uint8_t gathered[64];
+
+		int expected_length = modbus_write_read_holding_registers_response(TEST_ADDRESS, expected, registers, 3);
+		int length = modbus_get_read_holding_registers_response_segments(TEST_ADDRESS, &response, s_wire_registers, 3);
+
+		CPPUNIT_ASSERT_EQUAL(expected_length, length);
+		CPPUNIT_ASSERT_EQUAL(length, modbus_copy_segments(gathered, response.segments, response.n_segments));
+		CPPUNIT_ASSERT(memcmp(expected, gathered, length) == 0);
+	}
+
+	void test_read_input_registers_segments_without_crc()
+	{
+		MODBUS_RESPONSE_SEGMENTS response;
+
+		int length = modbus_get_read_input_registers_response_segments(TEST_ADDRESS, &response, s_wire_registers, 2, false);
+
+		CPPUNIT_ASSERT_EQUAL(7, length);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)2, response.n_segments);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)READ_INPUT_REGISTERS, response.segments[0].data[1]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)4, response.segments[0].data[2]);
+	}
+
+	void test_set_mbap_header_drops_crc_and_prefixes_header()
+	{
+		MODBUS_RESPONSE_SEGMENTS response;
+		uint8_t gathered[64];
+
+		modbus_get_read_holding_registers_response_segments(TEST_ADDRESS, &response, s_wire_registers, 3);
+		int length = modbus_set_mbap_header(&response, 0xBEEF);
+
+		uint8_t expected[] = {0xBE, 0xEF, 0x00, 0x00, 0x00, 0x09, TEST_ADDRESS, READ_HOLDING_REGISTERS, 6, 0x12, 0x34, 0x80, 0x01, 0x00, 0xFF};
+		CPPUNIT_ASSERT_EQUAL((int)sizeof(expected), length);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)2, response.n_segments);
+		modbus_copy_segments(gathered, response.segments, response.n_segments);
+		CPPUNIT_ASSERT(memcmp(expected, gathered, length) == 0);
+
+		CPPUNIT_ASSERT_EQUAL(length, modbus_set_mbap_header(&response, 0x0001));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x01, response.segments[0].data[1]);
+	}
+
+	void test_write_mbap_header()
+	{
+		uint8_t buffer[8];
+
+		CPPUNIT_ASSERT_EQUAL(7, modbus_write_mbap_header(buffer, 0x0102, 5, 0x11));
+
+		uint8_t expected[] = {0x01, 0x02, 0x00, 0x00, 0x00, 0x06, 0x11};
+		CPPUNIT_ASSERT(memcmp(expected, buffer, sizeof(expected)) == 0);
+	}
+
+	void test_posix_write_segments()
+	{
+		MODBUS_RESPONSE_SEGMENTS response;
+		uint8_t expected[64];
+		uint8_t received[64];
+		int fds[2];
+
+		CPPUNIT_ASSERT_EQUAL(0, pipe(fds));
+
+		int length = modbus_get_read_holding_registers_response_segments(TEST_ADDRESS, &response, s_wire_registers, 3);
+		modbus_copy_segments(expected, response.segments, response.n_segments);
+
+		CPPUNIT_ASSERT_EQUAL(length, modbus_posix_write_segments(fds[1], response.segments, response.n_segments));
+		CPPUNIT_ASSERT_EQUAL((ssize_t)length, read(fds[0], received, sizeof(received)));
+		CPPUNIT_ASSERT(memcmp(expected, received, length) == 0);
+
+		close(fds[0]);
+		close(fds[1]);
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusSegmentsTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
@@ -0,0 +1,211 @@
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_server.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+static const uint16_t NUMBER_OF_COILS = 32;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 200;
+
+class TestHandler
+{
+public:
+	TestHandler() : last_function_code(0), last_first(UINT16_MAX), last_n(UINT16_MAX),
+		last_exception_function(0), last_exception_code((MODBUS_EXCEPTION_CODES)0xFF) {}
+
+	int last_function_code;
+	uint16_t last_first;
+	uint16_t last_n;
+	uint8_t last_exception_function;
+	MODBUS_EXCEPTION_CODES last_exception_code;
+
+	bool coils[NUMBER_OF_COILS];
+	int16_t registers[NUMBER_OF_HOLDING_REGISTERS];
+
+	uint8_t device_address() { return TEST_ADDRESS; }
+
+	bool supports(MODBUS_FUNCTION_CODE function_code)
+	{
+		return (function_code == READ_HOLDING_REGISTERS) || (function_code == WRITE_MULTIPLE_COILS) || (function_code == WRITE_HOLDING_REGISTERS);
+	}
+
+	bool valid_addresses(modbus::Table table, modbus::Access, uint16_t first, uint16_t n)
+	{
+		uint32_t end = (uint32_t)first + n;
+		return (table == modbus::COILS) ? (end <= NUMBER_OF_COILS) : (end <= NUMBER_OF_HOLDING_REGISTERS);
+	}
+
+	MODBUS_FILE const * files() { return NULL; }
+	uint8_t num_files() { return 0; }
+
+	void read_coils(uint16_t, uint16_t) {}
+	void read_discrete_inputs(uint16_t, uint16_t) {}
+	void write_single_coil(uint16_t, bool) {}
+	void write_multiple_coils_view(uint16_t first_coil, MODBUS_COIL_VIEW const * values)
+	{
+		modbus_coil_view_copy(values, coils);
+		record(WRITE_MULTIPLE_COILS, first_coil, values->n_coils);
+	}
+	void read_input_registers(uint16_t, uint16_t) {}
+	void read_holding_registers(uint16_t reg, uint16_t n_registers) { record(READ_HOLDING_REGISTERS, reg, n_registers); }
+	void write_holding_register(uint16_t, int16_t) {}
+	void write_holding_registers_view(uint16_t first_reg, MODBUS_REGISTER_VIEW const * values)
+	{
+		modbus_register_view_copy(values, registers);
+		record(WRITE_HOLDING_REGISTERS, first_reg, values->n_registers);
+	}
+	void read_write_registers_view(uint16_t, uint16_t, uint16_t, MODBUS_REGISTER_VIEW const *) {}
+	void mask_write_register(uint16_t, uint16_t, uint16_t) {}
+	void diagnostics(uint16_t, uint16_t) {}
+	void read_fifo_queue(uint16_t) {}
+	void read_file_record(uint8_t const *, uint8_t) {}
+	void write_file_record(uint8_t const *, uint8_t) {}
+
+	void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+	{
+		last_exception_function = function_code;
+		last_exception_code = exception_code;
+	}
+
+private:
+	void record(int function_code, uint16_t first, uint16_t n)
+	{
+		last_function_code = function_code;
+		last_first = first;
+		last_n = n;
+	}
+};
+
+class ModbusServerTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusServerTest);
+
+	CPPUNIT_TEST(test_server_calls_handler_member);
+	CPPUNIT_TEST(test_server_ignores_other_addresses);
+	CPPUNIT_TEST(test_server_unsupported_function_is_illegal_function);
+	CPPUNIT_TEST(test_server_uses_handler_address_validation);
+	CPPUNIT_TEST(test_server_quantity_over_protocol_limit_is_illegal_value);
+	CPPUNIT_TEST(test_server_write_multiple_coils_unpacks_every_byte);
+	CPPUNIT_TEST(test_server_write_multiple_coils_with_wrong_byte_count_is_illegal_address);
+	CPPUNIT_TEST(test_server_write_holding_registers_copies_values);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	TestHandler * m_handler;
+	modbus::Server<TestHandler> * m_server;
+
+	void service(uint8_t const * message, int length)
+	{
+		m_server->service_message(message, length, false);
+	}
+
+	void test_server_calls_handler_member()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_HOLDING_REGISTERS, 0x00, 0x10, 0x00, 0x7D};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT_EQUAL((int)READ_HOLDING_REGISTERS, m_handler->last_function_code);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x10, m_handler->last_first);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)125, m_handler->last_n);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, m_handler->last_exception_function);
+	}
+
+	void test_server_ignores_other_addresses()
+	{
+		uint8_t message[] = {0xAB, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x01};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT_EQUAL(0, m_handler->last_function_code);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, m_handler->last_exception_function);
+	}
+
+	void test_server_unsupported_function_is_illegal_function()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_COILS, 0x00, 0x00, 0x00, 0x01};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT_EQUAL((int)(128 + READ_COILS), (int)m_handler->last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_FUNCTION_CODE, m_handler->last_exception_code);
+	}
+
+	void test_server_uses_handler_address_validation()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_HOLDING_REGISTERS, 0x00, 0xC0, 0x00, 0x09};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT_EQUAL(0, m_handler->last_function_code);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, m_handler->last_exception_code);
+	}
+
+	void test_server_quantity_over_protocol_limit_is_illegal_value()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x7E};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT_EQUAL(0, m_handler->last_function_code);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, m_handler->last_exception_code);
+	}
+
+	void test_server_write_multiple_coils_unpacks_every_byte()
+	{
+		uint8_t message[] = {TEST_ADDRESS, WRITE_MULTIPLE_COILS, 0x00, 0x00, 0x00, 0x12, 0x03, 0x01, 0x80, 0x02};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT_EQUAL((int)WRITE_MULTIPLE_COILS, m_handler->last_function_code);
+		for (int i = 0; i < 18; i++)
+		{
+			bool expected = (i == 0) || (i == 15) || (i == 17);
+			CPPUNIT_ASSERT_EQUAL(expected, m_handler->coils[i]);
+		}
+	}
+
+	void test_server_write_multiple_coils_with_wrong_byte_count_is_illegal_address()
+	{
+		uint8_t message[] = {TEST_ADDRESS, WRITE_MULTIPLE_COILS, 0x00, 0x00, 0x00, 0x09, 0x01, 0xFF};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT_EQUAL(0, m_handler->last_function_code);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, m_handler->last_exception_code);
+	}
+
+	void test_server_write_holding_registers_copies_values()
+	{
+		uint8_t message[] = {TEST_ADDRESS, WRITE_HOLDING_REGISTERS, 0x00, 0x02, 0x00, 0x02, 0x04, 0x00, 0x0A, 0x80, 0x01};
+		service(message, sizeof(message));
+
+		CPPUNIT_ASSERT_EQUAL((int)WRITE_HOLDING_REGISTERS, m_handler->last_function_code);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x000A, m_handler->registers[0]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x8001, m_handler->registers[1]);
+	}
+
+public:
+	void setUp()
+	{
+		m_handler = new TestHandler();
+		m_server = new modbus::Server<TestHandler>(*m_handler);
+	}
+
+	void tearDown()
+	{
+		delete m_server;
+		delete m_handler;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusServerTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
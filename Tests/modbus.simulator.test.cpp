@@ -0,0 +1,295 @@
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_posix_master.h"
+#include "modbus_simulator.h"
+
+static const MODBUS_ADDRESS_RANGE s_holding_register_ranges[] = {{0, 10}, {100, 10}};
+static const MODBUS_ADDRESS_RANGE s_input_register_ranges[] = {{0, 50}};
+
+struct completion
+{
+	MODBUS_POSIX_MASTER_RESULT result;
+	uint8_t response[MODBUS_RTU_MAX_FRAME];
+	int response_length;
+	uint64_t completed_us;
+};
+
+static completion s_completions[16];
+static int s_n_completions;
+
+static uint64_t get_time_us()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+static void on_complete(int, uint8_t const *, int, uint8_t const * response, int response_length, MODBUS_POSIX_MASTER_RESULT result, void *)
+{
+	completion& c = s_completions[s_n_completions++];
+	c.result = result;
+	c.response_length = response_length;
+	c.completed_us = get_time_us();
+	if (response) { memcpy(c.response, response, response_length); }
+}
+
+class ModbusSimulatorTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusSimulatorTest);
+
+	CPPUNIT_TEST(test_units_on_a_line_answer_independently);
+	CPPUNIT_TEST(test_unhosted_unit_does_not_answer);
+	CPPUNIT_TEST(test_sparse_register_map);
+	CPPUNIT_TEST(test_coils_are_illegal_function);
+	CPPUNIT_TEST(test_broadcast_writes_every_unit);
+	CPPUNIT_TEST(test_latency_delays_responses);
+	CPPUNIT_TEST(test_crc_faults);
+	CPPUNIT_TEST(test_exception_faults);
+	CPPUNIT_TEST(test_tcp_request);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	MODBUS_SIMULATOR_CONFIG m_config;
+	MODBUS_SIMULATOR m_simulator;
+	MODBUS_POSIX_MASTER m_master;
+	int m_line;
+	int m_fd;
+
+	void start()
+	{
+		CPPUNIT_ASSERT(modbus_simulator_init(&m_simulator, &m_config));
+		m_line = modbus_simulator_add_pty_line(&m_simulator);
+		CPPUNIT_ASSERT(m_line >= 0);
+
+		m_fd = modbus_posix_open_serial(modbus_simulator_get_line_path(&m_simulator, m_line), 115200);
+		CPPUNIT_ASSERT(m_fd >= 0);
+		CPPUNIT_ASSERT(modbus_posix_master_init(&m_master));
+		CPPUNIT_ASSERT_EQUAL(0, modbus_posix_master_add_port(&m_master, m_fd, 115200, 100, 2));
+	}
+
+	void queue(uint8_t const * request, int length)
+	{
+		CPPUNIT_ASSERT(modbus_posix_master_queue(&m_master, 0, request, length, on_complete, NULL));
+	}
+
+	void queue_read_holding(uint8_t unit, uint16_t reg, uint16_t n)
+	{
+		uint8_t request[8];
+		queue(request, modbus_get_read_holding_registers_request(unit, request, reg, n));
+	}
+
+	void run_until_idle()
+	{
+		for (int i = 0; (i < 2000) && !modbus_posix_master_idle(&m_master); i++)
+		{
+			modbus_posix_master_poll(&m_master, 1);
+			modbus_simulator_poll(&m_simulator, 0);
+		}
+		CPPUNIT_ASSERT(modbus_posix_master_idle(&m_master));
+	}
+
+	void test_units_on_a_line_answer_independently()
+	{
+		start();
+		*modbus_simulator_get_holding_register(&m_simulator, m_line, 1, 2) = 0x0101;
+		*modbus_simulator_get_holding_register(&m_simulator, m_line, 3, 2) = 0x0303;
+
+		queue_read_holding(1, 2, 1);
+		queue_read_holding(3, 2, 1);
+
+		uint8_t request[8];
+		queue(request, modbus_get_read_input_registers_request(2, request, 40, 1));
+
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(3, s_n_completions);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x01, s_completions[0].response[4]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x03, s_completions[1].response[4]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)40, s_completions[2].response[4]);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)3, m_simulator.counters.responses);
+	}
+
+	void test_unhosted_unit_does_not_answer()
+	{
+		start();
+
+		queue_read_holding(4, 0, 1);
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_TIMEOUT, s_completions[0].result);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1, m_simulator.counters.ignored);
+	}
+
+	void test_sparse_register_map()
+	{
+		start();
+		*modbus_simulator_get_holding_register(&m_simulator, m_line, 1, 109) = 0x0109;
+		CPPUNIT_ASSERT(modbus_simulator_get_holding_register(&m_simulator, m_line, 1, 50) == NULL);
+
+		queue_read_holding(1, 100, 10);
+		queue_read_holding(1, 5, 10);
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(25, s_completions[0].response_length);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x01, s_completions[0].response[21]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x09, s_completions[0].response[22]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(READ_HOLDING_REGISTERS + 128), s_completions[1].response[1]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)EXCEPTION_ILLEGAL_DATA_ADDRESS, s_completions[1].response[2]);
+	}
+
+	void test_coils_are_illegal_function()
+	{
+		start();
+
+		uint8_t request[8];
+		queue(request, modbus_get_read_coils_request(1, request, 0, 8));
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_OK, s_completions[0].result);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(READ_COILS + 128), s_completions[0].response[1]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)EXCEPTION_ILLEGAL_FUNCTION_CODE, s_completions[0].response[2]);
+	}
+
+	void test_broadcast_writes_every_unit()
+	{
+		start();
+
+		uint8_t request[8];
+		queue(request, modbus_get_write_holding_register_request(MODBUS_BROADCAST_ADDRESS, request, 101, 0x55AA));
+		run_until_idle();
+
+		/* The master goes idle after the turnaround delay, which may be before the simulator has read the frame */
+		for (int i = 0; (i < 1000) && (m_simulator.counters.requests == 0); i++)
+		{
+			modbus_simulator_poll(&m_simulator, 1);
+		}
+
+		for (uint8_t unit = 1; unit <= 3; unit++)
+		{
+			CPPUNIT_ASSERT_EQUAL((int16_t)0x55AA, *modbus_simulator_get_holding_register(&m_simulator, m_line, unit, 101));
+		}
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, m_simulator.counters.responses);
+	}
+
+	void test_latency_delays_responses()
+	{
+		m_config.latency_us = 20000;
+		start();
+
+		uint64_t start_us = get_time_us();
+		queue_read_holding(1, 0, 1);
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_OK, s_completions[0].result);
+		CPPUNIT_ASSERT(s_completions[0].completed_us - start_us >= 20000);
+	}
+
+	void test_crc_faults()
+	{
+		m_config.crc_fault_rate = 0xFFFF;
+		start();
+
+		queue_read_holding(1, 0, 1);
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_CRC_FAILED, s_completions[0].result);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1, m_simulator.counters.crc_faults);
+	}
+
+	void test_exception_faults()
+	{
+		m_config.exception_rate = 0xFFFF;
+		start();
+
+		queue_read_holding(1, 0, 1);
+		run_until_idle();
+
+		CPPUNIT_ASSERT_EQUAL(MASTER_RESPONSE_OK, s_completions[0].result);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(READ_HOLDING_REGISTERS + 128), s_completions[0].response[1]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)EXCEPTION_SLAVE_DEVICE_BUSY, s_completions[0].response[2]);
+	}
+
+	void test_tcp_request()
+	{
+		start();
+		int bus = modbus_simulator_add_tcp_port(&m_simulator, 0);
+		CPPUNIT_ASSERT(bus >= 0);
+		*modbus_simulator_get_holding_register(&m_simulator, bus, 2, 3) = 0x1234;
+
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(modbus_simulator_get_tcp_port(&m_simulator, bus));
+		CPPUNIT_ASSERT_EQUAL(0, connect(fd, (struct sockaddr *)&address, sizeof(address)));
+
+		uint8_t request[16];
+		int length = modbus_write_mbap_header(request, 0x0102, 5, 2);
+		length += modbus_get_read_holding_registers_request(2, &request[length - 1], 3, 1, false) - 1;
+		CPPUNIT_ASSERT_EQUAL((ssize_t)length, write(fd, request, length));
+
+		uint8_t response[32];
+		int received = 0;
+		for (int i = 0; (i < 100) && (received < 11); i++)
+		{
+			modbus_simulator_poll(&m_simulator, 10);
+			ssize_t n = recv(fd, &response[received], sizeof(response) - received, MSG_DONTWAIT);
+			if (n > 0) { received += n; }
+		}
+
+		uint8_t expected[] = {0x01, 0x02, 0x00, 0x00, 0x00, 0x05, 0x02, READ_HOLDING_REGISTERS, 0x02, 0x12, 0x34};
+		CPPUNIT_ASSERT_EQUAL((int)sizeof(expected), received);
+		CPPUNIT_ASSERT(memcmp(expected, response, sizeof(expected)) == 0);
+
+		close(fd);
+	}
+
+public:
+	void setUp()
+	{
+		memset(&m_config, 0, sizeof(m_config));
+		m_config.first_unit = 1;
+		m_config.last_unit = 3;
+		m_config.holding_register_ranges = s_holding_register_ranges;
+		m_config.num_holding_register_ranges = 2;
+		m_config.input_register_ranges = s_input_register_ranges;
+		m_config.num_input_register_ranges = 1;
+		m_config.seed = 1;
+
+		s_n_completions = 0;
+		m_fd = -1;
+	}
+
+	void tearDown()
+	{
+		modbus_posix_master_close(&m_master);
+		if (m_fd >= 0) { close(m_fd); }
+		modbus_simulator_close(&m_simulator);
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusSimulatorTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
@@ -0,0 +1,255 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 16;
+static const uint16_t RING_SIZE = 32;
+static const int NUMBER_OF_RECORDS = 8;
+
+static int16_t s_holding_registers[NUMBER_OF_HOLDING_REGISTERS];
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+static uint8_t s_file_records[NUMBER_OF_RECORDS * 2];
+static MODBUS_FILE s_files[1];
+
+static MODBUS_HANDLER s_modbus_handler;
+
+static uint8_t s_ring[RING_SIZE];
+
+static uint8_t const * s_current_message;
+static int s_current_message_length;
+static uint8_t s_response[64];
+static int s_response_length;
+static uint8_t s_last_exception_function;
+static MODBUS_EXCEPTION_CODES s_last_exception_code;
+
+static void write_holding_registers(uint16_t first_reg, uint16_t n_registers, int16_t * values)
+{
+	s_current_message = modbus_get_current_message();
+	s_current_message_length = modbus_get_current_message_length();
+	memcpy(&s_holding_registers[first_reg], values, n_registers * sizeof(int16_t));
+}
+
+static void read_file_record(uint8_t const * request, uint8_t request_length)
+{
+	s_response_length = modbus_write_read_file_record_response(TEST_ADDRESS, s_response, s_files, 1, request, request_length);
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_last_exception_function = function_code;
+	s_last_exception_code = exception_code;
+}
+
+/* Copies a frame into the ring at start, wrapping as DMA would, and describes it in place */
+static MODBUS_SPLIT_FRAME put_in_ring(uint8_t const * message, int length, uint16_t start)
+{
+	for (int i = 0; i < length; i++)
+	{
+		s_ring[(start + i) % RING_SIZE] = message[i];
+	}
+
+	MODBUS_SPLIT_FRAME frame;
+	modbus_get_ring_frame(s_ring, RING_SIZE, start, length, &frame);
+	return frame;
+}
+
+class ModbusSplitTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusSplitTest);
+
+	CPPUNIT_TEST(test_get_ring_frame);
+	CPPUNIT_TEST(test_split_crc_at_every_wrap);
+	CPPUNIT_TEST(test_service_write_registers_at_every_wrap);
+	CPPUNIT_TEST(test_service_split_frame_with_bad_crc);
+	CPPUNIT_TEST(test_service_split_frame_for_another_device_is_ignored);
+	CPPUNIT_TEST(test_service_split_frame_with_bad_quantity);
+	CPPUNIT_TEST(test_service_truncated_split_frame);
+	CPPUNIT_TEST(test_service_file_record_straddling_wrap);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_get_ring_frame()
+	{
+		MODBUS_SPLIT_FRAME frame;
+
+		modbus_get_ring_frame(s_ring, RING_SIZE, 4, 8, &frame);
+		CPPUNIT_ASSERT(frame.segments[0].data == &s_ring[4]);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)8, frame.segments[0].length);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0, frame.segments[1].length);
+
+		modbus_get_ring_frame(s_ring, RING_SIZE, 28, 8, &frame);
+		CPPUNIT_ASSERT(frame.segments[0].data == &s_ring[28]);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)4, frame.segments[0].length);
+		CPPUNIT_ASSERT(frame.segments[1].data == s_ring);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)4, frame.segments[1].length);
+	}
+
+	void test_split_crc_at_every_wrap()
+	{
+		uint8_t message[32];
+		int16_t values[] = {0x1234, 0x5678, 0x0102};
+		int length = modbus_write_write_holding_registers_request(TEST_ADDRESS, message, 2, 3, values);
+
+		for (int wrap = 1; wrap < length; wrap++)
+		{
+			MODBUS_SPLIT_FRAME frame = put_in_ring(message, length, RING_SIZE - wrap);
+			CPPUNIT_ASSERT(modbus_validate_split_message_crc(&frame));
+
+			s_ring[(RING_SIZE - wrap + 4) % RING_SIZE] ^= 0x01;
+			CPPUNIT_ASSERT(!modbus_validate_split_message_crc(&frame));
+		}
+	}
+
+	void test_service_write_registers_at_every_wrap()
+	{
+		uint8_t message[32];
+		int16_t values[] = {0x1234, 0x5678, 0x0102};
+		int length = modbus_write_write_holding_registers_request(TEST_ADDRESS, message, 2, 3, values);
+
+		for (int wrap = 0; wrap < length; wrap++)
+		{
+			memset(s_holding_registers, 0, sizeof(s_holding_registers));
+
+			uint16_t start = (RING_SIZE - wrap) % RING_SIZE;
+			MODBUS_SPLIT_FRAME frame = put_in_ring(message, length, start);
+			MODBUS_FRAME_STATUS status = modbus_service_split_message(&frame, s_modbus_handler, true);
+
+			CPPUNIT_ASSERT_EQUAL(MESSAGE_ACCEPTED, status.state);
+			CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, status.exception);
+			CPPUNIT_ASSERT_EQUAL((int16_t)0x1234, s_holding_registers[2]);
+			CPPUNIT_ASSERT_EQUAL((int16_t)0x5678, s_holding_registers[3]);
+			CPPUNIT_ASSERT_EQUAL((int16_t)0x0102, s_holding_registers[4]);
+
+			CPPUNIT_ASSERT(s_current_message == &s_ring[start]);
+			CPPUNIT_ASSERT_EQUAL(length, s_current_message_length);
+		}
+	}
+
+	void test_service_split_frame_with_bad_crc()
+	{
+		uint8_t message[8];
+		int length = modbus_get_write_holding_register_request(TEST_ADDRESS, message, 1, 0x0101);
+		message[7] ^= 0x01;
+
+		MODBUS_SPLIT_FRAME frame = put_in_ring(message, length, RING_SIZE - 3);
+		MODBUS_FRAME_STATUS status = modbus_service_split_message(&frame, s_modbus_handler, true);
+
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_CRC_FAILED, status.state);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(WRITE_HOLDING_REGISTER + 128), s_last_exception_function);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_INVALID_CRC, s_last_exception_code);
+	}
+
+	void test_service_split_frame_for_another_device_is_ignored()
+	{
+		uint8_t message[8];
+		int length = modbus_get_write_holding_register_request(TEST_ADDRESS + 1, message, 1, 0x0101);
+
+		MODBUS_SPLIT_FRAME frame = put_in_ring(message, length, RING_SIZE - 1);
+		MODBUS_FRAME_STATUS status = modbus_service_split_message(&frame, s_modbus_handler, true);
+
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_IGNORED, status.state);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0, s_holding_registers[1]);
+	}
+
+	void test_service_split_frame_with_bad_quantity()
+	{
+		uint8_t message[] = {TEST_ADDRESS, WRITE_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x02, 0x03, 0x00, 0x01, 0x00, 0x02};
+
+		MODBUS_SPLIT_FRAME frame = put_in_ring(message, sizeof(message), RING_SIZE - 6);
+		MODBUS_FRAME_STATUS status = modbus_service_split_message(&frame, s_modbus_handler, false);
+
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_ADDRESS, status.exception);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)(WRITE_HOLDING_REGISTERS + 128), s_last_exception_function);
+	}
+
+	void test_service_truncated_split_frame()
+	{
+		/* Claims three registers but carries one, with a valid CRC over what was received */
+		uint8_t message[32];
+		int16_t values[] = {0x1234, 0x5678, 0x0102};
+		int length = modbus_write_write_holding_registers_request(TEST_ADDRESS, message, 2, 3, values, false) - 4;
+		uint16_t crc = modbus_get_crc16(message, length);
+		message[length++] = (uint8_t)(crc & 0xFF);
+		message[length++] = (uint8_t)(crc >> 8);
+
+		memset(s_holding_registers, 0, sizeof(s_holding_registers));
+
+		MODBUS_SPLIT_FRAME frame = put_in_ring(message, length, RING_SIZE - 5);
+		MODBUS_FRAME_STATUS status = modbus_service_split_message(&frame, s_modbus_handler, true);
+
+		CPPUNIT_ASSERT_EQUAL(MESSAGE_ACCEPTED, status.state);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, status.exception);
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_ILLEGAL_DATA_VALUE, s_last_exception_code);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0, s_holding_registers[2]);
+	}
+
+	void test_service_file_record_straddling_wrap()
+	{
+		uint8_t message[] = {
+			TEST_ADDRESS, READ_FILE_RECORD, 0x0E,
+			0x06, 0x00, 0x01, 0x00, 0x01, 0x00, 0x02,
+			0x06, 0x00, 0x01, 0x00, 0x05, 0x00, 0x01
+		};
+
+		MODBUS_SPLIT_FRAME frame = put_in_ring(message, sizeof(message), RING_SIZE - 8);
+		MODBUS_FRAME_STATUS status = modbus_service_split_message(&frame, s_modbus_handler, false);
+
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, status.exception);
+		CPPUNIT_ASSERT_EQUAL(15, s_response_length);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x0A, s_response[2]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x02, s_response[5]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x03, s_response[6]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x0A, s_response[11]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x0B, s_response[12]);
+	}
+
+public:
+	void setUp()
+	{
+		memset(&s_modbus_handler, 0, sizeof(s_modbus_handler));
+		memset(s_holding_registers, 0, sizeof(s_holding_registers));
+		memset(s_ring, 0, sizeof(s_ring));
+
+		for (int i = 0; i < (int)sizeof(s_file_records); i++) { s_file_records[i] = i; }
+		s_files[0].file_number = 1;
+		s_files[0].n_records = NUMBER_OF_RECORDS;
+		s_files[0].records = s_file_records;
+		s_files[0].writable = false;
+
+		s_modbus_handler.functions.write_holding_registers = write_holding_registers;
+		s_modbus_handler.functions.read_file_record = read_file_record;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+
+		s_modbus_handler.data.device_address = TEST_ADDRESS;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+		s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+		s_modbus_handler.data.files = s_files;
+		s_modbus_handler.data.num_files = 1;
+
+		s_current_message = NULL;
+		s_current_message_length = 0;
+		s_response_length = 0;
+		s_last_exception_function = 0;
+		s_last_exception_code = EXCEPTION_NONE;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusSplitTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
@@ -0,0 +1,208 @@
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const int NUMBER_OF_COILS = 6;
+static const int NUMBER_OF_INPUTS = 4;
+static const int NUMBER_OF_INPUT_REGISTERS = 4;
+static const int NUMBER_OF_HOLDING_REGISTERS = 6;
+
+static bool s_write_multiple_coils_data_buffer[NUMBER_OF_COILS];
+static int16_t s_write_holding_register_data_buffer[NUMBER_OF_HOLDING_REGISTERS];
+
+static uint32_t s_ticks;
+static uint32_t s_ticks_per_call;
+
+static MODBUS_HANDLER s_modbus_handler;
+
+uint32_t application_get_ticks()
+{
+	uint32_t ticks = s_ticks;
+	s_ticks += s_ticks_per_call;
+	return ticks;
+}
+
+static void read_coils(uint16_t, uint16_t) {}
+static void read_holding_registers(uint16_t, uint16_t) {}
+static void write_holding_register(uint16_t, int16_t) {}
+
+static MODBUS_STATISTICS get_statistics()
+{
+	MODBUS_STATISTICS statistics;
+	modbus_get_statistics(&statistics);
+	return statistics;
+}
+
+class ModbusStatisticsTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusStatisticsTest);
+
+	CPPUNIT_TEST(test_statistics_count_frames_seen_for_any_address);
+	CPPUNIT_TEST(test_statistics_count_addressed_and_broadcast_frames);
+	CPPUNIT_TEST(test_statistics_count_crc_failures);
+	CPPUNIT_TEST(test_statistics_count_exceptions_by_code);
+	CPPUNIT_TEST(test_statistics_count_frames_per_function_code);
+	CPPUNIT_TEST(test_statistics_bin_handler_time_into_log2_buckets);
+	CPPUNIT_TEST(test_statistics_clamp_long_handler_times_into_last_bucket);
+	CPPUNIT_TEST(test_statistics_clear_resets_all_counters);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_statistics_count_frames_seen_for_any_address()
+	{
+		uint8_t ours[] = {0xAA, READ_COILS, 0x00, 0x00, 0x00, 0x01};
+		uint8_t theirs[] = {0xAB, READ_COILS, 0x00, 0x00, 0x00, 0x01};
+
+		modbus_service_message(ours, s_modbus_handler, sizeof(ours), false);
+		modbus_service_message(theirs, s_modbus_handler, sizeof(theirs), false);
+		modbus_service_message(theirs, s_modbus_handler, sizeof(theirs), false);
+
+		MODBUS_STATISTICS statistics = get_statistics();
+		CPPUNIT_ASSERT_EQUAL((uint32_t)3, statistics.frames_seen);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, statistics.frames_addressed);
+	}
+
+	void test_statistics_count_addressed_and_broadcast_frames()
+	{
+		uint8_t message[] = {0xAA, WRITE_HOLDING_REGISTER, 0x00, 0x01, 0x12, 0x34};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+		message[0] = MODBUS_BROADCAST_ADDRESS;
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		MODBUS_STATISTICS statistics = get_statistics();
+		CPPUNIT_ASSERT_EQUAL((uint32_t)3, statistics.frames_seen);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, statistics.frames_addressed);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)2, statistics.frames_broadcast);
+	}
+
+	void test_statistics_count_crc_failures()
+	{
+		uint8_t good[] = {0xAA, READ_COILS, 0x00, 0x00, 0x00, NUMBER_OF_COILS, 0xA5, 0xD3};
+		uint8_t bad[] = {0xAA, READ_COILS, 0x00, 0x00, 0x00, NUMBER_OF_COILS, 0x13, 0xF3};
+
+		modbus_service_message(good, s_modbus_handler, sizeof(good), true);
+		modbus_service_message(bad, s_modbus_handler, sizeof(bad), true);
+
+		MODBUS_STATISTICS statistics = get_statistics();
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, statistics.crc_failures);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, statistics.function_code_frames[modbus_get_statistics_function_code_index(READ_COILS)]);
+	}
+
+	void test_statistics_count_exceptions_by_code()
+	{
+		uint8_t bad_address[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, NUMBER_OF_HOLDING_REGISTERS, 0x00, 0x01};
+		uint8_t no_handler[] = {0xAA, READ_INPUT_REGISTERS, 0x00, 0x00, 0x00, 0x01};
+
+		modbus_service_message(bad_address, s_modbus_handler, sizeof(bad_address), false);
+		modbus_service_message(bad_address, s_modbus_handler, sizeof(bad_address), false);
+		modbus_service_message(no_handler, s_modbus_handler, sizeof(no_handler), false);
+
+		MODBUS_STATISTICS statistics = get_statistics();
+		CPPUNIT_ASSERT_EQUAL((uint32_t)2, statistics.exceptions[EXCEPTION_ILLEGAL_DATA_ADDRESS]);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, statistics.exceptions[EXCEPTION_ILLEGAL_FUNCTION_CODE]);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, statistics.exceptions[EXCEPTION_NONE]);
+	}
+
+	void test_statistics_count_frames_per_function_code()
+	{
+		uint8_t read[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x02};
+		uint8_t write[] = {0xAA, WRITE_HOLDING_REGISTER, 0x00, 0x01, 0x12, 0x34};
+
+		modbus_service_message(read, s_modbus_handler, sizeof(read), false);
+		modbus_service_message(read, s_modbus_handler, sizeof(read), false);
+		modbus_service_message(write, s_modbus_handler, sizeof(write), false);
+
+		MODBUS_STATISTICS statistics = get_statistics();
+		CPPUNIT_ASSERT_EQUAL((uint32_t)2, statistics.function_code_frames[modbus_get_statistics_function_code_index(READ_HOLDING_REGISTERS)]);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, statistics.function_code_frames[modbus_get_statistics_function_code_index(WRITE_HOLDING_REGISTER)]);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, statistics.function_code_frames[modbus_get_statistics_function_code_index(READ_COILS)]);
+	}
+
+	void test_statistics_bin_handler_time_into_log2_buckets()
+	{
+		uint8_t message[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x02};
+		int index = modbus_get_statistics_function_code_index(READ_HOLDING_REGISTERS);
+
+		s_ticks_per_call = 0;
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+		s_ticks_per_call = 1;
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+		s_ticks_per_call = 5;
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+		s_ticks_per_call = 7;
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		MODBUS_STATISTICS statistics = get_statistics();
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, statistics.handler_time_histogram[index][0]);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, statistics.handler_time_histogram[index][1]);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, statistics.handler_time_histogram[index][2]);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)2, statistics.handler_time_histogram[index][3]);
+	}
+
+	void test_statistics_clamp_long_handler_times_into_last_bucket()
+	{
+		uint8_t message[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, 0x00, 0x00, 0x02};
+		int index = modbus_get_statistics_function_code_index(READ_HOLDING_REGISTERS);
+
+		s_ticks_per_call = UINT32_MAX;
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		MODBUS_STATISTICS statistics = get_statistics();
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, statistics.handler_time_histogram[index][MODBUS_STATISTICS_HISTOGRAM_BUCKETS - 1]);
+	}
+
+	void test_statistics_clear_resets_all_counters()
+	{
+		uint8_t message[] = {0xAA, READ_HOLDING_REGISTERS, 0x00, NUMBER_OF_HOLDING_REGISTERS, 0x00, 0x01};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+		modbus_clear_statistics();
+
+		MODBUS_STATISTICS statistics = get_statistics();
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, statistics.frames_seen);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, statistics.frames_addressed);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, statistics.exceptions[EXCEPTION_ILLEGAL_DATA_ADDRESS]);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, statistics.function_code_frames[modbus_get_statistics_function_code_index(READ_HOLDING_REGISTERS)]);
+	}
+
+public:
+	void setUp()
+	{
+		s_modbus_handler.functions.read_coils = read_coils;
+		s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+		s_modbus_handler.functions.write_holding_register = write_holding_register;
+		s_modbus_handler.functions.exception_handler = NULL;
+		s_modbus_handler.data.device_address = 0xAA;
+		s_modbus_handler.data.write_multiple_coils = s_write_multiple_coils_data_buffer;
+		s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+		s_modbus_handler.data.num_coils = NUMBER_OF_COILS;
+		s_modbus_handler.data.num_inputs =  NUMBER_OF_INPUTS;
+		s_modbus_handler.data.num_input_registers = NUMBER_OF_INPUT_REGISTERS;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+
+		s_ticks = 1000;
+		s_ticks_per_call = 0;
+
+		modbus_clear_statistics();
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusStatisticsTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
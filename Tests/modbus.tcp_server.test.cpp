@@ -0,0 +1,400 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_posix_tcp_server.h"
+
+static const uint8_t UNIT_ID = 1;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 16;
+
+/* Registers read by each kind of client, so the service log shows whose request ran */
+static const uint16_t FLOOD_REGISTER = 0;
+static const uint16_t HMI_REGISTER = 1;
+
+static int16_t s_registers[NUMBER_OF_HOLDING_REGISTERS];
+static MODBUS_HANDLER s_modbus_handler;
+
+/* The response being written, for the handler callbacks */
+static uint8_t * s_response;
+static int s_response_length;
+
+static uint16_t s_log[256];
+static int s_n_runs;
+static int s_flood_runs;
+
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+	if (s_n_runs < 256) { s_log[s_n_runs] = reg; }
+	s_n_runs++;
+	if (reg == FLOOD_REGISTER) { s_flood_runs++; }
+
+	s_response_length = modbus_write_read_holding_registers_response(UNIT_ID, s_response, &s_registers[reg], n_registers, false);
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_response_length = modbus_write_exception(UNIT_ID, s_response, exception_code, function_code, false);
+}
+
+static int service(uint8_t const * request, int request_length, uint8_t * response, void *)
+{
+	s_response = response;
+	s_response_length = 0;
+	modbus_service_message(request, s_modbus_handler, request_length, false);
+	return s_response_length;
+}
+
+/* A Modbus TCP client, keeping the first ADUs the server sends back */
+struct client
+{
+	int fd;
+	uint8_t rx[4096];
+	int received;
+	uint8_t adus[32][MODBUS_TCP_SERVER_MAX_ADU];
+	int n_adus;
+	int n_busy;
+};
+
+static uint16_t get_uint16(uint8_t const * bytes)
+{
+	return (uint16_t)((bytes[0] << 8) | bytes[1]);
+}
+
+class ModbusTcpServerTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusTcpServerTest);
+
+	CPPUNIT_TEST(test_requests_on_a_connection_run_in_order);
+	CPPUNIT_TEST(test_full_queue_answers_busy);
+	CPPUNIT_TEST(test_full_queue_pauses_reading);
+	CPPUNIT_TEST(test_turns_alternate_between_connections);
+	CPPUNIT_TEST(test_bad_frame_closes_connection);
+	CPPUNIT_TEST(test_flood_does_not_delay_other_client);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	MODBUS_POSIX_TCP_SERVER m_server;
+	MODBUS_TCP_SERVER_CONFIG m_config;
+	client m_clients[2];
+
+	void start(MODBUS_TCP_OVERLOAD_POLICY overload, uint16_t quantum, uint16_t max_requests_per_poll)
+	{
+		m_config.overload = overload;
+		m_config.quantum = quantum;
+		m_config.max_requests_per_poll = max_requests_per_poll;
+		CPPUNIT_ASSERT(modbus_posix_tcp_server_init(&m_server, &m_config, 0));
+	}
+
+	void connect_client(client& c)
+	{
+		c.fd = socket(AF_INET, SOCK_STREAM, 0);
+		CPPUNIT_ASSERT(c.fd >= 0);
+
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(modbus_posix_tcp_server_get_port(&m_server));
+		CPPUNIT_ASSERT_EQUAL(0, connect(c.fd, (struct sockaddr *)&address, sizeof(address)));
+
+		/* Accept it before anything else happens, so connections take turns in the order they were made */
+		modbus_posix_tcp_server_poll(&m_server, 100);
+	}
+
+	/* Appends a read holding registers ADU to frames and returns its length */
+	static int put_read_request(uint8_t * frames, uint16_t transaction_id, uint16_t reg)
+	{
+		int length = modbus_get_read_holding_registers_request(UNIT_ID, &frames[MODBUS_MBAP_HEADER_SIZE - 1], reg, 1, false);
+		modbus_write_mbap_header(frames, transaction_id, length - 1, UNIT_ID);
+		return length + MODBUS_MBAP_HEADER_SIZE - 1;
+	}
+
+	void send_frames(client& c, uint8_t const * frames, int length)
+	{
+		CPPUNIT_ASSERT_EQUAL((ssize_t)length, send(c.fd, frames, length, 0));
+	}
+
+	void send_reads(client& c, uint16_t first_transaction_id, int n, uint16_t reg)
+	{
+		uint8_t frames[64 * 12];
+		int length = 0;
+
+		for (int i = 0; i < n; i++)
+		{
+			length += put_read_request(&frames[length], first_transaction_id + i, reg);
+		}
+		send_frames(c, frames, length);
+	}
+
+	/* Returns the number of ADUs received */
+	int collect(client& c)
+	{
+		int n_adus = c.n_adus;
+		ssize_t n;
+		while ((n = recv(c.fd, &c.rx[c.received], sizeof(c.rx) - c.received, MSG_DONTWAIT)) > 0) { c.received += n; }
+
+		while (c.received >= MODBUS_MBAP_HEADER_SIZE)
+		{
+			int total = get_uint16(&c.rx[4]) + MODBUS_MBAP_HEADER_SIZE - 1;
+			if (c.received < total) { break; }
+
+			if (c.n_adus < 32) { memcpy(c.adus[c.n_adus], c.rx, total); }
+			if (c.rx[7] & 0x80) { c.n_busy++; }
+			c.n_adus++;
+
+			memmove(c.rx, &c.rx[total], c.received - total);
+			c.received -= total;
+		}
+
+		return c.n_adus - n_adus;
+	}
+
+	void run_until(int expected_0, int expected_1 = 0)
+	{
+		for (int i = 0; i < 5000; i++)
+		{
+			modbus_posix_tcp_server_poll(&m_server, 1);
+
+			if (m_clients[0].fd >= 0) { collect(m_clients[0]); }
+			if (m_clients[1].fd >= 0) { collect(m_clients[1]); }
+
+			if ((m_clients[0].n_adus >= expected_0) && (m_clients[1].n_adus >= expected_1)) { break; }
+		}
+
+		CPPUNIT_ASSERT_EQUAL(expected_0, m_clients[0].n_adus);
+		CPPUNIT_ASSERT_EQUAL(expected_1, m_clients[1].n_adus);
+	}
+
+	void assert_response(uint8_t const * adu, uint16_t transaction_id, int16_t value)
+	{
+		CPPUNIT_ASSERT_EQUAL(transaction_id, get_uint16(&adu[0]));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0, get_uint16(&adu[2]));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)5, get_uint16(&adu[4]));
+		CPPUNIT_ASSERT_EQUAL(UNIT_ID, adu[6]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)READ_HOLDING_REGISTERS, adu[7]);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)value, get_uint16(&adu[9]));
+	}
+
+	void test_requests_on_a_connection_run_in_order()
+	{
+		start(MODBUS_TCP_OVERLOAD_BUSY, 0, 0);
+		connect_client(m_clients[0]);
+
+		s_registers[2] = 0x1234;
+		s_registers[3] = 0x5678;
+
+		uint8_t frames[36];
+		int length = put_read_request(frames, 0x0A01, 2);
+		length += put_read_request(&frames[length], 0x0A02, 3);
+		length += put_read_request(&frames[length], 0x0A03, 2);
+		send_frames(m_clients[0], frames, length);
+
+		run_until(3);
+
+		assert_response(m_clients[0].adus[0], 0x0A01, 0x1234);
+		assert_response(m_clients[0].adus[1], 0x0A02, 0x5678);
+		assert_response(m_clients[0].adus[2], 0x0A03, 0x1234);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)3, m_server.counters.responses);
+	}
+
+	void test_full_queue_answers_busy()
+	{
+		static const int N_REQUESTS = 20;
+		static const int N_BUSY = N_REQUESTS - MODBUS_TCP_SERVER_QUEUE_SIZE;
+
+		start(MODBUS_TCP_OVERLOAD_BUSY, 0, 1);
+		connect_client(m_clients[0]);
+
+		send_reads(m_clients[0], 0, N_REQUESTS, HMI_REGISTER);
+
+		run_until(N_REQUESTS);
+
+		/* The requests that did not fit are refused as they arrive, ahead of the queued ones */
+		for (int i = 0; i < N_BUSY; i++)
+		{
+			uint8_t const * adu = m_clients[0].adus[i];
+			CPPUNIT_ASSERT_EQUAL((uint16_t)(MODBUS_TCP_SERVER_QUEUE_SIZE + i), get_uint16(&adu[0]));
+			CPPUNIT_ASSERT_EQUAL((uint8_t)(READ_HOLDING_REGISTERS | 0x80), adu[7]);
+			CPPUNIT_ASSERT_EQUAL((uint8_t)EXCEPTION_SLAVE_DEVICE_BUSY, adu[8]);
+		}
+
+		for (int i = 0; i < MODBUS_TCP_SERVER_QUEUE_SIZE; i++)
+		{
+			assert_response(m_clients[0].adus[N_BUSY + i], i, 0);
+		}
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)N_BUSY, m_server.counters.busy);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)MODBUS_TCP_SERVER_QUEUE_SIZE, m_server.counters.requests);
+	}
+
+	void test_full_queue_pauses_reading()
+	{
+		static const int N_REQUESTS = 20;
+
+		start(MODBUS_TCP_OVERLOAD_PAUSE, 0, 1);
+		connect_client(m_clients[0]);
+
+		send_reads(m_clients[0], 0, N_REQUESTS, HMI_REGISTER);
+
+		run_until(N_REQUESTS);
+
+		for (int i = 0; i < N_REQUESTS; i++)
+		{
+			assert_response(m_clients[0].adus[i], i, 0);
+		}
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, m_server.counters.busy);
+		CPPUNIT_ASSERT(m_server.counters.pauses > 0);
+		CPPUNIT_ASSERT(!m_server.connections[0].paused);
+	}
+
+	void test_turns_alternate_between_connections()
+	{
+		/* Credit for a single request per turn */
+		start(MODBUS_TCP_OVERLOAD_BUSY, 1, 0);
+		connect_client(m_clients[0]);
+		connect_client(m_clients[1]);
+
+		send_reads(m_clients[0], 0, 4, FLOOD_REGISTER);
+		send_reads(m_clients[1], 0, 2, HMI_REGISTER);
+
+		run_until(4, 2);
+
+		uint16_t expected[] = {FLOOD_REGISTER, HMI_REGISTER, FLOOD_REGISTER, HMI_REGISTER, FLOOD_REGISTER, FLOOD_REGISTER};
+		CPPUNIT_ASSERT_EQUAL(6, s_n_runs);
+		for (int i = 0; i < 6; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(expected[i], s_log[i]);
+		}
+	}
+
+	void test_bad_frame_closes_connection()
+	{
+		start(MODBUS_TCP_OVERLOAD_BUSY, 0, 0);
+		connect_client(m_clients[0]);
+
+		uint8_t frame[] = {0x00, 0x01, 0x00, 0x00, 0x00, 0x01, UNIT_ID};
+		send_frames(m_clients[0], frame, sizeof(frame));
+
+		for (int i = 0; (i < 100) && (m_server.connections[0].fd >= 0); i++)
+		{
+			modbus_posix_tcp_server_poll(&m_server, 1);
+		}
+
+		CPPUNIT_ASSERT_EQUAL(-1, m_server.connections[0].fd);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1, m_server.counters.bad_frames);
+	}
+
+	/*
+	 * Load test: one client keeps far more requests in flight than its queue holds, while
+	 * another polls one request at a time. The polling client's wait, counted in flood
+	 * requests run while it waits, stays within one turn of the flooder however deep the
+	 * flooder's pipeline is.
+	 */
+	void test_flood_does_not_delay_other_client()
+	{
+		static const int FLOOD_DEPTH = 64;
+		static const int N_POLLS = 200;
+
+		/* A flood request and its response, in bytes */
+		static const int FLOOD_COST = 12 + 11;
+		static const int MAX_TURN = (MODBUS_TCP_SERVER_QUANTUM + FLOOD_COST - 1) / FLOOD_COST;
+
+		start(MODBUS_TCP_OVERLOAD_BUSY, 0, 4);
+		connect_client(m_clients[0]);
+		connect_client(m_clients[1]);
+
+		client& flooder = m_clients[0];
+		client& hmi = m_clients[1];
+
+		int in_flight = 0;
+		int polls = 0;
+		int worst_wait = 0;
+		int sent_at = s_flood_runs;
+		uint16_t transaction_id = 0;
+
+		send_reads(hmi, 0, 1, HMI_REGISTER);
+
+		for (int i = 0; (i < 100000) && (polls < N_POLLS); i++)
+		{
+			if (in_flight < FLOOD_DEPTH)
+			{
+				send_reads(flooder, transaction_id, FLOOD_DEPTH - in_flight, FLOOD_REGISTER);
+				transaction_id += FLOOD_DEPTH - in_flight;
+				in_flight = FLOOD_DEPTH;
+			}
+
+			modbus_posix_tcp_server_poll(&m_server, 1);
+
+			in_flight -= collect(flooder);
+
+			if (collect(hmi) > 0)
+			{
+				int wait = s_flood_runs - sent_at;
+				if (wait > worst_wait) { worst_wait = wait; }
+
+				polls++;
+				sent_at = s_flood_runs;
+				send_reads(hmi, polls, 1, HMI_REGISTER);
+			}
+		}
+
+		CPPUNIT_ASSERT_EQUAL(N_POLLS, polls);
+		CPPUNIT_ASSERT(worst_wait <= MAX_TURN);
+		CPPUNIT_ASSERT_EQUAL(0, hmi.n_busy);
+
+		/* The flooder is held back, not starved */
+		CPPUNIT_ASSERT(flooder.n_busy > 0);
+		CPPUNIT_ASSERT(s_flood_runs > N_POLLS);
+	}
+
+public:
+	void setUp()
+	{
+		memset(&s_modbus_handler, 0, sizeof(s_modbus_handler));
+		s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+		s_modbus_handler.data.device_address = UNIT_ID;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+
+		memset(s_registers, 0, sizeof(s_registers));
+		s_n_runs = 0;
+		s_flood_runs = 0;
+
+		memset(&m_config, 0, sizeof(m_config));
+		m_config.service = service;
+
+		memset(m_clients, 0, sizeof(m_clients));
+		m_clients[0].fd = -1;
+		m_clients[1].fd = -1;
+	}
+
+	void tearDown()
+	{
+		if (m_clients[0].fd >= 0) { close(m_clients[0].fd); }
+		if (m_clients[1].fd >= 0) { close(m_clients[1].fd); }
+		modbus_posix_tcp_server_close(&m_server);
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusTcpServerTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
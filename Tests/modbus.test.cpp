@@ -145,6 +145,7 @@ class ModbusTest : public CppUnit::TestFixture  {
 	CPPUNIT_TEST(test_service_with_wrong_address_does_not_call_any_functions);
 	CPPUNIT_TEST(test_service_with_check_crc_enabled_does_not_handle_message_with_invalid_crc);
 	CPPUNIT_TEST(test_service_with_check_crc_enabled_handles_message_with_valid_crc);
+	CPPUNIT_TEST(test_validate_message_crc_rejects_runt_frames);
 
 	CPPUNIT_TEST(test_service_with_read_coils_message);
 	CPPUNIT_TEST(test_service_with_read_discrete_inputs_message);
@@ -196,6 +197,19 @@ class ModbusTest : public CppUnit::TestFixture  {
 		CPPUNIT_ASSERT_EQUAL((uint16_t)NUMBER_OF_COILS, s_read_coils_data.n_coils);
 	}
 
+	void test_validate_message_crc_rejects_runt_frames()
+	{
+		uint8_t message[] = {(uint8_t)0xAA, (uint8_t)READ_COILS, (uint8_t)0xA5};
+
+		CPPUNIT_ASSERT(!modbus_validate_message_crc(message, 0));
+		CPPUNIT_ASSERT(!modbus_validate_message_crc(message, 1));
+		CPPUNIT_ASSERT(!modbus_validate_message_crc(message, 3));
+		CPPUNIT_ASSERT(!modbus_validate_message_crc(NULL, 8));
+
+		modbus_service_message(message, s_modbus_handler, 3, true);
+		CPPUNIT_ASSERT_EQUAL(0, s_last_function_code);
+	}
+
 	void test_service_with_read_coils_message()
 	{
 		uint8_t message[] = {(uint8_t)0xAA, (uint8_t)READ_COILS, (uint8_t)0x00, (uint8_t)0x00, (uint8_t)0x00, (uint8_t)NUMBER_OF_COILS};
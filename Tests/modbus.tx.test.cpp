@@ -0,0 +1,187 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+
+/* Port events, in order: 'E'/'D' for driver enable on/off, 'S' for a started frame, 'C' for a completion callback */
+static char s_events[64];
+static int s_n_events;
+
+static uint8_t const * s_started[16];
+static int s_n_started;
+static int s_completed_context[16];
+static int s_n_completed;
+
+static MODBUS_TX_QUEUE s_queue;
+static bool s_complete_immediately;
+
+static void log_event(char event)
+{
+	s_events[s_n_events++] = event;
+	s_events[s_n_events] = '\0';
+}
+
+static void start_transmit(void * port, uint8_t const * data, uint16_t)
+{
+	CPPUNIT_ASSERT(port == &s_queue);
+	log_event('S');
+	s_started[s_n_started++] = data;
+
+	/* Like a transmit complete interrupt that fires before start_transmit returns */
+	if (s_complete_immediately) { modbus_tx_queue_complete(&s_queue); }
+}
+
+static void set_driver_enable(void *, bool enable)
+{
+	log_event(enable ? 'E' : 'D');
+}
+
+static void on_complete(void * context, uint8_t const *, uint16_t)
+{
+	log_event('C');
+	s_completed_context[s_n_completed++] = *(int *)context;
+}
+
+class ModbusTxTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusTxTest);
+
+	CPPUNIT_TEST(test_send_starts_idle_transmitter);
+	CPPUNIT_TEST(test_driver_enable_drops_before_callback);
+	CPPUNIT_TEST(test_queued_frames_are_sent_in_order);
+	CPPUNIT_TEST(test_full_queue_rejects_frames);
+	CPPUNIT_TEST(test_null_queue_is_ignored);
+	CPPUNIT_TEST(test_completion_inside_start_transmit);
+	CPPUNIT_TEST(test_send_response_from_builder);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	uint8_t m_frames[4][8];
+	int m_contexts[4];
+
+	void test_send_starts_idle_transmitter()
+	{
+		CPPUNIT_ASSERT(modbus_tx_queue_idle(&s_queue));
+		CPPUNIT_ASSERT(modbus_tx_queue_send(&s_queue, m_frames[0], 8, on_complete, &m_contexts[0]));
+
+		CPPUNIT_ASSERT_EQUAL(std::string("ES"), std::string(s_events));
+		CPPUNIT_ASSERT(s_started[0] == m_frames[0]);
+		CPPUNIT_ASSERT(!modbus_tx_queue_idle(&s_queue));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)1, modbus_tx_queue_count(&s_queue));
+	}
+
+	void test_driver_enable_drops_before_callback()
+	{
+		modbus_tx_queue_send(&s_queue, m_frames[0], 8, on_complete, &m_contexts[0]);
+		modbus_tx_queue_complete(&s_queue);
+
+		CPPUNIT_ASSERT_EQUAL(std::string("ESDC"), std::string(s_events));
+		CPPUNIT_ASSERT(modbus_tx_queue_idle(&s_queue));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, modbus_tx_queue_count(&s_queue));
+	}
+
+	void test_queued_frames_are_sent_in_order()
+	{
+		modbus_tx_queue_send(&s_queue, m_frames[0], 8, on_complete, &m_contexts[0]);
+		modbus_tx_queue_send(&s_queue, m_frames[1], 8, on_complete, &m_contexts[1]);
+		modbus_tx_queue_send(&s_queue, m_frames[2], 8, NULL, NULL);
+
+		CPPUNIT_ASSERT_EQUAL(1, s_n_started);
+
+		modbus_tx_queue_complete(&s_queue);
+		modbus_tx_queue_complete(&s_queue);
+		modbus_tx_queue_complete(&s_queue);
+
+		CPPUNIT_ASSERT_EQUAL(std::string("ESDCESDCESD"), std::string(s_events));
+		CPPUNIT_ASSERT(s_started[0] == m_frames[0]);
+		CPPUNIT_ASSERT(s_started[1] == m_frames[1]);
+		CPPUNIT_ASSERT(s_started[2] == m_frames[2]);
+		CPPUNIT_ASSERT_EQUAL(2, s_n_completed);
+		CPPUNIT_ASSERT_EQUAL(0, s_completed_context[0]);
+		CPPUNIT_ASSERT_EQUAL(1, s_completed_context[1]);
+		CPPUNIT_ASSERT(modbus_tx_queue_idle(&s_queue));
+	}
+
+	void test_full_queue_rejects_frames()
+	{
+		for (int i = 0; i < (MODBUS_TX_QUEUE_SIZE - 1); i++)
+		{
+			CPPUNIT_ASSERT(modbus_tx_queue_send(&s_queue, m_frames[i], 8, NULL, NULL));
+		}
+		CPPUNIT_ASSERT(!modbus_tx_queue_send(&s_queue, m_frames[3], 8, NULL, NULL));
+
+		modbus_tx_queue_complete(&s_queue);
+		CPPUNIT_ASSERT(modbus_tx_queue_send(&s_queue, m_frames[3], 8, NULL, NULL));
+	}
+
+	void test_null_queue_is_ignored()
+	{
+		CPPUNIT_ASSERT(!modbus_tx_queue_send(NULL, m_frames[0], 8, NULL, NULL));
+		modbus_tx_queue_complete(NULL);
+
+		CPPUNIT_ASSERT_EQUAL(std::string(""), std::string(s_events));
+	}
+
+	void test_completion_inside_start_transmit()
+	{
+		s_complete_immediately = true;
+
+		modbus_tx_queue_send(&s_queue, m_frames[0], 8, on_complete, &m_contexts[0]);
+		modbus_tx_queue_send(&s_queue, m_frames[1], 8, on_complete, &m_contexts[1]);
+
+		CPPUNIT_ASSERT_EQUAL(std::string("ESDCESDC"), std::string(s_events));
+		CPPUNIT_ASSERT(modbus_tx_queue_idle(&s_queue));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, modbus_tx_queue_count(&s_queue));
+	}
+
+	void test_send_response_from_builder()
+	{
+		uint8_t response[16];
+		int16_t registers[] = {0x0102, 0x0304};
+		int length = modbus_write_read_holding_registers_response(TEST_ADDRESS, response, registers, 2);
+
+		CPPUNIT_ASSERT(modbus_tx_queue_send(&s_queue, response, length, on_complete, &m_contexts[0]));
+		CPPUNIT_ASSERT(s_started[0] == response);
+
+		modbus_tx_queue_complete(&s_queue);
+		CPPUNIT_ASSERT_EQUAL(1, s_n_completed);
+	}
+
+public:
+	void setUp()
+	{
+		modbus_tx_queue_init(&s_queue, start_transmit, set_driver_enable, &s_queue);
+
+		for (int i = 0; i < 4; i++)
+		{
+			memset(m_frames[i], i, sizeof(m_frames[i]));
+			m_contexts[i] = i;
+		}
+
+		s_events[0] = '\0';
+		s_n_events = 0;
+		s_n_started = 0;
+		s_n_completed = 0;
+		s_complete_immediately = false;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusTxTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
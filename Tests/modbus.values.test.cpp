@@ -0,0 +1,219 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+
+static const uint8_t TEST_ADDRESS = 0x65;
+
+static void assert_bytes(uint8_t const * expected, uint8_t const * actual, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		CPPUNIT_ASSERT_EQUAL((int)expected[i], (int)actual[i]);
+	}
+}
+
+class ModbusValuesTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusValuesTest);
+
+	CPPUNIT_TEST(test_write_float32_in_each_word_order);
+	CPPUNIT_TEST(test_write_int32_in_each_word_order);
+	CPPUNIT_TEST(test_write_int64_in_each_word_order);
+	CPPUNIT_TEST(test_write_float64_big_endian);
+	CPPUNIT_TEST(test_read_values_reverses_write_values);
+	CPPUNIT_TEST(test_values_to_registers);
+	CPPUNIT_TEST(test_registers_to_values);
+	CPPUNIT_TEST(test_read_holding_registers_response_with_float32_values);
+	CPPUNIT_TEST(test_read_input_registers_response_with_uint32_values);
+	CPPUNIT_TEST(test_read_holding_registers_response_refuses_more_than_125_registers);
+	CPPUNIT_TEST(test_read_input_registers_response_refuses_more_than_125_registers);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_write_float32_in_each_word_order()
+	{
+		uint8_t buffer[4];
+		float value = 1.0f;
+
+		uint8_t abcd[] = {0x3F, 0x80, 0x00, 0x00};
+		CPPUNIT_ASSERT_EQUAL(4, modbus_write_values(buffer, &value, 1, WORD_ORDER_ABCD));
+		assert_bytes(abcd, buffer, 4);
+
+		uint8_t cdab[] = {0x00, 0x00, 0x3F, 0x80};
+		modbus_write_values(buffer, &value, 1, WORD_ORDER_CDAB);
+		assert_bytes(cdab, buffer, 4);
+
+		uint8_t badc[] = {0x80, 0x3F, 0x00, 0x00};
+		modbus_write_values(buffer, &value, 1, WORD_ORDER_BADC);
+		assert_bytes(badc, buffer, 4);
+
+		uint8_t dcba[] = {0x00, 0x00, 0x80, 0x3F};
+		modbus_write_values(buffer, &value, 1, WORD_ORDER_DCBA);
+		assert_bytes(dcba, buffer, 4);
+	}
+
+	void test_write_int32_in_each_word_order()
+	{
+		uint8_t buffer[8];
+		int32_t values[] = {0x11223344, -2};
+
+		uint8_t abcd[] = {0x11, 0x22, 0x33, 0x44, 0xFF, 0xFF, 0xFF, 0xFE};
+		CPPUNIT_ASSERT_EQUAL(8, modbus_write_values(buffer, values, 2, WORD_ORDER_ABCD));
+		assert_bytes(abcd, buffer, 8);
+
+		uint8_t cdab[] = {0x33, 0x44, 0x11, 0x22, 0xFF, 0xFE, 0xFF, 0xFF};
+		modbus_write_values(buffer, values, 2, WORD_ORDER_CDAB);
+		assert_bytes(cdab, buffer, 8);
+
+		uint8_t badc[] = {0x22, 0x11, 0x44, 0x33, 0xFF, 0xFF, 0xFE, 0xFF};
+		modbus_write_values(buffer, values, 2, WORD_ORDER_BADC);
+		assert_bytes(badc, buffer, 8);
+
+		uint8_t dcba[] = {0x44, 0x33, 0x22, 0x11, 0xFE, 0xFF, 0xFF, 0xFF};
+		modbus_write_values(buffer, values, 2, WORD_ORDER_DCBA);
+		assert_bytes(dcba, buffer, 8);
+	}
+
+	void test_write_int64_in_each_word_order()
+	{
+		uint8_t buffer[8];
+		int64_t value = 0x0102030405060708LL;
+
+		uint8_t abcd[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+		CPPUNIT_ASSERT_EQUAL(8, modbus_write_values(buffer, &value, 1, WORD_ORDER_ABCD));
+		assert_bytes(abcd, buffer, 8);
+
+		uint8_t cdab[] = {0x07, 0x08, 0x05, 0x06, 0x03, 0x04, 0x01, 0x02};
+		modbus_write_values(buffer, &value, 1, WORD_ORDER_CDAB);
+		assert_bytes(cdab, buffer, 8);
+
+		uint8_t badc[] = {0x02, 0x01, 0x04, 0x03, 0x06, 0x05, 0x08, 0x07};
+		modbus_write_values(buffer, &value, 1, WORD_ORDER_BADC);
+		assert_bytes(badc, buffer, 8);
+
+		uint8_t dcba[] = {0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01};
+		modbus_write_values(buffer, &value, 1, WORD_ORDER_DCBA);
+		assert_bytes(dcba, buffer, 8);
+	}
+
+	void test_write_float64_big_endian()
+	{
+		uint8_t buffer[8];
+		double value = -2.5;
+
+		uint8_t expected[] = {0xC0, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+		CPPUNIT_ASSERT_EQUAL(8, modbus_write_values(buffer, &value, 1, WORD_ORDER_ABCD));
+		assert_bytes(expected, buffer, 8);
+	}
+
+	void test_read_values_reverses_write_values()
+	{
+		uint8_t buffer[32];
+		MODBUS_WORD_ORDER orders[] = {WORD_ORDER_ABCD, WORD_ORDER_CDAB, WORD_ORDER_BADC, WORD_ORDER_DCBA};
+
+		for (int o = 0; o < 4; o++)
+		{
+			float floats[] = {3.25f, -1e-3f, 12345.5f};
+			float read_floats[3];
+			modbus_write_values(buffer, floats, 3, orders[o]);
+			CPPUNIT_ASSERT_EQUAL(12, modbus_read_values(buffer, read_floats, 3, orders[o]));
+			CPPUNIT_ASSERT(memcmp(floats, read_floats, sizeof(floats)) == 0);
+
+			uint64_t longs[] = {0xFEDCBA9876543210ULL, 1ULL, 0x8000000000000000ULL, 0ULL};
+			uint64_t read_longs[4];
+			modbus_write_values(buffer, longs, 4, orders[o]);
+			CPPUNIT_ASSERT_EQUAL(32, modbus_read_values(buffer, read_longs, 4, orders[o]));
+			CPPUNIT_ASSERT(memcmp(longs, read_longs, sizeof(longs)) == 0);
+		}
+	}
+
+	void test_values_to_registers()
+	{
+		int16_t registers[4];
+		uint32_t values[] = {0x11223344, 0xA0B0C0D0};
+
+		modbus_values_to_registers(registers, values, 2, WORD_ORDER_CDAB);
+
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x3344, registers[0]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x1122, registers[1]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0xC0D0, registers[2]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0xA0B0, registers[3]);
+	}
+
+	void test_registers_to_values()
+	{
+		int16_t registers[] = {(int16_t)0x803F, 0x0000, 0x2040, 0x0000};
+		float values[2];
+
+		modbus_registers_to_values(values, registers, 2, WORD_ORDER_BADC);
+
+		CPPUNIT_ASSERT_EQUAL(1.0f, values[0]);
+		CPPUNIT_ASSERT_EQUAL(2.5f, values[1]);
+	}
+
+	void test_read_holding_registers_response_with_float32_values()
+	{
+		uint8_t buffer[64];
+		float values[] = {1.0f, -2.0f};
+
+		int bytes_written = modbus_write_read_holding_registers_response(TEST_ADDRESS, buffer, values, 2, WORD_ORDER_ABCD);
+
+		uint8_t expected[] = {TEST_ADDRESS, READ_HOLDING_REGISTERS, 8, 0x3F, 0x80, 0x00, 0x00, 0xC0, 0x00, 0x00, 0x00};
+		CPPUNIT_ASSERT_EQUAL((int)sizeof(expected) + 2, bytes_written);
+		assert_bytes(expected, buffer, sizeof(expected));
+		CPPUNIT_ASSERT(modbus_validate_message_crc(buffer, bytes_written));
+	}
+
+	void test_read_input_registers_response_with_uint32_values()
+	{
+		uint8_t buffer[64];
+		uint32_t value = 0x00010002;
+
+		int bytes_written = modbus_write_read_input_registers_response(TEST_ADDRESS, buffer, &value, 1, WORD_ORDER_CDAB, false);
+
+		uint8_t expected[] = {TEST_ADDRESS, READ_INPUT_REGISTERS, 4, 0x00, 0x02, 0x00, 0x01};
+		CPPUNIT_ASSERT_EQUAL((int)sizeof(expected), bytes_written);
+		assert_bytes(expected, buffer, sizeof(expected));
+	}
+
+	void test_read_holding_registers_response_refuses_more_than_125_registers()
+	{
+		uint8_t buffer[256];
+		float values[63] = {0};
+
+		CPPUNIT_ASSERT_EQUAL(3 + 248 + 2, modbus_write_read_holding_registers_response(TEST_ADDRESS, buffer, values, 62, WORD_ORDER_ABCD));
+		CPPUNIT_ASSERT_EQUAL(248, (int)buffer[2]);
+
+		buffer[0] = 0x00;
+		CPPUNIT_ASSERT_EQUAL(0, modbus_write_read_holding_registers_response(TEST_ADDRESS, buffer, values, 63, WORD_ORDER_ABCD));
+		CPPUNIT_ASSERT_EQUAL(0, (int)buffer[0]);
+	}
+
+	void test_read_input_registers_response_refuses_more_than_125_registers()
+	{
+		uint8_t buffer[256];
+		double values[32] = {0};
+
+		CPPUNIT_ASSERT_EQUAL(3 + 248, modbus_write_read_input_registers_response(TEST_ADDRESS, buffer, values, 31, WORD_ORDER_ABCD, false));
+		CPPUNIT_ASSERT_EQUAL(0, modbus_write_read_input_registers_response(TEST_ADDRESS, buffer, values, 32, WORD_ORDER_ABCD, false));
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusValuesTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
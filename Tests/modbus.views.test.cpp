@@ -0,0 +1,251 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "modbus.h"
+#include "modbus_server.h"
+#include "modbus_map.h"
+
+static const uint8_t TEST_ADDRESS = 0xAA;
+static const uint16_t NUMBER_OF_COILS = 32;
+static const uint16_t NUMBER_OF_HOLDING_REGISTERS = 16;
+static const uint16_t RING_SIZE = 32;
+
+/* Registers kept in wire order, as an application mirroring the frame would */
+static uint8_t s_wire_registers[NUMBER_OF_HOLDING_REGISTERS * 2];
+static bool s_coils[NUMBER_OF_COILS];
+
+static MODBUS_HANDLER s_modbus_handler;
+
+static uint8_t s_ring[RING_SIZE];
+
+static uint8_t const * s_view_data;
+static uint16_t s_read_start_reg;
+static uint16_t s_read_n_registers;
+static MODBUS_EXCEPTION_CODES s_last_exception_code;
+
+static void write_multiple_coils_view(uint16_t first_coil, MODBUS_COIL_VIEW const * values)
+{
+	s_view_data = values->data;
+	for (uint16_t i = 0; i < values->n_coils; i++)
+	{
+		s_coils[first_coil + i] = modbus_coil_view_get(values, i);
+	}
+}
+
+static void write_holding_registers_view(uint16_t first_reg, MODBUS_REGISTER_VIEW const * values)
+{
+	s_view_data = values->data;
+	memcpy(&s_wire_registers[first_reg * 2], values->data, values->n_registers * 2);
+}
+
+static void read_write_registers_view(uint16_t read_start_reg, uint16_t n_registers, uint16_t write_start_reg, MODBUS_REGISTER_VIEW const * values)
+{
+	s_read_start_reg = read_start_reg;
+	s_read_n_registers = n_registers;
+	write_holding_registers_view(write_start_reg, values);
+}
+
+static void exception_handler(uint8_t, MODBUS_EXCEPTION_CODES exception_code)
+{
+	s_last_exception_code = exception_code;
+}
+
+struct ViewDevice
+{
+	static void write_holding_registers_view(uint16_t first_reg, MODBUS_REGISTER_VIEW const * values) { ::write_holding_registers_view(first_reg, values); }
+	static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code) { ::exception_handler(function_code, exception_code); }
+};
+
+typedef modbus::RegisterMap<ViewDevice, modbus::HoldingRegisters<0, NUMBER_OF_HOLDING_REGISTERS> > VIEW_MAP;
+
+static uint16_t get_wire_register(uint16_t reg)
+{
+	return (uint16_t)((s_wire_registers[reg * 2] << 8) | s_wire_registers[(reg * 2) + 1]);
+}
+
+class ModbusViewsTest : public CppUnit::TestFixture  {
+
+	CPPUNIT_TEST_SUITE(ModbusViewsTest);
+
+	CPPUNIT_TEST(test_register_view_accessors);
+	CPPUNIT_TEST(test_coil_view_accessors);
+	CPPUNIT_TEST(test_write_holding_registers_view_points_into_frame);
+	CPPUNIT_TEST(test_write_multiple_coils_view_points_into_frame);
+	CPPUNIT_TEST(test_read_write_registers_view);
+	CPPUNIT_TEST(test_view_needs_no_write_buffer);
+	CPPUNIT_TEST(test_view_of_wrapped_payload_is_contiguous);
+	CPPUNIT_TEST(test_map_handler_passes_view);
+
+	CPPUNIT_TEST_SUITE_END();
+
+	void test_register_view_accessors()
+	{
+		uint8_t data[] = {0x12, 0x34, 0xFF, 0xFE};
+		MODBUS_REGISTER_VIEW view = {data, 2};
+		int16_t values[2];
+
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x1234, modbus_register_view_get(&view, 0));
+		CPPUNIT_ASSERT_EQUAL((int16_t)-2, modbus_register_view_get(&view, 1));
+
+		modbus_register_view_copy(&view, values);
+		CPPUNIT_ASSERT_EQUAL((int16_t)0x1234, values[0]);
+		CPPUNIT_ASSERT_EQUAL((int16_t)-2, values[1]);
+	}
+
+	void test_coil_view_accessors()
+	{
+		uint8_t data[] = {0xCD, 0x01};
+		MODBUS_COIL_VIEW view = {data, 10};
+		bool values[10];
+		bool expected[] = {true, false, true, true, false, false, true, true, true, false};
+
+		modbus_coil_view_copy(&view, values);
+
+		for (uint16_t i = 0; i < 10; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(expected[i], modbus_coil_view_get(&view, i));
+			CPPUNIT_ASSERT_EQUAL(expected[i], values[i]);
+		}
+	}
+
+	void test_write_holding_registers_view_points_into_frame()
+	{
+		uint8_t message[32];
+		int16_t values[] = {0x0102, (int16_t)0x8304, 0x0506};
+		int length = modbus_write_write_holding_registers_request(TEST_ADDRESS, message, 4, 3, values);
+
+		modbus_service_message(message, s_modbus_handler, length, true);
+
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, s_last_exception_code);
+		CPPUNIT_ASSERT(s_view_data == &message[7]);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x0102, get_wire_register(4));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x8304, get_wire_register(5));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x0506, get_wire_register(6));
+	}
+
+	void test_write_multiple_coils_view_points_into_frame()
+	{
+		uint8_t message[16];
+		bool values[] = {true, false, true, true, false, false, true, true, true};
+		int length = modbus_write_write_multiple_coils_request(TEST_ADDRESS, message, 3, 9, values);
+
+		modbus_service_message(message, s_modbus_handler, length, true);
+
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, s_last_exception_code);
+		CPPUNIT_ASSERT(s_view_data == &message[7]);
+		for (uint16_t i = 0; i < 9; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(values[i], s_coils[3 + i]);
+		}
+		CPPUNIT_ASSERT(!s_coils[12]);
+	}
+
+	void test_read_write_registers_view()
+	{
+		uint8_t message[] = {TEST_ADDRESS, READ_WRITE_REGISTERS, 0x00, 0x01, 0x00, 0x02, 0x00, 0x08, 0x00, 0x02, 0x04, 0xAB, 0xCD, 0x00, 0x11};
+
+		modbus_service_message(message, s_modbus_handler, sizeof(message), false);
+
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, s_last_exception_code);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)1, s_read_start_reg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)2, s_read_n_registers);
+		CPPUNIT_ASSERT(s_view_data == &message[11]);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0xABCD, get_wire_register(8));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x0011, get_wire_register(9));
+	}
+
+	void test_view_needs_no_write_buffer()
+	{
+		uint8_t message[16];
+		int16_t values[] = {0x7FFF};
+		int length = modbus_write_write_holding_registers_request(TEST_ADDRESS, message, 0, 1, values);
+
+		CPPUNIT_ASSERT(s_modbus_handler.data.write_holding_registers == NULL);
+		CPPUNIT_ASSERT(s_modbus_handler.functions.write_holding_registers == NULL);
+
+		modbus_service_message(message, s_modbus_handler, length, true);
+
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, s_last_exception_code);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x7FFF, get_wire_register(0));
+	}
+
+	void test_view_of_wrapped_payload_is_contiguous()
+	{
+		uint8_t message[32];
+		int16_t values[] = {0x1111, 0x2222, 0x3333, 0x4444};
+		int length = modbus_write_write_holding_registers_request(TEST_ADDRESS, message, 2, 4, values);
+
+		/* Wrap the ring in the middle of the second register */
+		uint16_t start = RING_SIZE - 10;
+		for (int i = 0; i < length; i++)
+		{
+			s_ring[(start + i) % RING_SIZE] = message[i];
+		}
+
+		MODBUS_SPLIT_FRAME frame;
+		modbus_get_ring_frame(s_ring, RING_SIZE, start, length, &frame);
+		modbus_service_split_message(&frame, s_modbus_handler, true);
+
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, s_last_exception_code);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x1111, get_wire_register(2));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x2222, get_wire_register(3));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x3333, get_wire_register(4));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x4444, get_wire_register(5));
+	}
+
+	void test_map_handler_passes_view()
+	{
+		uint8_t message[32];
+		int16_t values[] = {0x0A0B, 0x0C0D};
+		int length = modbus_write_write_holding_registers_request(TEST_ADDRESS, message, 14, 2, values);
+
+		CPPUNIT_ASSERT(modbus::MapHandler<VIEW_MAP>::writes_holding_registers);
+
+		modbus::service_message<VIEW_MAP>(message, TEST_ADDRESS, length, true);
+
+		CPPUNIT_ASSERT_EQUAL(EXCEPTION_NONE, s_last_exception_code);
+		CPPUNIT_ASSERT(s_view_data == &message[7]);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x0A0B, get_wire_register(14));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x0C0D, get_wire_register(15));
+	}
+
+public:
+	void setUp()
+	{
+		memset(&s_modbus_handler, 0, sizeof(s_modbus_handler));
+		memset(s_wire_registers, 0, sizeof(s_wire_registers));
+		memset(s_coils, 0, sizeof(s_coils));
+
+		s_modbus_handler.functions.write_multiple_coils_view = write_multiple_coils_view;
+		s_modbus_handler.functions.write_holding_registers_view = write_holding_registers_view;
+		s_modbus_handler.functions.read_write_registers_view = read_write_registers_view;
+		s_modbus_handler.functions.exception_handler = exception_handler;
+
+		s_modbus_handler.data.device_address = TEST_ADDRESS;
+		s_modbus_handler.data.num_coils = NUMBER_OF_COILS;
+		s_modbus_handler.data.num_holding_registers = NUMBER_OF_HOLDING_REGISTERS;
+
+		s_view_data = NULL;
+		s_read_start_reg = 0;
+		s_read_n_registers = 0;
+		s_last_exception_code = EXCEPTION_NONE;
+	}
+};
+
+int main()
+{
+   CppUnit::TextUi::TestRunner runner;
+
+   CPPUNIT_TEST_SUITE_REGISTRATION( ModbusViewsTest );
+
+   CppUnit::TestFactoryRegistry &registry = CppUnit::TestFactoryRegistry::getRegistry();
+
+   runner.addTest( registry.makeTest() );
+   runner.run();
+
+   return 0;
+}
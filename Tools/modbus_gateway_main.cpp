@@ -0,0 +1,191 @@
+/*
+ * C/C++ Library Includes
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+
+/*
+ * Modbus Library Includes
+ */
+
+#include "modbus.h"
+#include "modbus_posix_master.h"
+#include "modbus_posix_gateway.h"
+
+/*
+ * Private Module Data
+ */
+
+static volatile sig_atomic_t s_running = 1;
+
+static MODBUS_POSIX_MASTER s_master;
+static MODBUS_POSIX_GATEWAY s_gateway;
+
+/*
+ * Private Module Functions
+ */
+
+static void stop(int)
+{
+    s_running = 0;
+}
+
+static void usage(const char * program)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --port PORT           Modbus TCP port to listen on (default 502, 0 picks a free port)\n"
+        "  --line PATH[:BAUD]    serial line, may be repeated; lines are numbered from 0 (default 19200 baud)\n"
+        "  --route FIRST-LAST:LINE  send units FIRST..LAST to LINE, may be repeated\n"
+        "  --timeout-ms MS       response timeout on every line (default 1000)\n"
+        "  --broadcast-delay-ms MS  turnaround after a broadcast (default 100)\n"
+        "  --stats SECONDS       print counters every SECONDS\n",
+        program);
+}
+
+static void print_counters(MODBUS_GATEWAY_COUNTERS const& counters)
+{
+    printf("requests %llu responses %llu path_unavailable %llu target_no_response %llu orphaned %llu bad_frames %llu\n",
+        (unsigned long long)counters.requests, (unsigned long long)counters.responses,
+        (unsigned long long)counters.path_unavailable, (unsigned long long)counters.target_no_response,
+        (unsigned long long)counters.orphaned, (unsigned long long)counters.bad_frames);
+    fflush(stdout);
+}
+
+/*
+ * Public Module Functions
+ */
+
+int main(int argc, char * argv[])
+{
+    static struct option options[] = {
+        {"port", required_argument, NULL, 'p'},
+        {"line", required_argument, NULL, 'l'},
+        {"route", required_argument, NULL, 'r'},
+        {"timeout-ms", required_argument, NULL, 't'},
+        {"broadcast-delay-ms", required_argument, NULL, 'b'},
+        {"stats", required_argument, NULL, 'S'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    const char * lines[MODBUS_POSIX_MASTER_MAX_PORTS];
+    int n_lines = 0;
+    MODBUS_GATEWAY_ROUTE routes[MODBUS_GATEWAY_MAX_ROUTES];
+    int n_routes = 0;
+
+    int port = 502;
+    uint32_t timeout_ms = 1000;
+    uint32_t broadcast_delay_ms = 100;
+    int stats_seconds = 0;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "h", options, NULL)) != -1)
+    {
+        unsigned int first_unit;
+        unsigned int last_unit;
+        int line;
+
+        switch (option)
+        {
+        case 'p': port = atoi(optarg); break;
+        case 'l':
+            if (n_lines < MODBUS_POSIX_MASTER_MAX_PORTS) { lines[n_lines++] = optarg; }
+            break;
+        case 'r':
+            if ((sscanf(optarg, "%u-%u:%d", &first_unit, &last_unit, &line) != 3) || (first_unit > last_unit) || (last_unit > 247)
+                || (n_routes == MODBUS_GATEWAY_MAX_ROUTES))
+            {
+                fprintf(stderr, "Bad route %s\n", optarg);
+                return 1;
+            }
+            routes[n_routes].first_unit = first_unit;
+            routes[n_routes].last_unit = last_unit;
+            routes[n_routes].line = line;
+            n_routes++;
+            break;
+        case 't': timeout_ms = strtoul(optarg, NULL, 0); break;
+        case 'b': broadcast_delay_ms = strtoul(optarg, NULL, 0); break;
+        case 'S': stats_seconds = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return (option == 'h') ? 0 : 1;
+        }
+    }
+
+    if (!modbus_posix_master_init(&s_master))
+    {
+        fprintf(stderr, "Could not start master\n");
+        return 1;
+    }
+
+    for (int i = 0; i < n_lines; i++)
+    {
+        char path[256];
+        uint32_t baud = 19200;
+
+        strncpy(path, lines[i], sizeof(path) - 1);
+        path[sizeof(path) - 1] = '\0';
+
+        char * separator = strrchr(path, ':');
+        if (separator)
+        {
+            *separator = '\0';
+            baud = strtoul(separator + 1, NULL, 0);
+        }
+
+        int fd = modbus_posix_open_serial(path, baud);
+        if ((fd < 0) || (modbus_posix_master_add_port(&s_master, fd, baud, timeout_ms, broadcast_delay_ms) < 0))
+        {
+            fprintf(stderr, "Could not open line %s\n", lines[i]);
+            return 1;
+        }
+    }
+
+    if (!modbus_posix_gateway_init(&s_gateway, &s_master, (uint16_t)port))
+    {
+        fprintf(stderr, "Could not listen on TCP port %d\n", port);
+        return 1;
+    }
+
+    for (int i = 0; i < n_routes; i++)
+    {
+        if (!modbus_posix_gateway_add_route(&s_gateway, routes[i].first_unit, routes[i].last_unit, routes[i].line))
+        {
+            fprintf(stderr, "Route %u-%u goes to unknown line %d\n", routes[i].first_unit, routes[i].last_unit, routes[i].line);
+            return 1;
+        }
+    }
+
+    printf("tcp %u\n", modbus_posix_gateway_get_port(&s_gateway));
+    fflush(stdout);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    time_t next_stats = time(NULL) + stats_seconds;
+
+    while (s_running)
+    {
+        modbus_posix_gateway_poll(&s_gateway, 100);
+
+        if (stats_seconds && (time(NULL) >= next_stats))
+        {
+            print_counters(s_gateway.counters);
+            next_stats += stats_seconds;
+        }
+    }
+
+    print_counters(s_gateway.counters);
+    modbus_posix_gateway_close(&s_gateway);
+    modbus_posix_master_close(&s_master);
+
+    return 0;
+}
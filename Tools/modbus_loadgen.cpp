@@ -0,0 +1,745 @@
+/*
+ * C/C++ Library Includes
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/*
+ * Modbus Library Includes
+ */
+
+#include "modbus.h"
+#include "modbus_posix_master.h"
+#include "modbus_loadgen.h"
+
+/*
+ * Private Module Constants
+ */
+
+/* epoll tag for the master; connections are tagged with their index */
+#define MASTER_EVENT 0xFFFFFFFFUL
+
+/*
+ * Private Module Functions
+ */
+
+static uint64_t get_time_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+static uint32_t next_random(MODBUS_LOADGEN * loadgen)
+{
+    uint32_t x = loadgen->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    loadgen->random_state = x;
+    return x;
+}
+
+static int get_bucket(uint64_t value)
+{
+    if (value < (2 * MODBUS_LOADGEN_SUB_BUCKETS)) { return (int)value; }
+
+    /* Scale the value down to SUB_BUCKETS..2 * SUB_BUCKETS - 1, one range per power of two */
+    int shift = (63 - __builtin_clzll(value)) - MODBUS_LOADGEN_SUB_BUCKET_BITS;
+    return (shift * MODBUS_LOADGEN_SUB_BUCKETS) + (int)(value >> shift);
+}
+
+/* The highest value that falls in a bucket */
+static uint64_t get_bucket_value(int bucket)
+{
+    if (bucket < (2 * MODBUS_LOADGEN_SUB_BUCKETS)) { return bucket; }
+
+    int shift = (bucket / MODBUS_LOADGEN_SUB_BUCKETS) - 1;
+    uint64_t scaled = bucket - (shift * MODBUS_LOADGEN_SUB_BUCKETS);
+    return ((scaled + 1) << shift) - 1;
+}
+
+/* The most registers or coils one request of a function code can carry, or 0 if it is not supported */
+static uint16_t get_block_limit(uint8_t function_code)
+{
+    switch (function_code)
+    {
+    case READ_COILS:
+    case READ_DISCRETE_INPUTS:
+        return 2000;
+    case READ_HOLDING_REGISTERS:
+    case READ_INPUT_REGISTERS:
+        return 125;
+    case WRITE_SINGLE_COIL:
+    case WRITE_HOLDING_REGISTER:
+        return 1;
+    case WRITE_MULTIPLE_COILS:
+        return 1968;
+    case WRITE_HOLDING_REGISTERS:
+        return 123;
+    default:
+        return 0;
+    }
+}
+
+static uint8_t choose_function_code(MODBUS_LOADGEN * loadgen)
+{
+    MODBUS_LOADGEN_CONFIG const& config = loadgen->config;
+
+    uint32_t total = 0;
+    for (int i = 0; i < config.n_mix; i++) { total += config.mix[i].weight; }
+
+    uint32_t choice = next_random(loadgen) % total;
+    for (int i = 0; i < config.n_mix; i++)
+    {
+        if (choice < config.mix[i].weight) { return config.mix[i].function_code; }
+        choice -= config.mix[i].weight;
+    }
+
+    return config.mix[config.n_mix - 1].function_code;
+}
+
+/* Builds a request from the mix into buffer, with or without CRC, and returns its length */
+static int build_request(MODBUS_LOADGEN * loadgen, uint8_t * buffer, uint8_t function_code, bool add_crc)
+{
+    MODBUS_LOADGEN_CONFIG const& config = loadgen->config;
+
+    uint16_t limit = get_block_limit(function_code);
+    if (limit > config.n_registers) { limit = config.n_registers; }
+
+    uint16_t block = config.min_block + (next_random(loadgen) % (config.max_block - config.min_block + 1));
+    if (block > limit) { block = limit; }
+
+    uint16_t first = config.first_register + (next_random(loadgen) % (config.n_registers - block + 1));
+    uint8_t unit = config.unit_id;
+
+    int16_t registers[123];
+    bool coils[1968];
+
+    switch (function_code)
+    {
+    case READ_COILS:
+        return modbus_get_read_coils_request(unit, buffer, first, block, add_crc);
+    case READ_DISCRETE_INPUTS:
+        return modbus_get_read_discrete_inputs_request(unit, buffer, first, block, add_crc);
+    case READ_HOLDING_REGISTERS:
+        return modbus_get_read_holding_registers_request(unit, buffer, first, block, add_crc);
+    case READ_INPUT_REGISTERS:
+        return modbus_get_read_input_registers_request(unit, buffer, first, block, add_crc);
+    case WRITE_SINGLE_COIL:
+        return modbus_get_write_single_coil_request(unit, buffer, first, next_random(loadgen) & 1, add_crc);
+    case WRITE_HOLDING_REGISTER:
+        return modbus_get_write_holding_register_request(unit, buffer, first, (int16_t)next_random(loadgen), add_crc);
+    case WRITE_MULTIPLE_COILS:
+        for (int i = 0; i < block; i++) { coils[i] = next_random(loadgen) & 1; }
+        return modbus_write_write_multiple_coils_request(unit, buffer, first, block, coils, add_crc);
+    default:
+        for (int i = 0; i < block; i++) { registers[i] = (int16_t)next_random(loadgen); }
+        return modbus_write_write_holding_registers_request(unit, buffer, first, block, registers, add_crc);
+    }
+}
+
+static MODBUS_LOADGEN_REQUEST * allocate_request(MODBUS_LOADGEN_CONNECTION * connection)
+{
+    for (int i = 0; i < MODBUS_LOADGEN_MAX_DEPTH; i++)
+    {
+        if (!connection->requests[i].in_use)
+        {
+            connection->requests[i].in_use = true;
+            connection->n_requests++;
+            return &connection->requests[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void free_request(MODBUS_LOADGEN_REQUEST * request)
+{
+    request->in_use = false;
+    request->connection->n_requests--;
+}
+
+/* Records the answer to a request; exception is true for an exception response */
+static void complete_request(MODBUS_LOADGEN_REQUEST * request, bool exception, uint64_t now)
+{
+    MODBUS_LOADGEN_RESULTS& results = request->loadgen->results;
+
+    if (exception) { results.exceptions++; } else { results.responses++; }
+    modbus_loadgen_histogram_record(&results.latency, (now > request->start_us) ? (now - request->start_us) : 0);
+
+    free_request(request);
+}
+
+/* A connection that breaks loses the requests in flight on it, and takes no more */
+static void fail_connection(MODBUS_LOADGEN * loadgen, MODBUS_LOADGEN_CONNECTION * connection)
+{
+    if (connection->fd >= 0)
+    {
+        epoll_ctl(loadgen->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+        close(connection->fd);
+        connection->fd = -1;
+    }
+
+    for (int i = 0; i < MODBUS_LOADGEN_MAX_DEPTH; i++)
+    {
+        if (connection->requests[i].in_use)
+        {
+            loadgen->results.errors++;
+            free_request(&connection->requests[i]);
+        }
+    }
+
+    connection->failed = true;
+}
+
+/*
+ * Called by the master when a line finishes a request.
+ */
+static void on_line_complete(int, uint8_t const *, int, uint8_t const * response, int,
+    MODBUS_POSIX_MASTER_RESULT result, void * context)
+{
+    MODBUS_LOADGEN_REQUEST * request = (MODBUS_LOADGEN_REQUEST *)context;
+    MODBUS_LOADGEN_RESULTS& results = request->loadgen->results;
+
+    switch (result)
+    {
+    case MASTER_RESPONSE_OK:
+        /* Broadcasts have no response */
+        complete_request(request, response && (response[1] & 0x80), get_time_us());
+        return;
+    case MASTER_RESPONSE_TIMEOUT:
+        results.timeouts++;
+        break;
+    default:
+        results.errors++;
+        break;
+    }
+
+    free_request(request);
+}
+
+static void send_request(MODBUS_LOADGEN * loadgen, MODBUS_LOADGEN_CONNECTION * connection, uint64_t start_us, uint64_t now)
+{
+    MODBUS_LOADGEN_REQUEST * request = allocate_request(connection);
+    if (!request) { return; }
+
+    uint8_t function_code = choose_function_code(loadgen);
+    uint8_t frame[MODBUS_LOADGEN_MAX_ADU];
+
+    request->function_code = function_code;
+    request->start_us = start_us;
+    request->sent_us = now;
+
+    loadgen->results.sent++;
+
+    if (connection->fd < 0)
+    {
+        int length = build_request(loadgen, frame, function_code, true);
+        if (!modbus_posix_master_queue(loadgen->master, connection->line, frame, length, on_line_complete, request))
+        {
+            loadgen->results.errors++;
+            free_request(request);
+        }
+        return;
+    }
+
+    request->transaction_id = connection->next_transaction_id++;
+
+    int length = build_request(loadgen, &frame[MODBUS_MBAP_HEADER_SIZE - 1], function_code, false);
+    modbus_write_mbap_header(frame, request->transaction_id, length - 1, loadgen->config.unit_id);
+    length += MODBUS_MBAP_HEADER_SIZE - 1;
+
+    ssize_t written;
+    do
+    {
+        written = send(connection->fd, frame, length, MSG_NOSIGNAL);
+    } while ((written < 0) && (errno == EINTR));
+
+    if (written != length) { fail_connection(loadgen, connection); }
+}
+
+/* The next connection, in rotation, with room for another request */
+static MODBUS_LOADGEN_CONNECTION * find_connection(MODBUS_LOADGEN * loadgen)
+{
+    for (int i = 0; i < loadgen->n_connections; i++)
+    {
+        int index = (loadgen->next_connection + i) % loadgen->n_connections;
+        MODBUS_LOADGEN_CONNECTION * connection = &loadgen->connections[index];
+
+        if (!connection->failed && (connection->n_requests < loadgen->config.depth))
+        {
+            loadgen->next_connection = (index + 1) % loadgen->n_connections;
+            return connection;
+        }
+    }
+
+    return NULL;
+}
+
+/* When the next request is due: on a fixed schedule in open loop, after the last one sent in closed loop */
+static uint64_t get_due_us(MODBUS_LOADGEN const * loadgen)
+{
+    if (loadgen->config.open_loop)
+    {
+        return loadgen->start_us + ((loadgen->results.sent * 1000000) / loadgen->config.rate);
+    }
+
+    return loadgen->next_send_us;
+}
+
+static void update_stopping(MODBUS_LOADGEN * loadgen, uint64_t now)
+{
+    MODBUS_LOADGEN_CONFIG const& config = loadgen->config;
+
+    bool connected = false;
+    for (int i = 0; i < loadgen->n_connections; i++)
+    {
+        if (!loadgen->connections[i].failed) { connected = true; }
+    }
+
+    if (!connected
+        || (config.max_requests && (loadgen->results.sent >= config.max_requests))
+        || (config.duration_ms && ((now - loadgen->start_us) >= ((uint64_t)config.duration_ms * 1000))))
+    {
+        loadgen->stopping = true;
+    }
+}
+
+static void issue_requests(MODBUS_LOADGEN * loadgen, uint64_t now)
+{
+    uint32_t rate = loadgen->config.rate;
+
+    for (;;)
+    {
+        update_stopping(loadgen, now);
+        if (loadgen->stopping) { return; }
+
+        uint64_t due = rate ? get_due_us(loadgen) : now;
+        if (due > now) { return; }
+
+        MODBUS_LOADGEN_CONNECTION * connection = find_connection(loadgen);
+        if (!connection) { return; }
+
+        /* Open loop counts latency from when the request should have gone */
+        send_request(loadgen, connection, loadgen->config.open_loop ? due : now, now);
+
+        if (rate)
+        {
+            loadgen->next_send_us = ((due + (1000000 / rate)) > now) ? (due + (1000000 / rate)) : now;
+        }
+    }
+}
+
+static void check_timeouts(MODBUS_LOADGEN * loadgen, uint64_t now)
+{
+    uint64_t timeout_us = (uint64_t)loadgen->config.timeout_ms * 1000;
+
+    for (int c = 0; c < loadgen->n_connections; c++)
+    {
+        MODBUS_LOADGEN_CONNECTION * connection = &loadgen->connections[c];
+        if (connection->fd < 0) { continue; }
+
+        for (int i = 0; i < MODBUS_LOADGEN_MAX_DEPTH; i++)
+        {
+            MODBUS_LOADGEN_REQUEST * request = &connection->requests[i];
+
+            if (request->in_use && ((now - request->sent_us) >= timeout_us))
+            {
+                loadgen->results.timeouts++;
+                free_request(request);
+            }
+        }
+    }
+}
+
+static void handle_adu(MODBUS_LOADGEN * loadgen, MODBUS_LOADGEN_CONNECTION * connection, uint8_t const * adu, uint64_t now)
+{
+    uint16_t transaction_id = (adu[0] << 8) | adu[1];
+    uint8_t function_code = adu[MODBUS_MBAP_HEADER_SIZE];
+
+    for (int i = 0; i < MODBUS_LOADGEN_MAX_DEPTH; i++)
+    {
+        MODBUS_LOADGEN_REQUEST * request = &connection->requests[i];
+        if (!request->in_use || (request->transaction_id != transaction_id)) { continue; }
+
+        if ((function_code & 0x7F) != request->function_code)
+        {
+            loadgen->results.errors++;
+            free_request(request);
+            return;
+        }
+
+        complete_request(request, function_code & 0x80, now);
+        return;
+    }
+
+    /* Unknown, or answered after its timeout */
+    loadgen->results.errors++;
+}
+
+static void read_connection(MODBUS_LOADGEN * loadgen, MODBUS_LOADGEN_CONNECTION * connection, uint64_t now)
+{
+    while (connection->fd >= 0)
+    {
+        ssize_t n = read(connection->fd, &connection->rx[connection->received], sizeof(connection->rx) - connection->received);
+
+        if (n > 0)
+        {
+            connection->received += n;
+
+            while (connection->received >= MODBUS_MBAP_HEADER_SIZE)
+            {
+                int length = (connection->rx[4] << 8) | connection->rx[5];
+                int total = length + MODBUS_MBAP_HEADER_SIZE - 1;
+
+                if ((length < 2) || (total > MODBUS_LOADGEN_MAX_ADU))
+                {
+                    fail_connection(loadgen, connection);
+                    return;
+                }
+                if (connection->received < total) { break; }
+
+                handle_adu(loadgen, connection, connection->rx, now);
+
+                memmove(connection->rx, &connection->rx[total], connection->received - total);
+                connection->received -= total;
+            }
+            continue;
+        }
+
+        if ((n < 0) && (errno == EINTR)) { continue; }
+        if ((n < 0) && (errno == EAGAIN)) { break; }
+
+        fail_connection(loadgen, connection);
+    }
+}
+
+static bool has_requests(MODBUS_LOADGEN const * loadgen)
+{
+    for (int i = 0; i < loadgen->n_connections; i++)
+    {
+        if (loadgen->connections[i].n_requests > 0) { return true; }
+    }
+
+    return false;
+}
+
+static bool has_room(MODBUS_LOADGEN const * loadgen)
+{
+    for (int i = 0; i < loadgen->n_connections; i++)
+    {
+        MODBUS_LOADGEN_CONNECTION const * connection = &loadgen->connections[i];
+        if (!connection->failed && (connection->n_requests < loadgen->config.depth)) { return true; }
+    }
+
+    return false;
+}
+
+/*
+ * Until the next request is due, the run ends or the oldest TCP request times out, at most max_wait_ms.
+ * A request that is overdue because every connection is full waits for a response instead.
+ */
+static int get_wait_ms(MODBUS_LOADGEN const * loadgen, uint64_t now, int max_wait_ms)
+{
+    uint64_t deadline = UINT64_MAX;
+
+    /* Nothing left to wait for */
+    if (loadgen->stopping && !has_requests(loadgen)) { return 0; }
+
+    if (!loadgen->stopping && loadgen->config.rate && has_room(loadgen)) { deadline = get_due_us(loadgen); }
+
+    uint64_t end_us = loadgen->start_us + ((uint64_t)loadgen->config.duration_ms * 1000);
+    if (!loadgen->stopping && loadgen->config.duration_ms && (end_us < deadline)) { deadline = end_us; }
+
+    uint64_t timeout_us = (uint64_t)loadgen->config.timeout_ms * 1000;
+    for (int c = 0; c < loadgen->n_connections; c++)
+    {
+        MODBUS_LOADGEN_CONNECTION const * connection = &loadgen->connections[c];
+        if (connection->fd < 0) { continue; }
+
+        for (int i = 0; i < MODBUS_LOADGEN_MAX_DEPTH; i++)
+        {
+            MODBUS_LOADGEN_REQUEST const * request = &connection->requests[i];
+            if (request->in_use && ((request->sent_us + timeout_us) < deadline)) { deadline = request->sent_us + timeout_us; }
+        }
+    }
+
+    int wait_ms = max_wait_ms;
+
+    if (deadline != UINT64_MAX)
+    {
+        /* Rounded down, so sends are not late by the timer's granularity */
+        uint64_t remaining_us = (deadline > now) ? (deadline - now) : 0;
+        int deadline_ms = (int)(remaining_us / 1000);
+        if ((wait_ms < 0) || (deadline_ms < wait_ms)) { wait_ms = deadline_ms; }
+    }
+
+    return loadgen->master ? modbus_posix_master_get_wait_ms(loadgen->master, wait_ms) : wait_ms;
+}
+
+/*
+ * Public Module Functions
+ */
+
+void modbus_loadgen_histogram_reset(MODBUS_LOADGEN_HISTOGRAM * histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+/* Values of 2^32 and above are recorded as 2^32 - 1 */
+void modbus_loadgen_histogram_record(MODBUS_LOADGEN_HISTOGRAM * histogram, uint64_t value)
+{
+    if (value > 0xFFFFFFFFUL) { value = 0xFFFFFFFFUL; }
+
+    histogram->counts[get_bucket(value)]++;
+
+    if ((histogram->total == 0) || (value < histogram->min)) { histogram->min = value; }
+    if (value > histogram->max) { histogram->max = value; }
+
+    histogram->total++;
+}
+
+/*
+ * The value at or below which percentile (0 to 100) of the recorded values fall,
+ * reported as the highest value of its bucket, or 0 if nothing was recorded.
+ */
+uint64_t modbus_loadgen_histogram_get_percentile(MODBUS_LOADGEN_HISTOGRAM const * histogram, double percentile)
+{
+    if (histogram->total == 0) { return 0; }
+
+    uint64_t rank = (uint64_t)((percentile / 100.0) * histogram->total + 0.999999);
+    if (rank < 1) { rank = 1; }
+
+    uint64_t count = 0;
+    for (int i = 0; i < MODBUS_LOADGEN_BUCKETS; i++)
+    {
+        count += histogram->counts[i];
+        if (count >= rank)
+        {
+            uint64_t value = get_bucket_value(i);
+            return (value < histogram->max) ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+/*
+ * Sets up a run; master is needed only for RTU lines (modbus_loadgen_add_rtu) and may
+ * be NULL. The load generator does not take ownership of master.
+ * Returns false if the mix names an unsupported function code, the window is empty
+ * or there is no response timeout.
+ */
+bool modbus_loadgen_init(MODBUS_LOADGEN * loadgen, MODBUS_LOADGEN_CONFIG const * config, MODBUS_POSIX_MASTER * master)
+{
+    if (!loadgen || !config || (config->n_mix == 0) || (config->n_mix > MODBUS_LOADGEN_MAX_MIX) || (config->n_registers == 0)) { return false; }
+    if ((config->min_block == 0) || (config->min_block > config->max_block) || (config->rate > 1000000)) { return false; }
+    if (config->open_loop && !config->rate) { return false; }
+    if (config->timeout_ms == 0) { return false; }
+
+    uint32_t total_weight = 0;
+    for (int i = 0; i < config->n_mix; i++)
+    {
+        if (!get_block_limit(config->mix[i].function_code)) { return false; }
+        total_weight += config->mix[i].weight;
+    }
+    if (total_weight == 0) { return false; }
+
+    memset(loadgen, 0, sizeof(*loadgen));
+    loadgen->config = *config;
+    loadgen->master = master;
+    loadgen->random_state = config->seed ? config->seed : 1;
+
+    if (loadgen->config.depth == 0) { loadgen->config.depth = 1; }
+    if (loadgen->config.depth > MODBUS_LOADGEN_MAX_DEPTH) { loadgen->config.depth = MODBUS_LOADGEN_MAX_DEPTH; }
+
+    loadgen->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loadgen->epoll_fd < 0) { return false; }
+
+    if (master)
+    {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = MASTER_EVENT;
+
+        if (epoll_ctl(loadgen->epoll_fd, EPOLL_CTL_ADD, master->epoll_fd, &event) != 0)
+        {
+            modbus_loadgen_close(loadgen);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Opens a Modbus TCP connection to host:port and returns its index, or -1.
+ * Call once per connection wanted.
+ */
+int modbus_loadgen_add_tcp(MODBUS_LOADGEN * loadgen, const char * host, uint16_t port)
+{
+    if (!loadgen || !host || (loadgen->n_connections == MODBUS_LOADGEN_MAX_CONNECTIONS)) { return -1; }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo * address;
+    if (getaddrinfo(host, NULL, &hints, &address) != 0) { return -1; }
+
+    struct sockaddr_in target = *(struct sockaddr_in *)address->ai_addr;
+    target.sin_port = htons(port);
+    freeaddrinfo(address);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { return -1; }
+
+    int index = loadgen->n_connections;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = index;
+
+    int one = 1;
+    if ((connect(fd, (struct sockaddr *)&target, sizeof(target)) != 0)
+        || (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0)
+        || (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) != 0)
+        || (epoll_ctl(loadgen->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    MODBUS_LOADGEN_CONNECTION * connection = &loadgen->connections[index];
+    memset(connection, 0, sizeof(*connection));
+    connection->fd = fd;
+    connection->line = -1;
+
+    for (int i = 0; i < MODBUS_LOADGEN_MAX_DEPTH; i++)
+    {
+        connection->requests[i].loadgen = loadgen;
+        connection->requests[i].connection = connection;
+    }
+
+    loadgen->n_connections++;
+
+    return index;
+}
+
+/*
+ * Sends requests on a port of the master and returns the connection's index, or -1.
+ * The line takes one request at a time; depth is how many wait in the master's queue,
+ * at most MODBUS_POSIX_MASTER_QUEUE_SIZE.
+ */
+int modbus_loadgen_add_rtu(MODBUS_LOADGEN * loadgen, int line)
+{
+    if (!loadgen || !loadgen->master || (line < 0) || (line >= loadgen->master->n_ports)) { return -1; }
+    if (loadgen->n_connections == MODBUS_LOADGEN_MAX_CONNECTIONS) { return -1; }
+
+    if (loadgen->config.depth > MODBUS_POSIX_MASTER_QUEUE_SIZE) { loadgen->config.depth = MODBUS_POSIX_MASTER_QUEUE_SIZE; }
+
+    int index = loadgen->n_connections;
+
+    MODBUS_LOADGEN_CONNECTION * connection = &loadgen->connections[index];
+    memset(connection, 0, sizeof(*connection));
+    connection->fd = -1;
+    connection->line = line;
+
+    for (int i = 0; i < MODBUS_LOADGEN_MAX_DEPTH; i++)
+    {
+        connection->requests[i].loadgen = loadgen;
+        connection->requests[i].connection = connection;
+    }
+
+    loadgen->n_connections++;
+
+    return index;
+}
+
+/*
+ * Sends due requests and collects responses, waiting up to max_wait_ms (or
+ * indefinitely if negative) for something to happen. The run starts at the first
+ * call. Returns false once the run has ended and every request has been answered
+ * or timed out; results.elapsed_us is then the length of the run.
+ */
+bool modbus_loadgen_poll(MODBUS_LOADGEN * loadgen, int max_wait_ms)
+{
+    struct epoll_event events[MODBUS_LOADGEN_MAX_CONNECTIONS + 1];
+
+    if (!loadgen) { return false; }
+
+    uint64_t now = get_time_us();
+
+    if (!loadgen->started)
+    {
+        loadgen->started = true;
+        loadgen->start_us = now;
+        loadgen->next_send_us = now;
+    }
+
+    if (loadgen->stopping && !has_requests(loadgen))
+    {
+        if (!loadgen->results.elapsed_us) { loadgen->results.elapsed_us = now - loadgen->start_us; }
+        return false;
+    }
+
+    issue_requests(loadgen, now);
+
+    if (loadgen->master) { modbus_posix_master_poll(loadgen->master, 0); }
+
+    int wait_ms = get_wait_ms(loadgen, get_time_us(), max_wait_ms);
+    int n_events = epoll_wait(loadgen->epoll_fd, events, MODBUS_LOADGEN_MAX_CONNECTIONS + 1, wait_ms);
+
+    now = get_time_us();
+
+    for (int e = 0; e < n_events; e++)
+    {
+        uint32_t tag = events[e].data.u32;
+
+        if (tag != MASTER_EVENT)
+        {
+            read_connection(loadgen, &loadgen->connections[tag], now);
+        }
+    }
+
+    if (loadgen->master) { modbus_posix_master_poll(loadgen->master, 0); }
+
+    now = get_time_us();
+    check_timeouts(loadgen, now);
+    issue_requests(loadgen, now);
+
+    return true;
+}
+
+void modbus_loadgen_close(MODBUS_LOADGEN * loadgen)
+{
+    if (!loadgen) { return; }
+
+    for (int i = 0; i < loadgen->n_connections; i++)
+    {
+        if (loadgen->connections[i].fd >= 0) { close(loadgen->connections[i].fd); }
+        loadgen->connections[i].fd = -1;
+    }
+
+    if (loadgen->epoll_fd >= 0) { close(loadgen->epoll_fd); }
+
+    loadgen->epoll_fd = -1;
+    loadgen->n_connections = 0;
+}
@@ -0,0 +1,159 @@
+#ifndef _MODBUS_LOADGEN_H_
+#define _MODBUS_LOADGEN_H_
+
+/*
+ * Synthetic load for sizing Modbus servers and gateways.
+ *
+ * Requests are built with the library's request encoders from a weighted mix of
+ * function codes, with random block sizes and addresses inside a register window,
+ * and sent to Modbus TCP connections (pipelined, up to depth requests in flight on
+ * each) or to RTU lines of a MODBUS_POSIX_MASTER (one request at a time on the
+ * wire, up to depth queued).
+ *
+ * Closed loop keeps depth requests in flight per connection, paced to at most rate
+ * requests per second over all connections when rate is set. Open loop sends at
+ * rate whether or not responses are keeping up; a request that finds every
+ * connection full waits, and its latency counts from when it should have been sent,
+ * so a stalled target is not hidden by the generator slowing down with it.
+ *
+ * Latencies go into a log-linear histogram in the manner of HdrHistogram: exact
+ * below 2 * MODBUS_LOADGEN_SUB_BUCKETS microseconds and within 1 / SUB_BUCKETS of
+ * the value above, in fixed memory.
+ *
+ * Everything runs on one thread from modbus_loadgen_poll. The master's epoll fd is
+ * nested in the load generator's, so one wait covers the sockets and the lines.
+ */
+
+#ifndef MODBUS_LOADGEN_MAX_CONNECTIONS
+#define MODBUS_LOADGEN_MAX_CONNECTIONS 64
+#endif
+
+#ifndef MODBUS_LOADGEN_MAX_DEPTH
+#define MODBUS_LOADGEN_MAX_DEPTH 32
+#endif
+
+#define MODBUS_LOADGEN_MAX_MIX 8
+#define MODBUS_LOADGEN_MAX_ADU 260
+
+#define MODBUS_LOADGEN_SUB_BUCKET_BITS 6
+#define MODBUS_LOADGEN_SUB_BUCKETS (1 << MODBUS_LOADGEN_SUB_BUCKET_BITS)
+/* Enough sub-bucket ranges for values up to 2^32 us */
+#define MODBUS_LOADGEN_BUCKETS (MODBUS_LOADGEN_SUB_BUCKETS * (33 - MODBUS_LOADGEN_SUB_BUCKET_BITS))
+
+struct modbus_loadgen_histogram
+{
+	uint64_t counts[MODBUS_LOADGEN_BUCKETS];
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+};
+typedef struct modbus_loadgen_histogram MODBUS_LOADGEN_HISTOGRAM;
+
+/* A function code and its share of the requests, relative to the other weights */
+struct modbus_loadgen_mix
+{
+	uint8_t function_code;
+	uint16_t weight;
+};
+typedef struct modbus_loadgen_mix MODBUS_LOADGEN_MIX;
+
+struct modbus_loadgen_config
+{
+	uint8_t unit_id;
+
+	MODBUS_LOADGEN_MIX mix[MODBUS_LOADGEN_MAX_MIX];
+	uint8_t n_mix;
+
+	/* Requests address registers (or coils) first_register..first_register + n_registers - 1 */
+	uint16_t first_register;
+	uint16_t n_registers;
+	uint16_t min_block;
+	uint16_t max_block;
+
+	uint8_t depth;
+	uint32_t rate;
+	bool open_loop;
+
+	/* The run ends after duration_ms or max_requests, whichever is first; 0 for no limit */
+	uint32_t duration_ms;
+	uint64_t max_requests;
+
+	/* Required; a request unanswered after timeout_ms counts as a timeout */
+	uint32_t timeout_ms;
+	uint32_t seed;
+};
+typedef struct modbus_loadgen_config MODBUS_LOADGEN_CONFIG;
+
+struct modbus_loadgen_results
+{
+	uint64_t sent;
+	uint64_t responses;
+	uint64_t exceptions;
+	uint64_t timeouts;
+	uint64_t errors;
+	uint64_t elapsed_us;
+
+	/* Of responses and exceptions, in microseconds */
+	MODBUS_LOADGEN_HISTOGRAM latency;
+};
+typedef struct modbus_loadgen_results MODBUS_LOADGEN_RESULTS;
+
+struct modbus_loadgen_request
+{
+	struct modbus_loadgen * loadgen;
+	struct modbus_loadgen_connection * connection;
+	bool in_use;
+	uint16_t transaction_id;
+	uint8_t function_code;
+	uint64_t start_us;
+	uint64_t sent_us;
+};
+typedef struct modbus_loadgen_request MODBUS_LOADGEN_REQUEST;
+
+struct modbus_loadgen_connection
+{
+	/* A TCP socket, or -1 for an RTU line */
+	int fd;
+	int line;
+	bool failed;
+
+	uint16_t next_transaction_id;
+	MODBUS_LOADGEN_REQUEST requests[MODBUS_LOADGEN_MAX_DEPTH];
+	int n_requests;
+
+	uint8_t rx[MODBUS_LOADGEN_MAX_ADU * 2];
+	int received;
+};
+typedef struct modbus_loadgen_connection MODBUS_LOADGEN_CONNECTION;
+
+struct modbus_loadgen
+{
+	MODBUS_LOADGEN_CONFIG config;
+	MODBUS_LOADGEN_RESULTS results;
+
+	MODBUS_POSIX_MASTER * master;
+	int epoll_fd;
+
+	MODBUS_LOADGEN_CONNECTION connections[MODBUS_LOADGEN_MAX_CONNECTIONS];
+	int n_connections;
+	int next_connection;
+
+	bool started;
+	bool stopping;
+	uint64_t start_us;
+	uint64_t next_send_us;
+	uint32_t random_state;
+};
+typedef struct modbus_loadgen MODBUS_LOADGEN;
+
+void modbus_loadgen_histogram_reset(MODBUS_LOADGEN_HISTOGRAM * histogram);
+void modbus_loadgen_histogram_record(MODBUS_LOADGEN_HISTOGRAM * histogram, uint64_t value);
+uint64_t modbus_loadgen_histogram_get_percentile(MODBUS_LOADGEN_HISTOGRAM const * histogram, double percentile);
+
+bool modbus_loadgen_init(MODBUS_LOADGEN * loadgen, MODBUS_LOADGEN_CONFIG const * config, MODBUS_POSIX_MASTER * master);
+int modbus_loadgen_add_tcp(MODBUS_LOADGEN * loadgen, const char * host, uint16_t port);
+int modbus_loadgen_add_rtu(MODBUS_LOADGEN * loadgen, int line);
+bool modbus_loadgen_poll(MODBUS_LOADGEN * loadgen, int max_wait_ms);
+void modbus_loadgen_close(MODBUS_LOADGEN * loadgen);
+
+#endif
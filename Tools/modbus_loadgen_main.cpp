@@ -0,0 +1,278 @@
+/*
+ * C/C++ Library Includes
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+
+/*
+ * Modbus Library Includes
+ */
+
+#include "modbus.h"
+#include "modbus_posix_master.h"
+#include "modbus_loadgen.h"
+
+/*
+ * Private Module Data
+ */
+
+static volatile sig_atomic_t s_running = 1;
+
+static MODBUS_POSIX_MASTER s_master;
+static MODBUS_LOADGEN s_loadgen;
+
+/*
+ * Private Module Functions
+ */
+
+static void stop(int)
+{
+    s_running = 0;
+}
+
+static void usage(const char * program)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --tcp HOST:PORT       Modbus TCP target\n"
+        "  --rtu PATH[:BAUD]     RTU target (serial port or pty), may be repeated (default 19200 baud)\n"
+        "  --connections N       TCP connections (default 1)\n"
+        "  --depth N             requests in flight per connection (default 1)\n"
+        "  --rate N              requests per second over all connections (default 0, as fast as answered)\n"
+        "  --open-loop           send at --rate whether or not responses keep up\n"
+        "  --duration SECONDS    length of the run (default 10)\n"
+        "  --requests N          stop after N requests\n"
+        "  --mix FC:WEIGHT[,...] function code mix (default 3:1); 1-6, 15 and 16\n"
+        "  --block MIN[-MAX]     registers or coils per request (default 1)\n"
+        "  --registers FIRST:COUNT  address window (default 0:100)\n"
+        "  --unit N              unit id (default 1)\n"
+        "  --timeout-ms MS       response timeout, at least 1 (default 1000)\n"
+        "  --seed N              random seed for the mix, blocks and addresses\n",
+        program);
+}
+
+static uint8_t parse_mix(const char * text, MODBUS_LOADGEN_MIX * mix)
+{
+    uint8_t n = 0;
+
+    while (text && *text && (n < MODBUS_LOADGEN_MAX_MIX))
+    {
+        unsigned int function_code;
+        unsigned int weight;
+        if ((sscanf(text, "%u:%u", &function_code, &weight) != 2) || (function_code > 0x7F) || (weight > 0xFFFF)) { return 0; }
+
+        mix[n].function_code = function_code;
+        mix[n].weight = weight;
+        n++;
+
+        text = strchr(text, ',');
+        if (text) { text++; }
+    }
+
+    return n;
+}
+
+static void print_results(MODBUS_LOADGEN_RESULTS const& results)
+{
+    MODBUS_LOADGEN_HISTOGRAM const * latency = &results.latency;
+    double seconds = results.elapsed_us / 1000000.0;
+    uint64_t answered = results.responses + results.exceptions;
+
+    printf("sent %llu responses %llu exceptions %llu timeouts %llu errors %llu\n",
+        (unsigned long long)results.sent, (unsigned long long)results.responses, (unsigned long long)results.exceptions,
+        (unsigned long long)results.timeouts, (unsigned long long)results.errors);
+    printf("elapsed %.3f s rate %.1f/s\n", seconds, (seconds > 0.0) ? (answered / seconds) : 0.0);
+    printf("latency_us min %llu p50 %llu p90 %llu p99 %llu p999 %llu max %llu\n",
+        (unsigned long long)latency->min,
+        (unsigned long long)modbus_loadgen_histogram_get_percentile(latency, 50.0),
+        (unsigned long long)modbus_loadgen_histogram_get_percentile(latency, 90.0),
+        (unsigned long long)modbus_loadgen_histogram_get_percentile(latency, 99.0),
+        (unsigned long long)modbus_loadgen_histogram_get_percentile(latency, 99.9),
+        (unsigned long long)latency->max);
+    fflush(stdout);
+}
+
+/*
+ * Public Module Functions
+ */
+
+int main(int argc, char * argv[])
+{
+    static struct option options[] = {
+        {"tcp", required_argument, NULL, 't'},
+        {"rtu", required_argument, NULL, 'r'},
+        {"connections", required_argument, NULL, 'c'},
+        {"depth", required_argument, NULL, 'd'},
+        {"rate", required_argument, NULL, 'R'},
+        {"open-loop", no_argument, NULL, 'o'},
+        {"duration", required_argument, NULL, 'D'},
+        {"requests", required_argument, NULL, 'n'},
+        {"mix", required_argument, NULL, 'm'},
+        {"block", required_argument, NULL, 'b'},
+        {"registers", required_argument, NULL, 'g'},
+        {"unit", required_argument, NULL, 'u'},
+        {"timeout-ms", required_argument, NULL, 'T'},
+        {"seed", required_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    MODBUS_LOADGEN_CONFIG config;
+    memset(&config, 0, sizeof(config));
+    config.unit_id = 1;
+    config.mix[0].function_code = READ_HOLDING_REGISTERS;
+    config.mix[0].weight = 1;
+    config.n_mix = 1;
+    config.first_register = 0;
+    config.n_registers = 100;
+    config.min_block = 1;
+    config.max_block = 1;
+    config.depth = 1;
+    config.duration_ms = 10000;
+    config.timeout_ms = 1000;
+    config.seed = (uint32_t)time(NULL);
+
+    const char * tcp_target = NULL;
+    const char * lines[MODBUS_POSIX_MASTER_MAX_PORTS];
+    int n_lines = 0;
+    int n_connections = 1;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "h", options, NULL)) != -1)
+    {
+        unsigned int first;
+        unsigned int last;
+
+        switch (option)
+        {
+        case 't': tcp_target = optarg; break;
+        case 'r':
+            if (n_lines < MODBUS_POSIX_MASTER_MAX_PORTS) { lines[n_lines++] = optarg; }
+            break;
+        case 'c': n_connections = atoi(optarg); break;
+        case 'd': config.depth = (uint8_t)atoi(optarg); break;
+        case 'R': config.rate = strtoul(optarg, NULL, 0); break;
+        case 'o': config.open_loop = true; break;
+        case 'D': config.duration_ms = (uint32_t)(atof(optarg) * 1000.0); break;
+        case 'n': config.max_requests = strtoull(optarg, NULL, 0); break;
+        case 'm':
+            config.n_mix = parse_mix(optarg, config.mix);
+            if (!config.n_mix) { fprintf(stderr, "Bad mix %s\n", optarg); return 1; }
+            break;
+        case 'b':
+            if (sscanf(optarg, "%u-%u", &first, &last) != 2) { last = first = strtoul(optarg, NULL, 0); }
+            if ((first == 0) || (first > last) || (last > 2000)) { fprintf(stderr, "Bad block size %s\n", optarg); return 1; }
+            config.min_block = first;
+            config.max_block = last;
+            break;
+        case 'g':
+            if ((sscanf(optarg, "%u:%u", &first, &last) != 2) || (last == 0) || ((first + last) > 0x10000))
+            {
+                fprintf(stderr, "Bad register window %s\n", optarg);
+                return 1;
+            }
+            config.first_register = first;
+            config.n_registers = last;
+            break;
+        case 'u': config.unit_id = (uint8_t)atoi(optarg); break;
+        case 'T': config.timeout_ms = strtoul(optarg, NULL, 0); break;
+        case 's': config.seed = strtoul(optarg, NULL, 0); break;
+        default:
+            usage(argv[0]);
+            return (option == 'h') ? 0 : 1;
+        }
+    }
+
+    if (!tcp_target && !n_lines)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (n_lines && !modbus_posix_master_init(&s_master))
+    {
+        fprintf(stderr, "Could not start master\n");
+        return 1;
+    }
+
+    for (int i = 0; i < n_lines; i++)
+    {
+        char path[256];
+        uint32_t baud = 19200;
+
+        strncpy(path, lines[i], sizeof(path) - 1);
+        path[sizeof(path) - 1] = '\0';
+
+        char * separator = strrchr(path, ':');
+        if (separator)
+        {
+            *separator = '\0';
+            baud = strtoul(separator + 1, NULL, 0);
+        }
+
+        int fd = modbus_posix_open_serial(path, baud);
+        if ((fd < 0) || (modbus_posix_master_add_port(&s_master, fd, baud, config.timeout_ms, 0) < 0))
+        {
+            fprintf(stderr, "Could not open line %s\n", lines[i]);
+            return 1;
+        }
+    }
+
+    if (!modbus_loadgen_init(&s_loadgen, &config, n_lines ? &s_master : NULL))
+    {
+        fprintf(stderr, "Bad load configuration\n");
+        return 1;
+    }
+
+    if (tcp_target)
+    {
+        char host[256];
+        strncpy(host, tcp_target, sizeof(host) - 1);
+        host[sizeof(host) - 1] = '\0';
+
+        char * separator = strrchr(host, ':');
+        uint16_t port = 502;
+        if (separator)
+        {
+            *separator = '\0';
+            port = (uint16_t)atoi(separator + 1);
+        }
+
+        for (int i = 0; i < n_connections; i++)
+        {
+            if (modbus_loadgen_add_tcp(&s_loadgen, host, port) < 0)
+            {
+                fprintf(stderr, "Could not connect to %s\n", tcp_target);
+                return 1;
+            }
+        }
+    }
+
+    for (int i = 0; i < n_lines; i++)
+    {
+        modbus_loadgen_add_rtu(&s_loadgen, i);
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    while (modbus_loadgen_poll(&s_loadgen, 100))
+    {
+        /* Interrupting ends the run; requests in flight are still collected */
+        if (!s_running) { s_loadgen.stopping = true; }
+    }
+
+    print_results(s_loadgen.results);
+
+    modbus_loadgen_close(&s_loadgen);
+    if (n_lines) { modbus_posix_master_close(&s_master); }
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * C/C++ Library Includes
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Modbus Library Includes
+ */
+
+#include "modbus.h"
+#include "modbus_posix_file.h"
+
+/*
+ * Public Module Functions
+ */
+
+bool modbus_posix_map_file(const char * path, uint16_t file_number, bool writable, MODBUS_FILE * file)
+{
+    if (!path || !file) { return false; }
+
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) { return false; }
+
+    struct stat file_stat;
+    if ((fstat(fd, &file_stat) != 0) || (file_stat.st_size < 2))
+    {
+        close(fd);
+        return false;
+    }
+
+    /* A file can hold at most MODBUS_MAX_FILE_RECORD_NUMBER + 1 addressable records */
+    uint32_t n_records = (uint32_t)(file_stat.st_size / 2);
+    if (n_records > (MODBUS_MAX_FILE_RECORD_NUMBER + 1)) { n_records = MODBUS_MAX_FILE_RECORD_NUMBER + 1; }
+
+    int protection = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void * records = mmap(NULL, n_records * 2, protection, MAP_SHARED, fd, 0);
+
+    /* The mapping keeps its own reference to the file */
+    close(fd);
+
+    if (records == MAP_FAILED) { return false; }
+
+    file->file_number = file_number;
+    file->n_records = (uint16_t)n_records;
+    file->records = (uint8_t *)records;
+    file->writable = writable;
+
+    return true;
+}
+
+bool modbus_posix_sync_file(MODBUS_FILE const * file)
+{
+    if (!file || !file->records) { return false; }
+
+    return msync(file->records, file->n_records * 2, MS_SYNC) == 0;
+}
+
+void modbus_posix_unmap_file(MODBUS_FILE * file)
+{
+    if (!file || !file->records) { return; }
+
+    munmap(file->records, file->n_records * 2);
+
+    file->records = NULL;
+    file->n_records = 0;
+}
@@ -0,0 +1,15 @@
+#ifndef _MODBUS_POSIX_FILE_H_
+#define _MODBUS_POSIX_FILE_H_
+
+/*
+ * Memory mapped file store for the file record function codes (FC20/FC21).
+ * The file holds its records as big-endian registers, exactly as they appear
+ * on the wire, so reads are served by copying straight from the mapping and
+ * the file is never read into a separate buffer.
+ */
+
+bool modbus_posix_map_file(const char * path, uint16_t file_number, bool writable, MODBUS_FILE * file);
+bool modbus_posix_sync_file(MODBUS_FILE const * file);
+void modbus_posix_unmap_file(MODBUS_FILE * file);
+
+#endif
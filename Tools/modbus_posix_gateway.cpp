@@ -0,0 +1,421 @@
+/*
+ * C/C++ Library Includes
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/*
+ * Modbus Library Includes
+ */
+
+#include "modbus.h"
+#include "modbus_posix_master.h"
+#include "modbus_posix_gateway.h"
+
+/*
+ * Private Module Constants
+ */
+
+/* epoll tags for the non-connection fds; connections are tagged with their index */
+#define LISTENER_EVENT 0xFFFFFFFEUL
+#define MASTER_EVENT 0xFFFFFFFFUL
+
+/* Function code and data; the RTU frame adds the unit address and CRC */
+#define MAX_PDU_LENGTH (MODBUS_RTU_MAX_FRAME - 3)
+
+/*
+ * Private Module Functions
+ */
+
+static uint64_t get_completed(MODBUS_GATEWAY_COUNTERS const& counters)
+{
+    return counters.responses + counters.path_unavailable + counters.target_no_response + counters.orphaned;
+}
+
+static void close_connection(MODBUS_POSIX_GATEWAY * gateway, int index)
+{
+    MODBUS_GATEWAY_CONNECTION * connection = &gateway->connections[index];
+
+    if (connection->fd < 0) { return; }
+
+    epoll_ctl(gateway->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+
+    connection->fd = -1;
+    connection->received = 0;
+
+    /* Requests still on a line now belong to nobody */
+    connection->generation++;
+}
+
+/* A client that does not keep up with its responses is disconnected */
+static void send_adu(MODBUS_POSIX_GATEWAY * gateway, int index, uint8_t const * adu, int length)
+{
+    MODBUS_GATEWAY_CONNECTION * connection = &gateway->connections[index];
+
+    ssize_t written;
+    do
+    {
+        written = send(connection->fd, adu, length, MSG_NOSIGNAL);
+    } while ((written < 0) && (errno == EINTR));
+
+    if (written != length) { close_connection(gateway, index); }
+}
+
+static void send_exception(MODBUS_POSIX_GATEWAY * gateway, int index, uint16_t transaction_id, uint8_t unit_id,
+    uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+    uint8_t adu[MODBUS_TCP_MAX_ADU];
+
+    int length = modbus_write_exception(unit_id, &adu[MODBUS_MBAP_HEADER_SIZE - 1], exception_code, function_code | 0x80, false);
+    modbus_write_mbap_header(adu, transaction_id, length - 1, unit_id);
+
+    send_adu(gateway, index, adu, length + MODBUS_MBAP_HEADER_SIZE - 1);
+}
+
+static MODBUS_GATEWAY_PENDING * allocate_pending(MODBUS_POSIX_GATEWAY * gateway)
+{
+    for (int i = 0; i < MODBUS_GATEWAY_MAX_PENDING; i++)
+    {
+        if (!gateway->pending[i].in_use)
+        {
+            gateway->pending[i].in_use = true;
+            return &gateway->pending[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Called by the master when a line finishes a request: relays the RTU response, or
+ * answers for the device if it did not respond.
+ */
+static void on_line_complete(int, uint8_t const * request, int, uint8_t const * response, int response_length,
+    MODBUS_POSIX_MASTER_RESULT result, void * context)
+{
+    MODBUS_GATEWAY_PENDING * pending = (MODBUS_GATEWAY_PENDING *)context;
+    MODBUS_POSIX_GATEWAY * gateway = pending->gateway;
+
+    pending->in_use = false;
+
+    if (request[0] == MODBUS_BROADCAST_ADDRESS) { return; }
+
+    MODBUS_GATEWAY_CONNECTION const * connection = &gateway->connections[pending->connection];
+    if ((connection->fd < 0) || (connection->generation != pending->generation))
+    {
+        gateway->counters.orphaned++;
+        return;
+    }
+
+    if ((result != MASTER_RESPONSE_OK) || !response)
+    {
+        gateway->counters.target_no_response++;
+        send_exception(gateway, pending->connection, pending->transaction_id, pending->unit_id, request[1], EXCEPTION_GATEWAY_TGT_DEVICE_NO_RSP);
+        return;
+    }
+
+    /* Swap the RTU address and CRC for an MBAP header */
+    uint8_t adu[MODBUS_TCP_MAX_ADU];
+    int pdu_length = response_length - 3;
+
+    modbus_write_mbap_header(adu, pending->transaction_id, pdu_length, pending->unit_id);
+    memcpy(&adu[MODBUS_MBAP_HEADER_SIZE], &response[1], pdu_length);
+
+    gateway->counters.responses++;
+    send_adu(gateway, pending->connection, adu, pdu_length + MODBUS_MBAP_HEADER_SIZE);
+}
+
+/* Hands one request (unit id onwards, no CRC) to the line its unit is routed to */
+static void route_request(MODBUS_POSIX_GATEWAY * gateway, int index, uint16_t transaction_id, uint8_t const * message, int length)
+{
+    uint8_t unit_id = message[0];
+    uint8_t function_code = message[1];
+
+    gateway->counters.requests++;
+
+    int line = modbus_posix_gateway_find_route(gateway, unit_id);
+    MODBUS_GATEWAY_PENDING * pending = (line >= 0) ? allocate_pending(gateway) : NULL;
+
+    if (pending)
+    {
+        uint8_t frame[MODBUS_RTU_MAX_FRAME];
+        memcpy(frame, message, length);
+        int frame_length = length + modbus_write_crc(frame, length);
+
+        pending->connection = index;
+        pending->generation = gateway->connections[index].generation;
+        pending->transaction_id = transaction_id;
+        pending->unit_id = unit_id;
+
+        MODBUS_POSIX_MASTER_PRIORITY priority = modbus_posix_master_get_priority(frame);
+        if (modbus_posix_master_queue_priority(gateway->master, line, priority, frame, frame_length, on_line_complete, pending)) { return; }
+
+        pending->in_use = false;
+    }
+
+    gateway->counters.path_unavailable++;
+
+    if (unit_id != MODBUS_BROADCAST_ADDRESS)
+    {
+        send_exception(gateway, index, transaction_id, unit_id, function_code, EXCEPTION_GATEWAY_PATH_UNAVAILABLE);
+    }
+}
+
+static void consume(MODBUS_GATEWAY_CONNECTION * connection, int n)
+{
+    memmove(connection->rx, &connection->rx[n], connection->received - n);
+    connection->received -= n;
+}
+
+/* Routes every complete ADU received; returns false if the stream cannot be framed */
+static bool service_frames(MODBUS_POSIX_GATEWAY * gateway, int index)
+{
+    MODBUS_GATEWAY_CONNECTION * connection = &gateway->connections[index];
+
+    while (connection->received >= MODBUS_MBAP_HEADER_SIZE)
+    {
+        uint16_t transaction_id = (connection->rx[0] << 8) | connection->rx[1];
+        uint16_t protocol_id = (connection->rx[2] << 8) | connection->rx[3];
+        int length = (connection->rx[4] << 8) | connection->rx[5];
+
+        if ((length < 2) || (length > (MAX_PDU_LENGTH + 1))) { return false; }
+
+        int total = length + MODBUS_MBAP_HEADER_SIZE - 1;
+        if (connection->received < total) { break; }
+
+        if (protocol_id == 0)
+        {
+            route_request(gateway, index, transaction_id, &connection->rx[MODBUS_MBAP_HEADER_SIZE - 1], length);
+        }
+        else
+        {
+            gateway->counters.bad_frames++;
+        }
+
+        /* Answering may have closed the connection */
+        if (connection->fd < 0) { break; }
+
+        consume(connection, total);
+    }
+
+    return true;
+}
+
+static void read_connection(MODBUS_POSIX_GATEWAY * gateway, int index)
+{
+    MODBUS_GATEWAY_CONNECTION * connection = &gateway->connections[index];
+
+    while (connection->fd >= 0)
+    {
+        ssize_t n = read(connection->fd, &connection->rx[connection->received], sizeof(connection->rx) - connection->received);
+
+        if (n > 0)
+        {
+            connection->received += n;
+
+            if (!service_frames(gateway, index))
+            {
+                gateway->counters.bad_frames++;
+                close_connection(gateway, index);
+            }
+            continue;
+        }
+
+        if ((n < 0) && (errno == EINTR)) { continue; }
+        if ((n < 0) && (errno == EAGAIN)) { break; }
+
+        close_connection(gateway, index);
+    }
+}
+
+static void accept_connections(MODBUS_POSIX_GATEWAY * gateway)
+{
+    int fd;
+
+    while ((fd = accept4(gateway->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        int index = -1;
+        for (int i = 0; (i < MODBUS_GATEWAY_MAX_CONNECTIONS) && (index < 0); i++)
+        {
+            if (gateway->connections[i].fd < 0) { index = i; }
+        }
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = index;
+
+        if ((index < 0) || (epoll_ctl(gateway->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0))
+        {
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        gateway->connections[index].fd = fd;
+        gateway->connections[index].received = 0;
+    }
+}
+
+static bool watch(int epoll_fd, int fd, uint32_t tag)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = tag;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+/*
+ * Public Module Functions
+ */
+
+/*
+ * Listens for Modbus TCP clients on port (0 picks a free port, see
+ * modbus_posix_gateway_get_port) and relays their requests to the lines of master.
+ * The gateway does not take ownership of master, but it must outlive the requests
+ * the gateway queues on it.
+ */
+bool modbus_posix_gateway_init(MODBUS_POSIX_GATEWAY * gateway, MODBUS_POSIX_MASTER * master, uint16_t port)
+{
+    if (!gateway || !master) { return false; }
+
+    memset(gateway, 0, sizeof(*gateway));
+    gateway->master = master;
+    gateway->listen_fd = -1;
+
+    for (int i = 0; i < MODBUS_GATEWAY_MAX_CONNECTIONS; i++) { gateway->connections[i].fd = -1; }
+    for (int i = 0; i < MODBUS_GATEWAY_MAX_PENDING; i++) { gateway->pending[i].gateway = gateway; }
+
+    gateway->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (gateway->epoll_fd < 0) { return false; }
+
+    gateway->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (gateway->listen_fd < 0)
+    {
+        modbus_posix_gateway_close(gateway);
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(gateway->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    socklen_t address_length = sizeof(address);
+    bool listening = (bind(gateway->listen_fd, (struct sockaddr *)&address, sizeof(address)) == 0)
+        && (listen(gateway->listen_fd, SOMAXCONN) == 0)
+        && (getsockname(gateway->listen_fd, (struct sockaddr *)&address, &address_length) == 0);
+
+    if (!listening || !watch(gateway->epoll_fd, gateway->listen_fd, LISTENER_EVENT) || !watch(gateway->epoll_fd, master->epoll_fd, MASTER_EVENT))
+    {
+        modbus_posix_gateway_close(gateway);
+        return false;
+    }
+
+    gateway->port = ntohs(address.sin_port);
+
+    return true;
+}
+
+uint16_t modbus_posix_gateway_get_port(MODBUS_POSIX_GATEWAY const * gateway)
+{
+    return gateway->port;
+}
+
+/*
+ * Routes units first_unit..last_unit to a port of the master. Routes are searched in
+ * the order they were added. Returns false if the line is unknown or the table is full.
+ */
+bool modbus_posix_gateway_add_route(MODBUS_POSIX_GATEWAY * gateway, uint8_t first_unit, uint8_t last_unit, int line)
+{
+    if (!gateway || (first_unit > last_unit) || (line < 0) || (line >= gateway->master->n_ports)) { return false; }
+    if (gateway->n_routes == MODBUS_GATEWAY_MAX_ROUTES) { return false; }
+
+    MODBUS_GATEWAY_ROUTE * route = &gateway->routes[gateway->n_routes++];
+    route->first_unit = first_unit;
+    route->last_unit = last_unit;
+    route->line = line;
+
+    return true;
+}
+
+/* The line a unit is routed to, or -1 */
+int modbus_posix_gateway_find_route(MODBUS_POSIX_GATEWAY const * gateway, uint8_t unit)
+{
+    for (int i = 0; i < gateway->n_routes; i++)
+    {
+        MODBUS_GATEWAY_ROUTE const * route = &gateway->routes[i];
+        if ((unit >= route->first_unit) && (unit <= route->last_unit)) { return route->line; }
+    }
+
+    return -1;
+}
+
+/*
+ * Accepts clients, routes their requests and relays responses, waiting up to
+ * max_wait_ms (or indefinitely if negative) for something to happen. Drives the
+ * master too, so the application does not poll it separately.
+ * Returns the number of requests answered, by a device or by the gateway.
+ */
+int modbus_posix_gateway_poll(MODBUS_POSIX_GATEWAY * gateway, int max_wait_ms)
+{
+    struct epoll_event events[MODBUS_GATEWAY_MAX_CONNECTIONS + 2];
+
+    if (!gateway) { return 0; }
+
+    uint64_t completed = get_completed(gateway->counters);
+
+    int wait_ms = modbus_posix_master_get_wait_ms(gateway->master, max_wait_ms);
+    int n_events = epoll_wait(gateway->epoll_fd, events, MODBUS_GATEWAY_MAX_CONNECTIONS + 2, wait_ms);
+
+    for (int e = 0; e < n_events; e++)
+    {
+        uint32_t tag = events[e].data.u32;
+
+        if (tag == LISTENER_EVENT)
+        {
+            accept_connections(gateway);
+        }
+        else if (tag != MASTER_EVENT)
+        {
+            read_connection(gateway, (int)tag);
+        }
+    }
+
+    /* Starts newly queued requests as well as reading the lines */
+    modbus_posix_master_poll(gateway->master, 0);
+
+    return (int)(get_completed(gateway->counters) - completed);
+}
+
+void modbus_posix_gateway_close(MODBUS_POSIX_GATEWAY * gateway)
+{
+    if (!gateway) { return; }
+
+    for (int i = 0; i < MODBUS_GATEWAY_MAX_CONNECTIONS; i++) { close_connection(gateway, i); }
+
+    if (gateway->listen_fd >= 0) { close(gateway->listen_fd); }
+    if (gateway->epoll_fd >= 0) { close(gateway->epoll_fd); }
+
+    gateway->listen_fd = -1;
+    gateway->epoll_fd = -1;
+    gateway->n_routes = 0;
+}
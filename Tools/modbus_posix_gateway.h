@@ -0,0 +1,102 @@
+#ifndef _MODBUS_POSIX_GATEWAY_H_
+#define _MODBUS_POSIX_GATEWAY_H_
+
+/*
+ * Modbus TCP to RTU gateway.
+ *
+ * TCP clients send MBAP framed requests to the gateway's listening port. Each
+ * request is routed by its unit id, through a table of unit ranges, to a serial
+ * line of a MODBUS_POSIX_MASTER, where it waits in the line's bounded queue for
+ * the line's single in-flight slot; writes are queued as control requests and go
+ * ahead of waiting reads. The RTU response goes back to the connection
+ * the request came from, under the request's transaction id; responses for
+ * connections that have since closed are dropped.
+ *
+ * The gateway answers for the device with EXCEPTION_GATEWAY_PATH_UNAVAILABLE when
+ * no route covers the unit or the line's queue is full, and with
+ * EXCEPTION_GATEWAY_TGT_DEVICE_NO_RSP when the device does not answer within the
+ * line's response timeout or its answer is corrupt. Broadcasts (unit 0) are sent
+ * on the routed line and not answered.
+ *
+ * Everything runs on one thread from modbus_posix_gateway_poll. The master's epoll
+ * fd is nested in the gateway's, so one wait covers the sockets and the lines.
+ */
+
+#ifndef MODBUS_GATEWAY_MAX_CONNECTIONS
+#define MODBUS_GATEWAY_MAX_CONNECTIONS 32
+#endif
+
+#ifndef MODBUS_GATEWAY_MAX_ROUTES
+#define MODBUS_GATEWAY_MAX_ROUTES 32
+#endif
+
+/* Every line's queue can be full at once */
+#define MODBUS_GATEWAY_MAX_PENDING (MODBUS_POSIX_MASTER_MAX_PORTS * MODBUS_POSIX_MASTER_QUEUE_SIZE)
+
+#define MODBUS_TCP_MAX_ADU 260
+
+struct modbus_gateway_route
+{
+	uint8_t first_unit;
+	uint8_t last_unit;
+	int line;
+};
+typedef struct modbus_gateway_route MODBUS_GATEWAY_ROUTE;
+
+struct modbus_gateway_connection
+{
+	int fd;
+	uint32_t generation;
+	uint8_t rx[MODBUS_TCP_MAX_ADU * 2];
+	int received;
+};
+typedef struct modbus_gateway_connection MODBUS_GATEWAY_CONNECTION;
+
+/* A request handed to a line, and where its response goes */
+struct modbus_gateway_pending
+{
+	struct modbus_posix_gateway * gateway;
+	bool in_use;
+	int connection;
+	uint32_t generation;
+	uint16_t transaction_id;
+	uint8_t unit_id;
+};
+typedef struct modbus_gateway_pending MODBUS_GATEWAY_PENDING;
+
+struct modbus_gateway_counters
+{
+	uint64_t requests;
+	uint64_t responses;
+	uint64_t path_unavailable;
+	uint64_t target_no_response;
+	uint64_t orphaned;
+	uint64_t bad_frames;
+};
+typedef struct modbus_gateway_counters MODBUS_GATEWAY_COUNTERS;
+
+struct modbus_posix_gateway
+{
+	MODBUS_POSIX_MASTER * master;
+	MODBUS_GATEWAY_COUNTERS counters;
+
+	int epoll_fd;
+	int listen_fd;
+	uint16_t port;
+
+	MODBUS_GATEWAY_ROUTE routes[MODBUS_GATEWAY_MAX_ROUTES];
+	int n_routes;
+
+	MODBUS_GATEWAY_CONNECTION connections[MODBUS_GATEWAY_MAX_CONNECTIONS];
+	MODBUS_GATEWAY_PENDING pending[MODBUS_GATEWAY_MAX_PENDING];
+};
+typedef struct modbus_posix_gateway MODBUS_POSIX_GATEWAY;
+
+bool modbus_posix_gateway_init(MODBUS_POSIX_GATEWAY * gateway, MODBUS_POSIX_MASTER * master, uint16_t port);
+uint16_t modbus_posix_gateway_get_port(MODBUS_POSIX_GATEWAY const * gateway);
+bool modbus_posix_gateway_add_route(MODBUS_POSIX_GATEWAY * gateway, uint8_t first_unit, uint8_t last_unit, int line);
+int modbus_posix_gateway_find_route(MODBUS_POSIX_GATEWAY const * gateway, uint8_t unit);
+int modbus_posix_gateway_poll(MODBUS_POSIX_GATEWAY * gateway, int max_wait_ms);
+void modbus_posix_gateway_close(MODBUS_POSIX_GATEWAY * gateway);
+
+#endif
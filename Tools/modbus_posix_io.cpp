@@ -0,0 +1,42 @@
+/*
+ * C/C++ Library Includes
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <sys/uio.h>
+
+/*
+ * Modbus Library Includes
+ */
+
+#include "modbus.h"
+#include "modbus_posix_io.h"
+
+/*
+ * Public Module Functions
+ */
+
+int modbus_posix_write_segments(int fd, MODBUS_SEGMENT const * segments, uint8_t n_segments)
+{
+    struct iovec iov[MODBUS_MAX_RESPONSE_SEGMENTS];
+
+    if (!segments || (n_segments > MODBUS_MAX_RESPONSE_SEGMENTS)) { return -1; }
+
+    for (int i = 0; i < n_segments; i++)
+    {
+        iov[i].iov_base = (void *)segments[i].data;
+        iov[i].iov_len = segments[i].length;
+    }
+
+    ssize_t written;
+    do
+    {
+        written = writev(fd, iov, n_segments);
+    } while ((written < 0) && (errno == EINTR));
+
+    return (int)written;
+}
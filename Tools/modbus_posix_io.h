@@ -0,0 +1,14 @@
+#ifndef _MODBUS_POSIX_IO_H_
+#define _MODBUS_POSIX_IO_H_
+
+/*
+ * Sends a scatter-gather response (see MODBUS_RESPONSE_SEGMENTS) on a file
+ * descriptor with a single writev, so the payload goes straight from the
+ * application's storage to the kernel without being copied into a frame buffer.
+ * Returns the number of bytes written (which may be short on a non-blocking
+ * descriptor), or -1 on error.
+ */
+
+int modbus_posix_write_segments(int fd, MODBUS_SEGMENT const * segments, uint8_t n_segments);
+
+#endif
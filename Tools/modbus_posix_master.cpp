@@ -0,0 +1,488 @@
+/*
+ * C/C++ Library Includes
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/epoll.h>
+
+/*
+ * Modbus Library Includes
+ */
+
+#include "modbus.h"
+#include "modbus_posix_master.h"
+
+/*
+ * Private Module Functions
+ */
+
+static uint64_t get_time_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+static speed_t get_speed(uint32_t baud)
+{
+    switch (baud)
+    {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    default: return B0;
+    }
+}
+
+static bool nothing_waiting(MODBUS_POSIX_MASTER_PORT const * port)
+{
+    return port->n_requests == ((port->current >= 0) ? 1 : 0);
+}
+
+/*
+ * The class whose first waiting request goes next: the earliest queueing time after
+ * adding one aging interval per class below control, or simply the highest
+ * non-empty class when aging is off. Ties go to the higher class.
+ */
+static int select_class(MODBUS_POSIX_MASTER_PORT const * port)
+{
+    int selected = -1;
+    uint64_t selected_rank = 0;
+
+    for (int c = 0; c < MASTER_PRIORITY_CLASSES; c++)
+    {
+        if (port->n_waiting[c] == 0) { continue; }
+
+        if (port->aging_us == 0) { return c; }
+
+        MODBUS_POSIX_MASTER_REQUEST const * request = &port->requests[port->waiting[c][port->first_waiting[c]]];
+        uint64_t rank = request->queued_us + ((uint64_t)c * port->aging_us);
+
+        if ((selected < 0) || (rank < selected_rank))
+        {
+            selected = c;
+            selected_rank = rank;
+        }
+    }
+
+    return selected;
+}
+
+static void update_stats(MODBUS_POSIX_MASTER_QUEUE_STATS * stats, uint64_t wait_us)
+{
+    stats->requests++;
+    stats->total_wait_us += wait_us;
+    if (wait_us > stats->max_wait_us) { stats->max_wait_us = wait_us; }
+}
+
+static void discard_input(MODBUS_POSIX_MASTER_PORT * port)
+{
+    uint8_t scratch[MODBUS_RTU_MAX_FRAME];
+    while (read(port->fd, scratch, sizeof(scratch)) > 0) {}
+}
+
+/*
+ * Takes the current request off the queue before calling back, so the callback
+ * can queue the next request on the same port.
+ */
+static void complete_request(MODBUS_POSIX_MASTER_PORT * port, int port_index, MODBUS_POSIX_MASTER_RESULT result, uint64_t now, uint32_t silent_us)
+{
+    MODBUS_POSIX_MASTER_REQUEST request = port->requests[port->current];
+    port->requests[port->current].in_use = false;
+    port->current = -1;
+    port->n_requests--;
+
+    port->state = PORT_TURNAROUND;
+    port->deadline_us = now + silent_us;
+
+    int response_length = port->received;
+    port->received = 0;
+
+    if (request.callback)
+    {
+        bool has_response = (result == MASTER_RESPONSE_OK) && (response_length > 0);
+        request.callback(port_index, request.frame, request.length,
+            has_response ? port->response : NULL, has_response ? response_length : 0, result, request.context);
+    }
+}
+
+static int start_next_request(MODBUS_POSIX_MASTER_PORT * port, int port_index, uint64_t now)
+{
+    if ((port->state != PORT_IDLE) || nothing_waiting(port)) { return 0; }
+
+    int c = select_class(port);
+    port->current = port->waiting[c][port->first_waiting[c]];
+    port->first_waiting[c] = (port->first_waiting[c] + 1) % MODBUS_POSIX_MASTER_QUEUE_SIZE;
+    port->n_waiting[c]--;
+
+    MODBUS_POSIX_MASTER_REQUEST const * request = &port->requests[port->current];
+    update_stats(&port->stats[c], (now > request->queued_us) ? (now - request->queued_us) : 0);
+
+    discard_input(port);
+    port->received = 0;
+
+    ssize_t written;
+    do
+    {
+        written = write(port->fd, request->frame, request->length);
+    } while ((written < 0) && (errno == EINTR));
+
+    if (written != request->length)
+    {
+        complete_request(port, port_index, MASTER_RESPONSE_IO_ERROR, now, port->turnaround_us);
+        return 1;
+    }
+
+    uint32_t transmit_us = request->length * port->character_us;
+
+    if (request->frame[0] == MODBUS_BROADCAST_ADDRESS)
+    {
+        complete_request(port, port_index, MASTER_RESPONSE_OK, now, transmit_us + port->broadcast_delay_us);
+        return 1;
+    }
+
+    port->state = PORT_WAITING_RESPONSE;
+    port->deadline_us = now + transmit_us + port->response_timeout_us;
+
+    return 0;
+}
+
+static int check_response(MODBUS_POSIX_MASTER_PORT * port, int port_index, uint64_t now)
+{
+    int expected = modbus_get_response_length(port->response, port->received);
+
+    if (expected == 0) { return 0; }
+
+    MODBUS_POSIX_MASTER_REQUEST const * request = &port->requests[port->current];
+    bool matches_request = (port->response[0] == request->frame[0]) && ((port->response[1] & 0x7F) == request->frame[1]);
+
+    if ((expected < 0) || (expected > MODBUS_RTU_MAX_FRAME) || !matches_request)
+    {
+        complete_request(port, port_index, MASTER_RESPONSE_INVALID_FRAME, now, port->turnaround_us);
+        return 1;
+    }
+
+    if (port->received < expected) { return 0; }
+
+    port->received = expected;
+    bool valid = modbus_validate_message_crc(port->response, expected);
+    complete_request(port, port_index, valid ? MASTER_RESPONSE_OK : MASTER_RESPONSE_CRC_FAILED, now, port->turnaround_us);
+
+    return 1;
+}
+
+static int read_port(MODBUS_POSIX_MASTER_PORT * port, int port_index, uint64_t now)
+{
+    if (port->state != PORT_WAITING_RESPONSE)
+    {
+        /* Late or unsolicited bytes */
+        discard_input(port);
+        return 0;
+    }
+
+    ssize_t n;
+    while ((n = read(port->fd, &port->response[port->received], MODBUS_RTU_MAX_FRAME - port->received)) > 0)
+    {
+        port->received += n;
+        if (port->received == MODBUS_RTU_MAX_FRAME) { break; }
+    }
+
+    return check_response(port, port_index, now);
+}
+
+static int service_timers(MODBUS_POSIX_MASTER * master, uint64_t now)
+{
+    int completed = 0;
+
+    for (int i = 0; i < master->n_ports; i++)
+    {
+        MODBUS_POSIX_MASTER_PORT * port = &master->ports[i];
+
+        if ((port->state == PORT_WAITING_RESPONSE) && (now >= port->deadline_us))
+        {
+            port->received = 0;
+            complete_request(port, i, MASTER_RESPONSE_TIMEOUT, now, port->turnaround_us);
+            completed++;
+        }
+
+        if ((port->state == PORT_TURNAROUND) && (now >= port->deadline_us))
+        {
+            port->state = PORT_IDLE;
+        }
+
+        completed += start_next_request(port, i, now);
+    }
+
+    return completed;
+}
+
+static int get_wait_ms(MODBUS_POSIX_MASTER const * master, uint64_t now, int max_wait_ms)
+{
+    int wait_ms = max_wait_ms;
+
+    for (int i = 0; i < master->n_ports; i++)
+    {
+        MODBUS_POSIX_MASTER_PORT const * port = &master->ports[i];
+
+        if (port->state == PORT_IDLE) { continue; }
+
+        uint64_t remaining_us = (port->deadline_us > now) ? (port->deadline_us - now) : 0;
+        int port_wait_ms = (int)((remaining_us + 999) / 1000);
+
+        if ((wait_ms < 0) || (port_wait_ms < wait_ms)) { wait_ms = port_wait_ms; }
+    }
+
+    return wait_ms;
+}
+
+/*
+ * Public Module Functions
+ */
+
+/*
+ * Opens a serial port (or pty) in raw 8N1 mode, non-blocking. Returns the fd or -1.
+ */
+int modbus_posix_open_serial(const char * path, uint32_t baud)
+{
+    speed_t speed = get_speed(baud);
+    if (!path || (speed == B0)) { return -1; }
+
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) { return -1; }
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+
+    if (tcsetattr(fd, TCSANOW, &tio) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * The silent interval between frames: 3.5 characters of 11 bits, fixed at 1750us above 19200 baud.
+ */
+uint32_t modbus_posix_get_turnaround_us(uint32_t baud)
+{
+    if ((baud == 0) || (baud > 19200)) { return 1750; }
+    return (38500000 + baud - 1) / baud;
+}
+
+bool modbus_posix_master_init(MODBUS_POSIX_MASTER * master)
+{
+    if (!master) { return false; }
+
+    master->n_ports = 0;
+    master->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    return master->epoll_fd >= 0;
+}
+
+/*
+ * Adds an open serial fd to the master and returns its port number, or -1.
+ * The master does not take ownership of fd.
+ */
+int modbus_posix_master_add_port(MODBUS_POSIX_MASTER * master, int fd, uint32_t baud, uint32_t response_timeout_ms, uint32_t broadcast_delay_ms)
+{
+    if (!master || (fd < 0) || (master->n_ports == MODBUS_POSIX_MASTER_MAX_PORTS)) { return -1; }
+
+    int index = master->n_ports;
+    MODBUS_POSIX_MASTER_PORT * port = &master->ports[index];
+
+    int flags = fcntl(fd, F_GETFL);
+    if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) { return -1; }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = index;
+    if (epoll_ctl(master->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) { return -1; }
+
+    port->fd = fd;
+    port->character_us = (baud > 0) ? ((11000000 + baud - 1) / baud) : 0;
+    port->turnaround_us = modbus_posix_get_turnaround_us(baud);
+    port->response_timeout_us = response_timeout_ms * 1000;
+    port->broadcast_delay_us = broadcast_delay_ms * 1000;
+    port->state = PORT_IDLE;
+    port->deadline_us = 0;
+    port->n_requests = 0;
+    memset(port->first_waiting, 0, sizeof(port->first_waiting));
+    memset(port->n_waiting, 0, sizeof(port->n_waiting));
+    port->current = -1;
+    port->aging_us = MODBUS_POSIX_MASTER_AGING_MS * 1000;
+    memset(port->stats, 0, sizeof(port->stats));
+    port->received = 0;
+
+    for (int i = 0; i < MODBUS_POSIX_MASTER_QUEUE_SIZE; i++)
+    {
+        port->requests[i].in_use = false;
+    }
+
+    master->n_ports++;
+
+    return index;
+}
+
+/*
+ * Queues a complete request frame (including its CRC) on a port at interactive priority.
+ * Returns false if the port is unknown, the frame is too long or the queue is full.
+ */
+bool modbus_posix_master_queue(MODBUS_POSIX_MASTER * master, int port, uint8_t const * request, int request_length,
+    MODBUS_POSIX_MASTER_CALLBACK callback, void * context)
+{
+    return modbus_posix_master_queue_priority(master, port, MASTER_PRIORITY_INTERACTIVE, request, request_length, callback, context);
+}
+
+/*
+ * As modbus_posix_master_queue, in the given class.
+ */
+bool modbus_posix_master_queue_priority(MODBUS_POSIX_MASTER * master, int port, MODBUS_POSIX_MASTER_PRIORITY priority,
+    uint8_t const * request, int request_length, MODBUS_POSIX_MASTER_CALLBACK callback, void * context)
+{
+    if (!master || (port < 0) || (port >= master->n_ports) || !request) { return false; }
+    if ((request_length < 4) || (request_length > MODBUS_RTU_MAX_FRAME)) { return false; }
+    if ((priority < MASTER_PRIORITY_CONTROL) || (priority >= MASTER_PRIORITY_CLASSES)) { return false; }
+
+    MODBUS_POSIX_MASTER_PORT * p = &master->ports[port];
+
+    if (p->n_requests == MODBUS_POSIX_MASTER_QUEUE_SIZE) { return false; }
+
+    int index = 0;
+    while (p->requests[index].in_use) { index++; }
+
+    MODBUS_POSIX_MASTER_REQUEST * slot = &p->requests[index];
+    memcpy(slot->frame, request, request_length);
+    slot->length = request_length;
+    slot->callback = callback;
+    slot->context = context;
+    slot->in_use = true;
+    slot->priority = priority;
+    slot->queued_us = get_time_us();
+
+    p->waiting[priority][(p->first_waiting[priority] + p->n_waiting[priority]) % MODBUS_POSIX_MASTER_QUEUE_SIZE] = index;
+    p->n_waiting[priority]++;
+    p->n_requests++;
+
+    return true;
+}
+
+/*
+ * The class a request frame naturally belongs in: writes are control, everything else interactive.
+ * Background is left to the application, for the polls it knows can wait.
+ */
+MODBUS_POSIX_MASTER_PRIORITY modbus_posix_master_get_priority(uint8_t const * request)
+{
+    switch (request[1])
+    {
+    case WRITE_SINGLE_COIL:
+    case WRITE_HOLDING_REGISTER:
+    case WRITE_MULTIPLE_COILS:
+    case WRITE_HOLDING_REGISTERS:
+    case MASK_WRITE_REGISTER:
+    case READ_WRITE_REGISTERS:
+        return MASTER_PRIORITY_CONTROL;
+    default:
+        return MASTER_PRIORITY_INTERACTIVE;
+    }
+}
+
+/*
+ * Sets how long a request waits before it ranks alongside the class above it; 0 makes the classes strict.
+ */
+bool modbus_posix_master_set_aging(MODBUS_POSIX_MASTER * master, int port, uint32_t aging_ms)
+{
+    if (!master || (port < 0) || (port >= master->n_ports)) { return false; }
+
+    master->ports[port].aging_us = aging_ms * 1000;
+
+    return true;
+}
+
+/*
+ * Sends queued requests, collects responses and handles timeouts, waiting up to
+ * max_wait_ms (or indefinitely if negative) for something to happen.
+ * Returns the number of requests completed.
+ */
+int modbus_posix_master_poll(MODBUS_POSIX_MASTER * master, int max_wait_ms)
+{
+    struct epoll_event events[MODBUS_POSIX_MASTER_MAX_PORTS];
+
+    if (!master) { return 0; }
+
+    int completed = service_timers(master, get_time_us());
+
+    int wait_ms = (completed > 0) ? 0 : get_wait_ms(master, get_time_us(), max_wait_ms);
+
+    int n_events = epoll_wait(master->epoll_fd, events, MODBUS_POSIX_MASTER_MAX_PORTS, wait_ms);
+
+    uint64_t now = get_time_us();
+
+    for (int e = 0; e < n_events; e++)
+    {
+        int index = events[e].data.u32;
+        completed += read_port(&master->ports[index], index, now);
+    }
+
+    completed += service_timers(master, now);
+
+    return completed;
+}
+
+bool modbus_posix_master_idle(MODBUS_POSIX_MASTER const * master)
+{
+    for (int i = 0; i < master->n_ports; i++)
+    {
+        if (master->ports[i].n_requests > 0) { return false; }
+    }
+
+    return true;
+}
+
+/*
+ * How long an application that waits on the master's epoll fd itself may sleep before the
+ * next turnaround or response timeout falls due: at most max_wait_ms, or indefinitely if
+ * negative and no port is busy.
+ */
+int modbus_posix_master_get_wait_ms(MODBUS_POSIX_MASTER const * master, int max_wait_ms)
+{
+    return get_wait_ms(master, get_time_us(), max_wait_ms);
+}
+
+void modbus_posix_master_close(MODBUS_POSIX_MASTER * master)
+{
+    if (!master) { return; }
+
+    if (master->epoll_fd >= 0) { close(master->epoll_fd); }
+
+    master->epoll_fd = -1;
+    master->n_ports = 0;
+}
@@ -0,0 +1,152 @@
+#ifndef _MODBUS_POSIX_MASTER_H_
+#define _MODBUS_POSIX_MASTER_H_
+
+/*
+ * Serial line master for many RS-485 ports serviced from a single epoll loop.
+ *
+ * Each port has its own queue of up to MODBUS_POSIX_MASTER_QUEUE_SIZE requests,
+ * counting the one in flight. A port sends one request at a time, waits for the
+ * response (frames are completed with modbus_get_response_length and checked
+ * with modbus_validate_message_crc) or for the response timeout,
+ * then keeps the line silent for the turnaround time before the next request.
+ * The turnaround is 3.5 character times at the port's baud rate (1750us above
+ * 19200 baud); broadcasts expect no response and wait broadcast_delay_ms instead.
+ *
+ * Requests are taken by class: control writes first, then interactive reads, then
+ * background polls, so a setpoint does not wait behind a backlog of polls. Within a
+ * class they run in the order they were queued. modbus_posix_master_queue queues
+ * at interactive priority, so requests queued with it alone keep their order;
+ * modbus_posix_master_queue_priority takes a class, for example from
+ * modbus_posix_master_get_priority. Requests age so that lower classes are not
+ * starved: a request is ranked as if it had been queued one aging interval later
+ * for each class it is below control, and the earliest rank goes next. With aging
+ * 0 the classes are strict. Every port records the queueing delay of each class,
+ * from queueing to transmission, in stats.
+ *
+ * The master is driven by calling modbus_posix_master_poll from the
+ * application's loop; completed requests are reported through their callback.
+ * All memory is inside MODBUS_POSIX_MASTER, nothing is allocated.
+ */
+
+#ifndef MODBUS_POSIX_MASTER_MAX_PORTS
+#define MODBUS_POSIX_MASTER_MAX_PORTS 32
+#endif
+
+#ifndef MODBUS_POSIX_MASTER_QUEUE_SIZE
+#define MODBUS_POSIX_MASTER_QUEUE_SIZE 16
+#endif
+
+#ifndef MODBUS_POSIX_MASTER_AGING_MS
+#define MODBUS_POSIX_MASTER_AGING_MS 1000
+#endif
+
+#define MODBUS_RTU_MAX_FRAME 256
+
+enum modbus_posix_master_priority
+{
+	MASTER_PRIORITY_CONTROL,
+	MASTER_PRIORITY_INTERACTIVE,
+	MASTER_PRIORITY_BACKGROUND,
+	MASTER_PRIORITY_CLASSES
+};
+typedef enum modbus_posix_master_priority MODBUS_POSIX_MASTER_PRIORITY;
+
+enum modbus_posix_master_result
+{
+	MASTER_RESPONSE_OK,
+	MASTER_RESPONSE_TIMEOUT,
+	MASTER_RESPONSE_CRC_FAILED,
+	MASTER_RESPONSE_INVALID_FRAME,
+	MASTER_RESPONSE_IO_ERROR
+};
+typedef enum modbus_posix_master_result MODBUS_POSIX_MASTER_RESULT;
+
+/*
+ * response is NULL unless result is MASTER_RESPONSE_OK; it may be an exception
+ * response. For broadcasts a successful request has no response.
+ * MASTER_RESPONSE_INVALID_FRAME is a response from another unit or for another
+ * function code, or one whose length cannot be determined.
+ */
+typedef void (*MODBUS_POSIX_MASTER_CALLBACK)(int port, uint8_t const * request, int request_length,
+	uint8_t const * response, int response_length, MODBUS_POSIX_MASTER_RESULT result, void * context);
+
+struct modbus_posix_master_request
+{
+	uint8_t frame[MODBUS_RTU_MAX_FRAME];
+	int length;
+	MODBUS_POSIX_MASTER_CALLBACK callback;
+	void * context;
+	bool in_use;
+	MODBUS_POSIX_MASTER_PRIORITY priority;
+	uint64_t queued_us;
+};
+typedef struct modbus_posix_master_request MODBUS_POSIX_MASTER_REQUEST;
+
+struct modbus_posix_master_queue_stats
+{
+	uint64_t requests;
+	uint64_t total_wait_us;
+	uint64_t max_wait_us;
+};
+typedef struct modbus_posix_master_queue_stats MODBUS_POSIX_MASTER_QUEUE_STATS;
+
+enum modbus_posix_master_port_state
+{
+	PORT_IDLE,
+	PORT_WAITING_RESPONSE,
+	PORT_TURNAROUND
+};
+typedef enum modbus_posix_master_port_state MODBUS_POSIX_MASTER_PORT_STATE;
+
+struct modbus_posix_master_port
+{
+	int fd;
+	uint32_t character_us;
+	uint32_t turnaround_us;
+	uint32_t response_timeout_us;
+	uint32_t broadcast_delay_us;
+
+	MODBUS_POSIX_MASTER_PORT_STATE state;
+	uint64_t deadline_us;
+
+	/* Request slots, and the slot indices waiting in each class in queueing order */
+	MODBUS_POSIX_MASTER_REQUEST requests[MODBUS_POSIX_MASTER_QUEUE_SIZE];
+	uint8_t n_requests;
+	uint8_t waiting[MASTER_PRIORITY_CLASSES][MODBUS_POSIX_MASTER_QUEUE_SIZE];
+	uint8_t first_waiting[MASTER_PRIORITY_CLASSES];
+	uint8_t n_waiting[MASTER_PRIORITY_CLASSES];
+	int current;
+
+	uint32_t aging_us;
+	MODBUS_POSIX_MASTER_QUEUE_STATS stats[MASTER_PRIORITY_CLASSES];
+
+	uint8_t response[MODBUS_RTU_MAX_FRAME];
+	int received;
+};
+typedef struct modbus_posix_master_port MODBUS_POSIX_MASTER_PORT;
+
+struct modbus_posix_master
+{
+	int epoll_fd;
+	MODBUS_POSIX_MASTER_PORT ports[MODBUS_POSIX_MASTER_MAX_PORTS];
+	int n_ports;
+};
+typedef struct modbus_posix_master MODBUS_POSIX_MASTER;
+
+int modbus_posix_open_serial(const char * path, uint32_t baud);
+uint32_t modbus_posix_get_turnaround_us(uint32_t baud);
+
+bool modbus_posix_master_init(MODBUS_POSIX_MASTER * master);
+int modbus_posix_master_add_port(MODBUS_POSIX_MASTER * master, int fd, uint32_t baud, uint32_t response_timeout_ms, uint32_t broadcast_delay_ms);
+bool modbus_posix_master_queue(MODBUS_POSIX_MASTER * master, int port, uint8_t const * request, int request_length,
+	MODBUS_POSIX_MASTER_CALLBACK callback, void * context);
+bool modbus_posix_master_queue_priority(MODBUS_POSIX_MASTER * master, int port, MODBUS_POSIX_MASTER_PRIORITY priority,
+	uint8_t const * request, int request_length, MODBUS_POSIX_MASTER_CALLBACK callback, void * context);
+MODBUS_POSIX_MASTER_PRIORITY modbus_posix_master_get_priority(uint8_t const * request);
+bool modbus_posix_master_set_aging(MODBUS_POSIX_MASTER * master, int port, uint32_t aging_ms);
+int modbus_posix_master_poll(MODBUS_POSIX_MASTER * master, int max_wait_ms);
+bool modbus_posix_master_idle(MODBUS_POSIX_MASTER const * master);
+int modbus_posix_master_get_wait_ms(MODBUS_POSIX_MASTER const * master, int max_wait_ms);
+void modbus_posix_master_close(MODBUS_POSIX_MASTER * master);
+
+#endif
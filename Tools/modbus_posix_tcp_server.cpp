@@ -0,0 +1,433 @@
+/*
+ * C/C++ Library Includes
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/*
+ * Modbus Library Includes
+ */
+
+#include "modbus.h"
+#include "modbus_posix_tcp_server.h"
+
+/*
+ * Private Module Constants
+ */
+
+/* epoll tag for the listener; connections are tagged with their index */
+#define LISTENER_EVENT 0xFFFFFFFFUL
+
+/*
+ * Private Module Functions
+ */
+
+static void close_connection(MODBUS_POSIX_TCP_SERVER * server, int index)
+{
+    MODBUS_TCP_SERVER_CONNECTION * connection = &server->connections[index];
+
+    if (connection->fd < 0) { return; }
+
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+
+    connection->fd = -1;
+    connection->paused = false;
+    connection->received = 0;
+    connection->n_queued = 0;
+    connection->deficit = 0;
+
+    if (server->current == index) { server->current = -1; }
+}
+
+/* A client that does not keep up with its responses is disconnected */
+static void send_adu(MODBUS_POSIX_TCP_SERVER * server, int index, uint8_t const * adu, int length)
+{
+    MODBUS_TCP_SERVER_CONNECTION * connection = &server->connections[index];
+
+    ssize_t written;
+    do
+    {
+        written = send(connection->fd, adu, length, MSG_NOSIGNAL);
+    } while ((written < 0) && (errno == EINTR));
+
+    if (written != length) { close_connection(server, index); }
+}
+
+static void send_busy(MODBUS_POSIX_TCP_SERVER * server, int index, uint8_t const * request)
+{
+    uint16_t transaction_id = (request[0] << 8) | request[1];
+    uint8_t unit_id = request[MODBUS_MBAP_HEADER_SIZE - 1];
+    uint8_t adu[MODBUS_TCP_SERVER_MAX_ADU];
+
+    int length = modbus_write_exception(unit_id, &adu[MODBUS_MBAP_HEADER_SIZE - 1], EXCEPTION_SLAVE_DEVICE_BUSY,
+        request[MODBUS_MBAP_HEADER_SIZE] | 0x80, false);
+    modbus_write_mbap_header(adu, transaction_id, length - 1, unit_id);
+
+    server->counters.busy++;
+    server->connections[index].busy++;
+
+    send_adu(server, index, adu, length + MODBUS_MBAP_HEADER_SIZE - 1);
+}
+
+static void set_paused(MODBUS_POSIX_TCP_SERVER * server, int index, bool paused)
+{
+    MODBUS_TCP_SERVER_CONNECTION * connection = &server->connections[index];
+
+    if (connection->paused == paused) { return; }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = paused ? 0 : (uint32_t)EPOLLIN;
+    event.data.u32 = index;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+
+    connection->paused = paused;
+    if (paused) { server->counters.pauses++; }
+}
+
+static void consume(MODBUS_TCP_SERVER_CONNECTION * connection, int n)
+{
+    memmove(connection->rx, &connection->rx[n], connection->received - n);
+    connection->received -= n;
+}
+
+/*
+ * Moves every complete ADU received into the connection's queue. Once the queue is
+ * full, further ADUs are answered busy, or left unread with the connection paused.
+ * Returns false if the stream cannot be framed.
+ */
+static bool queue_frames(MODBUS_POSIX_TCP_SERVER * server, int index)
+{
+    MODBUS_TCP_SERVER_CONNECTION * connection = &server->connections[index];
+
+    while ((connection->fd >= 0) && (connection->received >= MODBUS_MBAP_HEADER_SIZE))
+    {
+        uint16_t protocol_id = (connection->rx[2] << 8) | connection->rx[3];
+        int length = (connection->rx[4] << 8) | connection->rx[5];
+        int total = length + MODBUS_MBAP_HEADER_SIZE - 1;
+
+        if ((length < 2) || (total > MODBUS_TCP_SERVER_MAX_ADU)) { return false; }
+        if (connection->received < total) { break; }
+
+        if (protocol_id != 0)
+        {
+            server->counters.bad_frames++;
+        }
+        else if (connection->n_queued < MODBUS_TCP_SERVER_QUEUE_SIZE)
+        {
+            int slot = (connection->first + connection->n_queued) % MODBUS_TCP_SERVER_QUEUE_SIZE;
+            memcpy(connection->queue[slot], connection->rx, total);
+            connection->lengths[slot] = total;
+            connection->n_queued++;
+
+            server->counters.requests++;
+            connection->requests++;
+        }
+        else if (server->config.overload == MODBUS_TCP_OVERLOAD_PAUSE)
+        {
+            set_paused(server, index, true);
+            break;
+        }
+        else
+        {
+            send_busy(server, index, connection->rx);
+            if (connection->fd < 0) { break; }
+        }
+
+        consume(connection, total);
+    }
+
+    return true;
+}
+
+static void read_connection(MODBUS_POSIX_TCP_SERVER * server, int index)
+{
+    MODBUS_TCP_SERVER_CONNECTION * connection = &server->connections[index];
+
+    while ((connection->fd >= 0) && !connection->paused)
+    {
+        ssize_t n = read(connection->fd, &connection->rx[connection->received], sizeof(connection->rx) - connection->received);
+
+        if (n > 0)
+        {
+            connection->received += n;
+
+            if (!queue_frames(server, index))
+            {
+                server->counters.bad_frames++;
+                close_connection(server, index);
+            }
+            continue;
+        }
+
+        if ((n < 0) && (errno == EINTR)) { continue; }
+        if ((n < 0) && (errno == EAGAIN)) { break; }
+
+        close_connection(server, index);
+    }
+}
+
+static void accept_connections(MODBUS_POSIX_TCP_SERVER * server)
+{
+    int fd;
+
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        int index = -1;
+        for (int i = 0; (i < MODBUS_TCP_SERVER_MAX_CONNECTIONS) && (index < 0); i++)
+        {
+            if (server->connections[i].fd < 0) { index = i; }
+        }
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = index;
+
+        if ((index < 0) || (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0))
+        {
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        MODBUS_TCP_SERVER_CONNECTION * connection = &server->connections[index];
+        connection->fd = fd;
+        connection->paused = false;
+        connection->received = 0;
+        connection->first = 0;
+        connection->n_queued = 0;
+        connection->deficit = 0;
+        connection->requests = 0;
+        connection->busy = 0;
+    }
+}
+
+/* Runs the request at the head of a connection's queue and charges it to the connection's credit */
+static void run_request(MODBUS_POSIX_TCP_SERVER * server, int index)
+{
+    MODBUS_TCP_SERVER_CONNECTION * connection = &server->connections[index];
+
+    uint8_t const * request = connection->queue[connection->first];
+    int length = connection->lengths[connection->first];
+
+    uint16_t transaction_id = (request[0] << 8) | request[1];
+    uint8_t unit_id = request[MODBUS_MBAP_HEADER_SIZE - 1];
+
+    uint8_t adu[MODBUS_TCP_SERVER_MAX_ADU];
+    int response_length = server->config.service(&request[MODBUS_MBAP_HEADER_SIZE - 1], length - MODBUS_MBAP_HEADER_SIZE + 1,
+        &adu[MODBUS_MBAP_HEADER_SIZE - 1], server->config.context);
+
+    connection->first = (connection->first + 1) % MODBUS_TCP_SERVER_QUEUE_SIZE;
+    connection->n_queued--;
+
+    if (response_length > 0)
+    {
+        modbus_write_mbap_header(adu, transaction_id, response_length - 1, unit_id);
+        server->counters.responses++;
+        send_adu(server, index, adu, response_length + MODBUS_MBAP_HEADER_SIZE - 1);
+        response_length += MODBUS_MBAP_HEADER_SIZE - 1;
+    }
+
+    if (connection->fd < 0) { return; }
+
+    connection->deficit -= length + response_length;
+
+    /* There is room again: take what was left unread, and resume reading if that fits */
+    if (connection->paused)
+    {
+        set_paused(server, index, false);
+        if (!queue_frames(server, index))
+        {
+            server->counters.bad_frames++;
+            close_connection(server, index);
+        }
+    }
+}
+
+/* The next connection with requests waiting, in rotation, or -1 */
+static int find_next_turn(MODBUS_POSIX_TCP_SERVER * server)
+{
+    for (int i = 0; i < MODBUS_TCP_SERVER_MAX_CONNECTIONS; i++)
+    {
+        int index = (server->next + i) % MODBUS_TCP_SERVER_MAX_CONNECTIONS;
+        MODBUS_TCP_SERVER_CONNECTION const * connection = &server->connections[index];
+
+        if ((connection->fd >= 0) && (connection->n_queued > 0))
+        {
+            server->next = (index + 1) % MODBUS_TCP_SERVER_MAX_CONNECTIONS;
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Deficit round robin over the connection queues, up to max_requests_per_poll requests.
+ * A turn interrupted by the limit carries on at the next poll.
+ */
+static int run_queues(MODBUS_POSIX_TCP_SERVER * server)
+{
+    uint16_t limit = server->config.max_requests_per_poll;
+    int32_t quantum = server->config.quantum ? server->config.quantum : MODBUS_TCP_SERVER_QUANTUM;
+    int served = 0;
+
+    while ((limit == 0) || (served < limit))
+    {
+        if (server->current < 0)
+        {
+            server->current = find_next_turn(server);
+            if (server->current < 0) { break; }
+
+            server->connections[server->current].deficit += quantum;
+        }
+
+        MODBUS_TCP_SERVER_CONNECTION * connection = &server->connections[server->current];
+
+        if ((connection->n_queued == 0) || (connection->deficit <= 0))
+        {
+            /* Credit is not banked by a connection with nothing left to send */
+            if (connection->n_queued == 0) { connection->deficit = 0; }
+            server->current = -1;
+            continue;
+        }
+
+        run_request(server, server->current);
+        served++;
+    }
+
+    return served;
+}
+
+static bool has_queued(MODBUS_POSIX_TCP_SERVER const * server)
+{
+    for (int i = 0; i < MODBUS_TCP_SERVER_MAX_CONNECTIONS; i++)
+    {
+        if ((server->connections[i].fd >= 0) && (server->connections[i].n_queued > 0)) { return true; }
+    }
+
+    return false;
+}
+
+/*
+ * Public Module Functions
+ */
+
+/*
+ * Listens for Modbus TCP clients on port (0 picks a free port, see
+ * modbus_posix_tcp_server_get_port) and runs their requests with config->service.
+ */
+bool modbus_posix_tcp_server_init(MODBUS_POSIX_TCP_SERVER * server, MODBUS_TCP_SERVER_CONFIG const * config, uint16_t port)
+{
+    if (!server || !config || !config->service) { return false; }
+
+    memset(server, 0, sizeof(*server));
+    server->config = *config;
+    server->listen_fd = -1;
+    server->current = -1;
+
+    for (int i = 0; i < MODBUS_TCP_SERVER_MAX_CONNECTIONS; i++) { server->connections[i].fd = -1; }
+
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->epoll_fd < 0) { return false; }
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0)
+    {
+        modbus_posix_tcp_server_close(server);
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = LISTENER_EVENT;
+
+    socklen_t address_length = sizeof(address);
+    bool listening = (bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) == 0)
+        && (listen(server->listen_fd, SOMAXCONN) == 0)
+        && (getsockname(server->listen_fd, (struct sockaddr *)&address, &address_length) == 0)
+        && (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event) == 0);
+
+    if (!listening)
+    {
+        modbus_posix_tcp_server_close(server);
+        return false;
+    }
+
+    server->port = ntohs(address.sin_port);
+
+    return true;
+}
+
+uint16_t modbus_posix_tcp_server_get_port(MODBUS_POSIX_TCP_SERVER const * server)
+{
+    return server->port;
+}
+
+/*
+ * Accepts clients, queues their requests and runs them in turn, waiting up to
+ * max_wait_ms (or indefinitely if negative) for something to happen; it does not
+ * wait while requests are queued. Returns the number of requests run.
+ */
+int modbus_posix_tcp_server_poll(MODBUS_POSIX_TCP_SERVER * server, int max_wait_ms)
+{
+    struct epoll_event events[MODBUS_TCP_SERVER_MAX_CONNECTIONS + 1];
+
+    if (!server) { return 0; }
+
+    int wait_ms = has_queued(server) ? 0 : max_wait_ms;
+    int n_events = epoll_wait(server->epoll_fd, events, MODBUS_TCP_SERVER_MAX_CONNECTIONS + 1, wait_ms);
+
+    for (int e = 0; e < n_events; e++)
+    {
+        uint32_t tag = events[e].data.u32;
+
+        if (tag == LISTENER_EVENT)
+        {
+            accept_connections(server);
+        }
+        else
+        {
+            read_connection(server, (int)tag);
+        }
+    }
+
+    return run_queues(server);
+}
+
+void modbus_posix_tcp_server_close(MODBUS_POSIX_TCP_SERVER * server)
+{
+    if (!server) { return; }
+
+    for (int i = 0; i < MODBUS_TCP_SERVER_MAX_CONNECTIONS; i++) { close_connection(server, i); }
+
+    if (server->listen_fd >= 0) { close(server->listen_fd); }
+    if (server->epoll_fd >= 0) { close(server->epoll_fd); }
+
+    server->listen_fd = -1;
+    server->epoll_fd = -1;
+}
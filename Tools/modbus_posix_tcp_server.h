@@ -0,0 +1,125 @@
+#ifndef _MODBUS_POSIX_TCP_SERVER_H_
+#define _MODBUS_POSIX_TCP_SERVER_H_
+
+/*
+ * Modbus TCP server that shares its time fairly between clients.
+ *
+ * Complete MBAP requests are read from each connection into that connection's own
+ * queue of up to MODBUS_TCP_SERVER_QUEUE_SIZE requests, and the queues are serviced
+ * by deficit round robin: each connection with requests waiting takes a turn, gains
+ * quantum bytes of credit for it, and runs requests until the credit is spent, each
+ * costing its request plus response length. A client that floods requests gets no
+ * more of the server than any other busy client, and a client with one request
+ * outstanding waits for at most one turn of each other client, not behind the flood.
+ *
+ * When a connection's queue is full the server either answers its further requests
+ * straight away with EXCEPTION_SLAVE_DEVICE_BUSY (MODBUS_TCP_OVERLOAD_BUSY), or stops
+ * reading its socket until the queue has room again (MODBUS_TCP_OVERLOAD_PAUSE), so
+ * TCP flow control holds the client back.
+ *
+ * Requests are executed by the application's service function, typically with
+ * modbus_service_message. modbus_posix_tcp_server_poll runs at most
+ * max_requests_per_poll of them (0 for no limit) before going back to the sockets,
+ * so new arrivals join the rotation promptly.
+ *
+ * Everything runs on one thread from modbus_posix_tcp_server_poll. All memory is
+ * inside MODBUS_POSIX_TCP_SERVER, nothing is allocated.
+ */
+
+#ifndef MODBUS_TCP_SERVER_MAX_CONNECTIONS
+#define MODBUS_TCP_SERVER_MAX_CONNECTIONS 32
+#endif
+
+#ifndef MODBUS_TCP_SERVER_QUEUE_SIZE
+#define MODBUS_TCP_SERVER_QUEUE_SIZE 8
+#endif
+
+#define MODBUS_TCP_SERVER_MAX_ADU 260
+
+/* One maximum size request and response */
+#ifndef MODBUS_TCP_SERVER_QUANTUM
+#define MODBUS_TCP_SERVER_QUANTUM (MODBUS_TCP_SERVER_MAX_ADU * 2)
+#endif
+
+/*
+ * Executes one request. request is the unit id and PDU of an MBAP frame (no CRC).
+ * The response, also from the unit id and without CRC, is written to response, which
+ * has room for MODBUS_TCP_SERVER_MAX_ADU - MODBUS_MBAP_HEADER_SIZE + 1 bytes.
+ * Returns the response length, or 0 to send no response.
+ */
+typedef int (*MODBUS_TCP_SERVER_SERVICE)(uint8_t const * request, int request_length, uint8_t * response, void * context);
+
+enum modbus_tcp_overload_policy
+{
+	MODBUS_TCP_OVERLOAD_BUSY,
+	MODBUS_TCP_OVERLOAD_PAUSE
+};
+typedef enum modbus_tcp_overload_policy MODBUS_TCP_OVERLOAD_POLICY;
+
+struct modbus_tcp_server_config
+{
+	MODBUS_TCP_SERVER_SERVICE service;
+	void * context;
+
+	MODBUS_TCP_OVERLOAD_POLICY overload;
+
+	/* Credit per turn in bytes; 0 for MODBUS_TCP_SERVER_QUANTUM */
+	uint16_t quantum;
+	uint16_t max_requests_per_poll;
+};
+typedef struct modbus_tcp_server_config MODBUS_TCP_SERVER_CONFIG;
+
+struct modbus_tcp_server_counters
+{
+	uint64_t requests;
+	uint64_t responses;
+	uint64_t busy;
+	uint64_t pauses;
+	uint64_t bad_frames;
+};
+typedef struct modbus_tcp_server_counters MODBUS_TCP_SERVER_COUNTERS;
+
+struct modbus_tcp_server_connection
+{
+	int fd;
+	bool paused;
+
+	uint8_t rx[MODBUS_TCP_SERVER_MAX_ADU * 2];
+	int received;
+
+	/* Complete ADUs waiting for their turn, in arrival order */
+	uint8_t queue[MODBUS_TCP_SERVER_QUEUE_SIZE][MODBUS_TCP_SERVER_MAX_ADU];
+	uint16_t lengths[MODBUS_TCP_SERVER_QUEUE_SIZE];
+	uint8_t first;
+	uint8_t n_queued;
+
+	int32_t deficit;
+
+	uint64_t requests;
+	uint64_t busy;
+};
+typedef struct modbus_tcp_server_connection MODBUS_TCP_SERVER_CONNECTION;
+
+struct modbus_posix_tcp_server
+{
+	MODBUS_TCP_SERVER_CONFIG config;
+	MODBUS_TCP_SERVER_COUNTERS counters;
+
+	int epoll_fd;
+	int listen_fd;
+	uint16_t port;
+
+	MODBUS_TCP_SERVER_CONNECTION connections[MODBUS_TCP_SERVER_MAX_CONNECTIONS];
+
+	/* The connection taking its turn (-1 between turns), and where the next turn starts looking */
+	int current;
+	int next;
+};
+typedef struct modbus_posix_tcp_server MODBUS_POSIX_TCP_SERVER;
+
+bool modbus_posix_tcp_server_init(MODBUS_POSIX_TCP_SERVER * server, MODBUS_TCP_SERVER_CONFIG const * config, uint16_t port);
+uint16_t modbus_posix_tcp_server_get_port(MODBUS_POSIX_TCP_SERVER const * server);
+int modbus_posix_tcp_server_poll(MODBUS_POSIX_TCP_SERVER * server, int max_wait_ms);
+void modbus_posix_tcp_server_close(MODBUS_POSIX_TCP_SERVER * server);
+
+#endif
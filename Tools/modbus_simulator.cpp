@@ -0,0 +1,720 @@
+/*
+ * C/C++ Library Includes
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/*
+ * Modbus Library Includes
+ */
+
+#include "modbus.h"
+#include "modbus_simulator.h"
+
+/*
+ * Private Module Types
+ */
+
+#define MAX_UNITS 248
+
+enum endpoint_kind
+{
+    ENDPOINT_LINE,
+    ENDPOINT_LISTENER,
+    ENDPOINT_CONNECTION
+};
+
+struct pending_response
+{
+    uint64_t due_us;
+    int length;
+    uint8_t bytes[MODBUS_SIMULATOR_MAX_FRAME];
+};
+
+struct modbus_simulator_bus
+{
+    bool tcp;
+    int hold_fd;
+    char path[64];
+    uint16_t port;
+    int16_t * units[MAX_UNITS];
+};
+
+struct modbus_simulator_endpoint
+{
+    endpoint_kind kind;
+    int fd;
+    int bus;
+
+    uint8_t rx[MODBUS_SIMULATOR_MAX_FRAME * 2];
+    int received;
+
+    pending_response pending[MODBUS_SIMULATOR_PENDING_RESPONSES];
+    uint8_t head;
+    uint8_t tail;
+    uint64_t last_due_us;
+};
+
+/*
+ * Private Module Data
+ */
+
+/* The frame being serviced, for the handler callbacks */
+static MODBUS_SIMULATOR * s_simulator;
+static int16_t * s_unit;
+static uint8_t s_unit_address;
+static bool s_tcp;
+
+static uint8_t s_response[MODBUS_SIMULATOR_MAX_FRAME];
+static int s_response_length;
+
+static int16_t s_write_holding_register_data_buffer[123];
+static MODBUS_HANDLER s_modbus_handler;
+
+/*
+ * Private Module Functions
+ */
+
+static uint64_t get_time_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+static uint32_t next_random(MODBUS_SIMULATOR * simulator)
+{
+    uint32_t x = simulator->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    simulator->random_state = x;
+    return x;
+}
+
+static bool random_event(MODBUS_SIMULATOR * simulator, uint16_t rate)
+{
+    return (rate != 0) && ((next_random(simulator) & 0xFFFF) < rate);
+}
+
+static uint16_t get_total_count(MODBUS_ADDRESS_RANGE const * ranges, uint8_t num_ranges)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < num_ranges; i++) { total += ranges[i].count; }
+    return (total > 0xFFFF) ? 0xFFFF : (uint16_t)total;
+}
+
+/* Index into a unit's storage of a register, or -1 if it is not mapped */
+static int get_storage_index(MODBUS_ADDRESS_RANGE const * ranges, uint8_t num_ranges, uint16_t reg)
+{
+    int range = modbus_find_address_range(ranges, num_ranges, reg);
+    if (range < 0) { return -1; }
+
+    int index = reg - ranges[range].first;
+    for (int i = 0; i < range; i++) { index += ranges[i].count; }
+
+    return index;
+}
+
+static int16_t * get_unit(MODBUS_SIMULATOR * simulator, modbus_simulator_bus * bus, uint8_t unit)
+{
+    if (!bus->units[unit])
+    {
+        int n_registers = simulator->n_holding_registers + simulator->n_input_registers;
+        bus->units[unit] = (int16_t *)calloc(n_registers ? n_registers : 1, sizeof(int16_t));
+
+        /* Input registers read back their own index, so masters can check the data */
+        for (int i = 0; bus->units[unit] && (i < simulator->n_input_registers); i++)
+        {
+            bus->units[unit][simulator->n_holding_registers + i] = (int16_t)i;
+        }
+    }
+
+    return bus->units[unit];
+}
+
+static bool unit_is_hosted(MODBUS_SIMULATOR const * simulator, uint8_t unit)
+{
+    return (unit >= simulator->config.first_unit) && (unit <= simulator->config.last_unit);
+}
+
+static uint8_t * response_start()
+{
+    return s_tcp ? &s_response[MODBUS_MBAP_HEADER_SIZE - 1] : s_response;
+}
+
+static void read_holding_registers(uint16_t reg, uint16_t n_registers)
+{
+    MODBUS_SIMULATOR_CONFIG const& config = s_simulator->config;
+    int index = get_storage_index(config.holding_register_ranges, config.num_holding_register_ranges, reg);
+    s_response_length = modbus_write_read_holding_registers_response(s_unit_address, response_start(), &s_unit[index], n_registers, !s_tcp);
+}
+
+static void read_input_registers(uint16_t reg, uint16_t n_registers)
+{
+    MODBUS_SIMULATOR_CONFIG const& config = s_simulator->config;
+    int index = s_simulator->n_holding_registers + get_storage_index(config.input_register_ranges, config.num_input_register_ranges, reg);
+    s_response_length = modbus_write_read_input_registers_response(s_unit_address, response_start(), &s_unit[index], n_registers, !s_tcp);
+}
+
+static void write_holding_register(uint16_t reg, int16_t value)
+{
+    MODBUS_SIMULATOR_CONFIG const& config = s_simulator->config;
+    s_unit[get_storage_index(config.holding_register_ranges, config.num_holding_register_ranges, reg)] = value;
+    s_response_length = modbus_get_write_holding_register_response(s_unit_address, response_start(), reg, value, !s_tcp);
+}
+
+static void write_holding_registers(uint16_t first_reg, uint16_t n_registers, int16_t * values)
+{
+    MODBUS_SIMULATOR_CONFIG const& config = s_simulator->config;
+    int index = get_storage_index(config.holding_register_ranges, config.num_holding_register_ranges, first_reg);
+    memcpy(&s_unit[index], values, n_registers * sizeof(int16_t));
+    s_response_length = modbus_get_write_holding_registers_response(s_unit_address, response_start(), first_reg, n_registers, !s_tcp);
+}
+
+static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+{
+    /* A real slave stays silent on a CRC error */
+    if (exception_code == EXCEPTION_INVALID_CRC) { return; }
+
+    s_simulator->counters.exceptions++;
+    s_response_length = modbus_write_exception(s_unit_address, response_start(), exception_code, function_code, !s_tcp);
+}
+
+static bool add_endpoint(MODBUS_SIMULATOR * simulator, modbus_simulator_endpoint * endpoint)
+{
+    if (simulator->n_endpoints == simulator->endpoints_capacity)
+    {
+        int capacity = simulator->endpoints_capacity ? (simulator->endpoints_capacity * 2) : 16;
+        modbus_simulator_endpoint ** endpoints = (modbus_simulator_endpoint **)realloc(simulator->endpoints, capacity * sizeof(*endpoints));
+        if (!endpoints) { return false; }
+        simulator->endpoints = endpoints;
+        simulator->endpoints_capacity = capacity;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = endpoint;
+    if (epoll_ctl(simulator->epoll_fd, EPOLL_CTL_ADD, endpoint->fd, &event) != 0) { return false; }
+
+    simulator->endpoints[simulator->n_endpoints++] = endpoint;
+    return true;
+}
+
+static modbus_simulator_endpoint * new_endpoint(endpoint_kind kind, int fd, int bus)
+{
+    modbus_simulator_endpoint * endpoint = (modbus_simulator_endpoint *)calloc(1, sizeof(modbus_simulator_endpoint));
+    if (endpoint)
+    {
+        endpoint->kind = kind;
+        endpoint->fd = fd;
+        endpoint->bus = bus;
+    }
+    return endpoint;
+}
+
+static void remove_endpoint(MODBUS_SIMULATOR * simulator, modbus_simulator_endpoint * endpoint)
+{
+    epoll_ctl(simulator->epoll_fd, EPOLL_CTL_DEL, endpoint->fd, NULL);
+    close(endpoint->fd);
+
+    for (int i = 0; i < simulator->n_endpoints; i++)
+    {
+        if (simulator->endpoints[i] == endpoint)
+        {
+            simulator->endpoints[i] = simulator->endpoints[--simulator->n_endpoints];
+            break;
+        }
+    }
+
+    free(endpoint);
+}
+
+static void send_response(MODBUS_SIMULATOR * simulator, modbus_simulator_endpoint * endpoint, uint8_t const * bytes, int length)
+{
+    if (write(endpoint->fd, bytes, length) == length)
+    {
+        simulator->counters.responses++;
+    }
+    else
+    {
+        simulator->counters.dropped++;
+    }
+}
+
+static void queue_response(MODBUS_SIMULATOR * simulator, modbus_simulator_endpoint * endpoint, uint64_t now)
+{
+    MODBUS_SIMULATOR_CONFIG const& config = simulator->config;
+    int length = s_tcp ? (s_response_length + MODBUS_MBAP_HEADER_SIZE - 1) : s_response_length;
+
+    if ((config.latency_us == 0) && (config.jitter_us == 0) && (endpoint->head == endpoint->tail))
+    {
+        send_response(simulator, endpoint, s_response, length);
+        return;
+    }
+
+    uint8_t next_head = (endpoint->head + 1) % MODBUS_SIMULATOR_PENDING_RESPONSES;
+    if (next_head == endpoint->tail)
+    {
+        simulator->counters.dropped++;
+        return;
+    }
+
+    uint64_t due = now + config.latency_us + (config.jitter_us ? (next_random(simulator) % (config.jitter_us + 1)) : 0);
+
+    /* Responses on one connection or line leave in request order */
+    if (due < endpoint->last_due_us) { due = endpoint->last_due_us; }
+    endpoint->last_due_us = due;
+
+    pending_response& pending = endpoint->pending[endpoint->head];
+    pending.due_us = due;
+    pending.length = length;
+    memcpy(pending.bytes, s_response, length);
+    endpoint->head = next_head;
+}
+
+/*
+ * Services one request. message starts at the unit address; for TCP it is the
+ * unit id and PDU from an MBAP frame, with no CRC.
+ */
+static void service_request(MODBUS_SIMULATOR * simulator, modbus_simulator_endpoint * endpoint, uint8_t const * message, int length, uint16_t transaction_id, uint64_t now)
+{
+    modbus_simulator_bus * bus = simulator->buses[endpoint->bus];
+    uint8_t unit = message[0];
+
+    simulator->counters.requests++;
+
+    s_simulator = simulator;
+    s_tcp = bus->tcp;
+
+    if (unit == MODBUS_BROADCAST_ADDRESS)
+    {
+        for (int u = simulator->config.first_unit; u <= simulator->config.last_unit; u++)
+        {
+            s_unit = get_unit(simulator, bus, u);
+            s_unit_address = u;
+            s_modbus_handler.data.device_address = u;
+            if (s_unit) { modbus_service_message(message, s_modbus_handler, length, !s_tcp); }
+        }
+        return;
+    }
+
+    if (!unit_is_hosted(simulator, unit) || !(s_unit = get_unit(simulator, bus, unit)))
+    {
+        simulator->counters.ignored++;
+        return;
+    }
+
+    s_unit_address = unit;
+    s_modbus_handler.data.device_address = unit;
+    s_response_length = 0;
+
+    modbus_service_message(message, s_modbus_handler, length, !s_tcp);
+
+    if (s_response_length == 0)
+    {
+        simulator->counters.ignored++;
+        return;
+    }
+
+    MODBUS_SIMULATOR_CONFIG const& config = simulator->config;
+
+    if (random_event(simulator, config.drop_rate))
+    {
+        simulator->counters.dropped++;
+        return;
+    }
+
+    if (random_event(simulator, config.exception_rate))
+    {
+        simulator->counters.exception_faults++;
+        s_response_length = modbus_write_exception(unit, response_start(), EXCEPTION_SLAVE_DEVICE_BUSY, message[1] | 0x80, !s_tcp);
+    }
+
+    if (!s_tcp && random_event(simulator, config.crc_fault_rate))
+    {
+        simulator->counters.crc_faults++;
+        s_response[s_response_length - 1] ^= 0xFF;
+    }
+
+    if (s_tcp)
+    {
+        modbus_write_mbap_header(s_response, transaction_id, s_response_length - 1, unit);
+    }
+
+    queue_response(simulator, endpoint, now);
+}
+
+static void consume(modbus_simulator_endpoint * endpoint, int n)
+{
+    memmove(endpoint->rx, &endpoint->rx[n], endpoint->received - n);
+    endpoint->received -= n;
+}
+
+static void service_line_frames(MODBUS_SIMULATOR * simulator, modbus_simulator_endpoint * endpoint, uint64_t now)
+{
+    while (endpoint->received >= 2)
+    {
+        int length = modbus_get_request_length(endpoint->rx, endpoint->received);
+
+        if ((length < 0) || (length > MODBUS_SIMULATOR_MAX_FRAME))
+        {
+            /* Not a frame start: slide along until one lines up */
+            consume(endpoint, 1);
+            continue;
+        }
+
+        if ((length == 0) || (endpoint->received < length)) { break; }
+
+        service_request(simulator, endpoint, endpoint->rx, length, 0, now);
+        consume(endpoint, length);
+    }
+}
+
+static bool service_connection_frames(MODBUS_SIMULATOR * simulator, modbus_simulator_endpoint * endpoint, uint64_t now)
+{
+    while (endpoint->received >= MODBUS_MBAP_HEADER_SIZE)
+    {
+        uint16_t transaction_id = (endpoint->rx[0] << 8) | endpoint->rx[1];
+        int length = (endpoint->rx[4] << 8) | endpoint->rx[5];
+
+        if ((length < 2) || ((length + MODBUS_MBAP_HEADER_SIZE - 1) > MODBUS_SIMULATOR_MAX_FRAME)) { return false; }
+
+        int total = length + MODBUS_MBAP_HEADER_SIZE - 1;
+        if (endpoint->received < total) { break; }
+
+        service_request(simulator, endpoint, &endpoint->rx[MODBUS_MBAP_HEADER_SIZE - 1], length, transaction_id, now);
+        consume(endpoint, total);
+    }
+
+    return true;
+}
+
+static void accept_connections(MODBUS_SIMULATOR * simulator, modbus_simulator_endpoint * listener)
+{
+    int fd;
+
+    while ((fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        modbus_simulator_endpoint * endpoint = new_endpoint(ENDPOINT_CONNECTION, fd, listener->bus);
+        if (!endpoint || !add_endpoint(simulator, endpoint))
+        {
+            close(fd);
+            free(endpoint);
+        }
+    }
+}
+
+/* Returns the number of requests serviced */
+static int read_endpoint(MODBUS_SIMULATOR * simulator, modbus_simulator_endpoint * endpoint, uint64_t now)
+{
+    uint64_t requests = simulator->counters.requests;
+
+    if (endpoint->kind == ENDPOINT_LISTENER)
+    {
+        accept_connections(simulator, endpoint);
+        return 0;
+    }
+
+    for (;;)
+    {
+        ssize_t n = read(endpoint->fd, &endpoint->rx[endpoint->received], sizeof(endpoint->rx) - endpoint->received);
+
+        if (n > 0)
+        {
+            endpoint->received += n;
+
+            if (endpoint->kind == ENDPOINT_LINE)
+            {
+                service_line_frames(simulator, endpoint, now);
+            }
+            else if (!service_connection_frames(simulator, endpoint, now))
+            {
+                remove_endpoint(simulator, endpoint);
+                break;
+            }
+            continue;
+        }
+
+        if ((n == 0) || ((errno != EAGAIN) && (errno != EINTR)))
+        {
+            if (endpoint->kind == ENDPOINT_CONNECTION) { remove_endpoint(simulator, endpoint); }
+            break;
+        }
+
+        if (errno == EAGAIN) { break; }
+    }
+
+    return (int)(simulator->counters.requests - requests);
+}
+
+static void send_due_responses(MODBUS_SIMULATOR * simulator, uint64_t now)
+{
+    for (int i = 0; i < simulator->n_endpoints; i++)
+    {
+        modbus_simulator_endpoint * endpoint = simulator->endpoints[i];
+
+        while ((endpoint->tail != endpoint->head) && (endpoint->pending[endpoint->tail].due_us <= now))
+        {
+            pending_response& pending = endpoint->pending[endpoint->tail];
+            send_response(simulator, endpoint, pending.bytes, pending.length);
+            endpoint->tail = (endpoint->tail + 1) % MODBUS_SIMULATOR_PENDING_RESPONSES;
+        }
+    }
+}
+
+static int get_wait_ms(MODBUS_SIMULATOR const * simulator, uint64_t now, int max_wait_ms)
+{
+    int wait_ms = max_wait_ms;
+
+    for (int i = 0; i < simulator->n_endpoints; i++)
+    {
+        modbus_simulator_endpoint const * endpoint = simulator->endpoints[i];
+
+        if (endpoint->tail == endpoint->head) { continue; }
+
+        uint64_t due = endpoint->pending[endpoint->tail].due_us;
+        int endpoint_wait_ms = (due > now) ? (int)((due - now + 999) / 1000) : 0;
+
+        if ((wait_ms < 0) || (endpoint_wait_ms < wait_ms)) { wait_ms = endpoint_wait_ms; }
+    }
+
+    return wait_ms;
+}
+
+static int add_bus(MODBUS_SIMULATOR * simulator, modbus_simulator_bus * bus)
+{
+    modbus_simulator_bus ** buses = (modbus_simulator_bus **)realloc(simulator->buses, (simulator->n_buses + 1) * sizeof(*buses));
+    if (!buses) { return -1; }
+
+    simulator->buses = buses;
+    simulator->buses[simulator->n_buses] = bus;
+
+    return simulator->n_buses++;
+}
+
+/*
+ * Public Module Functions
+ */
+
+bool modbus_simulator_init(MODBUS_SIMULATOR * simulator, MODBUS_SIMULATOR_CONFIG const * config)
+{
+    if (!simulator || !config) { return false; }
+
+    memset(simulator, 0, sizeof(*simulator));
+    simulator->config = *config;
+    simulator->random_state = config->seed ? config->seed : 1;
+    simulator->n_holding_registers = get_total_count(config->holding_register_ranges, config->num_holding_register_ranges);
+    simulator->n_input_registers = get_total_count(config->input_register_ranges, config->num_input_register_ranges);
+
+    if (simulator->config.last_unit > 247) { simulator->config.last_unit = 247; }
+    if (simulator->config.first_unit == 0) { simulator->config.first_unit = 1; }
+
+    memset(&s_modbus_handler, 0, sizeof(s_modbus_handler));
+    s_modbus_handler.functions.read_holding_registers = read_holding_registers;
+    s_modbus_handler.functions.read_input_registers = read_input_registers;
+    s_modbus_handler.functions.write_holding_register = write_holding_register;
+    s_modbus_handler.functions.write_holding_registers = write_holding_registers;
+    s_modbus_handler.functions.exception_handler = exception_handler;
+    s_modbus_handler.data.write_holding_registers = s_write_holding_register_data_buffer;
+    s_modbus_handler.data.holding_register_ranges = config->holding_register_ranges;
+    s_modbus_handler.data.num_holding_register_ranges = config->num_holding_register_ranges;
+    s_modbus_handler.data.input_register_ranges = config->input_register_ranges;
+    s_modbus_handler.data.num_input_register_ranges = config->num_input_register_ranges;
+
+    simulator->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    return simulator->epoll_fd >= 0;
+}
+
+/*
+ * Creates a pty pair and hosts an RTU line on it. Masters open the path from
+ * modbus_simulator_get_line_path. Returns the bus number or -1.
+ */
+int modbus_simulator_add_pty_line(MODBUS_SIMULATOR * simulator)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) { return -1; }
+
+    modbus_simulator_bus * bus = (modbus_simulator_bus *)calloc(1, sizeof(modbus_simulator_bus));
+    const char * path = ((grantpt(fd) == 0) && (unlockpt(fd) == 0)) ? ptsname(fd) : NULL;
+
+    if (!bus || !path)
+    {
+        free(bus);
+        close(fd);
+        return -1;
+    }
+
+    strncpy(bus->path, path, sizeof(bus->path) - 1);
+
+    /* Keep the far end open in raw mode, so the line works before (and after) a master opens it */
+    bus->hold_fd = open(bus->path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (bus->hold_fd >= 0)
+    {
+        struct termios tio;
+        if (tcgetattr(bus->hold_fd, &tio) == 0)
+        {
+            cfmakeraw(&tio);
+            tcsetattr(bus->hold_fd, TCSANOW, &tio);
+        }
+    }
+
+    int index = add_bus(simulator, bus);
+    modbus_simulator_endpoint * endpoint = (index >= 0) ? new_endpoint(ENDPOINT_LINE, fd, index) : NULL;
+
+    if (!endpoint || !add_endpoint(simulator, endpoint))
+    {
+        free(endpoint);
+        close(fd);
+        return -1;
+    }
+
+    return index;
+}
+
+const char * modbus_simulator_get_line_path(MODBUS_SIMULATOR const * simulator, int bus)
+{
+    if ((bus < 0) || (bus >= simulator->n_buses) || simulator->buses[bus]->tcp) { return NULL; }
+    return simulator->buses[bus]->path;
+}
+
+/*
+ * Listens for Modbus TCP connections on port (0 picks a free port, see
+ * modbus_simulator_get_tcp_port). Returns the bus number or -1.
+ */
+int modbus_simulator_add_tcp_port(MODBUS_SIMULATOR * simulator, uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { return -1; }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    socklen_t address_length = sizeof(address);
+    if ((bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) || (listen(fd, SOMAXCONN) != 0)
+        || (getsockname(fd, (struct sockaddr *)&address, &address_length) != 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    modbus_simulator_bus * bus = (modbus_simulator_bus *)calloc(1, sizeof(modbus_simulator_bus));
+    if (!bus)
+    {
+        close(fd);
+        return -1;
+    }
+
+    bus->tcp = true;
+    bus->hold_fd = -1;
+    bus->port = ntohs(address.sin_port);
+
+    int index = add_bus(simulator, bus);
+    modbus_simulator_endpoint * endpoint = (index >= 0) ? new_endpoint(ENDPOINT_LISTENER, fd, index) : NULL;
+
+    if (!endpoint || !add_endpoint(simulator, endpoint))
+    {
+        free(endpoint);
+        close(fd);
+        return -1;
+    }
+
+    return index;
+}
+
+uint16_t modbus_simulator_get_tcp_port(MODBUS_SIMULATOR const * simulator, int bus)
+{
+    if ((bus < 0) || (bus >= simulator->n_buses) || !simulator->buses[bus]->tcp) { return 0; }
+    return simulator->buses[bus]->port;
+}
+
+/*
+ * The storage behind a unit's holding register, for seeding and checking values.
+ * Returns NULL if the unit is not hosted or the register is not mapped.
+ */
+int16_t * modbus_simulator_get_holding_register(MODBUS_SIMULATOR * simulator, int bus, uint8_t unit, uint16_t reg)
+{
+    if ((bus < 0) || (bus >= simulator->n_buses) || !unit_is_hosted(simulator, unit)) { return NULL; }
+
+    MODBUS_SIMULATOR_CONFIG const& config = simulator->config;
+    int index = get_storage_index(config.holding_register_ranges, config.num_holding_register_ranges, reg);
+    int16_t * registers = get_unit(simulator, simulator->buses[bus], unit);
+
+    return ((index < 0) || !registers) ? NULL : &registers[index];
+}
+
+/*
+ * Services requests and sends responses as they fall due, waiting up to
+ * max_wait_ms (or indefinitely if negative). Returns the number of requests serviced.
+ */
+int modbus_simulator_poll(MODBUS_SIMULATOR * simulator, int max_wait_ms)
+{
+    struct epoll_event events[64];
+
+    if (!simulator) { return 0; }
+
+    int wait_ms = get_wait_ms(simulator, get_time_us(), max_wait_ms);
+    int n_events = epoll_wait(simulator->epoll_fd, events, 64, wait_ms);
+
+    uint64_t now = get_time_us();
+    int serviced = 0;
+
+    for (int e = 0; e < n_events; e++)
+    {
+        serviced += read_endpoint(simulator, (modbus_simulator_endpoint *)events[e].data.ptr, now);
+    }
+
+    send_due_responses(simulator, get_time_us());
+
+    return serviced;
+}
+
+void modbus_simulator_close(MODBUS_SIMULATOR * simulator)
+{
+    if (!simulator) { return; }
+
+    while (simulator->n_endpoints > 0)
+    {
+        remove_endpoint(simulator, simulator->endpoints[simulator->n_endpoints - 1]);
+    }
+
+    for (int b = 0; b < simulator->n_buses; b++)
+    {
+        modbus_simulator_bus * bus = simulator->buses[b];
+        for (int u = 0; u < MAX_UNITS; u++) { free(bus->units[u]); }
+        if (bus->hold_fd >= 0) { close(bus->hold_fd); }
+        free(bus);
+    }
+
+    free(simulator->buses);
+    free(simulator->endpoints);
+
+    if (simulator->epoll_fd >= 0) { close(simulator->epoll_fd); }
+
+    memset(simulator, 0, sizeof(*simulator));
+    simulator->epoll_fd = -1;
+}
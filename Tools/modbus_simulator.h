@@ -0,0 +1,90 @@
+#ifndef _MODBUS_SIMULATOR_H_
+#define _MODBUS_SIMULATOR_H_
+
+/*
+ * Simulated slave farm for load testing masters and gateways.
+ *
+ * Each bus (a pty line speaking RTU, or a TCP port speaking MBAP) hosts units
+ * first_unit..last_unit, all with the same register map. Requests are serviced
+ * with modbus_service_message; each unit's registers are allocated on first use,
+ * so idle units cost nothing. Responses are held back by latency_us plus a random
+ * 0..jitter_us, and can be corrupted (bad CRC), replaced with a busy exception
+ * or dropped at configurable rates.
+ *
+ * Everything runs on one thread from modbus_simulator_poll, which waits in epoll,
+ * so the simulator itself stays cheap while it drives a master hard.
+ * Supported function codes: read holding/input registers and write single/multiple
+ * holding registers (3, 4, 6 and 16). There are no coil or discrete input tables;
+ * every other function code is answered with an illegal function exception.
+ */
+
+#define MODBUS_SIMULATOR_MAX_FRAME 260
+#define MODBUS_SIMULATOR_PENDING_RESPONSES 16
+
+struct modbus_simulator_config
+{
+	uint8_t first_unit;
+	uint8_t last_unit;
+
+	MODBUS_ADDRESS_RANGE const * holding_register_ranges;
+	uint8_t num_holding_register_ranges;
+	MODBUS_ADDRESS_RANGE const * input_register_ranges;
+	uint8_t num_input_register_ranges;
+
+	uint32_t latency_us;
+	uint32_t jitter_us;
+
+	/* Fault rates, in faults per 65536 responses */
+	uint16_t crc_fault_rate;
+	uint16_t exception_rate;
+	uint16_t drop_rate;
+
+	uint32_t seed;
+};
+typedef struct modbus_simulator_config MODBUS_SIMULATOR_CONFIG;
+
+struct modbus_simulator_counters
+{
+	uint64_t requests;
+	uint64_t responses;
+	uint64_t exceptions;
+	uint64_t crc_faults;
+	uint64_t exception_faults;
+	uint64_t dropped;
+	uint64_t ignored;
+};
+typedef struct modbus_simulator_counters MODBUS_SIMULATOR_COUNTERS;
+
+struct modbus_simulator_bus;
+struct modbus_simulator_endpoint;
+
+struct modbus_simulator
+{
+	MODBUS_SIMULATOR_CONFIG config;
+	MODBUS_SIMULATOR_COUNTERS counters;
+
+	int epoll_fd;
+	uint32_t random_state;
+
+	uint16_t n_holding_registers;
+	uint16_t n_input_registers;
+
+	struct modbus_simulator_bus ** buses;
+	int n_buses;
+
+	struct modbus_simulator_endpoint ** endpoints;
+	int n_endpoints;
+	int endpoints_capacity;
+};
+typedef struct modbus_simulator MODBUS_SIMULATOR;
+
+bool modbus_simulator_init(MODBUS_SIMULATOR * simulator, MODBUS_SIMULATOR_CONFIG const * config);
+int modbus_simulator_add_pty_line(MODBUS_SIMULATOR * simulator);
+const char * modbus_simulator_get_line_path(MODBUS_SIMULATOR const * simulator, int bus);
+int modbus_simulator_add_tcp_port(MODBUS_SIMULATOR * simulator, uint16_t port);
+uint16_t modbus_simulator_get_tcp_port(MODBUS_SIMULATOR const * simulator, int bus);
+int16_t * modbus_simulator_get_holding_register(MODBUS_SIMULATOR * simulator, int bus, uint8_t unit, uint16_t reg);
+int modbus_simulator_poll(MODBUS_SIMULATOR * simulator, int max_wait_ms);
+void modbus_simulator_close(MODBUS_SIMULATOR * simulator);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * C/C++ Library Includes
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+
+/*
+ * Modbus Library Includes
+ */
+
+#include "modbus.h"
+#include "modbus_simulator.h"
+
+/*
+ * Private Module Data
+ */
+
+#define MAX_RANGES 32
+#define MAX_TCP_PORTS 64
+
+static volatile sig_atomic_t s_running = 1;
+
+static MODBUS_ADDRESS_RANGE s_holding_register_ranges[MAX_RANGES];
+static MODBUS_ADDRESS_RANGE s_input_register_ranges[MAX_RANGES];
+
+/*
+ * Private Module Functions
+ */
+
+static void stop(int)
+{
+    s_running = 0;
+}
+
+static void usage(const char * program)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --lines N             RTU lines on pty pairs (default 1)\n"
+        "  --tcp PORT            Modbus TCP port, may be repeated (0 picks a free port)\n"
+        "  --units FIRST-LAST    units hosted on every line and port (default 1-247)\n"
+        "  --holding RANGES      holding register map as first:count[,first:count...] (default 0:1000)\n"
+        "  --input RANGES        input register map (default 0:1000)\n"
+        "  --latency-us US       response latency\n"
+        "  --jitter-us US        extra random latency, 0..US\n"
+        "  --crc-faults RATE     fraction of RTU responses sent with a bad CRC\n"
+        "  --exception-faults RATE  fraction of responses replaced by a busy exception\n"
+        "  --drop RATE           fraction of responses not sent\n"
+        "  --seed N              random seed for latency and faults\n"
+        "  --stats SECONDS       print counters every SECONDS\n"
+        "\n"
+        "Only holding and input registers are simulated: function codes 3, 4, 6 and 16.\n"
+        "Coils, discrete inputs and every other function code are answered with an\n"
+        "illegal function exception.\n",
+        program);
+}
+
+static uint8_t parse_ranges(const char * text, MODBUS_ADDRESS_RANGE * ranges)
+{
+    uint8_t n = 0;
+
+    while (text && *text && (n < MAX_RANGES))
+    {
+        unsigned int first;
+        unsigned int count;
+        if ((sscanf(text, "%u:%u", &first, &count) != 2) || (first > 0xFFFF) || (count == 0) || ((first + count) > 0x10000)) { return 0; }
+
+        ranges[n].first = first;
+        ranges[n].count = count;
+        n++;
+
+        text = strchr(text, ',');
+        if (text) { text++; }
+    }
+
+    /* The library expects ranges sorted by address */
+    for (int i = 1; i < n; i++)
+    {
+        if (ranges[i].first < (uint32_t)ranges[i-1].first + ranges[i-1].count) { return 0; }
+    }
+
+    return n;
+}
+
+static uint16_t parse_rate(const char * text)
+{
+    double rate = atof(text);
+    if (rate <= 0.0) { return 0; }
+    if (rate >= 1.0) { return 0xFFFF; }
+    return (uint16_t)(rate * 65536.0);
+}
+
+static void print_counters(MODBUS_SIMULATOR_COUNTERS const& counters)
+{
+    printf("requests %llu responses %llu exceptions %llu crc_faults %llu exception_faults %llu dropped %llu ignored %llu\n",
+        (unsigned long long)counters.requests, (unsigned long long)counters.responses, (unsigned long long)counters.exceptions,
+        (unsigned long long)counters.crc_faults, (unsigned long long)counters.exception_faults,
+        (unsigned long long)counters.dropped, (unsigned long long)counters.ignored);
+    fflush(stdout);
+}
+
+/*
+ * Public Module Functions
+ */
+
+int main(int argc, char * argv[])
+{
+    static struct option options[] = {
+        {"lines", required_argument, NULL, 'l'},
+        {"tcp", required_argument, NULL, 't'},
+        {"units", required_argument, NULL, 'u'},
+        {"holding", required_argument, NULL, 'H'},
+        {"input", required_argument, NULL, 'I'},
+        {"latency-us", required_argument, NULL, 'L'},
+        {"jitter-us", required_argument, NULL, 'J'},
+        {"crc-faults", required_argument, NULL, 'c'},
+        {"exception-faults", required_argument, NULL, 'e'},
+        {"drop", required_argument, NULL, 'd'},
+        {"seed", required_argument, NULL, 's'},
+        {"stats", required_argument, NULL, 'S'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    MODBUS_SIMULATOR_CONFIG config;
+    memset(&config, 0, sizeof(config));
+    config.first_unit = 1;
+    config.last_unit = 247;
+    config.seed = (uint32_t)time(NULL);
+
+    int n_lines = 1;
+    int tcp_ports[MAX_TCP_PORTS];
+    int n_tcp_ports = 0;
+    int stats_seconds = 0;
+    unsigned int first_unit;
+    unsigned int last_unit;
+
+    s_holding_register_ranges[0].first = 0;
+    s_holding_register_ranges[0].count = 1000;
+    config.num_holding_register_ranges = 1;
+    s_input_register_ranges[0].first = 0;
+    s_input_register_ranges[0].count = 1000;
+    config.num_input_register_ranges = 1;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "h", options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'l': n_lines = atoi(optarg); break;
+        case 't':
+            if (n_tcp_ports < MAX_TCP_PORTS) { tcp_ports[n_tcp_ports++] = atoi(optarg); }
+            break;
+        case 'u':
+            if ((sscanf(optarg, "%u-%u", &first_unit, &last_unit) != 2) || (first_unit < 1) || (last_unit > 247) || (first_unit > last_unit))
+            {
+                fprintf(stderr, "Bad unit range %s\n", optarg);
+                return 1;
+            }
+            config.first_unit = first_unit;
+            config.last_unit = last_unit;
+            break;
+        case 'H':
+            config.num_holding_register_ranges = parse_ranges(optarg, s_holding_register_ranges);
+            if (!config.num_holding_register_ranges) { fprintf(stderr, "Bad register map %s\n", optarg); return 1; }
+            break;
+        case 'I':
+            config.num_input_register_ranges = parse_ranges(optarg, s_input_register_ranges);
+            if (!config.num_input_register_ranges) { fprintf(stderr, "Bad register map %s\n", optarg); return 1; }
+            break;
+        case 'L': config.latency_us = strtoul(optarg, NULL, 0); break;
+        case 'J': config.jitter_us = strtoul(optarg, NULL, 0); break;
+        case 'c': config.crc_fault_rate = parse_rate(optarg); break;
+        case 'e': config.exception_rate = parse_rate(optarg); break;
+        case 'd': config.drop_rate = parse_rate(optarg); break;
+        case 's': config.seed = strtoul(optarg, NULL, 0); break;
+        case 'S': stats_seconds = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return (option == 'h') ? 0 : 1;
+        }
+    }
+
+    config.holding_register_ranges = s_holding_register_ranges;
+    config.input_register_ranges = s_input_register_ranges;
+
+    MODBUS_SIMULATOR simulator;
+    if (!modbus_simulator_init(&simulator, &config))
+    {
+        fprintf(stderr, "Could not start simulator\n");
+        return 1;
+    }
+
+    for (int i = 0; i < n_lines; i++)
+    {
+        int bus = modbus_simulator_add_pty_line(&simulator);
+        if (bus < 0) { fprintf(stderr, "Could not create pty line %d\n", i); return 1; }
+        printf("line %d %s\n", bus, modbus_simulator_get_line_path(&simulator, bus));
+    }
+
+    for (int i = 0; i < n_tcp_ports; i++)
+    {
+        int bus = modbus_simulator_add_tcp_port(&simulator, (uint16_t)tcp_ports[i]);
+        if (bus < 0) { fprintf(stderr, "Could not listen on TCP port %d\n", tcp_ports[i]); return 1; }
+        printf("tcp %d %u\n", bus, modbus_simulator_get_tcp_port(&simulator, bus));
+    }
+    fflush(stdout);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    time_t next_stats = time(NULL) + stats_seconds;
+
+    while (s_running)
+    {
+        modbus_simulator_poll(&simulator, 100);
+
+        if (stats_seconds && (time(NULL) >= next_stats))
+        {
+            print_counters(simulator.counters);
+            next_stats += stats_seconds;
+        }
+    }
+
+    print_counters(simulator.counters);
+    modbus_simulator_close(&simulator);
+
+    return 0;
+}
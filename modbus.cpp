@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 //#include <iostream>
 
@@ -13,6 +14,7 @@
  */
 
 #include "modbus.h"
+#include "modbus_server.h"
 
 /*
  * Private Module Data
@@ -20,8 +22,16 @@
 
 static uint8_t const * s_current_message = NULL;
 static int s_current_message_length = 0;
+static uint8_t s_current_function_code;
 static bool s_broadcast;
 
+static MODBUS_DIAGNOSTIC_COUNTERS s_diagnostic_counters;
+
+#ifdef MODBUS_ENABLE_STATISTICS
+static MODBUS_STATISTICS s_statistics;
+static uint32_t s_handler_start;
+#endif
+
 /*
  * Private Module Functions
  */
@@ -34,104 +44,65 @@ CRC_CHECK_STATE application_check_crc(const uint8_t * message, int message_lengt
 
 #endif
 
-static int get_number_of_required_bytes_for_number_of_bits(uint16_t n_bits)
-{
-  return (n_bits & 7) ? (n_bits / 8) + 1 : n_bits / 8;
-}
-
-static int modbus_write_read_discrete_inputs_response_data_bytes(uint8_t * buffer, bool * discrete_inputs, uint8_t n_inputs)
-{
-    int bool_count = 0;
-    int count = 0;
-
-    int required_bytes = get_number_of_required_bytes_for_number_of_bits(n_inputs);
-    buffer[count++] = (uint8_t)required_bytes;
-
-    for (int b = 0; b < required_bytes; b++)
-    {
-        buffer[count] = 0x00;
+uint32_t application_get_ticks();
 
-        for (int i = 0; i < 7; i++)
-        {
-            buffer[count] |= discrete_inputs[bool_count] ? (1 << i) : 0;
-            bool_count++;
-            if(bool_count == n_inputs) { break; }
-        }
+#ifndef ALLOW_APPLICATION_TICKS
 
-        count++;
-    }
+#define application_get_ticks() (0)
 
-    return count;
-}
+#endif
 
-static uint16_t bytes_to_uint16_t(uint8_t const * const bytes)
-{
-    return (bytes[0] << 8) + bytes[1];
-}
+#ifdef MODBUS_ENABLE_STATISTICS
 
-static int16_t bytes_to_int16_t(uint8_t const * const bytes)
-{
-    return (bytes[0] << 8) + bytes[1];
-}
+#define STATISTICS_INCREMENT(counter) ((void)__atomic_fetch_add(&s_statistics.counter, 1, __ATOMIC_RELAXED))
+#define STATISTICS_START_TIMER() (s_handler_start = application_get_ticks())
+#define STATISTICS_RECORD_HANDLER(function_code) record_handler_statistics(function_code, application_get_ticks() - s_handler_start)
+#define STATISTICS_RECORD_EXCEPTION(exception) record_exception_statistics(exception)
 
-static void copy_to_holding_registers(uint16_t n_registers, uint8_t const * const data, int16_t * holding_registers)
+static int get_histogram_bucket(uint32_t ticks)
 {
-    uint16_t i;
-    for (i = 0; i < n_registers; i++)
+    int bucket = 0;
+    while (ticks && (bucket < (MODBUS_STATISTICS_HISTOGRAM_BUCKETS - 1)))
     {
-        holding_registers[i] = bytes_to_int16_t(data + (i * 2));
-    }   
+        ticks >>= 1;
+        bucket++;
+    }
+    return bucket;
 }
 
-static void copy_byte_to_coils(uint8_t data, uint16_t n_coils, bool * coils)
+static void record_handler_statistics(MODBUS_FUNCTION_CODE function_code, uint32_t ticks)
 {
-    uint8_t i = 1;
-    uint8_t coil = 0;
-    n_coils = (n_coils <= 8) ? n_coils : 8; 
+    int index = modbus_get_statistics_function_code_index(function_code);
+    if (index < 0) { return; }
 
-    for(i = 1; coil < n_coils; i <<= 1)
-    {
-        coils[coil] = data & i;
-        coil++;
-    }
+    STATISTICS_INCREMENT(function_code_frames[index]);
+    STATISTICS_INCREMENT(handler_time_histogram[index][get_histogram_bucket(ticks)]);
 }
 
-static void copy_to_multiple_coils(uint16_t n_coils, uint8_t const * const data, bool * coils)
+static void record_exception_statistics(MODBUS_EXCEPTION_CODES exception)
 {
-    uint8_t byte = 0;
-    while(n_coils >= 8)
-    {
-        copy_byte_to_coils(data[byte], n_coils, coils);
-        n_coils -= 8;
-        byte++;
-    }
-    copy_byte_to_coils(data[byte], n_coils, coils);
+    if ((exception == EXCEPTION_NONE) || (exception >= MODBUS_STATISTICS_NUM_EXCEPTION_CODES)) { return; }
 
+    STATISTICS_INCREMENT(exceptions[exception]);
 }
 
-static bool bytes_to_on_off_data(uint8_t const * const bytes)
-{
-    return bytes[0] == 0xFF;
-}
+#else
 
-static bool is_valid_coil_address(uint16_t coil_addr, const MODBUS_HANDLER& handler)
-{
-    return (coil_addr < handler.data.num_coils);
-}
+#define STATISTICS_INCREMENT(counter)
+#define STATISTICS_START_TIMER()
+#define STATISTICS_RECORD_HANDLER(function_code)
+#define STATISTICS_RECORD_EXCEPTION(exception)
 
-static bool is_valid_input_register_addr(uint16_t input_register_addr, const MODBUS_HANDLER& handler)
-{
-    return (input_register_addr < handler.data.num_input_registers);
-}
+#endif
 
-static bool is_valid_holding_register_addr(uint16_t holding_register_addr, const MODBUS_HANDLER& handler)
+static int get_number_of_required_bytes_for_number_of_bits(uint16_t n_bits)
 {
-    return (holding_register_addr < handler.data.num_holding_registers);
+  return (n_bits & 7) ? (n_bits / 8) + 1 : n_bits / 8;
 }
 
-static bool is_valid_discrete_input_addr(uint16_t discrete_input_addr, const MODBUS_HANDLER& handler)
+static inline uint16_t bytes_to_uint16_t(uint8_t const * const bytes)
 {
-    return (discrete_input_addr < handler.data.num_inputs);
+    return (bytes[0] << 8) + bytes[1];
 }
 
 static bool is_valid_function_code(uint8_t code)
@@ -147,6 +118,10 @@ static bool is_valid_function_code(uint8_t code)
     valid |= (code == WRITE_HOLDING_REGISTERS);
     valid |= (code == READ_WRITE_REGISTERS);
     valid |= (code == MASK_WRITE_REGISTER);
+    valid |= (code == DIAGNOSTICS);
+    valid |= (code == READ_FIFO_QUEUE);
+    valid |= (code == READ_FILE_RECORD);
+    valid |= (code == WRITE_FILE_RECORD);
     return valid;
 }
 
@@ -155,376 +130,1604 @@ static uint8_t get_message_address(uint8_t const * const message)
     return (uint8_t)message[0];
 }
 
-static MODBUS_FUNCTION_CODE get_message_function_code(uint8_t const * const message)
+static int get_split_frame_length(MODBUS_SPLIT_FRAME const * frame)
 {
-    return (MODBUS_FUNCTION_CODE)message[1];
+    return frame->segments[0].length + frame->segments[1].length;
 }
 
-static MODBUS_EXCEPTION_CODES handle_read_coils(void const * const data, const MODBUS_HANDLER& handler)
+static uint8_t get_split_frame_byte(MODBUS_SPLIT_FRAME const * frame, int index)
 {
-    if (!handler.functions.read_coils) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+    int first_length = frame->segments[0].length;
+    return (index < first_length) ? frame->segments[0].data[index] : frame->segments[1].data[index - first_length];
+}
 
-    uint16_t first_coil = bytes_to_uint16_t((uint8_t*)data);
-    uint16_t n_coils = bytes_to_uint16_t((uint8_t*)data+2);
-    uint16_t last_coil = first_coil + n_coils - 1;
+#if MODBUS_ENABLE_FC_DIAGNOSTICS
 
-    if (!is_valid_coil_address(first_coil, handler) || !is_valid_coil_address(last_coil, handler))
+static bool get_diagnostic_counter(uint16_t sub_function, uint16_t * counter)
+{
+    switch(sub_function)
     {
-        return EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    case DIAGNOSTICS_RETURN_BUS_MESSAGE_COUNT:
+        *counter = s_diagnostic_counters.bus_message;
+        return true;
+    case DIAGNOSTICS_RETURN_BUS_COMMUNICATION_ERROR_COUNT:
+        *counter = s_diagnostic_counters.bus_communication_error;
+        return true;
+    case DIAGNOSTICS_RETURN_SLAVE_EXCEPTION_ERROR_COUNT:
+        *counter = s_diagnostic_counters.slave_exception_error;
+        return true;
+    case DIAGNOSTICS_RETURN_SLAVE_MESSAGE_COUNT:
+        *counter = s_diagnostic_counters.slave_message;
+        return true;
+    case DIAGNOSTICS_RETURN_SLAVE_NO_RESPONSE_COUNT:
+        *counter = s_diagnostic_counters.slave_no_response;
+        return true;
+    default:
+        return false;
     }
+}
 
-    handler.functions.read_coils(first_coil, n_coils);
+#endif
 
-    return EXCEPTION_NONE;
+#if MODBUS_ENABLE_FC_FILE_RECORDS
+
+static const uint8_t FILE_RECORD_SUB_REQUEST_HEADER_LENGTH = 7;
+static const uint8_t MIN_READ_FILE_RECORD_REQUEST_LENGTH = 0x07;
+static const uint8_t MAX_READ_FILE_RECORD_REQUEST_LENGTH = 0xF5;
+static const uint8_t MIN_WRITE_FILE_RECORD_REQUEST_LENGTH = 0x09;
+static const uint8_t MAX_WRITE_FILE_RECORD_REQUEST_LENGTH = 0xFB;
+static const int MAX_READ_FILE_RECORD_RESPONSE_LENGTH = 0xF5;
+
+struct file_record_sub_request
+{
+    uint8_t reference_type;
+    uint16_t file_number;
+    uint16_t record_number;
+    uint16_t record_length;
+};
+
+static void get_file_record_sub_request(uint8_t const * const data, struct file_record_sub_request * sub_request)
+{
+    sub_request->reference_type = data[0];
+    sub_request->file_number = bytes_to_uint16_t(data + 1);
+    sub_request->record_number = bytes_to_uint16_t(data + 3);
+    sub_request->record_length = bytes_to_uint16_t(data + 5);
 }
 
-static MODBUS_EXCEPTION_CODES handle_read_discrete_inputs(void const * const data, const MODBUS_HANDLER& handler)
+static MODBUS_EXCEPTION_CODES validate_file_record_sub_request(struct file_record_sub_request const * sub_request, MODBUS_FILE const * file)
 {
-    if (!handler.functions.read_discrete_inputs) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+    if (sub_request->reference_type != MODBUS_FILE_RECORD_REFERENCE_TYPE) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+    if (!file) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+    if (sub_request->record_length == 0) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+    if (sub_request->record_number > MODBUS_MAX_FILE_RECORD_NUMBER) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+    uint32_t end_record = (uint32_t)sub_request->record_number + sub_request->record_length;
+    if (end_record > file->n_records) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+    return EXCEPTION_NONE;
+}
+
+#endif
 
-    uint16_t first_input = bytes_to_uint16_t((uint8_t*)data);
-    uint16_t n_inputs = bytes_to_uint16_t((uint8_t*)data+2);
-    uint16_t last_input = first_input + n_inputs - 1;
+static bool has_side_effects(uint8_t function_code)
+{
+    bool writes = false;
+    writes |= (function_code == WRITE_SINGLE_COIL);
+    writes |= (function_code == WRITE_MULTIPLE_COILS);
+    writes |= (function_code == WRITE_HOLDING_REGISTER);
+    writes |= (function_code == WRITE_HOLDING_REGISTERS);
+    writes |= (function_code == READ_WRITE_REGISTERS);
+    writes |= (function_code == MASK_WRITE_REGISTER);
+    writes |= (function_code == WRITE_FILE_RECORD);
+    return writes;
+}
 
-    if (!is_valid_discrete_input_addr(first_input, handler) || !is_valid_discrete_input_addr(last_input, handler))
+/* FNV-1a, over the whole request including its CRC */
+static uint32_t get_request_hash(uint8_t const * request, int request_length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < request_length; i++)
     {
-        return EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        hash = (hash ^ request[i]) * 16777619u;
     }
+    return hash;
+}
 
-    handler.functions.read_discrete_inputs(first_input, n_inputs);
+/* The CRC carried in the last two bytes of a frame, low byte first */
+static uint16_t get_frame_crc(uint8_t const * frame, int frame_length)
+{
+    return (uint16_t)(frame[frame_length-2] | (frame[frame_length-1] << 8));
+}
 
-    return EXCEPTION_NONE;
+static uint8_t tx_queue_next(uint8_t index)
+{
+    return (index + 1) % MODBUS_TX_QUEUE_SIZE;
 }
 
-static bool on_off_data_is_valid(uint8_t const * const data)
+/* Sends the oldest queued frame; the caller owns the busy flag */
+static void start_tx_frame(MODBUS_TX_QUEUE * queue)
 {
-    bool valid_on_off_data = false;
-    valid_on_off_data |= (data[0] == 0xFF) && (data[1] == 0x00);
-    valid_on_off_data |= (data[0] == 0x00) && (data[1] == 0x00);
-    return valid_on_off_data;
+    MODBUS_TX_FRAME const& frame = queue->frames[__atomic_load_n(&queue->tail, __ATOMIC_RELAXED)];
+
+    if (queue->set_driver_enable) { queue->set_driver_enable(queue->port, true); }
+    queue->start_transmit(queue->port, frame.data, frame.length);
 }
 
-static MODBUS_EXCEPTION_CODES handle_write_single_coil(uint8_t const * const data, const MODBUS_HANDLER& handler)
+/*
+ * Claims the transmitter if it is idle and a frame is waiting. The test and the
+ * claim are two plain steps, not a compare and swap (which Cortex-M0 and AVR only
+ * get from libatomic), so the caller must not be interrupted by
+ * modbus_tx_queue_complete in between.
+ */
+static void try_start_tx(MODBUS_TX_QUEUE * queue)
 {
-    if (!handler.functions.write_single_coil) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+    if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == __atomic_load_n(&queue->tail, __ATOMIC_RELAXED)) { return; }
+    if (__atomic_load_n(&queue->busy, __ATOMIC_ACQUIRE)) { return; }
 
-    if (!on_off_data_is_valid(data + 2)) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+    __atomic_store_n(&queue->busy, true, __ATOMIC_RELAXED);
+    start_tx_frame(queue);
+}
 
-    uint16_t coil = bytes_to_uint16_t(data);
+#if MODBUS_ENABLE_FC_READ_FIFO_QUEUE
 
-    if (!is_valid_coil_address(coil, handler))
-    {
-        return EXCEPTION_ILLEGAL_DATA_ADDRESS;  
-    }
+static uint8_t fifo_next(uint8_t index)
+{
+    return (index + 1) & (MODBUS_FIFO_SIZE - 1);
+}
 
-    bool on = bytes_to_on_off_data(data + 2);
+#endif
 
-    handler.functions.write_single_coil(coil, on);
-    
-    return EXCEPTION_NONE;
+/*
+ * Typed register values are handled as raw bits in a same-size unsigned integer,
+ * with the value's most significant register/byte first (ABCD). The other word
+ * orders are the register reversal and the swap of the bytes within each register,
+ * both their own inverses, so encoding and decoding use the same transform.
+ * The order is a template parameter so each conversion loop is straight-line.
+ */
+template <int SIZE> struct value_bits;
+template <> struct value_bits<4> { typedef uint32_t type; };
+template <> struct value_bits<8> { typedef uint64_t type; };
+
+template <typename BITS>
+static inline BITS swap_bytes_in_registers(BITS bits)
+{
+    const BITS low_bytes = (BITS)(((BITS)~(BITS)0 / 0xFFFF) * 0x00FF);
+    return ((bits >> 8) & low_bytes) | ((bits & low_bytes) << 8);
+}
+
+static inline uint32_t reverse_registers(uint32_t bits)
+{
+    return (bits << 16) | (bits >> 16);
+}
 
+static inline uint64_t reverse_registers(uint64_t bits)
+{
+    bits = ((bits & 0x0000FFFF0000FFFFULL) << 16) | ((bits >> 16) & 0x0000FFFF0000FFFFULL);
+    return (bits << 32) | (bits >> 32);
 }
 
-static MODBUS_EXCEPTION_CODES handle_write_multiple_coils(uint8_t const * const data, const MODBUS_HANDLER& handler)
+template <typename BITS, MODBUS_WORD_ORDER ORDER>
+static inline BITS apply_word_order(BITS bits)
 {
-    if (!handler.functions.write_multiple_coils) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+    if ((ORDER == WORD_ORDER_BADC) || (ORDER == WORD_ORDER_DCBA)) { bits = swap_bytes_in_registers(bits); }
+    if ((ORDER == WORD_ORDER_CDAB) || (ORDER == WORD_ORDER_DCBA)) { bits = reverse_registers(bits); }
+    return bits;
+}
 
-    uint16_t first_coil = bytes_to_uint16_t((uint8_t*)data);
-    uint16_t n_coils = bytes_to_uint16_t((uint8_t*)data + 2);
-    uint16_t last_coil = first_coil + n_coils - 1;
+template <typename T, MODBUS_WORD_ORDER ORDER>
+static void write_values(uint8_t * buffer, T const * values, uint8_t n_values)
+{
+    typedef typename value_bits<sizeof(T)>::type BITS;
 
-    if (!is_valid_coil_address(first_coil, handler) || !is_valid_coil_address(last_coil, handler))
+    for (int i = 0; i < n_values; i++)
     {
-        return EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        BITS bits;
+        memcpy(&bits, &values[i], sizeof(T));
+        bits = apply_word_order<BITS, ORDER>(bits);
+        for (unsigned int b = 0; b < sizeof(T); b++)
+        {
+            buffer[(i * sizeof(T)) + b] = (uint8_t)(bits >> (8 * (sizeof(T) - 1 - b)));
+        }
     }
+}
 
-    copy_to_multiple_coils(n_coils, (uint8_t*)data + 5, handler.data.write_multiple_coils);
-    handler.functions.write_multiple_coils(first_coil, n_coils, handler.data.write_multiple_coils);
+template <typename T, MODBUS_WORD_ORDER ORDER>
+static void read_values(uint8_t const * buffer, T * values, uint8_t n_values)
+{
+    typedef typename value_bits<sizeof(T)>::type BITS;
 
-    return EXCEPTION_NONE;
+    for (int i = 0; i < n_values; i++)
+    {
+        BITS bits = 0;
+        for (unsigned int b = 0; b < sizeof(T); b++)
+        {
+            bits = (bits << 8) | buffer[(i * sizeof(T)) + b];
+        }
+        bits = apply_word_order<BITS, ORDER>(bits);
+        memcpy(&values[i], &bits, sizeof(T));
+    }
 }
 
-static MODBUS_EXCEPTION_CODES handle_read_input_registers(uint8_t const * const data, const MODBUS_HANDLER& handler)
+template <typename T, MODBUS_WORD_ORDER ORDER>
+static void values_to_registers(int16_t * registers, T const * values, uint8_t n_values)
 {
-    if (!handler.functions.read_input_registers) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+    typedef typename value_bits<sizeof(T)>::type BITS;
+    const unsigned int registers_per_value = sizeof(T) / 2;
 
-    uint16_t first_reg = bytes_to_uint16_t(data);
-    uint16_t n_registers = bytes_to_uint16_t(data+2);
-    uint16_t last_reg = first_reg + n_registers - 1;
-    
-    if (!is_valid_input_register_addr(first_reg, handler) || !is_valid_input_register_addr(last_reg, handler))
+    for (int i = 0; i < n_values; i++)
     {
-        return EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        BITS bits;
+        memcpy(&bits, &values[i], sizeof(T));
+        bits = apply_word_order<BITS, ORDER>(bits);
+        for (unsigned int r = 0; r < registers_per_value; r++)
+        {
+            registers[(i * registers_per_value) + r] = (int16_t)(uint16_t)(bits >> (16 * (registers_per_value - 1 - r)));
+        }
     }
+}
 
-    handler.functions.read_input_registers(first_reg, n_registers);
+template <typename T, MODBUS_WORD_ORDER ORDER>
+static void registers_to_values(T * values, int16_t const * registers, uint8_t n_values)
+{
+    typedef typename value_bits<sizeof(T)>::type BITS;
+    const unsigned int registers_per_value = sizeof(T) / 2;
 
-    return EXCEPTION_NONE;
+    for (int i = 0; i < n_values; i++)
+    {
+        BITS bits = 0;
+        for (unsigned int r = 0; r < registers_per_value; r++)
+        {
+            bits = (bits << 16) | (uint16_t)registers[(i * registers_per_value) + r];
+        }
+        bits = apply_word_order<BITS, ORDER>(bits);
+        memcpy(&values[i], &bits, sizeof(T));
+    }
 }
 
-static MODBUS_EXCEPTION_CODES handle_read_holding_registers(uint8_t const * const data, const MODBUS_HANDLER& handler)
+/*
+ * True when n > 0 addresses from first all lie in [range_first, range_first + range_count).
+ * Works on the offset from the start of the range, so first + n never wraps.
+ */
+static bool range_contains(uint16_t range_first, uint16_t range_count, uint16_t first, uint16_t n)
 {
-    if (!handler.functions.read_holding_registers) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+    uint16_t offset = first - range_first;
+    return (n != 0) && (offset < range_count) && (n <= (uint16_t)(range_count - offset));
+}
 
-    uint16_t first_reg = bytes_to_uint16_t(data);
-    uint16_t n_registers = bytes_to_uint16_t(data+2);
-    uint16_t last_reg = first_reg + n_registers - 1;
+/* Reads a handler or table placed in RAM */
+struct RamMemory
+{
+    template <typename T> static T read(T const * address) { return *address; }
+};
 
-    if (!is_valid_holding_register_addr(first_reg, handler) || !is_valid_holding_register_addr(last_reg, handler))
+/* Reads a handler or table placed in program memory with MODBUS_ROM */
+struct RomMemory
+{
+    template <typename T> static T read(T const * address)
     {
-        return EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        T value;
+        MODBUS_ROM_COPY(&value, address, sizeof(T));
+        return value;
     }
-    
-    handler.functions.read_holding_registers(first_reg, n_registers);
+};
 
-    return EXCEPTION_NONE;
-}
-
-static MODBUS_EXCEPTION_CODES handle_write_holding_register(uint8_t const * const data, const MODBUS_HANDLER& handler)
+/*
+ * Returns the index of the range holding address, or -1.
+ * The search narrows the window with a conditional move rather than a branch,
+ * so it takes the same log2(num_ranges) steps for every address.
+ */
+template <typename MEMORY>
+static int find_address_range(MODBUS_ADDRESS_RANGE const * ranges, uint8_t num_ranges, uint16_t address)
 {
-    if (!handler.functions.write_holding_register) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+    if (!ranges || (num_ranges == 0)) { return -1; }
 
-    uint16_t reg = bytes_to_uint16_t(data);
-    int16_t value = bytes_to_int16_t(data+2);
+    MODBUS_ADDRESS_RANGE const * base = ranges;
+    uint8_t n = num_ranges;
 
-    if (!is_valid_holding_register_addr(reg, handler))
+    while (n > 1)
     {
-        return EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        uint8_t half = n / 2;
+        base = (MEMORY::read(&base[half].first) <= address) ? &base[half] : base;
+        n -= half;
     }
 
-    handler.functions.write_holding_register(reg, value);
-
-    return EXCEPTION_NONE;
+    return range_contains(MEMORY::read(&base->first), MEMORY::read(&base->count), address, 1) ? (int)(base - ranges) : -1;
 }
 
-static MODBUS_EXCEPTION_CODES handle_write_holding_registers(uint8_t const * const data, const MODBUS_HANDLER& handler)
+template <typename MEMORY>
+static bool address_ranges_contain(MODBUS_ADDRESS_RANGE const * ranges, uint8_t num_ranges, uint16_t first, uint16_t n)
 {
-    if (!handler.functions.write_holding_registers) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+    int index = find_address_range<MEMORY>(ranges, num_ranges, first);
+    if (index < 0) { return false; }
 
-    uint16_t first_reg = bytes_to_uint16_t(data);
-    uint16_t n_registers = bytes_to_int16_t(data+2);
-    uint16_t last_reg = first_reg + n_registers - 1;
+    return range_contains(MEMORY::read(&ranges[index].first), MEMORY::read(&ranges[index].count), first, n);
+}
 
-    uint8_t n_values = ((uint8_t*)data)[4];
+/*
+ * Adapts a MODBUS_HANDLER to the modbus::Server handler interface,
+ * checking the dense 0..num_x address ranges and calling through the function pointers.
+ * MEMORY says where the handler and its range tables live; each field is read
+ * through it as it is needed, so a handler in flash is never copied into RAM.
+ */
+template <typename MEMORY>
+class HandlerAdapter
+{
+public:
+    explicit HandlerAdapter(const MODBUS_HANDLER& handler) : m_handler(handler) {}
 
-    if (n_values != (n_registers * 2)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+    uint8_t device_address() { return MEMORY::read(&m_handler.data.device_address); }
 
-    if (!is_valid_holding_register_addr(first_reg, handler) || !is_valid_holding_register_addr(last_reg, handler))
+    bool supports(MODBUS_FUNCTION_CODE function_code)
     {
-        return EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        switch(function_code)
+        {
+        case READ_COILS: return MEMORY::read(&m_handler.functions.read_coils);
+        case READ_DISCRETE_INPUTS: return MEMORY::read(&m_handler.functions.read_discrete_inputs);
+        case WRITE_SINGLE_COIL: return MEMORY::read(&m_handler.functions.write_single_coil);
+        case WRITE_MULTIPLE_COILS: return MEMORY::read(&m_handler.functions.write_multiple_coils_view) || MEMORY::read(&m_handler.functions.write_multiple_coils);
+        case READ_INPUT_REGISTERS: return MEMORY::read(&m_handler.functions.read_input_registers);
+        case READ_HOLDING_REGISTERS: return MEMORY::read(&m_handler.functions.read_holding_registers);
+        case WRITE_HOLDING_REGISTER: return MEMORY::read(&m_handler.functions.write_holding_register);
+        case WRITE_HOLDING_REGISTERS: return MEMORY::read(&m_handler.functions.write_holding_registers_view) || MEMORY::read(&m_handler.functions.write_holding_registers);
+        case READ_WRITE_REGISTERS: return MEMORY::read(&m_handler.functions.read_write_registers_view) || MEMORY::read(&m_handler.functions.read_write_registers);
+        case MASK_WRITE_REGISTER: return MEMORY::read(&m_handler.functions.mask_write_register);
+        case DIAGNOSTICS: return MEMORY::read(&m_handler.functions.diagnostics);
+        case READ_FIFO_QUEUE: return MEMORY::read(&m_handler.functions.read_fifo_queue);
+        case READ_FILE_RECORD: return MEMORY::read(&m_handler.functions.read_file_record);
+        case WRITE_FILE_RECORD: return MEMORY::read(&m_handler.functions.write_file_record);
+        default: return false;
+        }
     }
 
-    copy_to_holding_registers(n_registers, data + 5, handler.data.write_holding_registers);
+    bool valid_addresses(modbus::Table table, modbus::Access, uint16_t first, uint16_t n)
+    {
+        MODBUS_ADDRESS_RANGE const * ranges;
+        uint8_t num_ranges;
 
-    handler.functions.write_holding_registers(first_reg, n_registers, handler.data.write_holding_registers);
+        get_table_ranges(table, &ranges, &num_ranges);
 
-    return EXCEPTION_NONE;
-}
+        if (ranges) { return address_ranges_contain<MEMORY>(ranges, num_ranges, first, n); }
 
-static MODBUS_EXCEPTION_CODES handle_read_write_registers(uint8_t const * const data, const MODBUS_HANDLER& handler)
-{
-    if (!handler.functions.read_write_registers) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+        return range_contains(0, get_table_size(table), first, n);
+    }
 
-    uint16_t read_start_reg = bytes_to_uint16_t(data);
-    uint16_t n_read_count = bytes_to_uint16_t(data+2);
-    uint16_t read_end_reg = read_start_reg + n_read_count - 1;
-    
-    uint16_t write_start_reg = bytes_to_uint16_t(data+4);
-    uint16_t n_write_count = bytes_to_uint16_t(data+6);
-    uint16_t write_end_reg = write_start_reg + n_write_count - 1;
-    uint16_t write_byte_count = (uint16_t)data[8];
-
-    bool bad_addresses = false;
-    bool bad_write_byte_count = false;
-
-    bad_addresses |= !is_valid_holding_register_addr(read_start_reg, handler);
-    bad_addresses |= !is_valid_holding_register_addr(read_end_reg, handler);
-    bad_addresses |= !is_valid_holding_register_addr(write_start_reg, handler);
-    bad_addresses |= !is_valid_holding_register_addr(write_end_reg, handler);
-    
-    bad_write_byte_count = write_byte_count != (n_write_count * 2);
+    MODBUS_FILE const * files() { return MEMORY::read(&m_handler.data.files); }
+    uint8_t num_files() { return MEMORY::read(&m_handler.data.num_files); }
 
-    if (bad_addresses || bad_write_byte_count) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+    void read_coils(uint16_t first_coil, uint16_t n_coils) { MEMORY::read(&m_handler.functions.read_coils)(first_coil, n_coils); }
+    void read_discrete_inputs(uint16_t first_input, uint16_t n_inputs) { MEMORY::read(&m_handler.functions.read_discrete_inputs)(first_input, n_inputs); }
+    void write_single_coil(uint16_t coil, bool on) { MEMORY::read(&m_handler.functions.write_single_coil)(coil, on); }
+    void write_multiple_coils_view(uint16_t first_coil, MODBUS_COIL_VIEW const * values)
+    {
+        void (*view_function)(uint16_t, MODBUS_COIL_VIEW const *) = MEMORY::read(&m_handler.functions.write_multiple_coils_view);
 
-    copy_to_holding_registers(n_write_count, data + 9, handler.data.write_holding_registers);
+        if (view_function) { view_function(first_coil, values); return; }
 
-    handler.functions.read_write_registers(read_start_reg, n_read_count, write_start_reg, n_write_count, handler.data.write_holding_registers);
+        bool * buffer = MEMORY::read(&m_handler.data.write_multiple_coils);
+        modbus_coil_view_copy(values, buffer);
+        MEMORY::read(&m_handler.functions.write_multiple_coils)(first_coil, values->n_coils, buffer);
+    }
+    void read_input_registers(uint16_t reg, uint16_t n_registers) { MEMORY::read(&m_handler.functions.read_input_registers)(reg, n_registers); }
+    void read_holding_registers(uint16_t reg, uint16_t n_registers) { MEMORY::read(&m_handler.functions.read_holding_registers)(reg, n_registers); }
+    void write_holding_register(uint16_t reg, int16_t value) { MEMORY::read(&m_handler.functions.write_holding_register)(reg, value); }
+    void write_holding_registers_view(uint16_t first_reg, MODBUS_REGISTER_VIEW const * values)
+    {
+        void (*view_function)(uint16_t, MODBUS_REGISTER_VIEW const *) = MEMORY::read(&m_handler.functions.write_holding_registers_view);
 
-    return EXCEPTION_NONE;
-}
+        if (view_function) { view_function(first_reg, values); return; }
 
+        int16_t * buffer = MEMORY::read(&m_handler.data.write_holding_registers);
+        modbus_register_view_copy(values, buffer);
+        MEMORY::read(&m_handler.functions.write_holding_registers)(first_reg, values->n_registers, buffer);
+    }
+    void read_write_registers_view(uint16_t read_start_reg, uint16_t n_registers, uint16_t write_start_reg, MODBUS_REGISTER_VIEW const * values)
+    {
+        void (*view_function)(uint16_t, uint16_t, uint16_t, MODBUS_REGISTER_VIEW const *) = MEMORY::read(&m_handler.functions.read_write_registers_view);
 
-static MODBUS_EXCEPTION_CODES handle_mask_write_register(uint8_t const * const data, const MODBUS_HANDLER& handler)
-{
-    if (!handler.functions.mask_write_register) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+        if (view_function) { view_function(read_start_reg, n_registers, write_start_reg, values); return; }
 
-    uint16_t reg = bytes_to_uint16_t(data);
-    uint16_t and_mask = bytes_to_uint16_t(data + 2);
-    uint16_t or_mask = bytes_to_uint16_t(data + 4);
+        int16_t * buffer = MEMORY::read(&m_handler.data.write_holding_registers);
+        modbus_register_view_copy(values, buffer);
+        MEMORY::read(&m_handler.functions.read_write_registers)(read_start_reg, n_registers, write_start_reg, values->n_registers, buffer);
+    }
+    void mask_write_register(uint16_t reg, uint16_t and_mask, uint16_t or_mask) { MEMORY::read(&m_handler.functions.mask_write_register)(reg, and_mask, or_mask); }
+    void diagnostics(uint16_t sub_function, uint16_t data) { MEMORY::read(&m_handler.functions.diagnostics)(sub_function, data); }
+    void read_fifo_queue(uint16_t fifo_pointer_address) { MEMORY::read(&m_handler.functions.read_fifo_queue)(fifo_pointer_address); }
+    void read_file_record(uint8_t const * request, uint8_t request_length) { MEMORY::read(&m_handler.functions.read_file_record)(request, request_length); }
+    void write_file_record(uint8_t const * request, uint8_t request_length) { MEMORY::read(&m_handler.functions.write_file_record)(request, request_length); }
 
-    if (!is_valid_holding_register_addr(reg, handler)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
-    
-    handler.functions.mask_write_register(reg, and_mask, or_mask);
+    void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+    {
+        void (*handler)(uint8_t, MODBUS_EXCEPTION_CODES) = MEMORY::read(&m_handler.functions.exception_handler);
 
-    return EXCEPTION_NONE;
-}
+        if (handler)
+        {
+            handler(function_code, exception_code);
+        }
+    }
 
-/*
- * Public Module Functions
- */
+private:
+    const MODBUS_HANDLER& m_handler;
 
-uint16_t modbus_get_crc16(uint8_t const * const buffer, uint8_t number_of_bytes)
-{
-    uint16_t crc = 0xFFFF;
- 
-    for (int pos = 0; pos < number_of_bytes; pos++)
+    void get_table_ranges(modbus::Table table, MODBUS_ADDRESS_RANGE const ** ranges, uint8_t * num_ranges)
     {
-        crc ^= (uint16_t)buffer[pos];
- 
-        for (uint8_t i = 8; i != 0; i--)
+        switch(table)
         {
-            if ((crc & 0x0001) != 0)
-            {
-                crc >>= 1;
-                crc ^= 0xA001;
-            }
-            else
-            {
-              crc >>= 1;
-            }
+        case modbus::COILS:
+            *ranges = MEMORY::read(&m_handler.data.coil_ranges);
+            *num_ranges = MEMORY::read(&m_handler.data.num_coil_ranges);
+            break;
+        case modbus::DISCRETE_INPUTS:
+            *ranges = MEMORY::read(&m_handler.data.input_ranges);
+            *num_ranges = MEMORY::read(&m_handler.data.num_input_ranges);
+            break;
+        case modbus::INPUT_REGISTERS:
+            *ranges = MEMORY::read(&m_handler.data.input_register_ranges);
+            *num_ranges = MEMORY::read(&m_handler.data.num_input_register_ranges);
+            break;
+        default:
+            *ranges = MEMORY::read(&m_handler.data.holding_register_ranges);
+            *num_ranges = MEMORY::read(&m_handler.data.num_holding_register_ranges);
+            break;
         }
+    }
 
+    uint16_t get_table_size(modbus::Table table)
+    {
+        switch(table)
+        {
+        case modbus::COILS: return MEMORY::read(&m_handler.data.num_coils);
+        case modbus::DISCRETE_INPUTS: return MEMORY::read(&m_handler.data.num_inputs);
+        case modbus::INPUT_REGISTERS: return MEMORY::read(&m_handler.data.num_input_registers);
+        default: return MEMORY::read(&m_handler.data.num_holding_registers);
+        }
     }
-    return crc;
-}
+};
 
-bool modbus_validate_message_crc(const uint8_t * message, int message_length, bool reverse_order)
+typedef HandlerAdapter<RamMemory> FunctionPointerHandler;
+typedef HandlerAdapter<RomMemory> RomFunctionPointerHandler;
+
+#ifdef MODBUS_CRC16_BITWISE
+
+static inline uint16_t update_crc16_byte(uint16_t crc, uint8_t byte)
 {
-    bool valid_crc = true;
+    crc ^= (uint16_t)byte;
 
-    if (application_check_crc(message, message_length, reverse_order) == CRC_PASSED) { return true; }
+    for (uint8_t i = 8; i != 0; i--)
+    {
+        if ((crc & 0x0001) != 0)
+        {
+            crc >>= 1;
+            crc ^= 0xA001;
+        }
+        else
+        {
+          crc >>= 1;
+        }
+    }
 
-    uint8_t expected_hi;
-    uint8_t expected_lo;
-    
-    uint16_t expected_crc = modbus_get_crc16(message, message_length - 2);
-    
-    expected_hi = reverse_order ? (uint8_t)(expected_crc & 0xFF) : (uint8_t)(expected_crc >> 8);
-    expected_lo = reverse_order ? (uint8_t)(expected_crc >> 8) : (uint8_t)(expected_crc & 0xFF);
-    
-    valid_crc &= message[message_length-1] == expected_hi;
-    valid_crc &= message[message_length-2] == expected_lo;
-    
-    return valid_crc;
+    return crc;
 }
 
-void modbus_service_message(uint8_t const * const message, const MODBUS_HANDLER& handler, int message_length, bool check_crc)
+#else
+
+/* CRC of each byte value, for stepping the CRC a byte at a time (reflected polynomial 0xA001), kept in flash */
+static const uint16_t s_crc16_table[256] MODBUS_ROM = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+static inline uint16_t update_crc16_byte(uint16_t crc, uint8_t byte)
 {
-    MODBUS_FUNCTION_CODE function_code;
+    return (crc >> 8) ^ MODBUS_ROM_READ_WORD(&s_crc16_table[(crc ^ byte) & 0xFF]);
+}
 
-    if (!message) { return; }
+#endif
 
-    uint8_t message_address = get_message_address(message);
+/*
+ * Frame output for the builders. Each byte is CRC'd as it is written, so a
+ * frame is built in one pass instead of being read back by modbus_write_crc.
+ */
+struct frame_writer
+{
+    uint8_t * buffer;
+    int count;
+    uint16_t crc;
+    bool add_crc;
+};
 
-    s_broadcast = (message_address == MODBUS_BROADCAST_ADDRESS);
+static inline void put_byte(frame_writer& writer, uint8_t byte)
+{
+    writer.buffer[writer.count++] = byte;
+    if (writer.add_crc) { writer.crc = update_crc16_byte(writer.crc, byte); }
+}
 
-    if (!s_broadcast && (message_address != handler.data.device_address)) { return; }
-    if (!is_valid_function_code(message[1])) { return; }
+static inline void put_uint16(frame_writer& writer, uint16_t value)
+{
+    put_byte(writer, (uint8_t)(value >> 8));
+    put_byte(writer, (uint8_t)(value & 0xFF));
+}
 
-    s_current_message = message;
-    s_current_message_length = message_length;
+static inline void put_bytes(frame_writer& writer, uint8_t const * bytes, int n_bytes)
+{
+    for (int i = 0; i < n_bytes; i++) { put_byte(writer, bytes[i]); }
+}
 
-    if (check_crc && !modbus_validate_message_crc(message, message_length))
+/* Packs n_bits bools into bytes, least significant bit first */
+static void put_bits(frame_writer& writer, bool const * bits, uint16_t n_bits)
+{
+    for (uint16_t first = 0; first < n_bits; first += 8)
     {
-        if (handler.functions.exception_handler)
+        uint8_t byte = 0x00;
+        for (uint16_t i = first; (i < n_bits) && (i < (first + 8)); i++)
         {
-            handler.functions.exception_handler(message[1]+128, EXCEPTION_INVALID_CRC);
+            byte |= bits[i] ? (1 << (i & 7)) : 0;
         }
-        return;
+        put_byte(writer, byte);
+    }
+}
+
+static inline frame_writer start_frame(uint8_t * buffer, uint8_t address, uint8_t function_code, bool add_crc)
+{
+    frame_writer writer = {buffer, 0, MODBUS_CRC16_INIT, add_crc};
+    put_byte(writer, address);
+    put_byte(writer, function_code);
+    return writer;
+}
+
+/* Appends the CRC if the frame has one and returns the frame length */
+static inline int end_frame(frame_writer& writer)
+{
+    if (writer.add_crc)
+    {
+        writer.buffer[writer.count++] = (uint8_t)(writer.crc & 0xFF);
+        writer.buffer[writer.count++] = (uint8_t)(writer.crc >> 8);
     }
+    return writer.count;
+}
 
-    function_code = get_message_function_code(message);
+static bool frame_crc_matches(MODBUS_FRAME const& frame, uint16_t crc)
+{
+    return (frame.message[frame.length-2] == (uint8_t)(crc & 0xFF)) && (frame.message[frame.length-1] == (uint8_t)(crc >> 8));
+}
 
-    uint8_t const * const data_start = &message[2];
+/*
+ * CRCs of CRC_LANES frames at once. The CRC of one frame is a serial chain, so
+ * stepping several independent frames byte by byte in the same loop lets the
+ * CPU overlap their chains. Bytes past the shortest frame are finished one
+ * frame at a time. The chain of a frame shorter than CRC_LANES_MIN_LENGTH is
+ * too short to gain from this, so such frames are checked on their own.
+ */
+#define CRC_LANES 4
+#define CRC_LANES_MIN_LENGTH 32
 
-    MODBUS_EXCEPTION_CODES exception = EXCEPTION_ILLEGAL_FUNCTION_CODE;
+static void get_frame_crc16s(MODBUS_FRAME const * frames, uint16_t * crcs)
+{
+    uint16_t common_length = frames[0].length - 2;
 
-    switch(function_code)
+    for (int lane = 0; lane < CRC_LANES; lane++)
     {
-    case READ_COILS:
-        exception = handle_read_coils(data_start, handler);
-        break;
-    case READ_DISCRETE_INPUTS:
-        exception = handle_read_discrete_inputs(data_start, handler);
-        break;
-    case WRITE_SINGLE_COIL:
-        exception = handle_write_single_coil(data_start, handler);
-        break;
-    case WRITE_MULTIPLE_COILS:
-        exception = handle_write_multiple_coils(data_start, handler);
-        break;
-    case READ_INPUT_REGISTERS:
-        exception = handle_read_input_registers(data_start, handler);
-        break;
-    case READ_HOLDING_REGISTERS:
-        exception = handle_read_holding_registers(data_start, handler);
-        break;
-    case WRITE_HOLDING_REGISTER:
-        exception = handle_write_holding_register(data_start, handler);
-        break;
-    case WRITE_HOLDING_REGISTERS:
-        exception = handle_write_holding_registers(data_start, handler);
-        break;
-    case READ_WRITE_REGISTERS:
-        exception = handle_read_write_registers(data_start, handler);
-        break;
-    case MASK_WRITE_REGISTER:
-        exception = handle_mask_write_register(data_start, handler);
-        break;
-    default:
-        break;
+        crcs[lane] = MODBUS_CRC16_INIT;
+        if ((uint16_t)(frames[lane].length - 2) < common_length) { common_length = frames[lane].length - 2; }
     }
 
-    if ((exception != EXCEPTION_NONE) && (handler.functions.exception_handler))
+    for (uint16_t pos = 0; pos < common_length; pos++)
     {
-        handler.functions.exception_handler(function_code + 128, exception);    
+        for (int lane = 0; lane < CRC_LANES; lane++)
+        {
+            crcs[lane] = update_crc16_byte(crcs[lane], frames[lane].message[pos]);
+        }
     }
 
-    s_current_message = NULL;
-    s_current_message_length = 0;
+    for (int lane = 0; lane < CRC_LANES; lane++)
+    {
+        crcs[lane] = modbus_update_crc16(crcs[lane], &frames[lane].message[common_length], frames[lane].length - 2 - common_length);
+    }
 }
 
-uint8_t const * modbus_get_current_message()
+/*
+ * Public Module Functions
+ */
+
+static int get_address_count_request(MODBUS_FUNCTION_CODE function_code, uint8_t device_address, uint8_t * buffer, uint16_t address, uint16_t count, bool add_crc)
 {
-    return s_current_message; 
+    frame_writer writer = start_frame(buffer, device_address, function_code, add_crc);
+    put_uint16(writer, address);
+    put_uint16(writer, count);
+
+    return end_frame(writer);
 }
 
-uint8_t modbus_get_current_message_address()
+int modbus_get_read_coils_request(uint8_t device_address, uint8_t * buffer, uint16_t first_coil, uint16_t n_coils, bool add_crc)
 {
-    return get_message_address(s_current_message);
+    return get_address_count_request(READ_COILS, device_address, buffer, first_coil, n_coils, add_crc);
 }
 
-bool modbus_last_message_was_broadcast()
+int modbus_get_read_discrete_inputs_request(uint8_t device_address, uint8_t * buffer, uint16_t first_input, uint16_t n_inputs, bool add_crc)
 {
-    return s_broadcast;
+    return get_address_count_request(READ_DISCRETE_INPUTS, device_address, buffer, first_input, n_inputs, add_crc);
 }
 
-int modbus_get_current_message_length()
+int modbus_get_read_input_registers_request(uint8_t device_address, uint8_t * buffer, uint16_t first_reg, uint16_t n_registers, bool add_crc)
 {
-    return s_current_message_length;
+    return get_address_count_request(READ_INPUT_REGISTERS, device_address, buffer, first_reg, n_registers, add_crc);
 }
 
-int modbus_start_response(uint8_t * const buffer, MODBUS_FUNCTION_CODE function_code, uint8_t device_address)
+int modbus_get_read_holding_registers_request(uint8_t device_address, uint8_t * buffer, uint16_t first_reg, uint16_t n_registers, bool add_crc)
 {
-    if (!buffer) { return 0;}
-
-    buffer[0] = device_address;
-    buffer[1] = (uint8_t)function_code;
-
-    return 2;
+    return get_address_count_request(READ_HOLDING_REGISTERS, device_address, buffer, first_reg, n_registers, add_crc);
 }
 
-int modbus_write(uint8_t * const buffer, int8_t value)
+int modbus_get_write_single_coil_request(uint8_t device_address, uint8_t * buffer, uint16_t coil, bool on, bool add_crc)
+{
+    return get_address_count_request(WRITE_SINGLE_COIL, device_address, buffer, coil, on ? 0xFF00 : 0x0000, add_crc);
+}
+
+int modbus_get_write_holding_register_request(uint8_t device_address, uint8_t * buffer, uint16_t reg, int16_t value, bool add_crc)
+{
+    return get_address_count_request(WRITE_HOLDING_REGISTER, device_address, buffer, reg, (uint16_t)value, add_crc);
+}
+
+int modbus_write_write_multiple_coils_request(uint8_t device_address, uint8_t * buffer, uint16_t first_coil, uint16_t n_coils, bool const * values, bool add_crc)
+{
+    frame_writer writer = start_frame(buffer, device_address, WRITE_MULTIPLE_COILS, add_crc);
+    put_uint16(writer, first_coil);
+    put_uint16(writer, n_coils);
+    put_byte(writer, (uint8_t)get_number_of_required_bytes_for_number_of_bits(n_coils));
+    put_bits(writer, values, n_coils);
+
+    return end_frame(writer);
+}
+
+int modbus_write_write_holding_registers_request(uint8_t device_address, uint8_t * buffer, uint16_t first_reg, uint16_t n_registers, int16_t const * values, bool add_crc)
+{
+    frame_writer writer = start_frame(buffer, device_address, WRITE_HOLDING_REGISTERS, add_crc);
+    put_uint16(writer, first_reg);
+    put_uint16(writer, n_registers);
+    put_byte(writer, (uint8_t)(n_registers*2));
+
+    for (int i = 0; i < n_registers; i++)
+    {
+        put_uint16(writer, (uint16_t)values[i]);
+    }
+
+    return end_frame(writer);
+}
+
+/* Length of a frame whose byte count is the byte at index, with header_length bytes before the data */
+static int get_byte_count_frame_length(uint8_t const * frame, int received, int index, int header_length)
+{
+    return (received > index) ? (header_length + frame[index] + 2) : 0;
+}
+
+int modbus_get_request_length(uint8_t const * frame, int received)
+{
+    if (received < 2) { return 0; }
+
+    switch (frame[1])
+    {
+    case READ_COILS:
+    case READ_DISCRETE_INPUTS:
+    case READ_HOLDING_REGISTERS:
+    case READ_INPUT_REGISTERS:
+    case WRITE_SINGLE_COIL:
+    case WRITE_HOLDING_REGISTER:
+    case DIAGNOSTICS:
+        return 8;
+    case MASK_WRITE_REGISTER:
+        return 10;
+    case READ_FIFO_QUEUE:
+        return 6;
+    case WRITE_MULTIPLE_COILS:
+    case WRITE_HOLDING_REGISTERS:
+        return get_byte_count_frame_length(frame, received, 6, 7);
+    case READ_WRITE_REGISTERS:
+        return get_byte_count_frame_length(frame, received, 10, 11);
+    case READ_FILE_RECORD:
+    case WRITE_FILE_RECORD:
+        return get_byte_count_frame_length(frame, received, 2, 3);
+    default:
+        return -1;
+    }
+}
+
+int modbus_get_response_length(uint8_t const * frame, int received)
+{
+    if (received < 2) { return 0; }
+
+    if (frame[1] & 0x80) { return 5; }
+
+    switch (frame[1])
+    {
+    case READ_COILS:
+    case READ_DISCRETE_INPUTS:
+    case READ_HOLDING_REGISTERS:
+    case READ_INPUT_REGISTERS:
+    case READ_WRITE_REGISTERS:
+    case READ_FILE_RECORD:
+    case WRITE_FILE_RECORD:
+        return get_byte_count_frame_length(frame, received, 2, 3);
+    case WRITE_SINGLE_COIL:
+    case WRITE_HOLDING_REGISTER:
+    case WRITE_MULTIPLE_COILS:
+    case WRITE_HOLDING_REGISTERS:
+    case DIAGNOSTICS:
+        return 8;
+    case MASK_WRITE_REGISTER:
+        return 10;
+    case READ_FIFO_QUEUE:
+        return (received > 3) ? (4 + ((frame[2] << 8) | frame[3]) + 2) : 0;
+    default:
+        return -1;
+    }
+}
+
+uint16_t modbus_get_crc16(uint8_t const * const buffer, uint16_t number_of_bytes)
+{
+    return modbus_update_crc16(MODBUS_CRC16_INIT, buffer, number_of_bytes);
+}
+
+/*
+ * Continues a CRC over the next part of a frame, so frames held in several
+ * pieces can be checked without joining them. Start from MODBUS_CRC16_INIT.
+ */
+uint16_t modbus_update_crc16(uint16_t crc, uint8_t const * const buffer, uint16_t number_of_bytes)
+{
+    for (int pos = 0; pos < number_of_bytes; pos++)
+    {
+        crc = update_crc16_byte(crc, buffer[pos]);
+    }
+    return crc;
+}
+
+bool modbus_validate_message_crc(const uint8_t * message, int message_length, bool reverse_order)
+{
+    bool valid_crc = true;
+
+    /* An address, a function code and the CRC at least; shorter frames have no CRC to check */
+    if (!message || (message_length < 4)) { return false; }
+
+    if (application_check_crc(message, message_length, reverse_order) == CRC_PASSED) { return true; }
+
+    uint8_t expected_hi;
+    uint8_t expected_lo;
+    
+    uint16_t expected_crc = modbus_get_crc16(message, message_length - 2);
+    
+    expected_hi = reverse_order ? (uint8_t)(expected_crc & 0xFF) : (uint8_t)(expected_crc >> 8);
+    expected_lo = reverse_order ? (uint8_t)(expected_crc >> 8) : (uint8_t)(expected_crc & 0xFF);
+    
+    valid_crc &= message[message_length-1] == expected_hi;
+    valid_crc &= message[message_length-2] == expected_lo;
+    
+    return valid_crc;
+}
+
+/*
+ * Checks the CRC of each frame, setting valid[i] for frames[i]. Frames shorter
+ * than an address, function code and CRC are never valid. Groups of longer
+ * frames are checked together (see get_frame_crc16s).
+ */
+void modbus_validate_message_crcs(MODBUS_FRAME const * frames, int count, bool * valid)
+{
+    MODBUS_FRAME group[CRC_LANES];
+    int group_index[CRC_LANES];
+    uint16_t crcs[CRC_LANES];
+    int n_group = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!frames[i].message || (frames[i].length < 4))
+        {
+            valid[i] = false;
+        }
+        else if (application_check_crc(frames[i].message, frames[i].length, false) == CRC_PASSED)
+        {
+            valid[i] = true;
+        }
+        else if (frames[i].length < CRC_LANES_MIN_LENGTH)
+        {
+            valid[i] = frame_crc_matches(frames[i], modbus_get_crc16(frames[i].message, frames[i].length - 2));
+        }
+        else
+        {
+            group[n_group] = frames[i];
+            group_index[n_group++] = i;
+
+            if (n_group == CRC_LANES)
+            {
+                get_frame_crc16s(group, crcs);
+                for (int lane = 0; lane < CRC_LANES; lane++)
+                {
+                    valid[group_index[lane]] = frame_crc_matches(group[lane], crcs[lane]);
+                }
+                n_group = 0;
+            }
+        }
+    }
+
+    for (int lane = 0; lane < n_group; lane++)
+    {
+        valid[group_index[lane]] = frame_crc_matches(group[lane], modbus_get_crc16(group[lane].message, group[lane].length - 2));
+    }
+}
+
+/*
+ * Checks the CRC of a frame that wrapped in its receive ring, running the CRC
+ * over each segment in turn; the CRC bytes themselves may straddle the wrap.
+ */
+bool modbus_validate_split_message_crc(MODBUS_SPLIT_FRAME const * frame)
+{
+    int length = get_split_frame_length(frame);
+    if (length < 4) { return false; }
+
+    uint16_t first_length = frame->segments[0].length;
+    uint16_t crc;
+
+    if (first_length >= (length - 2))
+    {
+        crc = modbus_update_crc16(MODBUS_CRC16_INIT, frame->segments[0].data, length - 2);
+    }
+    else
+    {
+        crc = modbus_update_crc16(MODBUS_CRC16_INIT, frame->segments[0].data, first_length);
+        crc = modbus_update_crc16(crc, frame->segments[1].data, length - 2 - first_length);
+    }
+
+    bool valid_crc = true;
+    valid_crc &= get_split_frame_byte(frame, length - 2) == (uint8_t)(crc & 0xFF);
+    valid_crc &= get_split_frame_byte(frame, length - 1) == (uint8_t)(crc >> 8);
+
+    return valid_crc;
+}
+
+/*
+ * Counters for every frame on the bus. This runs before address filtering, so CRC
+ * errors are counted on frames for other units and on frames whose address byte
+ * was corrupted, as the serial line diagnostics require.
+ */
+static void count_bus_message(bool crc_failed)
+{
+    STATISTICS_INCREMENT(frames_seen);
+    s_diagnostic_counters.bus_message++;
+
+    if (crc_failed)
+    {
+        STATISTICS_INCREMENT(crc_failures);
+        s_diagnostic_counters.bus_communication_error++;
+    }
+}
+
+/*
+ * Address filtering and counters for a message from message_address.
+ * Returns false if the message is not for this device. Only the counters are
+ * touched, so this is safe to call from the receive interrupt.
+ */
+static bool accept_message_address(uint8_t message_address, uint8_t function_code, uint8_t device_address, bool * broadcast)
+{
+    *broadcast = (message_address == MODBUS_BROADCAST_ADDRESS);
+
+    if (!*broadcast && (message_address != device_address)) { return false; }
+
+    if (*broadcast)
+    {
+        STATISTICS_INCREMENT(frames_broadcast);
+    }
+    else
+    {
+        STATISTICS_INCREMENT(frames_addressed);
+    }
+
+    return is_valid_function_code(function_code);
+}
+
+/* crc_failed has already been counted by count_bus_message */
+static MODBUS_MESSAGE_STATE accept_message_crc(bool crc_failed, bool broadcast)
+{
+    if (crc_failed) { return MESSAGE_CRC_FAILED; }
+
+    s_diagnostic_counters.slave_message++;
+    if (broadcast) { s_diagnostic_counters.slave_no_response++; }
+
+    return MESSAGE_ACCEPTED;
+}
+
+static void set_current_message(uint8_t const * message, int message_length, uint8_t function_code)
+{
+    s_current_message = message;
+    s_current_message_length = message_length;
+    s_current_function_code = function_code;
+}
+
+MODBUS_MESSAGE_STATE modbus_begin_message(uint8_t const * const message, uint8_t device_address, int message_length, bool check_crc)
+{
+    if (!message) { return MESSAGE_IGNORED; }
+
+    bool crc_failed = check_crc && !modbus_validate_message_crc(message, message_length);
+    count_bus_message(crc_failed);
+
+    if (!accept_message_address(get_message_address(message), message[1], device_address, &s_broadcast)) { return MESSAGE_IGNORED; }
+
+    set_current_message(message, message_length, message[1]);
+
+    MODBUS_MESSAGE_STATE state = accept_message_crc(crc_failed, s_broadcast);
+    if (state == MESSAGE_ACCEPTED) { STATISTICS_START_TIMER(); }
+
+    return state;
+}
+
+MODBUS_MESSAGE_STATE modbus_begin_split_message(MODBUS_SPLIT_FRAME const * frame, uint8_t device_address, bool check_crc)
+{
+    if (!frame) { return MESSAGE_IGNORED; }
+
+    /* A frame that did not wrap goes through the contiguous path, with any application CRC check */
+    if (frame->segments[1].length == 0)
+    {
+        return modbus_begin_message(frame->segments[0].data, device_address, frame->segments[0].length, check_crc);
+    }
+    if (frame->segments[0].length == 0)
+    {
+        return modbus_begin_message(frame->segments[1].data, device_address, frame->segments[1].length, check_crc);
+    }
+
+    uint8_t function_code = get_split_frame_byte(frame, 1);
+
+    bool crc_failed = check_crc && !modbus_validate_split_message_crc(frame);
+    count_bus_message(crc_failed);
+
+    if (!accept_message_address(get_message_address(frame->segments[0].data), function_code, device_address, &s_broadcast)) { return MESSAGE_IGNORED; }
+
+    set_current_message(frame->segments[0].data, get_split_frame_length(frame), function_code);
+
+    MODBUS_MESSAGE_STATE state = accept_message_crc(crc_failed, s_broadcast);
+    if (state == MESSAGE_ACCEPTED) { STATISTICS_START_TIMER(); }
+
+    return state;
+}
+
+/*
+ * Screens and decodes a frame into request without touching the current message,
+ * so it can run in the receive interrupt while the main loop executes an earlier request.
+ * Frames shorter than their function code requires are counted as bus errors and ignored.
+ */
+MODBUS_MESSAGE_STATE modbus_decode_request(uint8_t const * const message, uint8_t device_address, int message_length, bool check_crc, MODBUS_REQUEST * request)
+{
+    if (!message || !request || (message_length < 2)) { return MESSAGE_IGNORED; }
+
+    uint8_t function_code = message[1];
+    bool broadcast;
+
+    bool crc_failed = check_crc && !modbus_validate_message_crc(message, message_length);
+    count_bus_message(crc_failed);
+
+    if (!accept_message_address(get_message_address(message), function_code, device_address, &broadcast)) { return MESSAGE_IGNORED; }
+
+    /* A short frame is a bus error, counted once even if its CRC failed too */
+    int expected_length = modbus_get_request_length(message, message_length);
+    if ((expected_length <= 0) || (message_length < expected_length - (check_crc ? 0 : 2)))
+    {
+        if (!crc_failed) { s_diagnostic_counters.bus_communication_error++; }
+        return MESSAGE_IGNORED;
+    }
+
+    request->message = message;
+    request->message_length = message_length;
+    request->broadcast = broadcast;
+    request->function_code = function_code;
+    request->byte_count = 0;
+    request->payload = NULL;
+    request->state = accept_message_crc(crc_failed, broadcast);
+
+    if (request->state == MESSAGE_ACCEPTED)
+    {
+        uint8_t offset = modbus::detail::decode_request_fields(function_code, message + 2, request->fields);
+        if (modbus::detail::request_has_payload(function_code))
+        {
+            request->byte_count = message[2 + offset];
+            request->payload = message + 3 + offset;
+        }
+    }
+
+    return request->state;
+}
+
+/* Makes a decoded request the current message, ready for its handlers to run */
+void modbus_begin_request(MODBUS_REQUEST const * request)
+{
+    s_broadcast = request->broadcast;
+    set_current_message(request->message, request->message_length, request->function_code);
+
+    if (request->state == MESSAGE_ACCEPTED) { STATISTICS_START_TIMER(); }
+}
+
+void modbus_request_queue_init(MODBUS_REQUEST_QUEUE * queue)
+{
+    if (!queue) { return; }
+
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+uint8_t modbus_request_queue_count(MODBUS_REQUEST_QUEUE const * queue)
+{
+    if (!queue) { return 0; }
+
+    uint8_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    uint8_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    return (head + MODBUS_REQUEST_QUEUE_SIZE - tail) % MODBUS_REQUEST_QUEUE_SIZE;
+}
+
+/*
+ * Receive interrupt half of deferred servicing: decodes the frame straight into the
+ * next free slot and publishes it. Returns false only if the frame was for this
+ * device but the queue was full, so the caller can count or answer the overrun.
+ */
+bool modbus_defer_message(MODBUS_REQUEST_QUEUE * queue, uint8_t const * const message, uint8_t device_address, int message_length, bool check_crc)
+{
+    if (!queue) { return false; }
+
+    uint8_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    uint8_t next = (head + 1) % MODBUS_REQUEST_QUEUE_SIZE;
+    MODBUS_REQUEST scratch;
+    bool full = (next == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE));
+
+    /* Screen even when full, so the counters still see the frame */
+    MODBUS_REQUEST * request = full ? &scratch : &queue->requests[head];
+
+    if (modbus_decode_request(message, device_address, message_length, check_crc, request) == MESSAGE_IGNORED) { return true; }
+
+    if (full) { return false; }
+
+    __atomic_store_n(&queue->head, next, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/*
+ * Main loop half of deferred servicing: runs the oldest queued request.
+ * Returns false if the queue was empty.
+ */
+bool modbus_service_deferred_message(MODBUS_REQUEST_QUEUE * queue, const MODBUS_HANDLER& handler, MODBUS_FRAME_STATUS * status)
+{
+    if (!queue) { return false; }
+
+    uint8_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    if (tail == __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) { return false; }
+
+    FunctionPointerHandler adapter(handler);
+    modbus::Server<FunctionPointerHandler> server(adapter);
+
+    MODBUS_FRAME_STATUS frame_status = server.service_request(queue->requests[tail]);
+
+    __atomic_store_n(&queue->tail, (uint8_t)((tail + 1) % MODBUS_REQUEST_QUEUE_SIZE), __ATOMIC_RELEASE);
+
+    if (status) { *status = frame_status; }
+
+    return true;
+}
+
+void modbus_end_message(MODBUS_EXCEPTION_CODES exception)
+{
+    STATISTICS_RECORD_HANDLER((MODBUS_FUNCTION_CODE)s_current_function_code);
+
+    STATISTICS_RECORD_EXCEPTION(exception);
+
+    if ((exception != EXCEPTION_NONE) && !s_broadcast) { s_diagnostic_counters.slave_exception_error++; }
+
+    s_current_message = NULL;
+    s_current_message_length = 0;
+}
+
+void modbus_service_message(uint8_t const * const message, const MODBUS_HANDLER& handler, int message_length, bool check_crc)
+{
+    FunctionPointerHandler adapter(handler);
+    modbus::Server<FunctionPointerHandler> server(adapter);
+
+    server.service_message(message, message_length, check_crc);
+}
+
+/* As modbus_service_message, for a handler declared const MODBUS_ROM */
+void modbus_service_rom_message(uint8_t const * const message, MODBUS_HANDLER const * rom_handler, int message_length, bool check_crc)
+{
+    if (!rom_handler) { return; }
+
+    RomFunctionPointerHandler adapter(*rom_handler);
+    modbus::Server<RomFunctionPointerHandler> server(adapter);
+
+    server.service_message(message, message_length, check_crc);
+}
+
+/*
+ * Services a burst of frames in arrival order, with one handler adapter for the
+ * whole burst and the CRCs checked in a single pass up front. Frames that fail
+ * the CRC go through the normal path again so their counters, statistics and
+ * exception callback are the same as with modbus_service_message.
+ * statuses[i] receives the outcome of frames[i].
+ */
+void modbus_service_messages(MODBUS_FRAME const * frames, int count, const MODBUS_HANDLER& handler, MODBUS_FRAME_STATUS * statuses, bool check_crc)
+{
+    FunctionPointerHandler adapter(handler);
+    modbus::Server<FunctionPointerHandler> server(adapter);
+
+    bool valid[MODBUS_MAX_BATCH_FRAMES];
+
+    for (int first = 0; first < count; first += MODBUS_MAX_BATCH_FRAMES)
+    {
+        int n = ((count - first) < MODBUS_MAX_BATCH_FRAMES) ? (count - first) : MODBUS_MAX_BATCH_FRAMES;
+
+        if (check_crc) { modbus_validate_message_crcs(&frames[first], n, valid); }
+
+        for (int i = 0; i < n; i++)
+        {
+            MODBUS_FRAME const& frame = frames[first + i];
+            statuses[first + i] = server.service_message(frame.message, frame.length, check_crc && !valid[i], check_crc);
+        }
+    }
+}
+
+/*
+ * Describes the length bytes at start in a ring of ring_size bytes as a split frame.
+ */
+void modbus_get_ring_frame(uint8_t const * ring, uint16_t ring_size, uint16_t start, uint16_t length, MODBUS_SPLIT_FRAME * frame)
+{
+    uint16_t first_length = ((ring_size - start) < length) ? (ring_size - start) : length;
+
+    frame->segments[0].data = &ring[start];
+    frame->segments[0].length = first_length;
+    frame->segments[1].data = ring;
+    frame->segments[1].length = length - first_length;
+}
+
+MODBUS_FRAME_STATUS modbus_service_split_message(MODBUS_SPLIT_FRAME const * frame, const MODBUS_HANDLER& handler, bool check_crc)
+{
+    FunctionPointerHandler adapter(handler);
+    modbus::Server<FunctionPointerHandler> server(adapter);
+
+    return server.service_split_message(frame, check_crc);
+}
+
+uint8_t const * modbus_get_current_message()
+{
+    return s_current_message; 
+}
+
+uint8_t modbus_get_current_message_address()
+{
+    return get_message_address(s_current_message);
+}
+
+bool modbus_last_message_was_broadcast()
+{
+    return s_broadcast;
+}
+
+int modbus_get_current_message_length()
+{
+    return s_current_message_length;
+}
+
+int modbus_find_address_range(MODBUS_ADDRESS_RANGE const * ranges, uint8_t num_ranges, uint16_t address)
+{
+    return find_address_range<RamMemory>(ranges, num_ranges, address);
+}
+
+bool modbus_address_ranges_contain(MODBUS_ADDRESS_RANGE const * ranges, uint8_t num_ranges, uint16_t first, uint16_t n)
+{
+    return address_ranges_contain<RamMemory>(ranges, num_ranges, first, n);
+}
+
+int16_t modbus_register_view_get(MODBUS_REGISTER_VIEW const * view, uint16_t index)
+{
+    return (int16_t)bytes_to_uint16_t(&view->data[index * 2]);
+}
+
+void modbus_register_view_copy(MODBUS_REGISTER_VIEW const * view, int16_t * values)
+{
+    for (uint16_t i = 0; i < view->n_registers; i++)
+    {
+        values[i] = modbus_register_view_get(view, i);
+    }
+}
+
+bool modbus_coil_view_get(MODBUS_COIL_VIEW const * view, uint16_t index)
+{
+    return (view->data[index / 8] >> (index & 7)) & 1;
+}
+
+void modbus_coil_view_copy(MODBUS_COIL_VIEW const * view, bool * values)
+{
+    for (uint16_t i = 0; i < view->n_coils; i++)
+    {
+        values[i] = modbus_coil_view_get(view, i);
+    }
+}
+
+#if MODBUS_ENABLE_FC_FILE_RECORDS
+
+MODBUS_FILE const * modbus_find_file(MODBUS_FILE const * files, uint8_t num_files, uint16_t file_number)
+{
+    if (!files) { return NULL; }
+
+    for (uint8_t i = 0; i < num_files; i++)
+    {
+        if (files[i].file_number == file_number) { return &files[i]; }
+    }
+
+    return NULL;
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_READ_FILE_RECORD
+
+MODBUS_EXCEPTION_CODES modbus_check_read_file_record_request(MODBUS_FILE const * files, uint8_t num_files, uint8_t const * request, uint8_t request_length)
+{
+    bool bad_length = false;
+    bad_length |= (request_length < MIN_READ_FILE_RECORD_REQUEST_LENGTH);
+    bad_length |= (request_length > MAX_READ_FILE_RECORD_REQUEST_LENGTH);
+    bad_length |= (request_length % FILE_RECORD_SUB_REQUEST_HEADER_LENGTH) != 0;
+    if (bad_length) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+
+    int response_length = 0;
+
+    for (uint8_t offset = 0; offset < request_length; offset += FILE_RECORD_SUB_REQUEST_HEADER_LENGTH)
+    {
+        struct file_record_sub_request sub_request;
+        get_file_record_sub_request(request + offset, &sub_request);
+
+        MODBUS_FILE const * file = modbus_find_file(files, num_files, sub_request.file_number);
+        MODBUS_EXCEPTION_CODES exception = validate_file_record_sub_request(&sub_request, file);
+        if (exception != EXCEPTION_NONE) { return exception; }
+
+        response_length += 2 + (sub_request.record_length * 2);
+        if (response_length > MAX_READ_FILE_RECORD_RESPONSE_LENGTH) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+    }
+
+    return EXCEPTION_NONE;
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_WRITE_FILE_RECORD
+
+MODBUS_EXCEPTION_CODES modbus_store_write_file_record_request(MODBUS_FILE const * files, uint8_t num_files, uint8_t const * request, uint8_t request_length)
+{
+    if ((request_length < MIN_WRITE_FILE_RECORD_REQUEST_LENGTH) || (request_length > MAX_WRITE_FILE_RECORD_REQUEST_LENGTH))
+    {
+        return EXCEPTION_ILLEGAL_DATA_VALUE;
+    }
+
+    /* Validate every sub-request before writing anything, so a bad request has no side effects */
+    int offset = 0;
+    while (offset < request_length)
+    {
+        if ((request_length - offset) < FILE_RECORD_SUB_REQUEST_HEADER_LENGTH) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+
+        struct file_record_sub_request sub_request;
+        get_file_record_sub_request(request + offset, &sub_request);
+
+        MODBUS_FILE const * file = modbus_find_file(files, num_files, sub_request.file_number);
+        MODBUS_EXCEPTION_CODES exception = validate_file_record_sub_request(&sub_request, file);
+        if (exception != EXCEPTION_NONE) { return exception; }
+        if (!file->writable) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+        offset += FILE_RECORD_SUB_REQUEST_HEADER_LENGTH + (sub_request.record_length * 2);
+    }
+
+    if (offset != request_length) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+
+    for (offset = 0; offset < request_length; )
+    {
+        struct file_record_sub_request sub_request;
+        get_file_record_sub_request(request + offset, &sub_request);
+
+        MODBUS_FILE const * file = modbus_find_file(files, num_files, sub_request.file_number);
+        memcpy(file->records + (sub_request.record_number * 2), request + offset + FILE_RECORD_SUB_REQUEST_HEADER_LENGTH, sub_request.record_length * 2);
+
+        offset += FILE_RECORD_SUB_REQUEST_HEADER_LENGTH + (sub_request.record_length * 2);
+    }
+
+    return EXCEPTION_NONE;
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_READ_FIFO_QUEUE
+
+void modbus_fifo_init(MODBUS_FIFO * fifo)
+{
+    if (!fifo) { return; }
+
+    fifo->head = 0;
+    fifo->tail = 0;
+}
+
+bool modbus_fifo_push(MODBUS_FIFO * fifo, int16_t value)
+{
+    if (!fifo) { return false; }
+
+    uint8_t head = __atomic_load_n(&fifo->head, __ATOMIC_RELAXED);
+    uint8_t next = fifo_next(head);
+
+    if (next == __atomic_load_n(&fifo->tail, __ATOMIC_ACQUIRE)) { return false; }
+
+    fifo->values[head] = value;
+    __atomic_store_n(&fifo->head, next, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+uint8_t modbus_fifo_count(MODBUS_FIFO const * fifo)
+{
+    uint8_t head = __atomic_load_n(&fifo->head, __ATOMIC_ACQUIRE);
+    uint8_t tail = __atomic_load_n(&fifo->tail, __ATOMIC_RELAXED);
+
+    return (head - tail) & (MODBUS_FIFO_SIZE - 1);
+}
+
+#endif
+
+void modbus_tx_queue_init(MODBUS_TX_QUEUE * queue, MODBUS_TX_START start_transmit, MODBUS_TX_DRIVER_ENABLE set_driver_enable, void * port)
+{
+    if (!queue) { return; }
+
+    queue->start_transmit = start_transmit;
+    queue->set_driver_enable = set_driver_enable;
+    queue->port = port;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->busy = false;
+}
+
+/*
+ * Queues a frame and starts sending it if the transmitter is idle.
+ * Returns false, without queueing, if the queue is full.
+ */
+bool modbus_tx_queue_send(MODBUS_TX_QUEUE * queue, uint8_t const * data, uint16_t length, MODBUS_TX_COMPLETE on_complete, void * context)
+{
+    if (!queue) { return false; }
+
+    uint8_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    uint8_t next = tx_queue_next(head);
+
+    if (next == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) { return false; }
+
+    MODBUS_TX_FRAME& frame = queue->frames[head];
+    frame.data = data;
+    frame.length = length;
+    frame.on_complete = on_complete;
+    frame.context = context;
+    __atomic_store_n(&queue->head, next, __ATOMIC_RELEASE);
+
+    try_start_tx(queue);
+
+    return true;
+}
+
+/*
+ * Call from the transmit complete interrupt of the frame in flight.
+ */
+void modbus_tx_queue_complete(MODBUS_TX_QUEUE * queue)
+{
+    if (!queue) { return; }
+
+    if (queue->set_driver_enable) { queue->set_driver_enable(queue->port, false); }
+
+    uint8_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    MODBUS_TX_FRAME frame = queue->frames[tail];
+    __atomic_store_n(&queue->tail, tx_queue_next(tail), __ATOMIC_RELEASE);
+
+    if (frame.on_complete) { frame.on_complete(frame.context, frame.data, frame.length); }
+
+    /* Keep the transmitter if there is more to send, otherwise release it */
+    if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&queue->tail, __ATOMIC_RELAXED))
+    {
+        start_tx_frame(queue);
+        return;
+    }
+
+    __atomic_store_n(&queue->busy, false, __ATOMIC_RELEASE);
+}
+
+uint8_t modbus_tx_queue_count(MODBUS_TX_QUEUE const * queue)
+{
+    uint8_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    uint8_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    return (head + MODBUS_TX_QUEUE_SIZE - tail) % MODBUS_TX_QUEUE_SIZE;
+}
+
+bool modbus_tx_queue_idle(MODBUS_TX_QUEUE const * queue)
+{
+    return !__atomic_load_n(&queue->busy, __ATOMIC_ACQUIRE);
+}
+
+void modbus_response_cache_init(MODBUS_RESPONSE_CACHE * cache, uint32_t window)
+{
+    if (!cache) { return; }
+
+    cache->window = window;
+    modbus_response_cache_clear(cache);
+}
+
+/*
+ * If request is a retry of the cached request, points response at the cached
+ * response and returns its length. Returns 0 if the request must be serviced.
+ * now is in the same ticks as the window and may wrap.
+ */
+int modbus_response_cache_find(MODBUS_RESPONSE_CACHE const * cache, uint8_t const * request, int request_length, uint32_t now, uint8_t const ** response)
+{
+    if (!cache->valid || (request_length != cache->request_length)) { return 0; }
+    if ((uint32_t)(now - cache->stored_at) >= cache->window) { return 0; }
+    if (get_frame_crc(request, request_length) != cache->request_crc) { return 0; }
+    if (get_request_hash(request, request_length) != cache->request_hash) { return 0; }
+
+    *response = cache->response;
+    return cache->response_length;
+}
+
+/*
+ * Records the response just sent for request. Returns false, leaving the cache
+ * empty, if the request is not cached (a read, a broadcast, a frame too short to
+ * carry a CRC, or too long a response), so a later retry of an older write is not answered with a stale response.
+ */
+bool modbus_response_cache_store(MODBUS_RESPONSE_CACHE * cache, uint8_t const * request, int request_length, uint8_t const * response, int response_length, uint32_t now)
+{
+    modbus_response_cache_clear(cache);
+
+    if (request_length < 4) { return false; }
+    if ((response_length <= 0) || (response_length > MODBUS_RESPONSE_CACHE_SIZE)) { return false; }
+    if ((get_message_address(request) == MODBUS_BROADCAST_ADDRESS) || !has_side_effects(request[1])) { return false; }
+
+    memcpy(cache->response, response, response_length);
+    cache->response_length = response_length;
+    cache->request_length = request_length;
+    cache->request_hash = get_request_hash(request, request_length);
+    cache->request_crc = get_frame_crc(request, request_length);
+    cache->stored_at = now;
+    cache->valid = true;
+
+    return true;
+}
+
+void modbus_response_cache_clear(MODBUS_RESPONSE_CACHE * cache)
+{
+    cache->valid = false;
+}
+
+#if MODBUS_ENABLE_FC_DIAGNOSTICS
+
+MODBUS_EXCEPTION_CODES modbus_get_diagnostics_data(uint16_t sub_function, uint16_t query_data, uint16_t * response_data)
+{
+    *response_data = 0x0000;
+
+    if (sub_function == DIAGNOSTICS_RETURN_QUERY_DATA)
+    {
+        *response_data = query_data;
+    }
+    else if (sub_function == DIAGNOSTICS_CLEAR_COUNTERS)
+    {
+        if (query_data != 0x0000) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+        modbus_clear_diagnostic_counters();
+    }
+    else
+    {
+        if (!get_diagnostic_counter(sub_function, response_data)) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+        if (query_data != 0x0000) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+    }
+
+    return EXCEPTION_NONE;
+}
+
+#endif
+
+void modbus_get_diagnostic_counters(MODBUS_DIAGNOSTIC_COUNTERS * counters)
+{
+    if (!counters) { return; }
+
+    *counters = s_diagnostic_counters;
+}
+
+void modbus_clear_diagnostic_counters()
+{
+    s_diagnostic_counters.bus_message = 0;
+    s_diagnostic_counters.bus_communication_error = 0;
+    s_diagnostic_counters.slave_exception_error = 0;
+    s_diagnostic_counters.slave_message = 0;
+    s_diagnostic_counters.slave_no_response = 0;
+}
+
+#ifdef MODBUS_ENABLE_STATISTICS
+
+int modbus_get_statistics_function_code_index(MODBUS_FUNCTION_CODE function_code)
+{
+    switch(function_code)
+    {
+    case READ_COILS: return 0;
+    case READ_DISCRETE_INPUTS: return 1;
+    case WRITE_SINGLE_COIL: return 2;
+    case WRITE_MULTIPLE_COILS: return 3;
+    case READ_INPUT_REGISTERS: return 4;
+    case READ_HOLDING_REGISTERS: return 5;
+    case WRITE_HOLDING_REGISTER: return 6;
+    case WRITE_HOLDING_REGISTERS: return 7;
+    case READ_WRITE_REGISTERS: return 8;
+    case MASK_WRITE_REGISTER: return 9;
+    case DIAGNOSTICS: return 10;
+    case READ_FIFO_QUEUE: return 11;
+    case READ_FILE_RECORD: return 12;
+    case WRITE_FILE_RECORD: return 13;
+    default: return -1;
+    }
+}
+
+void modbus_get_statistics(MODBUS_STATISTICS * statistics)
+{
+    if (!statistics) { return; }
+
+    uint32_t const * source = (uint32_t const *)&s_statistics;
+    uint32_t * destination = (uint32_t *)statistics;
+
+    for (unsigned int i = 0; i < (sizeof(MODBUS_STATISTICS) / sizeof(uint32_t)); i++)
+    {
+        destination[i] = __atomic_load_n(&source[i], __ATOMIC_RELAXED);
+    }
+}
+
+void modbus_clear_statistics()
+{
+    uint32_t * counters = (uint32_t *)&s_statistics;
+
+    for (unsigned int i = 0; i < (sizeof(MODBUS_STATISTICS) / sizeof(uint32_t)); i++)
+    {
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+#endif
+
+int modbus_start_response(uint8_t * const buffer, MODBUS_FUNCTION_CODE function_code, uint8_t device_address)
+{
+    if (!buffer) { return 0;}
+
+    buffer[0] = device_address;
+    buffer[1] = (uint8_t)function_code;
+
+    return 2;
+}
+
+int modbus_write(uint8_t * const buffer, int8_t value)
 {
     if (!buffer) { return 0;}
 
@@ -543,7 +1746,7 @@ int modbus_write(uint8_t * const buffer, int16_t value)
     return 2;
 }
 
-int modbus_write_crc(uint8_t * const buffer, uint8_t bytes, bool reverse_order)
+int modbus_write_crc(uint8_t * const buffer, uint16_t bytes, bool reverse_order)
 {
     uint16_t crc = modbus_get_crc16(buffer, bytes);
     uint8_t * crc_bytes = (uint8_t *)&crc;
@@ -552,113 +1755,456 @@ int modbus_write_crc(uint8_t * const buffer, uint8_t bytes, bool reverse_order)
     return 2;
 }
 
+#if MODBUS_ENABLE_FC_READ_BITS
+
 int modbus_write_read_discrete_inputs_response(uint8_t source_address, uint8_t * buffer, bool * discrete_inputs, uint8_t n_inputs, bool add_crc)
 {
-    int count = 0;
-    count += modbus_start_response(&buffer[count], READ_DISCRETE_INPUTS, source_address);
-    count += modbus_write_read_discrete_inputs_response_data_bytes(&buffer[count], discrete_inputs, n_inputs);
-    
-    if (add_crc)
+    frame_writer writer = start_frame(buffer, source_address, READ_DISCRETE_INPUTS, add_crc);
+    put_byte(writer, (uint8_t)get_number_of_required_bytes_for_number_of_bits(n_inputs));
+    put_bits(writer, discrete_inputs, n_inputs);
+
+    return end_frame(writer);
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_READ_INPUT_REGISTERS
+
+int modbus_write_read_input_registers_response(uint8_t source_address, uint8_t * buffer, int16_t * input_registers, uint8_t n_registers, bool add_crc)
+{
+    frame_writer writer = start_frame(buffer, source_address, READ_INPUT_REGISTERS, add_crc);
+    put_byte(writer, (uint8_t)(n_registers*2));
+
+    for (int i = 0; i < n_registers; i++)
     {
-        count += modbus_write_crc(buffer, count);
+        put_uint16(writer, (uint16_t)input_registers[i]);
     }
-    
-    return count;
+
+    return end_frame(writer);
 }
 
-int modbus_write_read_input_registers_response(uint8_t source_address, uint8_t * buffer, int16_t * input_registers, uint8_t n_registers, bool add_crc)
+#endif
+
+#if MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS
+
+int modbus_write_read_holding_registers_response(uint8_t source_address, uint8_t * buffer, int16_t * holding_registers, uint8_t n_registers, bool add_crc)
 {
-    int count = 0;
-    count += modbus_start_response(&buffer[count], READ_INPUT_REGISTERS, source_address);
-    count += modbus_write(&buffer[count], (int8_t)(n_registers*2));
-    
+    frame_writer writer = start_frame(buffer, source_address, READ_HOLDING_REGISTERS, add_crc);
+    put_byte(writer, (uint8_t)(n_registers*2));
+
     for (int i = 0; i < n_registers; i++)
     {
-        count += modbus_write(&buffer[count], (int16_t)input_registers[i]);
+        put_uint16(writer, (uint16_t)holding_registers[i]);
     }
 
-    if (add_crc)
+    return end_frame(writer);
+}
+
+#endif
+
+template <typename T>
+int modbus_write_values(uint8_t * const buffer, T const * values, uint8_t n_values, MODBUS_WORD_ORDER order)
+{
+    if (!buffer) { return 0;}
+
+    switch (order)
     {
-        count += modbus_write_crc(buffer, count);
+    case WORD_ORDER_CDAB: write_values<T, WORD_ORDER_CDAB>(buffer, values, n_values); break;
+    case WORD_ORDER_BADC: write_values<T, WORD_ORDER_BADC>(buffer, values, n_values); break;
+    case WORD_ORDER_DCBA: write_values<T, WORD_ORDER_DCBA>(buffer, values, n_values); break;
+    default: write_values<T, WORD_ORDER_ABCD>(buffer, values, n_values); break;
     }
 
-    return count;
+    return n_values * sizeof(T);
 }
 
-int modbus_write_read_holding_registers_response(uint8_t source_address, uint8_t * buffer, int16_t * holding_registers, uint8_t n_registers, bool add_crc)
+template <typename T>
+int modbus_read_values(uint8_t const * const buffer, T * values, uint8_t n_values, MODBUS_WORD_ORDER order)
 {
-    int count = 0;
-    count += modbus_start_response(&buffer[count], READ_HOLDING_REGISTERS, source_address);
-    count += modbus_write(&buffer[count], (int8_t)(n_registers*2));
-    
-    for (int i = 0; i < n_registers; i++)
+    if (!buffer) { return 0;}
+
+    switch (order)
     {
-        count += modbus_write(&buffer[count], (int16_t)holding_registers[i]);
+    case WORD_ORDER_CDAB: read_values<T, WORD_ORDER_CDAB>(buffer, values, n_values); break;
+    case WORD_ORDER_BADC: read_values<T, WORD_ORDER_BADC>(buffer, values, n_values); break;
+    case WORD_ORDER_DCBA: read_values<T, WORD_ORDER_DCBA>(buffer, values, n_values); break;
+    default: read_values<T, WORD_ORDER_ABCD>(buffer, values, n_values); break;
     }
 
-    if (add_crc)
+    return n_values * sizeof(T);
+}
+
+template <typename T>
+void modbus_values_to_registers(int16_t * registers, T const * values, uint8_t n_values, MODBUS_WORD_ORDER order)
+{
+    switch (order)
     {
-        count += modbus_write_crc(buffer, count);
+    case WORD_ORDER_CDAB: values_to_registers<T, WORD_ORDER_CDAB>(registers, values, n_values); break;
+    case WORD_ORDER_BADC: values_to_registers<T, WORD_ORDER_BADC>(registers, values, n_values); break;
+    case WORD_ORDER_DCBA: values_to_registers<T, WORD_ORDER_DCBA>(registers, values, n_values); break;
+    default: values_to_registers<T, WORD_ORDER_ABCD>(registers, values, n_values); break;
     }
+}
 
-    return count;
+template <typename T>
+void modbus_registers_to_values(T * values, int16_t const * registers, uint8_t n_values, MODBUS_WORD_ORDER order)
+{
+    switch (order)
+    {
+    case WORD_ORDER_CDAB: registers_to_values<T, WORD_ORDER_CDAB>(values, registers, n_values); break;
+    case WORD_ORDER_BADC: registers_to_values<T, WORD_ORDER_BADC>(values, registers, n_values); break;
+    case WORD_ORDER_DCBA: registers_to_values<T, WORD_ORDER_DCBA>(values, registers, n_values); break;
+    default: registers_to_values<T, WORD_ORDER_ABCD>(values, registers, n_values); break;
+    }
 }
 
-int modbus_get_write_single_coil_response(uint8_t source_address, uint8_t * buffer, uint16_t coil, bool on, bool add_crc)
+/* A read registers response carries at most 125 registers */
+static const unsigned int MAX_READ_REGISTERS_BYTE_COUNT = 250;
+
+/* Converts a value at a time and CRCs its bytes while they are still in registers */
+template <typename T, MODBUS_WORD_ORDER ORDER>
+static void put_values(frame_writer& writer, T const * values, uint8_t n_values)
 {
-    int count = 0;
-    count += modbus_start_response(&buffer[count], WRITE_SINGLE_COIL, source_address);
-    count += modbus_write(&buffer[count], (int16_t)coil);
-    count += modbus_write(&buffer[count], on ? (int16_t)0xFF00 : (int16_t)0x0000);
+    uint8_t value_bytes[sizeof(T)];
+    for (int i = 0; i < n_values; i++)
+    {
+        write_values<T, ORDER>(value_bytes, &values[i], 1);
+        put_bytes(writer, value_bytes, sizeof(T));
+    }
+}
 
-    if (add_crc)
+template <typename T>
+static void put_values(frame_writer& writer, T const * values, uint8_t n_values, MODBUS_WORD_ORDER order)
+{
+    switch (order)
     {
-        count += modbus_write_crc(buffer, count);
+    case WORD_ORDER_CDAB: put_values<T, WORD_ORDER_CDAB>(writer, values, n_values); break;
+    case WORD_ORDER_BADC: put_values<T, WORD_ORDER_BADC>(writer, values, n_values); break;
+    case WORD_ORDER_DCBA: put_values<T, WORD_ORDER_DCBA>(writer, values, n_values); break;
+    default: put_values<T, WORD_ORDER_ABCD>(writer, values, n_values); break;
     }
+}
 
-    return count;
+#if MODBUS_ENABLE_FC_READ_INPUT_REGISTERS
+
+template <typename T>
+int modbus_write_read_input_registers_response(uint8_t source_address, uint8_t * buffer, T const * values, uint8_t n_values, MODBUS_WORD_ORDER order, bool add_crc)
+{
+    if ((n_values * sizeof(T)) > MAX_READ_REGISTERS_BYTE_COUNT) { return 0; }
+
+    frame_writer writer = start_frame(buffer, source_address, READ_INPUT_REGISTERS, add_crc);
+    put_byte(writer, (uint8_t)(n_values*sizeof(T)));
+
+    put_values(writer, values, n_values, order);
+
+    return end_frame(writer);
 }
 
-int modbus_get_write_holding_register_response(uint8_t source_address, uint8_t * buffer, uint16_t reg, int16_t value, bool add_crc)
+#endif
+
+#if MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS
+
+template <typename T>
+int modbus_write_read_holding_registers_response(uint8_t source_address, uint8_t * buffer, T const * values, uint8_t n_values, MODBUS_WORD_ORDER order, bool add_crc)
 {
-    int count = 0;
-    count += modbus_start_response(&buffer[count], WRITE_HOLDING_REGISTER, source_address);
-    count += modbus_write(&buffer[count], (int16_t)reg);
-    count += modbus_write(&buffer[count], (int16_t)value);
+    if ((n_values * sizeof(T)) > MAX_READ_REGISTERS_BYTE_COUNT) { return 0; }
+
+    frame_writer writer = start_frame(buffer, source_address, READ_HOLDING_REGISTERS, add_crc);
+    put_byte(writer, (uint8_t)(n_values*sizeof(T)));
+
+    put_values(writer, values, n_values, order);
+
+    return end_frame(writer);
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_READ_INPUT_REGISTERS
+#define MODBUS_INSTANTIATE_INPUT_REGISTER_VALUES(T) \
+    template int modbus_write_read_input_registers_response<T>(uint8_t, uint8_t *, T const *, uint8_t, MODBUS_WORD_ORDER, bool);
+#else
+#define MODBUS_INSTANTIATE_INPUT_REGISTER_VALUES(T)
+#endif
+
+#if MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS
+#define MODBUS_INSTANTIATE_HOLDING_REGISTER_VALUES(T) \
+    template int modbus_write_read_holding_registers_response<T>(uint8_t, uint8_t *, T const *, uint8_t, MODBUS_WORD_ORDER, bool);
+#else
+#define MODBUS_INSTANTIATE_HOLDING_REGISTER_VALUES(T)
+#endif
+
+#define MODBUS_INSTANTIATE_VALUE_FUNCTIONS(T) \
+    template int modbus_write_values<T>(uint8_t * const, T const *, uint8_t, MODBUS_WORD_ORDER); \
+    template int modbus_read_values<T>(uint8_t const * const, T *, uint8_t, MODBUS_WORD_ORDER); \
+    template void modbus_values_to_registers<T>(int16_t *, T const *, uint8_t, MODBUS_WORD_ORDER); \
+    template void modbus_registers_to_values<T>(T *, int16_t const *, uint8_t, MODBUS_WORD_ORDER); \
+    MODBUS_INSTANTIATE_INPUT_REGISTER_VALUES(T) \
+    MODBUS_INSTANTIATE_HOLDING_REGISTER_VALUES(T)
+
+MODBUS_INSTANTIATE_VALUE_FUNCTIONS(float)
+MODBUS_INSTANTIATE_VALUE_FUNCTIONS(double)
+MODBUS_INSTANTIATE_VALUE_FUNCTIONS(int32_t)
+MODBUS_INSTANTIATE_VALUE_FUNCTIONS(uint32_t)
+MODBUS_INSTANTIATE_VALUE_FUNCTIONS(int64_t)
+MODBUS_INSTANTIATE_VALUE_FUNCTIONS(uint64_t)
+
+#if MODBUS_ENABLE_FC_READ_REGISTERS
+
+static int get_read_registers_response_segments(MODBUS_FUNCTION_CODE function_code, uint8_t source_address, MODBUS_RESPONSE_SEGMENTS * response, uint8_t const * wire_registers, uint8_t n_registers, bool add_crc)
+{
+    if (!response) { return 0; }
+
+    uint8_t * header = &response->header[MODBUS_MBAP_HEADER_SIZE - 1];
+    int header_length = modbus_start_response(header, function_code, source_address);
+    header_length += modbus_write(&header[header_length], (int8_t)(n_registers*2));
+
+    response->n_segments = 0;
+    response->segments[response->n_segments].data = header;
+    response->segments[response->n_segments++].length = header_length;
+
+    if (n_registers)
+    {
+        response->segments[response->n_segments].data = wire_registers;
+        response->segments[response->n_segments++].length = n_registers * 2;
+    }
 
     if (add_crc)
     {
-        count += modbus_write_crc(buffer, count);
+        uint16_t crc = modbus_update_crc16(MODBUS_CRC16_INIT, header, header_length);
+        crc = modbus_update_crc16(crc, wire_registers, n_registers * 2);
+        response->crc[0] = (uint8_t)(crc & 0xFF);
+        response->crc[1] = (uint8_t)(crc >> 8);
+        response->segments[response->n_segments].data = response->crc;
+        response->segments[response->n_segments++].length = 2;
     }
 
-    return count;
+    return modbus_get_segments_length(response->segments, response->n_segments);
 }
 
-int modbus_get_write_holding_registers_response(uint8_t source_address, uint8_t * buffer, uint16_t reg, uint16_t n_registers, bool add_crc)
+#endif
+
+#if MODBUS_ENABLE_FC_READ_INPUT_REGISTERS
+
+int modbus_get_read_input_registers_response_segments(uint8_t source_address, MODBUS_RESPONSE_SEGMENTS * response, uint8_t const * wire_registers, uint8_t n_registers, bool add_crc)
+{
+    return get_read_registers_response_segments(READ_INPUT_REGISTERS, source_address, response, wire_registers, n_registers, add_crc);
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS
+
+int modbus_get_read_holding_registers_response_segments(uint8_t source_address, MODBUS_RESPONSE_SEGMENTS * response, uint8_t const * wire_registers, uint8_t n_registers, bool add_crc)
+{
+    return get_read_registers_response_segments(READ_HOLDING_REGISTERS, source_address, response, wire_registers, n_registers, add_crc);
+}
+
+#endif
+
+/*
+ * Turns a response built by one of the _segments builders into a Modbus TCP ADU:
+ * the MBAP header is written in front of the unit id and any CRC segment is dropped.
+ * Returns the new total length.
+ */
+int modbus_set_mbap_header(MODBUS_RESPONSE_SEGMENTS * response, uint16_t transaction_id)
+{
+    if (!response || (response->n_segments == 0)) { return 0; }
+
+    if (response->segments[response->n_segments-1].data == response->crc)
+    {
+        response->n_segments--;
+    }
+
+    if (response->segments[0].data != response->header)
+    {
+        response->segments[0].data = response->header;
+        response->segments[0].length += MODBUS_MBAP_HEADER_SIZE - 1;
+    }
+
+    int length = modbus_get_segments_length(response->segments, response->n_segments);
+    uint8_t unit_id = response->header[MODBUS_MBAP_HEADER_SIZE - 1];
+    modbus_write_mbap_header(response->header, transaction_id, length - MODBUS_MBAP_HEADER_SIZE, unit_id);
+
+    return length;
+}
+
+int modbus_get_segments_length(MODBUS_SEGMENT const * segments, uint8_t n_segments)
+{
+    int length = 0;
+
+    for (int i = 0; i < n_segments; i++)
+    {
+        length += segments[i].length;
+    }
+
+    return length;
+}
+
+int modbus_copy_segments(uint8_t * buffer, MODBUS_SEGMENT const * segments, uint8_t n_segments)
 {
+    if (!buffer) { return 0; }
+
     int count = 0;
-    count += modbus_start_response(&buffer[count], WRITE_HOLDING_REGISTERS, source_address);
-    count += modbus_write(&buffer[count], (int16_t)reg);
-    count += modbus_write(&buffer[count], (int16_t)n_registers);
 
-    if (add_crc)
+    for (int i = 0; i < n_segments; i++)
     {
-        count += modbus_write_crc(buffer, count);
+        memcpy(&buffer[count], segments[i].data, segments[i].length);
+        count += segments[i].length;
     }
 
     return count;
 }
 
-int modbus_write_exception(uint8_t source_address, uint8_t * const buffer, MODBUS_EXCEPTION_CODES exception_code, uint8_t modified_function_code, bool add_crc)
+/*
+ * Writes the 7 byte MBAP header (transaction id, protocol id 0, length and unit id)
+ * for a PDU of pdu_length bytes (function code and data).
+ */
+int modbus_write_mbap_header(uint8_t * const buffer, uint16_t transaction_id, uint16_t pdu_length, uint8_t unit_id)
 {
+    if (!buffer) { return 0;}
+
     int count = 0;
-    count += modbus_start_response(&buffer[count], (MODBUS_FUNCTION_CODE)modified_function_code, source_address);
-    count += modbus_write(&buffer[count], (int8_t)exception_code);
+    count += modbus_write(&buffer[count], (int16_t)transaction_id);
+    count += modbus_write(&buffer[count], (int16_t)0);
+    count += modbus_write(&buffer[count], (int16_t)(pdu_length + 1));
+    count += modbus_write(&buffer[count], (int8_t)unit_id);
 
-    if (add_crc)
+    return count;
+}
+
+#if MODBUS_ENABLE_FC_WRITE_SINGLE_COIL
+
+int modbus_get_write_single_coil_response(uint8_t source_address, uint8_t * buffer, uint16_t coil, bool on, bool add_crc)
+{
+    frame_writer writer = start_frame(buffer, source_address, WRITE_SINGLE_COIL, add_crc);
+    put_uint16(writer, coil);
+    put_uint16(writer, on ? 0xFF00 : 0x0000);
+
+    return end_frame(writer);
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTER
+
+int modbus_get_write_holding_register_response(uint8_t source_address, uint8_t * buffer, uint16_t reg, int16_t value, bool add_crc)
+{
+    frame_writer writer = start_frame(buffer, source_address, WRITE_HOLDING_REGISTER, add_crc);
+    put_uint16(writer, reg);
+    put_uint16(writer, (uint16_t)value);
+
+    return end_frame(writer);
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTERS
+
+int modbus_get_write_holding_registers_response(uint8_t source_address, uint8_t * buffer, uint16_t reg, uint16_t n_registers, bool add_crc)
+{
+    frame_writer writer = start_frame(buffer, source_address, WRITE_HOLDING_REGISTERS, add_crc);
+    put_uint16(writer, reg);
+    put_uint16(writer, n_registers);
+
+    return end_frame(writer);
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_DIAGNOSTICS
+
+int modbus_get_diagnostics_response(uint8_t source_address, uint8_t * buffer, uint16_t sub_function, uint16_t data, bool add_crc)
+{
+    frame_writer writer = start_frame(buffer, source_address, DIAGNOSTICS, add_crc);
+    put_uint16(writer, sub_function);
+    put_uint16(writer, data);
+
+    return end_frame(writer);
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_READ_FIFO_QUEUE
+
+int modbus_write_read_fifo_queue_response(uint8_t source_address, uint8_t * buffer, MODBUS_FIFO * fifo, bool add_crc)
+{
+    uint8_t head = __atomic_load_n(&fifo->head, __ATOMIC_ACQUIRE);
+    uint8_t tail = __atomic_load_n(&fifo->tail, __ATOMIC_RELAXED);
+    uint8_t fifo_count = (head - tail) & (MODBUS_FIFO_SIZE - 1);
+
+    frame_writer writer = start_frame(buffer, source_address, READ_FIFO_QUEUE, add_crc);
+    put_uint16(writer, 2 + (fifo_count * 2));
+    put_uint16(writer, fifo_count);
+
+    /* Drain straight from the ring into the frame, then release the slots to the producer */
+    while (tail != head)
     {
-        count += modbus_write_crc(buffer, count);
+        put_uint16(writer, (uint16_t)fifo->values[tail]);
+        tail = fifo_next(tail);
     }
+    __atomic_store_n(&fifo->tail, tail, __ATOMIC_RELEASE);
 
-    return count;
+    return end_frame(writer);
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_READ_FILE_RECORD
+
+int modbus_write_read_file_record_response(uint8_t source_address, uint8_t * buffer, MODBUS_FILE const * files, uint8_t num_files, uint8_t const * request, uint8_t request_length, bool add_crc)
+{
+    struct file_record_sub_request sub_request;
+    uint8_t offset;
+
+    /* The response length comes first, so size the records before copying them */
+    int response_length = 0;
+    for (offset = 0; (offset + FILE_RECORD_SUB_REQUEST_HEADER_LENGTH) <= request_length; offset += FILE_RECORD_SUB_REQUEST_HEADER_LENGTH)
+    {
+        get_file_record_sub_request(request + offset, &sub_request);
+        if (modbus_find_file(files, num_files, sub_request.file_number))
+        {
+            response_length += 2 + (sub_request.record_length * 2);
+        }
+    }
+
+    frame_writer writer = start_frame(buffer, source_address, READ_FILE_RECORD, add_crc);
+    put_byte(writer, (uint8_t)response_length);
+
+    for (offset = 0; (offset + FILE_RECORD_SUB_REQUEST_HEADER_LENGTH) <= request_length; offset += FILE_RECORD_SUB_REQUEST_HEADER_LENGTH)
+    {
+        get_file_record_sub_request(request + offset, &sub_request);
+
+        MODBUS_FILE const * file = modbus_find_file(files, num_files, sub_request.file_number);
+        if (!file) { continue; }
+
+        uint16_t n_bytes = sub_request.record_length * 2;
+        put_byte(writer, (uint8_t)(n_bytes + 1));
+        put_byte(writer, MODBUS_FILE_RECORD_REFERENCE_TYPE);
+        put_bytes(writer, file->records + (sub_request.record_number * 2), n_bytes);
+    }
+
+    return end_frame(writer);
+}
+
+#endif
+
+#if MODBUS_ENABLE_FC_WRITE_FILE_RECORD
+
+int modbus_get_write_file_record_response(uint8_t source_address, uint8_t * buffer, uint8_t const * request, uint8_t request_length, bool add_crc)
+{
+    frame_writer writer = start_frame(buffer, source_address, WRITE_FILE_RECORD, add_crc);
+    put_byte(writer, request_length);
+    put_bytes(writer, request, request_length);
+
+    return end_frame(writer);
+}
+
+#endif
+
+int modbus_write_exception(uint8_t source_address, uint8_t * const buffer, MODBUS_EXCEPTION_CODES exception_code, uint8_t modified_function_code, bool add_crc)
+{
+    frame_writer writer = start_frame(buffer, source_address, modified_function_code, add_crc);
+    put_byte(writer, (uint8_t)exception_code);
+
+    return end_frame(writer);
 }
@@ -1,6 +1,28 @@
 #ifndef _MODBUS_H_
 #define _MODBUS_H_
 
+/*
+ * Placement of constant tables in program memory.
+ * On AVR, const data is copied into RAM at startup unless it is placed in flash
+ * with PROGMEM and read back with the pgm_read functions. Elsewhere const data
+ * already stays in flash (.rodata), so MODBUS_ROM is empty and the reads are plain
+ * loads. Ports with other program memory schemes can define all three macros
+ * themselves.
+ */
+#ifndef MODBUS_ROM
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define MODBUS_ROM PROGMEM
+#define MODBUS_ROM_READ_WORD(address) pgm_read_word(address)
+#define MODBUS_ROM_COPY(destination, source, size) memcpy_P(destination, source, size)
+#else
+#include <string.h>
+#define MODBUS_ROM
+#define MODBUS_ROM_READ_WORD(address) (*(address))
+#define MODBUS_ROM_COPY(destination, source, size) memcpy(destination, source, size)
+#endif
+#endif
+
 static const uint8_t MODBUS_BROADCAST_ADDRESS = 0x00;
 
 enum modbus_function_code
@@ -8,16 +30,94 @@ enum modbus_function_code
 	READ_COILS = 1,
 	READ_DISCRETE_INPUTS = 2,
 	WRITE_SINGLE_COIL = 5,
+	DIAGNOSTICS = 8,
 	WRITE_MULTIPLE_COILS = 15,
 	READ_INPUT_REGISTERS = 4,
 	READ_HOLDING_REGISTERS = 3,
 	WRITE_HOLDING_REGISTER = 6,
 	WRITE_HOLDING_REGISTERS = 16,
 	READ_WRITE_REGISTERS = 23,
-	MASK_WRITE_REGISTER = 22
+	MASK_WRITE_REGISTER = 22,
+	READ_FIFO_QUEUE = 24,
+	READ_FILE_RECORD = 20,
+	WRITE_FILE_RECORD = 21
 };
 typedef enum modbus_function_code MODBUS_FUNCTION_CODE;
 
+/*
+ * Function codes built into the slave. Each MODBUS_ENABLE_FC_x defaults to
+ * MODBUS_ENABLE_FC_DEFAULT, which is 1, so everything is built unless told otherwise.
+ * A slave that only reads and writes holding registers can build with
+ *
+ *   -DMODBUS_ENABLE_FC_DEFAULT=0 -DMODBUS_ENABLE_FC_READ_HOLDING_REGISTERS=1 -DMODBUS_ENABLE_FC_WRITE_HOLDING_REGISTER=1
+ *
+ * Disabled function codes are answered with EXCEPTION_ILLEGAL_FUNCTION_CODE. Their
+ * decoding, validation and response builders are compiled out, and the builders
+ * are not declared. Use the same settings for modbus.cpp and for every file that
+ * includes the library headers. Master side request builders are always built.
+ */
+#ifndef MODBUS_ENABLE_FC_DEFAULT
+#define MODBUS_ENABLE_FC_DEFAULT 1
+#endif
+#ifndef MODBUS_ENABLE_FC_READ_COILS
+#define MODBUS_ENABLE_FC_READ_COILS MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_READ_DISCRETE_INPUTS
+#define MODBUS_ENABLE_FC_READ_DISCRETE_INPUTS MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_WRITE_SINGLE_COIL
+#define MODBUS_ENABLE_FC_WRITE_SINGLE_COIL MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_WRITE_MULTIPLE_COILS
+#define MODBUS_ENABLE_FC_WRITE_MULTIPLE_COILS MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_READ_INPUT_REGISTERS
+#define MODBUS_ENABLE_FC_READ_INPUT_REGISTERS MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS
+#define MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTER
+#define MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTER MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTERS
+#define MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTERS MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_READ_WRITE_REGISTERS
+#define MODBUS_ENABLE_FC_READ_WRITE_REGISTERS MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_MASK_WRITE_REGISTER
+#define MODBUS_ENABLE_FC_MASK_WRITE_REGISTER MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_DIAGNOSTICS
+#define MODBUS_ENABLE_FC_DIAGNOSTICS MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_READ_FIFO_QUEUE
+#define MODBUS_ENABLE_FC_READ_FIFO_QUEUE MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_READ_FILE_RECORD
+#define MODBUS_ENABLE_FC_READ_FILE_RECORD MODBUS_ENABLE_FC_DEFAULT
+#endif
+#ifndef MODBUS_ENABLE_FC_WRITE_FILE_RECORD
+#define MODBUS_ENABLE_FC_WRITE_FILE_RECORD MODBUS_ENABLE_FC_DEFAULT
+#endif
+
+#define MODBUS_ENABLE_FC_READ_BITS (MODBUS_ENABLE_FC_READ_COILS || MODBUS_ENABLE_FC_READ_DISCRETE_INPUTS)
+#define MODBUS_ENABLE_FC_READ_REGISTERS (MODBUS_ENABLE_FC_READ_INPUT_REGISTERS || MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS)
+#define MODBUS_ENABLE_FC_FILE_RECORDS (MODBUS_ENABLE_FC_READ_FILE_RECORD || MODBUS_ENABLE_FC_WRITE_FILE_RECORD)
+
+enum modbus_diagnostics_sub_function
+{
+	DIAGNOSTICS_RETURN_QUERY_DATA = 0x00,
+	DIAGNOSTICS_CLEAR_COUNTERS = 0x0A,
+	DIAGNOSTICS_RETURN_BUS_MESSAGE_COUNT = 0x0B,
+	DIAGNOSTICS_RETURN_BUS_COMMUNICATION_ERROR_COUNT = 0x0C,
+	DIAGNOSTICS_RETURN_SLAVE_EXCEPTION_ERROR_COUNT = 0x0D,
+	DIAGNOSTICS_RETURN_SLAVE_MESSAGE_COUNT = 0x0E,
+	DIAGNOSTICS_RETURN_SLAVE_NO_RESPONSE_COUNT = 0x0F
+};
+typedef enum modbus_diagnostics_sub_function MODBUS_DIAGNOSTICS_SUB_FUNCTION;
+
 enum modbus_exception_codes
 {
 	EXCEPTION_NONE,
@@ -43,6 +143,33 @@ enum crc_check_state
 };
 typedef enum crc_check_state CRC_CHECK_STATE;
 
+enum modbus_message_state
+{
+	MESSAGE_IGNORED,
+	MESSAGE_CRC_FAILED,
+	MESSAGE_ACCEPTED
+};
+typedef enum modbus_message_state MODBUS_MESSAGE_STATE;
+
+/*
+ * Write request values left in place in the received frame. Registers are big-endian
+ * (wire order) and coils are packed eight to a byte, first coil in the least significant
+ * bit. A view is only valid during the callback it is passed to.
+ */
+struct modbus_register_view
+{
+	uint8_t const * data;
+	uint16_t n_registers;
+};
+typedef struct modbus_register_view MODBUS_REGISTER_VIEW;
+
+struct modbus_coil_view
+{
+	uint8_t const * data;
+	uint16_t n_coils;
+};
+typedef struct modbus_coil_view MODBUS_COIL_VIEW;
+
 struct modbus_handler_functions
 {
 	void (*read_coils)(uint16_t first_coil, uint16_t n_coils);
@@ -57,8 +184,68 @@ struct modbus_handler_functions
 	void (*mask_write_register)(uint16_t reg, uint16_t and_mask, uint16_t or_mask);
 
 	void (*exception_handler)(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code);
+
+	void (*diagnostics)(uint16_t sub_function, uint16_t data);
+	void (*read_fifo_queue)(uint16_t fifo_pointer_address);
+	void (*read_file_record)(uint8_t const * request, uint8_t request_length);
+	void (*write_file_record)(uint8_t const * request, uint8_t request_length);
+
+	/*
+	 * Optional zero-copy forms of write_multiple_coils, write_holding_registers and
+	 * read_write_registers, called instead of them when set. Values are passed as a
+	 * view of the frame, so the matching write buffer in modbus_handler_data is not needed.
+	 */
+	void (*write_multiple_coils_view)(uint16_t first_coil, MODBUS_COIL_VIEW const * values);
+	void (*write_holding_registers_view)(uint16_t first_reg, MODBUS_REGISTER_VIEW const * values);
+	void (*read_write_registers_view)(uint16_t read_start_reg, uint16_t n_registers, uint16_t write_start_reg, MODBUS_REGISTER_VIEW const * values);
 };
 
+/*
+ * A file served by the file record function codes (FC20/FC21).
+ * records points at n_records registers stored in wire (big-endian) order,
+ * e.g. a memory mapped file or a memory mapped flash region, so responses
+ * are copied straight from the store into the frame.
+ */
+#define MODBUS_FILE_RECORD_REFERENCE_TYPE 6
+#define MODBUS_MAX_FILE_RECORD_NUMBER 9999
+
+struct modbus_file
+{
+	uint16_t file_number;
+	uint16_t n_records;
+	uint8_t * records;
+	bool writable;
+};
+typedef struct modbus_file MODBUS_FILE;
+
+/*
+ * A block of addresses in a sparse coil, input or register table.
+ * Range lists are sorted by first address and must not overlap; adjacent
+ * blocks should be merged, as a request must lie within a single range.
+ */
+struct modbus_address_range
+{
+	uint16_t first;
+	uint16_t count;
+};
+typedef struct modbus_address_range MODBUS_ADDRESS_RANGE;
+
+/*
+ * Order of the bytes of a 32 or 64 bit value spread over consecutive registers,
+ * named after where the bytes of 0xAABBCCDD end up on the wire.
+ * ABCD is the Modbus big-endian order, CDAB swaps the registers, BADC swaps the
+ * bytes within each register and DCBA is fully little-endian. 64 bit values
+ * follow the same pattern over four registers.
+ */
+enum modbus_word_order
+{
+	WORD_ORDER_ABCD,
+	WORD_ORDER_CDAB,
+	WORD_ORDER_BADC,
+	WORD_ORDER_DCBA
+};
+typedef enum modbus_word_order MODBUS_WORD_ORDER;
+
 struct modbus_handler_data
 {
 	uint8_t device_address;
@@ -70,8 +257,27 @@ struct modbus_handler_data
 
 	bool * write_multiple_coils;	
 	int16_t * write_holding_registers;
+
+	MODBUS_FILE const * files;
+	uint8_t num_files;
+
+	/* Optional sparse tables, used instead of the num_x counts when not NULL */
+	MODBUS_ADDRESS_RANGE const * coil_ranges;
+	MODBUS_ADDRESS_RANGE const * input_ranges;
+	MODBUS_ADDRESS_RANGE const * input_register_ranges;
+	MODBUS_ADDRESS_RANGE const * holding_register_ranges;
+	uint8_t num_coil_ranges;
+	uint8_t num_input_ranges;
+	uint8_t num_input_register_ranges;
+	uint8_t num_holding_register_ranges;
 };
 
+/*
+ * A handler can live in flash: declare it const MODBUS_ROM and service frames
+ * with modbus_service_rom_message, which reads its function pointers and sizes
+ * from program memory. Its address range tables may be MODBUS_ROM too. Files,
+ * and the write buffers it points to, stay in RAM.
+ */
 struct modbus_handler
 {
 	struct modbus_handler_functions functions;
@@ -80,28 +286,435 @@ struct modbus_handler
 };
 typedef struct modbus_handler MODBUS_HANDLER;
 
+/*
+ * Serial line counters reported through the diagnostics (FC08) function code.
+ * They are 16 bits wide and roll over, as described by the Modbus serial line specification.
+ * bus_communication_error counts CRC failures on every frame seen, whatever its
+ * address, and frames too short for their function code.
+ *
+ * The counters are updated with plain increments, which are not atomic on 8-bit
+ * parts. Screen frames either from the receive interrupt (modbus_defer_message)
+ * or from the main loop (modbus_service_message and friends), not both. When
+ * screening from the interrupt, mask it around modbus_get_diagnostic_counters,
+ * modbus_clear_diagnostic_counters and the servicing of diagnostics requests,
+ * which read and clear the counters from the main loop.
+ */
+struct modbus_diagnostic_counters
+{
+	uint16_t bus_message;
+	uint16_t bus_communication_error;
+	uint16_t slave_exception_error;
+	uint16_t slave_message;
+	uint16_t slave_no_response;
+};
+typedef struct modbus_diagnostic_counters MODBUS_DIAGNOSTIC_COUNTERS;
+
+/*
+ * Lock-free single producer, single consumer register queue for FC24.
+ * The producer (typically an acquisition ISR) only writes head and the
+ * consumer (the FC24 response builder) only writes tail. One slot is kept
+ * free, so a full queue holds MODBUS_MAX_FIFO_COUNT (31) registers, which
+ * is the most a single FC24 response can carry.
+ */
+#define MODBUS_FIFO_SIZE 32
+#define MODBUS_MAX_FIFO_COUNT (MODBUS_FIFO_SIZE - 1)
+
+struct modbus_fifo
+{
+	uint8_t head;
+	uint8_t tail;
+	int16_t values[MODBUS_FIFO_SIZE];
+};
+typedef struct modbus_fifo MODBUS_FIFO;
+
+/*
+ * Non-blocking transmit queue for finished frames (e.g. from the response builders).
+ * The port supplies start_transmit, which starts a DMA or interrupt driven send
+ * and returns at once, and set_driver_enable for the RS-485 DE pin, and calls
+ * modbus_tx_queue_complete from its transmit complete interrupt, i.e. after
+ * the last stop bit. DE is raised just before each frame starts and dropped
+ * first thing on completion, then the frame's completion callback runs (in
+ * interrupt context) and the next queued frame is started. Frames are queued
+ * from the main loop only; buffers must stay valid until their callback.
+ * The busy flag is a plain flag, not an atomic read-modify-write, so mask the
+ * transmit complete interrupt around modbus_tx_queue_send, or call both from
+ * the same context.
+ * Back to back frames are started straight away, so a port that queues more
+ * than one frame at a time should enforce the inter-frame delay in start_transmit.
+ * One slot is kept free, so MODBUS_TX_QUEUE_SIZE - 1 frames can be queued.
+ */
+#ifndef MODBUS_TX_QUEUE_SIZE
+#define MODBUS_TX_QUEUE_SIZE 4
+#endif
+
+typedef void (*MODBUS_TX_START)(void * port, uint8_t const * data, uint16_t length);
+typedef void (*MODBUS_TX_DRIVER_ENABLE)(void * port, bool enable);
+typedef void (*MODBUS_TX_COMPLETE)(void * context, uint8_t const * data, uint16_t length);
+
+struct modbus_tx_frame
+{
+	uint8_t const * data;
+	uint16_t length;
+	MODBUS_TX_COMPLETE on_complete;
+	void * context;
+};
+typedef struct modbus_tx_frame MODBUS_TX_FRAME;
+
+struct modbus_tx_queue
+{
+	MODBUS_TX_START start_transmit;
+	MODBUS_TX_DRIVER_ENABLE set_driver_enable;
+	void * port;
+
+	uint8_t head;
+	uint8_t tail;
+	bool busy;
+	MODBUS_TX_FRAME frames[MODBUS_TX_QUEUE_SIZE];
+};
+typedef struct modbus_tx_queue MODBUS_TX_QUEUE;
+
+/*
+ * Retransmission cache for one unit: a fingerprint of the last write request
+ * (its length, a 32-bit hash and its own CRC) and the encoded response sent for
+ * it. The request itself is not kept, so the cache costs little more than the
+ * response. A request arriving within window ticks of the response whose
+ * length, hash and CRC all match is taken as a retry whose response was lost,
+ * and is answered from the cache instead of being serviced again. Only requests
+ * with side effects (coil, register and file record writes) are cached; reads
+ * are always serviced so polls see fresh data. Writing the same value twice
+ * within the window is indistinguishable from a retry, so keep the window
+ * shorter than the master's poll period. Requests are RTU frames, CRC included.
+ * Responses longer than MODBUS_RESPONSE_CACHE_SIZE are not cached.
+ */
+#ifndef MODBUS_RESPONSE_CACHE_SIZE
+#define MODBUS_RESPONSE_CACHE_SIZE 256
+#endif
+
+struct modbus_response_cache
+{
+	uint32_t window;
+	bool valid;
+	uint32_t stored_at;
+	uint32_t request_hash;
+	uint16_t request_crc;
+	uint16_t request_length;
+	uint16_t response_length;
+	uint8_t response[MODBUS_RESPONSE_CACHE_SIZE];
+};
+typedef struct modbus_response_cache MODBUS_RESPONSE_CACHE;
+
+/*
+ * Scatter-gather response output. A response is described as up to three
+ * segments (header, payload and CRC) that the transport sends in order, e.g.
+ * with writev or a DMA descriptor chain. The payload segment points at the
+ * caller's data, which must already be in wire order and must stay valid
+ * until the response has been sent; only the header and CRC are stored here.
+ * The header has room in front for an MBAP header, so the same response can
+ * be sent over Modbus TCP with modbus_set_mbap_header.
+ */
+#define MODBUS_MBAP_HEADER_SIZE 7
+#define MODBUS_MAX_RESPONSE_SEGMENTS 3
+
+#define MODBUS_CRC16_INIT 0xFFFF
+
+struct modbus_segment
+{
+	uint8_t const * data;
+	uint16_t length;
+};
+typedef struct modbus_segment MODBUS_SEGMENT;
+
+struct modbus_response_segments
+{
+	MODBUS_SEGMENT segments[MODBUS_MAX_RESPONSE_SEGMENTS];
+	uint8_t n_segments;
+	uint8_t header[MODBUS_MBAP_HEADER_SIZE + 2];
+	uint8_t crc[2];
+};
+typedef struct modbus_response_segments MODBUS_RESPONSE_SEGMENTS;
+
+/* Frames modbus_service_messages checks per CRC pass; longer bursts are taken in chunks */
+#ifndef MODBUS_MAX_BATCH_FRAMES
+#define MODBUS_MAX_BATCH_FRAMES 32
+#endif
+
+/*
+ * A received frame and the outcome of servicing it, for modbus_service_messages.
+ * exception is the exception the request was answered with, EXCEPTION_NONE if
+ * it was handled normally, or EXCEPTION_INVALID_CRC for MESSAGE_CRC_FAILED frames.
+ */
+struct modbus_frame
+{
+	uint8_t const * message;
+	int length;
+};
+typedef struct modbus_frame MODBUS_FRAME;
+
+struct modbus_frame_status
+{
+	MODBUS_MESSAGE_STATE state;
+	MODBUS_EXCEPTION_CODES exception;
+};
+typedef struct modbus_frame_status MODBUS_FRAME_STATUS;
+
+/*
+ * A frame received into a ring buffer (e.g. by circular DMA), in place.
+ * segments[0] holds the start of the frame and segments[1] the rest of it
+ * when it wraps past the end of the ring; segments[1].length is 0 otherwise.
+ */
+struct modbus_split_frame
+{
+	MODBUS_SEGMENT segments[2];
+};
+typedef struct modbus_split_frame MODBUS_SPLIT_FRAME;
+
+/*
+ * Deferred servicing. modbus_defer_message is the interrupt safe half: it
+ * filters on address, checks the frame length and CRC, decodes the request
+ * into a MODBUS_REQUEST and pushes it onto a single producer, single consumer
+ * queue. It runs no handlers and leaves the current message alone, but does
+ * update the diagnostic counters (see MODBUS_DIAGNOSTIC_COUNTERS).
+ * modbus_service_deferred_message is the main loop half: it pops a request
+ * and runs its handlers from the decoded fields, without parsing the frame
+ * again. The payload of write requests is read from the frame when the
+ * request runs, so the frame must stay valid until then (e.g. one receive
+ * buffer per queue slot). One slot is kept free, so MODBUS_REQUEST_QUEUE_SIZE - 1
+ * requests can be waiting.
+ *
+ * fields holds the request's 16-bit fields in order: address and quantity (or
+ * value) for most function codes, sub-function and data for diagnostics,
+ * register, AND mask and OR mask for mask write, read address, read quantity,
+ * write address and write quantity for read/write registers.
+ */
+#define MODBUS_REQUEST_FIELDS 4
+
+#ifndef MODBUS_REQUEST_QUEUE_SIZE
+#define MODBUS_REQUEST_QUEUE_SIZE 4
+#endif
+
+struct modbus_request
+{
+	uint8_t const * message;
+	uint16_t message_length;
+	MODBUS_MESSAGE_STATE state;
+	bool broadcast;
+	uint8_t function_code;
+	uint16_t fields[MODBUS_REQUEST_FIELDS];
+	uint8_t byte_count;
+	uint8_t const * payload;
+};
+typedef struct modbus_request MODBUS_REQUEST;
+
+struct modbus_request_queue
+{
+	uint8_t head;
+	uint8_t tail;
+	MODBUS_REQUEST requests[MODBUS_REQUEST_QUEUE_SIZE];
+};
+typedef struct modbus_request_queue MODBUS_REQUEST_QUEUE;
+
+#ifdef MODBUS_ENABLE_STATISTICS
+
+/*
+ * Optional instrumentation of modbus_service_message.
+ * Counters are updated with relaxed atomics, so they can be read from another
+ * thread or interrupt context while messages are being serviced.
+ * Handler times are taken from application_get_ticks() (enabled with
+ * ALLOW_APPLICATION_TICKS) and binned into log2 buckets: bucket 0 holds
+ * zero ticks, bucket n holds [2^(n-1), 2^n) ticks and the last bucket
+ * also holds anything longer.
+ */
+
+#ifndef MODBUS_STATISTICS_HISTOGRAM_BUCKETS
+#define MODBUS_STATISTICS_HISTOGRAM_BUCKETS 16
+#endif
+
+#define MODBUS_STATISTICS_NUM_FUNCTION_CODES 14
+#define MODBUS_STATISTICS_NUM_EXCEPTION_CODES 12
+
+struct modbus_statistics
+{
+	uint32_t frames_seen;
+	uint32_t frames_addressed;
+	uint32_t frames_broadcast;
+	uint32_t crc_failures;
+	uint32_t exceptions[MODBUS_STATISTICS_NUM_EXCEPTION_CODES];
+	uint32_t function_code_frames[MODBUS_STATISTICS_NUM_FUNCTION_CODES];
+	uint32_t handler_time_histogram[MODBUS_STATISTICS_NUM_FUNCTION_CODES][MODBUS_STATISTICS_HISTOGRAM_BUCKETS];
+};
+typedef struct modbus_statistics MODBUS_STATISTICS;
+
+void modbus_get_statistics(MODBUS_STATISTICS * statistics);
+void modbus_clear_statistics();
+int modbus_get_statistics_function_code_index(MODBUS_FUNCTION_CODE function_code);
+
+#endif
+
 void modbus_service_message(uint8_t const * const message, const MODBUS_HANDLER& handler, int message_length, bool check_crc);
+void modbus_service_messages(MODBUS_FRAME const * frames, int count, const MODBUS_HANDLER& handler, MODBUS_FRAME_STATUS * statuses, bool check_crc);
+void modbus_service_rom_message(uint8_t const * const message, MODBUS_HANDLER const * rom_handler, int message_length, bool check_crc);
+
+/*
+ * Services a frame straight out of a receive ring. The CRC and the request are
+ * decoded across the wrap without joining the segments; only file record
+ * requests, whose raw sub-requests are passed to the handler, are copied when
+ * they straddle it. While it is being serviced modbus_get_current_message()
+ * returns segments[0] and modbus_get_current_message_length() the whole length.
+ */
+void modbus_get_ring_frame(uint8_t const * ring, uint16_t ring_size, uint16_t start, uint16_t length, MODBUS_SPLIT_FRAME * frame);
+MODBUS_FRAME_STATUS modbus_service_split_message(MODBUS_SPLIT_FRAME const * frame, const MODBUS_HANDLER& handler, bool check_crc);
+
+void modbus_request_queue_init(MODBUS_REQUEST_QUEUE * queue);
+uint8_t modbus_request_queue_count(MODBUS_REQUEST_QUEUE const * queue);
+MODBUS_MESSAGE_STATE modbus_decode_request(uint8_t const * const message, uint8_t device_address, int message_length, bool check_crc, MODBUS_REQUEST * request);
+bool modbus_defer_message(MODBUS_REQUEST_QUEUE * queue, uint8_t const * const message, uint8_t device_address, int message_length, bool check_crc);
+bool modbus_service_deferred_message(MODBUS_REQUEST_QUEUE * queue, const MODBUS_HANDLER& handler, MODBUS_FRAME_STATUS * status);
+
+/*
+ * Per-message bookkeeping (address filtering, CRC check, counters, statistics and
+ * the current message) used by modbus::Server in modbus_server.h.
+ * Dispatch a message only when modbus_begin_message returns MESSAGE_ACCEPTED,
+ * then call modbus_end_message with the result.
+ */
+MODBUS_MESSAGE_STATE modbus_begin_message(uint8_t const * const message, uint8_t device_address, int message_length, bool check_crc);
+MODBUS_MESSAGE_STATE modbus_begin_split_message(MODBUS_SPLIT_FRAME const * frame, uint8_t device_address, bool check_crc);
+void modbus_begin_request(MODBUS_REQUEST const * request);
+void modbus_end_message(MODBUS_EXCEPTION_CODES exception);
 
 int modbus_start_response(uint8_t * const buffer, MODBUS_FUNCTION_CODE function_code, uint8_t device_address);
 
 int modbus_write(uint8_t * const buffer, int8_t value);
 int modbus_write(uint8_t * const buffer, int16_t value);
-int modbus_write_crc(uint8_t * const buffer, uint8_t bytes, bool reverse_order=false);
+int modbus_write_crc(uint8_t * const buffer, uint16_t bytes, bool reverse_order=false);
+#if MODBUS_ENABLE_FC_READ_BITS
 int modbus_write_read_discrete_inputs_response(uint8_t source_address, uint8_t * buffer, bool * discrete_inputs, uint8_t n_inputs, bool add_crc=true);
+#endif
+#if MODBUS_ENABLE_FC_READ_INPUT_REGISTERS
 int modbus_write_read_input_registers_response(uint8_t source_address, uint8_t * buffer, int16_t * input_registers, uint8_t n_registers, bool add_crc=true);
+#endif
+#if MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS
 int modbus_write_read_holding_registers_response(uint8_t source_address, uint8_t * buffer, int16_t * holding_registers, uint8_t n_registers, bool add_crc=true);
+#endif
+/*
+ * Typed register values. These are instantiated for float, double, int32_t,
+ * uint32_t, int64_t and uint64_t; each value takes sizeof(T) / 2 registers.
+ * modbus_write_values and modbus_read_values convert to and from wire bytes
+ * (e.g. the data of a read registers response), the register functions
+ * convert to and from the int16_t register buffers passed to handlers.
+ * The typed read registers responses return 0, writing nothing, when the
+ * values would take more than the 125 registers a response can carry.
+ */
+template <typename T> int modbus_write_values(uint8_t * const buffer, T const * values, uint8_t n_values, MODBUS_WORD_ORDER order);
+template <typename T> int modbus_read_values(uint8_t const * const buffer, T * values, uint8_t n_values, MODBUS_WORD_ORDER order);
+template <typename T> void modbus_values_to_registers(int16_t * registers, T const * values, uint8_t n_values, MODBUS_WORD_ORDER order);
+template <typename T> void modbus_registers_to_values(T * values, int16_t const * registers, uint8_t n_values, MODBUS_WORD_ORDER order);
+#if MODBUS_ENABLE_FC_READ_INPUT_REGISTERS
+template <typename T> int modbus_write_read_input_registers_response(uint8_t source_address, uint8_t * buffer, T const * values, uint8_t n_values, MODBUS_WORD_ORDER order, bool add_crc=true);
+int modbus_get_read_input_registers_response_segments(uint8_t source_address, MODBUS_RESPONSE_SEGMENTS * response, uint8_t const * wire_registers, uint8_t n_registers, bool add_crc=true);
+#endif
+#if MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS
+template <typename T> int modbus_write_read_holding_registers_response(uint8_t source_address, uint8_t * buffer, T const * values, uint8_t n_values, MODBUS_WORD_ORDER order, bool add_crc=true);
+int modbus_get_read_holding_registers_response_segments(uint8_t source_address, MODBUS_RESPONSE_SEGMENTS * response, uint8_t const * wire_registers, uint8_t n_registers, bool add_crc=true);
+#endif
+int modbus_set_mbap_header(MODBUS_RESPONSE_SEGMENTS * response, uint16_t transaction_id);
+int modbus_get_segments_length(MODBUS_SEGMENT const * segments, uint8_t n_segments);
+int modbus_copy_segments(uint8_t * buffer, MODBUS_SEGMENT const * segments, uint8_t n_segments);
+int modbus_write_mbap_header(uint8_t * const buffer, uint16_t transaction_id, uint16_t pdu_length, uint8_t unit_id);
+#if MODBUS_ENABLE_FC_WRITE_SINGLE_COIL
 int modbus_get_write_single_coil_response(uint8_t source_address, uint8_t * buffer, uint16_t coil, bool on, bool add_crc=true);
+#endif
+#if MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTER
 int modbus_get_write_holding_register_response(uint8_t source_address, uint8_t * buffer, uint16_t reg, int16_t value, bool add_crc=true);
+#endif
+#if MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTERS
 int modbus_get_write_holding_registers_response(uint8_t source_address, uint8_t * buffer, uint16_t reg, uint16_t n_registers, bool add_crc=true);
+#endif
+#if MODBUS_ENABLE_FC_DIAGNOSTICS
+int modbus_get_diagnostics_response(uint8_t source_address, uint8_t * buffer, uint16_t sub_function, uint16_t data, bool add_crc=true);
+#endif
+#if MODBUS_ENABLE_FC_READ_FIFO_QUEUE
+int modbus_write_read_fifo_queue_response(uint8_t source_address, uint8_t * buffer, MODBUS_FIFO * fifo, bool add_crc=true);
+#endif
+#if MODBUS_ENABLE_FC_READ_FILE_RECORD
+int modbus_write_read_file_record_response(uint8_t source_address, uint8_t * buffer, MODBUS_FILE const * files, uint8_t num_files, uint8_t const * request, uint8_t request_length, bool add_crc=true);
+#endif
+#if MODBUS_ENABLE_FC_WRITE_FILE_RECORD
+int modbus_get_write_file_record_response(uint8_t source_address, uint8_t * buffer, uint8_t const * request, uint8_t request_length, bool add_crc=true);
+#endif
 
 int modbus_write_exception(uint8_t source_address, uint8_t * const buffer, MODBUS_EXCEPTION_CODES exception_code, uint8_t modified_function_code, bool add_crc=true);
 
-uint16_t modbus_get_crc16(uint8_t const * const buffer, uint8_t number_of_bytes);
+/*
+ * Master side request builders, following the same conventions as the response builders.
+ */
+int modbus_get_read_coils_request(uint8_t device_address, uint8_t * buffer, uint16_t first_coil, uint16_t n_coils, bool add_crc=true);
+int modbus_get_read_discrete_inputs_request(uint8_t device_address, uint8_t * buffer, uint16_t first_input, uint16_t n_inputs, bool add_crc=true);
+int modbus_get_read_input_registers_request(uint8_t device_address, uint8_t * buffer, uint16_t first_reg, uint16_t n_registers, bool add_crc=true);
+int modbus_get_read_holding_registers_request(uint8_t device_address, uint8_t * buffer, uint16_t first_reg, uint16_t n_registers, bool add_crc=true);
+int modbus_get_write_single_coil_request(uint8_t device_address, uint8_t * buffer, uint16_t coil, bool on, bool add_crc=true);
+int modbus_get_write_holding_register_request(uint8_t device_address, uint8_t * buffer, uint16_t reg, int16_t value, bool add_crc=true);
+int modbus_write_write_multiple_coils_request(uint8_t device_address, uint8_t * buffer, uint16_t first_coil, uint16_t n_coils, bool const * values, bool add_crc=true);
+int modbus_write_write_holding_registers_request(uint8_t device_address, uint8_t * buffer, uint16_t first_reg, uint16_t n_registers, int16_t const * values, bool add_crc=true);
+
+/*
+ * RTU framing: the full length of a request or response frame (including the CRC)
+ * from its first received bytes. Returns 0 while more bytes are needed to tell,
+ * or -1 if the function code is not known.
+ */
+int modbus_get_request_length(uint8_t const * frame, int received);
+int modbus_get_response_length(uint8_t const * frame, int received);
+
+uint16_t modbus_get_crc16(uint8_t const * const buffer, uint16_t number_of_bytes);
+uint16_t modbus_update_crc16(uint16_t crc, uint8_t const * const buffer, uint16_t number_of_bytes);
+
 bool modbus_validate_message_crc(const uint8_t * message, int message_length, bool reverse_order = false);
+void modbus_validate_message_crcs(MODBUS_FRAME const * frames, int count, bool * valid);
+bool modbus_validate_split_message_crc(MODBUS_SPLIT_FRAME const * frame);
 
 uint8_t const * modbus_get_current_message();
 uint8_t modbus_get_current_message_address();
 int modbus_get_current_message_length();
 bool modbus_last_message_was_broadcast();
 
+int modbus_find_address_range(MODBUS_ADDRESS_RANGE const * ranges, uint8_t num_ranges, uint16_t address);
+bool modbus_address_ranges_contain(MODBUS_ADDRESS_RANGE const * ranges, uint8_t num_ranges, uint16_t first, uint16_t n);
+
+int16_t modbus_register_view_get(MODBUS_REGISTER_VIEW const * view, uint16_t index);
+void modbus_register_view_copy(MODBUS_REGISTER_VIEW const * view, int16_t * values);
+bool modbus_coil_view_get(MODBUS_COIL_VIEW const * view, uint16_t index);
+void modbus_coil_view_copy(MODBUS_COIL_VIEW const * view, bool * values);
+
+#if MODBUS_ENABLE_FC_FILE_RECORDS
+MODBUS_FILE const * modbus_find_file(MODBUS_FILE const * files, uint8_t num_files, uint16_t file_number);
+#endif
+#if MODBUS_ENABLE_FC_READ_FILE_RECORD
+MODBUS_EXCEPTION_CODES modbus_check_read_file_record_request(MODBUS_FILE const * files, uint8_t num_files, uint8_t const * request, uint8_t request_length);
+#endif
+#if MODBUS_ENABLE_FC_WRITE_FILE_RECORD
+MODBUS_EXCEPTION_CODES modbus_store_write_file_record_request(MODBUS_FILE const * files, uint8_t num_files, uint8_t const * request, uint8_t request_length);
+#endif
+
+#if MODBUS_ENABLE_FC_READ_FIFO_QUEUE
+void modbus_fifo_init(MODBUS_FIFO * fifo);
+bool modbus_fifo_push(MODBUS_FIFO * fifo, int16_t value);
+uint8_t modbus_fifo_count(MODBUS_FIFO const * fifo);
+#endif
+
+void modbus_tx_queue_init(MODBUS_TX_QUEUE * queue, MODBUS_TX_START start_transmit, MODBUS_TX_DRIVER_ENABLE set_driver_enable, void * port);
+bool modbus_tx_queue_send(MODBUS_TX_QUEUE * queue, uint8_t const * data, uint16_t length, MODBUS_TX_COMPLETE on_complete, void * context);
+void modbus_tx_queue_complete(MODBUS_TX_QUEUE * queue);
+uint8_t modbus_tx_queue_count(MODBUS_TX_QUEUE const * queue);
+bool modbus_tx_queue_idle(MODBUS_TX_QUEUE const * queue);
+
+void modbus_response_cache_init(MODBUS_RESPONSE_CACHE * cache, uint32_t window);
+int modbus_response_cache_find(MODBUS_RESPONSE_CACHE const * cache, uint8_t const * request, int request_length, uint32_t now, uint8_t const ** response);
+bool modbus_response_cache_store(MODBUS_RESPONSE_CACHE * cache, uint8_t const * request, int request_length, uint8_t const * response, int response_length, uint32_t now);
+void modbus_response_cache_clear(MODBUS_RESPONSE_CACHE * cache);
+
+#if MODBUS_ENABLE_FC_DIAGNOSTICS
+MODBUS_EXCEPTION_CODES modbus_get_diagnostics_data(uint16_t sub_function, uint16_t query_data, uint16_t * response_data);
+#endif
+void modbus_get_diagnostic_counters(MODBUS_DIAGNOSTIC_COUNTERS * counters);
+void modbus_clear_diagnostic_counters();
+
 #endif
@@ -0,0 +1,302 @@
+#ifndef _MODBUS_MAP_H_
+#define _MODBUS_MAP_H_
+
+/*
+ * Compile-time register maps.
+ *
+ * Include after stdint.h, modbus.h and modbus_server.h. A device's map is declared as a type
+ * listing its address ranges, their access rights and a handler:
+ *
+ *   struct Device
+ *   {
+ *       static void read_holding_registers(uint16_t reg, uint16_t n_registers);
+ *       static void write_holding_register(uint16_t reg, int16_t value);
+ *       static void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code);
+ *   };
+ *
+ *   typedef modbus::RegisterMap<Device,
+ *       modbus::HoldingRegisters<0, 8, modbus::READ_WRITE>,
+ *       modbus::HoldingRegisters<100, 2, modbus::READ_ONLY>
+ *   > DEVICE_MAP;
+ *
+ *   modbus::service_message<DEVICE_MAP>(message, device_address, message_length, check_crc);
+ *
+ * Handler functions are static and have the same signatures as the members of
+ * modbus_handler_functions. A function code is served only when the map has a
+ * range allowing it and the handler provides its function; every other code is
+ * answered with EXCEPTION_ILLEGAL_FUNCTION_CODE. Both are compile-time constants,
+ * so the handling code for unsupported function codes is optimised out of the
+ * modbus::Server the map runs on. Address checks are generated as one comparison
+ * per range, so a request must lie within a single range; declare adjacent blocks
+ * as one range.
+ *
+ * Multiple writes are passed to the handler's _view function when it has one
+ * (e.g. write_holding_registers_view), straight from the frame; otherwise they
+ * are decoded into a buffer sized for the largest writable range.
+ *
+ * Diagnostics (FC08) and read FIFO queue (FC24) are served when the handler has
+ * diagnostics and read_fifo_queue functions. File records are not supported.
+ */
+
+namespace modbus
+{
+	template <Table TABLE, uint16_t FIRST, uint16_t COUNT, Access ACCESS>
+	struct Range
+	{
+		static_assert(COUNT > 0, "A range must contain at least one address");
+		static_assert(((uint32_t)FIRST + COUNT) <= 0x10000UL, "A range must end within the 16 bit address space");
+
+		static const Table table = TABLE;
+		static const uint16_t first = FIRST;
+		static const uint16_t count = COUNT;
+		static const Access access = ACCESS;
+
+		static bool contains(uint16_t start, uint16_t n)
+		{
+			uint16_t offset = (uint16_t)(start - FIRST);
+			return (offset < COUNT) && (n <= (uint16_t)(COUNT - offset));
+		}
+	};
+
+	template <uint16_t FIRST, uint16_t COUNT, Access ACCESS = READ_WRITE>
+	struct Coils : Range<COILS, FIRST, COUNT, ACCESS> {};
+
+	template <uint16_t FIRST, uint16_t COUNT>
+	struct DiscreteInputs : Range<DISCRETE_INPUTS, FIRST, COUNT, READ_ONLY> {};
+
+	template <uint16_t FIRST, uint16_t COUNT>
+	struct InputRegisters : Range<INPUT_REGISTERS, FIRST, COUNT, READ_ONLY> {};
+
+	template <uint16_t FIRST, uint16_t COUNT, Access ACCESS = READ_WRITE>
+	struct HoldingRegisters : Range<HOLDING_REGISTERS, FIRST, COUNT, ACCESS> {};
+
+	namespace detail
+	{
+		/* The ranges of one table that allow an access, folded at compile time */
+		template <Table TABLE, Access ACCESS, typename... RANGES>
+		struct Lookup
+		{
+			static const bool any = false;
+			static const uint16_t max_count = 0;
+
+			static bool contains(uint16_t, uint16_t) { return false; }
+		};
+
+		template <Table TABLE, Access ACCESS, typename HEAD, typename... TAIL>
+		struct Lookup<TABLE, ACCESS, HEAD, TAIL...>
+		{
+			typedef Lookup<TABLE, ACCESS, TAIL...> NEXT;
+
+			static const bool matches = (HEAD::table == TABLE) && ((HEAD::access & ACCESS) == ACCESS);
+			static const bool any = matches || NEXT::any;
+			static const uint16_t max_count = (matches && (HEAD::count > NEXT::max_count)) ? HEAD::count : NEXT::max_count;
+
+			static bool contains(uint16_t start, uint16_t n)
+			{
+				return (matches && HEAD::contains(start, n)) || NEXT::contains(start, n);
+			}
+		};
+
+		/*
+		 * Detects whether HANDLER has a static function called NAME, and
+		 * calls it when it does. Calls to missing functions do nothing; the
+		 * server never makes them as supports() rejects their function codes.
+		 */
+#define MODBUS_MAP_HANDLER_FUNCTION(NAME) \
+		template <typename HANDLER> \
+		struct has_##NAME \
+		{ \
+			template <typename T> static char test(decltype(&T::NAME)); \
+			template <typename T> static long test(...); \
+			static const bool value = (sizeof(test<HANDLER>(0)) == 1); \
+		}; \
+		template <typename HANDLER, typename... ARGS> \
+		inline auto call_##NAME(int, ARGS... args) -> decltype(HANDLER::NAME(args...), void()) { HANDLER::NAME(args...); } \
+		template <typename HANDLER, typename... ARGS> \
+		inline void call_##NAME(long, ARGS...) {}
+
+		MODBUS_MAP_HANDLER_FUNCTION(read_coils)
+		MODBUS_MAP_HANDLER_FUNCTION(read_discrete_inputs)
+		MODBUS_MAP_HANDLER_FUNCTION(write_single_coil)
+		MODBUS_MAP_HANDLER_FUNCTION(write_multiple_coils)
+		MODBUS_MAP_HANDLER_FUNCTION(read_input_registers)
+		MODBUS_MAP_HANDLER_FUNCTION(read_holding_registers)
+		MODBUS_MAP_HANDLER_FUNCTION(write_holding_register)
+		MODBUS_MAP_HANDLER_FUNCTION(write_holding_registers)
+		MODBUS_MAP_HANDLER_FUNCTION(read_write_registers)
+		MODBUS_MAP_HANDLER_FUNCTION(mask_write_register)
+		MODBUS_MAP_HANDLER_FUNCTION(exception_handler)
+		MODBUS_MAP_HANDLER_FUNCTION(diagnostics)
+		MODBUS_MAP_HANDLER_FUNCTION(read_fifo_queue)
+		MODBUS_MAP_HANDLER_FUNCTION(write_multiple_coils_view)
+		MODBUS_MAP_HANDLER_FUNCTION(write_holding_registers_view)
+		MODBUS_MAP_HANDLER_FUNCTION(read_write_registers_view)
+
+#undef MODBUS_MAP_HANDLER_FUNCTION
+	}
+
+	template <typename HANDLER, typename... RANGES>
+	struct RegisterMap
+	{
+		typedef HANDLER handler;
+
+		template <Table TABLE, Access ACCESS>
+		struct lookup : detail::Lookup<TABLE, ACCESS, RANGES...> {};
+	};
+
+	/* Runs a RegisterMap as a modbus::Server handler */
+	template <typename MAP>
+	class MapHandler
+	{
+	public:
+		typedef typename MAP::handler HANDLER;
+
+		typedef typename MAP::template lookup<COILS, READ_ONLY> READABLE_COILS;
+		typedef typename MAP::template lookup<COILS, WRITE_ONLY> WRITABLE_COILS;
+		typedef typename MAP::template lookup<DISCRETE_INPUTS, READ_ONLY> DISCRETE_INPUT_RANGES;
+		typedef typename MAP::template lookup<INPUT_REGISTERS, READ_ONLY> INPUT_REGISTER_RANGES;
+		typedef typename MAP::template lookup<HOLDING_REGISTERS, READ_ONLY> READABLE_HOLDING_REGISTERS;
+		typedef typename MAP::template lookup<HOLDING_REGISTERS, WRITE_ONLY> WRITABLE_HOLDING_REGISTERS;
+		typedef typename MAP::template lookup<HOLDING_REGISTERS, READ_WRITE> READ_WRITE_HOLDING_REGISTERS;
+
+		/* Write buffers only need to hold the largest request the map can accept */
+		static const uint16_t coil_buffer_size = (WRITABLE_COILS::max_count < MAX_WRITE_COILS) ? WRITABLE_COILS::max_count : MAX_WRITE_COILS;
+		static const uint16_t register_buffer_size = (WRITABLE_HOLDING_REGISTERS::max_count < MAX_WRITE_REGISTERS) ? WRITABLE_HOLDING_REGISTERS::max_count : MAX_WRITE_REGISTERS;
+
+		static const bool writes_multiple_coils = detail::has_write_multiple_coils_view<HANDLER>::value || detail::has_write_multiple_coils<HANDLER>::value;
+		static const bool writes_holding_registers = detail::has_write_holding_registers_view<HANDLER>::value || detail::has_write_holding_registers<HANDLER>::value;
+		static const bool reads_and_writes_registers = detail::has_read_write_registers_view<HANDLER>::value || detail::has_read_write_registers<HANDLER>::value;
+
+		explicit MapHandler(uint8_t device_address) : m_device_address(device_address) {}
+
+		uint8_t device_address() { return m_device_address; }
+
+		bool supports(MODBUS_FUNCTION_CODE function_code)
+		{
+			switch(function_code)
+			{
+			case READ_COILS: return READABLE_COILS::any && detail::has_read_coils<HANDLER>::value;
+			case READ_DISCRETE_INPUTS: return DISCRETE_INPUT_RANGES::any && detail::has_read_discrete_inputs<HANDLER>::value;
+			case WRITE_SINGLE_COIL: return WRITABLE_COILS::any && detail::has_write_single_coil<HANDLER>::value;
+			case WRITE_MULTIPLE_COILS: return WRITABLE_COILS::any && writes_multiple_coils;
+			case READ_INPUT_REGISTERS: return INPUT_REGISTER_RANGES::any && detail::has_read_input_registers<HANDLER>::value;
+			case READ_HOLDING_REGISTERS: return READABLE_HOLDING_REGISTERS::any && detail::has_read_holding_registers<HANDLER>::value;
+			case WRITE_HOLDING_REGISTER: return WRITABLE_HOLDING_REGISTERS::any && detail::has_write_holding_register<HANDLER>::value;
+			case WRITE_HOLDING_REGISTERS: return WRITABLE_HOLDING_REGISTERS::any && writes_holding_registers;
+			case READ_WRITE_REGISTERS: return READABLE_HOLDING_REGISTERS::any && WRITABLE_HOLDING_REGISTERS::any && reads_and_writes_registers;
+			case MASK_WRITE_REGISTER: return READ_WRITE_HOLDING_REGISTERS::any && detail::has_mask_write_register<HANDLER>::value;
+			case DIAGNOSTICS: return detail::has_diagnostics<HANDLER>::value;
+			case READ_FIFO_QUEUE: return READABLE_HOLDING_REGISTERS::any && detail::has_read_fifo_queue<HANDLER>::value;
+			default: return false;
+			}
+		}
+
+		bool valid_addresses(Table table, Access access, uint16_t first, uint16_t n)
+		{
+			switch(table)
+			{
+			case COILS:
+				return (access == READ_ONLY) ? READABLE_COILS::contains(first, n) : WRITABLE_COILS::contains(first, n);
+			case DISCRETE_INPUTS:
+				return DISCRETE_INPUT_RANGES::contains(first, n);
+			case INPUT_REGISTERS:
+				return INPUT_REGISTER_RANGES::contains(first, n);
+			default:
+				if (access == READ_ONLY) { return READABLE_HOLDING_REGISTERS::contains(first, n); }
+				if (access == WRITE_ONLY) { return WRITABLE_HOLDING_REGISTERS::contains(first, n); }
+				return READ_WRITE_HOLDING_REGISTERS::contains(first, n);
+			}
+		}
+
+		MODBUS_FILE const * files() { return NULL; }
+		uint8_t num_files() { return 0; }
+
+		void read_coils(uint16_t first_coil, uint16_t n_coils) { detail::call_read_coils<HANDLER>(0, first_coil, n_coils); }
+		void read_discrete_inputs(uint16_t first_input, uint16_t n_inputs) { detail::call_read_discrete_inputs<HANDLER>(0, first_input, n_inputs); }
+		void write_single_coil(uint16_t coil, bool on) { detail::call_write_single_coil<HANDLER>(0, coil, on); }
+		void write_multiple_coils_view(uint16_t first_coil, MODBUS_COIL_VIEW const * values)
+		{
+			if (detail::has_write_multiple_coils_view<HANDLER>::value)
+			{
+				detail::call_write_multiple_coils_view<HANDLER>(0, first_coil, values);
+				return;
+			}
+
+			bool * buffer = coil_buffer();
+			modbus_coil_view_copy(values, buffer);
+			detail::call_write_multiple_coils<HANDLER>(0, first_coil, values->n_coils, buffer);
+		}
+		void read_input_registers(uint16_t reg, uint16_t n_registers) { detail::call_read_input_registers<HANDLER>(0, reg, n_registers); }
+		void read_holding_registers(uint16_t reg, uint16_t n_registers) { detail::call_read_holding_registers<HANDLER>(0, reg, n_registers); }
+		void write_holding_register(uint16_t reg, int16_t value) { detail::call_write_holding_register<HANDLER>(0, reg, value); }
+		void write_holding_registers_view(uint16_t first_reg, MODBUS_REGISTER_VIEW const * values)
+		{
+			if (detail::has_write_holding_registers_view<HANDLER>::value)
+			{
+				detail::call_write_holding_registers_view<HANDLER>(0, first_reg, values);
+				return;
+			}
+
+			int16_t * buffer = register_buffer();
+			modbus_register_view_copy(values, buffer);
+			detail::call_write_holding_registers<HANDLER>(0, first_reg, values->n_registers, buffer);
+		}
+		void read_write_registers_view(uint16_t read_start_reg, uint16_t n_registers, uint16_t write_start_reg, MODBUS_REGISTER_VIEW const * values)
+		{
+			if (detail::has_read_write_registers_view<HANDLER>::value)
+			{
+				detail::call_read_write_registers_view<HANDLER>(0, read_start_reg, n_registers, write_start_reg, values);
+				return;
+			}
+
+			int16_t * buffer = register_buffer();
+			modbus_register_view_copy(values, buffer);
+			detail::call_read_write_registers<HANDLER>(0, read_start_reg, n_registers, write_start_reg, values->n_registers, buffer);
+		}
+		void mask_write_register(uint16_t reg, uint16_t and_mask, uint16_t or_mask) { detail::call_mask_write_register<HANDLER>(0, reg, and_mask, or_mask); }
+		void diagnostics(uint16_t sub_function, uint16_t data) { detail::call_diagnostics<HANDLER>(0, sub_function, data); }
+		void read_fifo_queue(uint16_t fifo_pointer_address) { detail::call_read_fifo_queue<HANDLER>(0, fifo_pointer_address); }
+		void read_file_record(uint8_t const *, uint8_t) {}
+		void write_file_record(uint8_t const *, uint8_t) {}
+
+		void exception_handler(uint8_t function_code, MODBUS_EXCEPTION_CODES exception_code)
+		{
+			detail::call_exception_handler<HANDLER>(0, function_code, exception_code);
+		}
+
+	private:
+		uint8_t m_device_address;
+
+		bool * coil_buffer()
+		{
+			static bool values[coil_buffer_size ? coil_buffer_size : 1];
+			return values;
+		}
+
+		int16_t * register_buffer()
+		{
+			static int16_t values[register_buffer_size ? register_buffer_size : 1];
+			return values;
+		}
+	};
+
+	template <typename MAP>
+	MODBUS_FRAME_STATUS service_message(uint8_t const * const message, uint8_t device_address, int message_length, bool check_crc)
+	{
+		MapHandler<MAP> handler(device_address);
+		Server< MapHandler<MAP> > server(handler);
+
+		return server.service_message(message, message_length, check_crc);
+	}
+
+	template <typename MAP>
+	MODBUS_FRAME_STATUS service_split_message(MODBUS_SPLIT_FRAME const * frame, uint8_t device_address, bool check_crc)
+	{
+		MapHandler<MAP> handler(device_address);
+		Server< MapHandler<MAP> > server(handler);
+
+		return server.service_split_message(frame, check_crc);
+	}
+}
+
+#endif
@@ -0,0 +1,579 @@
+#ifndef _MODBUS_SERVER_H_
+#define _MODBUS_SERVER_H_
+
+/*
+ * Statically dispatched Modbus server.
+ *
+ * Include after stdint.h and modbus.h. modbus::Server<HANDLER> decodes and
+ * validates requests and calls HANDLER member functions directly, so trivial
+ * callbacks inline into the dispatcher. modbus_service_message is this server
+ * instantiated with an adapter around MODBUS_HANDLER, and modbus_map.h builds
+ * compile-time register maps on it.
+ *
+ * HANDLER provides:
+ *
+ *   uint8_t device_address();
+ *   bool supports(MODBUS_FUNCTION_CODE function_code);
+ *   bool valid_addresses(modbus::Table table, modbus::Access access, uint16_t first, uint16_t n);
+ *   MODBUS_FILE const * files();
+ *   uint8_t num_files();
+ *
+ * plus one member function for each member of modbus_handler_functions, with
+ * the same name and signature, except write_multiple_coils, write_holding_registers
+ * and read_write_registers: those writes always arrive through the _view members,
+ * as views of the frame, and a handler that wants decoded values copies them into
+ * its own buffer with modbus_coil_view_copy or modbus_register_view_copy.
+ * Callbacks are only called for function codes supports() accepts, after the
+ * request has been validated; when supports() is a compile-time constant the
+ * unsupported paths are optimised out.
+ *
+ * A frame for a supported function code that is shorter than the function code
+ * and byte count require (or, for file record requests, of a different length)
+ * is answered with EXCEPTION_ILLEGAL_DATA_VALUE before any field is read from it. message_length
+ * includes the CRC when it is checked; without a CRC check the frame may end
+ * before its CRC.
+ *
+ * Requests are decoded into their 16-bit fields and payload, then executed.
+ * Decoding is a template over the request bytes: a plain pointer for
+ * service_message, or detail::SplitBytes for service_split_message, which reads
+ * a frame that wrapped in a receive ring in place. service_request executes a
+ * request decoded ahead of time by modbus_decode_request.
+ */
+
+namespace modbus
+{
+	enum Access
+	{
+		READ_ONLY = 1,
+		WRITE_ONLY = 2,
+		READ_WRITE = 3
+	};
+
+	enum Table
+	{
+		COILS,
+		DISCRETE_INPUTS,
+		INPUT_REGISTERS,
+		HOLDING_REGISTERS
+	};
+
+	/* Protocol limits on the quantity of a single request */
+	static const uint16_t MAX_READ_BITS = 2000;
+	static const uint16_t MAX_WRITE_COILS = 1968;
+	static const uint16_t MAX_READ_REGISTERS = 125;
+	static const uint16_t MAX_WRITE_REGISTERS = 123;
+	static const uint16_t MAX_READ_WRITE_WRITE_REGISTERS = 121;
+
+	namespace detail
+	{
+		template <typename DATA>
+		inline uint16_t bytes_to_uint16_t(DATA const& bytes)
+		{
+			return (uint16_t)((bytes[0] << 8) + bytes[1]);
+		}
+
+		inline bool quantity_is_valid(uint16_t n, uint16_t max)
+		{
+			return (n != 0) && (n <= max);
+		}
+
+		/* Where straddling payloads are joined; the library services one message at a time */
+		inline uint8_t * split_scratch()
+		{
+			static uint8_t buffer[256];
+			return buffer;
+		}
+
+		/*
+		 * A split frame from offset onwards, indexed and offset like a pointer,
+		 * so the decoders read a wrapped frame in place.
+		 */
+		class SplitBytes
+		{
+		public:
+			SplitBytes(MODBUS_SPLIT_FRAME const& frame, int offset) : m_frame(frame), m_offset(offset) {}
+
+			uint8_t operator[](int index) const
+			{
+				int i = m_offset + index;
+				int first_length = m_frame.segments[0].length;
+				return (i < first_length) ? m_frame.segments[0].data[i] : m_frame.segments[1].data[i - first_length];
+			}
+
+			SplitBytes operator+(int n) const { return SplitBytes(m_frame, m_offset + n); }
+
+			uint8_t const * contiguous(uint8_t length) const
+			{
+				int first_length = m_frame.segments[0].length;
+
+				if (m_offset >= first_length) { return &m_frame.segments[1].data[m_offset - first_length]; }
+				if ((m_offset + length) <= first_length) { return &m_frame.segments[0].data[m_offset]; }
+
+				uint8_t * scratch = split_scratch();
+				for (uint8_t i = 0; i < length; i++) { scratch[i] = (*this)[i]; }
+				return scratch;
+			}
+
+		private:
+			MODBUS_SPLIT_FRAME const& m_frame;
+			int m_offset;
+		};
+
+		inline uint8_t const * contiguous(uint8_t const * data, uint8_t) { return data; }
+		inline uint8_t const * contiguous(SplitBytes const& data, uint8_t length) { return data.contiguous(length); }
+
+		/* The full length of the request frame, CRC included, as modbus_get_request_length */
+		inline int get_request_length(uint8_t const * message, int message_length)
+		{
+			return modbus_get_request_length(message, message_length);
+		}
+
+		inline int get_request_length(SplitBytes const& message, int message_length)
+		{
+			/* Every length is known from the first 11 bytes */
+			uint8_t header[11];
+			int n = (message_length < (int)sizeof(header)) ? message_length : (int)sizeof(header);
+			for (int i = 0; i < n; i++) { header[i] = message[i]; }
+			return modbus_get_request_length(header, n);
+		}
+
+		/*
+		 * Whether message_length bytes hold the whole request, so nothing is read past
+		 * the frame. has_crc is false when the frame may end before its CRC. File record
+		 * requests must match their byte count exactly. Unknown function codes pass,
+		 * to be refused by the dispatcher.
+		 */
+		template <typename DATA>
+		inline bool request_length_is_valid(DATA const& message, int message_length, bool has_crc)
+		{
+			int expected_length = get_request_length(message, message_length);
+			if (expected_length < 0) { return true; }
+
+			int available = message_length + (has_crc ? 0 : 2);
+			if ((expected_length == 0) || (available < expected_length)) { return false; }
+
+			if ((message[1] == READ_FILE_RECORD) || (message[1] == WRITE_FILE_RECORD)) { return message_length <= expected_length; }
+
+			return true;
+		}
+
+		/* Number of 16-bit fields at the start of a request, before any byte count and payload */
+		inline uint8_t get_request_field_count(uint8_t function_code)
+		{
+			switch(function_code)
+			{
+			case READ_FIFO_QUEUE:
+				return 1;
+			case MASK_WRITE_REGISTER:
+				return 3;
+			case READ_WRITE_REGISTERS:
+				return 4;
+			case READ_FILE_RECORD:
+			case WRITE_FILE_RECORD:
+				return 0;
+			default:
+				return 2;
+			}
+		}
+
+		inline bool request_has_payload(uint8_t function_code)
+		{
+			switch(function_code)
+			{
+			case WRITE_MULTIPLE_COILS:
+			case WRITE_HOLDING_REGISTERS:
+			case READ_WRITE_REGISTERS:
+			case READ_FILE_RECORD:
+			case WRITE_FILE_RECORD:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		/*
+		 * Decodes the fields of the request data (after the function code) into fields,
+		 * returning the offset of the byte count for requests that carry a payload.
+		 */
+		template <typename DATA>
+		inline uint8_t decode_request_fields(uint8_t function_code, DATA const& data, uint16_t * fields)
+		{
+			uint8_t n_fields = get_request_field_count(function_code);
+			for (uint8_t i = 0; i < n_fields; i++)
+			{
+				fields[i] = bytes_to_uint16_t(data + (i * 2));
+			}
+			return n_fields * 2;
+		}
+	}
+
+	template <typename HANDLER>
+	class Server
+	{
+	public:
+		explicit Server(HANDLER& handler) : m_handler(handler) {}
+
+		/* crc_validated is true when the caller has already checked the CRC, which message_length includes */
+		MODBUS_FRAME_STATUS service_message(uint8_t const * const message, int message_length, bool check_crc, bool crc_validated = false)
+		{
+			MODBUS_MESSAGE_STATE state = modbus_begin_message(message, m_handler.device_address(), message_length, check_crc);
+
+			return service(state, message, message_length, check_crc || crc_validated);
+		}
+
+		/* Services a frame wrapped in its receive ring without joining it (see MODBUS_SPLIT_FRAME) */
+		MODBUS_FRAME_STATUS service_split_message(MODBUS_SPLIT_FRAME const * frame, bool check_crc)
+		{
+			MODBUS_MESSAGE_STATE state = modbus_begin_split_message(frame, m_handler.device_address(), check_crc);
+
+			if (state == MESSAGE_IGNORED) { return service(state, (uint8_t const *)NULL, 0, check_crc); }
+
+			int message_length = frame->segments[0].length + frame->segments[1].length;
+			return service(state, detail::SplitBytes(*frame, 0), message_length, check_crc);
+		}
+
+		/* Runs a request decoded earlier by modbus_decode_request, e.g. in the receive interrupt */
+		MODBUS_FRAME_STATUS service_request(MODBUS_REQUEST const& request)
+		{
+			MODBUS_FRAME_STATUS status = {request.state, EXCEPTION_NONE};
+
+			if (status.state == MESSAGE_IGNORED) { return status; }
+
+			modbus_begin_request(&request);
+
+			MODBUS_FUNCTION_CODE function_code = (MODBUS_FUNCTION_CODE)request.function_code;
+
+			if (status.state == MESSAGE_CRC_FAILED)
+			{
+				status.exception = EXCEPTION_INVALID_CRC;
+				m_handler.exception_handler(function_code + 128, EXCEPTION_INVALID_CRC);
+				return status;
+			}
+
+			if (!m_handler.supports(function_code))
+			{
+				status.exception = EXCEPTION_ILLEGAL_FUNCTION_CODE;
+			}
+			else
+			{
+				status.exception = execute(function_code, request.fields, request.byte_count, request.payload);
+			}
+
+			finish(function_code, status.exception);
+
+			return status;
+		}
+
+	private:
+		HANDLER& m_handler;
+
+		template <typename DATA>
+		MODBUS_FRAME_STATUS service(MODBUS_MESSAGE_STATE state, DATA const& message, int message_length, bool has_crc)
+		{
+			MODBUS_FRAME_STATUS status = {state, EXCEPTION_NONE};
+
+			if (status.state == MESSAGE_IGNORED) { return status; }
+
+			if (status.state == MESSAGE_CRC_FAILED)
+			{
+				status.exception = EXCEPTION_INVALID_CRC;
+				m_handler.exception_handler(message[1] + 128, EXCEPTION_INVALID_CRC);
+				return status;
+			}
+
+			MODBUS_FUNCTION_CODE function_code = (MODBUS_FUNCTION_CODE)message[1];
+
+			status.exception = dispatch(function_code, message, message_length, has_crc);
+
+			finish(function_code, status.exception);
+
+			return status;
+		}
+
+		void finish(MODBUS_FUNCTION_CODE function_code, MODBUS_EXCEPTION_CODES exception)
+		{
+			if (exception != EXCEPTION_NONE)
+			{
+				m_handler.exception_handler(function_code + 128, exception);
+			}
+
+			modbus_end_message(exception);
+		}
+
+		template <typename DATA>
+		MODBUS_EXCEPTION_CODES dispatch(MODBUS_FUNCTION_CODE function_code, DATA const& message, int message_length, bool has_crc)
+		{
+			if (!m_handler.supports(function_code)) { return EXCEPTION_ILLEGAL_FUNCTION_CODE; }
+			if (!detail::request_length_is_valid(message, message_length, has_crc)) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+
+			DATA const data = message + 2;
+
+			uint16_t fields[MODBUS_REQUEST_FIELDS];
+			uint8_t offset = detail::decode_request_fields(function_code, data, fields);
+			uint8_t byte_count = detail::request_has_payload(function_code) ? data[offset] : 0;
+
+			return execute(function_code, fields, byte_count, data + (offset + 1));
+		}
+
+		/* Validates a decoded request and calls its handler; payload is the data after the byte count */
+		template <typename DATA>
+		MODBUS_EXCEPTION_CODES execute(MODBUS_FUNCTION_CODE function_code, uint16_t const * fields, uint8_t byte_count, DATA const& payload)
+		{
+			/* Unused when none of the enabled function codes need them */
+			(void)fields;
+			(void)byte_count;
+			(void)payload;
+
+			switch(function_code)
+			{
+#if MODBUS_ENABLE_FC_READ_COILS
+			case READ_COILS:
+				return handle_read_bits(fields[0], fields[1], COILS);
+#endif
+#if MODBUS_ENABLE_FC_READ_DISCRETE_INPUTS
+			case READ_DISCRETE_INPUTS:
+				return handle_read_bits(fields[0], fields[1], DISCRETE_INPUTS);
+#endif
+#if MODBUS_ENABLE_FC_WRITE_SINGLE_COIL
+			case WRITE_SINGLE_COIL:
+				return handle_write_single_coil(fields[0], fields[1]);
+#endif
+#if MODBUS_ENABLE_FC_WRITE_MULTIPLE_COILS
+			case WRITE_MULTIPLE_COILS:
+				return handle_write_multiple_coils(fields[0], fields[1], byte_count, payload);
+#endif
+#if MODBUS_ENABLE_FC_READ_INPUT_REGISTERS
+			case READ_INPUT_REGISTERS:
+				return handle_read_registers(fields[0], fields[1], INPUT_REGISTERS);
+#endif
+#if MODBUS_ENABLE_FC_READ_HOLDING_REGISTERS
+			case READ_HOLDING_REGISTERS:
+				return handle_read_registers(fields[0], fields[1], HOLDING_REGISTERS);
+#endif
+#if MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTER
+			case WRITE_HOLDING_REGISTER:
+				return handle_write_holding_register(fields[0], fields[1]);
+#endif
+#if MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTERS
+			case WRITE_HOLDING_REGISTERS:
+				return handle_write_holding_registers(fields[0], fields[1], byte_count, payload);
+#endif
+#if MODBUS_ENABLE_FC_READ_WRITE_REGISTERS
+			case READ_WRITE_REGISTERS:
+				return handle_read_write_registers(fields, byte_count, payload);
+#endif
+#if MODBUS_ENABLE_FC_MASK_WRITE_REGISTER
+			case MASK_WRITE_REGISTER:
+				return handle_mask_write_register(fields[0], fields[1], fields[2]);
+#endif
+#if MODBUS_ENABLE_FC_DIAGNOSTICS
+			case DIAGNOSTICS:
+				return handle_diagnostics(fields[0], fields[1]);
+#endif
+#if MODBUS_ENABLE_FC_READ_FIFO_QUEUE
+			case READ_FIFO_QUEUE:
+				return handle_read_fifo_queue(fields[0]);
+#endif
+#if MODBUS_ENABLE_FC_READ_FILE_RECORD
+			case READ_FILE_RECORD:
+				return handle_read_file_record(byte_count, payload);
+#endif
+#if MODBUS_ENABLE_FC_WRITE_FILE_RECORD
+			case WRITE_FILE_RECORD:
+				return handle_write_file_record(byte_count, payload);
+#endif
+			default:
+				return EXCEPTION_ILLEGAL_FUNCTION_CODE;
+			}
+		}
+
+#if MODBUS_ENABLE_FC_READ_BITS
+		MODBUS_EXCEPTION_CODES handle_read_bits(uint16_t first, uint16_t n, Table table)
+		{
+			if (!detail::quantity_is_valid(n, MAX_READ_BITS)) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+			if (!m_handler.valid_addresses(table, READ_ONLY, first, n)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+			if (table == COILS)
+			{
+				m_handler.read_coils(first, n);
+			}
+			else
+			{
+				m_handler.read_discrete_inputs(first, n);
+			}
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_WRITE_SINGLE_COIL
+		MODBUS_EXCEPTION_CODES handle_write_single_coil(uint16_t coil, uint16_t value)
+		{
+			if ((value != 0xFF00) && (value != 0x0000)) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+			if (!m_handler.valid_addresses(COILS, WRITE_ONLY, coil, 1)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+			m_handler.write_single_coil(coil, value == 0xFF00);
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_WRITE_MULTIPLE_COILS
+		template <typename DATA>
+		MODBUS_EXCEPTION_CODES handle_write_multiple_coils(uint16_t first_coil, uint16_t n_coils, uint8_t byte_count, DATA const& payload)
+		{
+			if (!detail::quantity_is_valid(n_coils, MAX_WRITE_COILS)) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+			if (!m_handler.valid_addresses(COILS, WRITE_ONLY, first_coil, n_coils)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+			if (byte_count != ((n_coils + 7) / 8)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+			MODBUS_COIL_VIEW values = {detail::contiguous(payload, byte_count), n_coils};
+
+			m_handler.write_multiple_coils_view(first_coil, &values);
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_READ_REGISTERS
+		MODBUS_EXCEPTION_CODES handle_read_registers(uint16_t first_reg, uint16_t n_registers, Table table)
+		{
+			if (!detail::quantity_is_valid(n_registers, MAX_READ_REGISTERS)) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+			if (!m_handler.valid_addresses(table, READ_ONLY, first_reg, n_registers)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+			if (table == INPUT_REGISTERS)
+			{
+				m_handler.read_input_registers(first_reg, n_registers);
+			}
+			else
+			{
+				m_handler.read_holding_registers(first_reg, n_registers);
+			}
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTER
+		MODBUS_EXCEPTION_CODES handle_write_holding_register(uint16_t reg, uint16_t value)
+		{
+			if (!m_handler.valid_addresses(HOLDING_REGISTERS, WRITE_ONLY, reg, 1)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+			m_handler.write_holding_register(reg, (int16_t)value);
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_WRITE_HOLDING_REGISTERS
+		template <typename DATA>
+		MODBUS_EXCEPTION_CODES handle_write_holding_registers(uint16_t first_reg, uint16_t n_registers, uint8_t byte_count, DATA const& payload)
+		{
+			if (!detail::quantity_is_valid(n_registers, MAX_WRITE_REGISTERS)) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+			if (byte_count != (n_registers * 2)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+			if (!m_handler.valid_addresses(HOLDING_REGISTERS, WRITE_ONLY, first_reg, n_registers)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+			MODBUS_REGISTER_VIEW values = {detail::contiguous(payload, byte_count), n_registers};
+
+			m_handler.write_holding_registers_view(first_reg, &values);
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_READ_WRITE_REGISTERS
+		template <typename DATA>
+		MODBUS_EXCEPTION_CODES handle_read_write_registers(uint16_t const * fields, uint8_t byte_count, DATA const& payload)
+		{
+			uint16_t read_start_reg = fields[0];
+			uint16_t n_read_count = fields[1];
+			uint16_t write_start_reg = fields[2];
+			uint16_t n_write_count = fields[3];
+
+			bool bad_quantity = false;
+			bad_quantity |= !detail::quantity_is_valid(n_read_count, MAX_READ_REGISTERS);
+			bad_quantity |= !detail::quantity_is_valid(n_write_count, MAX_READ_WRITE_WRITE_REGISTERS);
+			if (bad_quantity) { return EXCEPTION_ILLEGAL_DATA_VALUE; }
+
+			bool bad_addresses = false;
+			bad_addresses |= !m_handler.valid_addresses(HOLDING_REGISTERS, READ_ONLY, read_start_reg, n_read_count);
+			bad_addresses |= !m_handler.valid_addresses(HOLDING_REGISTERS, WRITE_ONLY, write_start_reg, n_write_count);
+			bad_addresses |= (byte_count != (n_write_count * 2));
+			if (bad_addresses) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+			MODBUS_REGISTER_VIEW values = {detail::contiguous(payload, byte_count), n_write_count};
+
+			m_handler.read_write_registers_view(read_start_reg, n_read_count, write_start_reg, &values);
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_MASK_WRITE_REGISTER
+		MODBUS_EXCEPTION_CODES handle_mask_write_register(uint16_t reg, uint16_t and_mask, uint16_t or_mask)
+		{
+			if (!m_handler.valid_addresses(HOLDING_REGISTERS, READ_WRITE, reg, 1)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+			m_handler.mask_write_register(reg, and_mask, or_mask);
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_DIAGNOSTICS
+		MODBUS_EXCEPTION_CODES handle_diagnostics(uint16_t sub_function, uint16_t query_data)
+		{
+			uint16_t response_data;
+
+			MODBUS_EXCEPTION_CODES exception = modbus_get_diagnostics_data(sub_function, query_data, &response_data);
+			if (exception != EXCEPTION_NONE) { return exception; }
+
+			m_handler.diagnostics(sub_function, response_data);
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_READ_FIFO_QUEUE
+		MODBUS_EXCEPTION_CODES handle_read_fifo_queue(uint16_t fifo_pointer_address)
+		{
+			if (!m_handler.valid_addresses(HOLDING_REGISTERS, READ_ONLY, fifo_pointer_address, 1)) { return EXCEPTION_ILLEGAL_DATA_ADDRESS; }
+
+			m_handler.read_fifo_queue(fifo_pointer_address);
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_READ_FILE_RECORD
+		template <typename DATA>
+		MODBUS_EXCEPTION_CODES handle_read_file_record(uint8_t request_length, DATA const& payload)
+		{
+			uint8_t const * const request = detail::contiguous(payload, request_length);
+
+			MODBUS_EXCEPTION_CODES exception = modbus_check_read_file_record_request(m_handler.files(), m_handler.num_files(), request, request_length);
+			if (exception != EXCEPTION_NONE) { return exception; }
+
+			m_handler.read_file_record(request, request_length);
+
+			return EXCEPTION_NONE;
+		}
+#endif
+
+#if MODBUS_ENABLE_FC_WRITE_FILE_RECORD
+		template <typename DATA>
+		MODBUS_EXCEPTION_CODES handle_write_file_record(uint8_t request_length, DATA const& payload)
+		{
+			uint8_t const * const request = detail::contiguous(payload, request_length);
+
+			MODBUS_EXCEPTION_CODES exception = modbus_store_write_file_record_request(m_handler.files(), m_handler.num_files(), request, request_length);
+			if (exception != EXCEPTION_NONE) { return exception; }
+
+			m_handler.write_file_record(request, request_length);
+
+			return EXCEPTION_NONE;
+		}
+#endif
+	};
+}
+
+#endif